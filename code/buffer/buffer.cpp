@@ -121,6 +121,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno)
 	iov[1].iov_base = buff;
 	iov[1].iov_len = sizeof(buff);
 
+	Metrics::AddSyscall();
 	const ssize_t len = readv(fd, iov, 2);  // 分散读fd到iov
 	if (len < 0)
 	{
@@ -141,6 +142,7 @@ ssize_t Buffer::ReadFd(int fd, int* saveErrno)
 ssize_t Buffer::WriteFd(int fd, int* saveErrno)
 {
 	size_t readSize = ReadableBytes();
+	Metrics::AddSyscall();
 	ssize_t len = write(fd, Peek(), readSize);
 	if (len < 0)
 	{
@@ -8,6 +8,9 @@
 #include <vector> //readv
 #include <atomic>
 #include <assert.h>
+
+#include "../metrics/metrics.h"
+
 class Buffer
 {
  public:
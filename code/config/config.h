@@ -3,3 +3,363 @@
  * @Date         : 2020-06-28
  * @copyleft Apache 2.0
  */ 
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/* 编译期默认配置, 可在makefile中用 -D 覆盖 */
+
+/* 负向查找缓存容量(条) */
+#ifndef NEG_CACHE_SIZE
+#define NEG_CACHE_SIZE 8192
+#endif
+
+/* 负向查找缓存单条路径最大长度 */
+#ifndef NEG_CACHE_MAX_PATH
+#define NEG_CACHE_MAX_PATH 512
+#endif
+
+/* 冷文件异步读取: 不小于该大小的文件才检查是否在page cache中 */
+#ifndef ASYNC_READ_MIN
+#define ASYNC_READ_MIN (16 * 1024)
+#endif
+
+/* 冷文件不大于该大小时由IO线程pread到池化缓冲区, 更大的文件由IO线程预先触发缺页 */
+#ifndef ASYNC_READ_MAX
+#define ASYNC_READ_MAX (1024 * 1024)
+#endif
+
+/* 文件IO线程数量, 0表示关闭异步读取 */
+#ifndef IO_THREAD_NUM
+#define IO_THREAD_NUM 2
+#endif
+
+/* 文件缓冲池中最多缓存的空闲缓冲区数量 */
+#ifndef FILE_BUF_POOL_SIZE
+#define FILE_BUF_POOL_SIZE 32
+#endif
+
+/* 大于该大小的文件分段映射发送 */
+#ifndef STREAM_FILE_MIN
+#define STREAM_FILE_MIN (1024 * 1024)
+#endif
+
+/* 分段发送的窗口大小(单连接映射上限), 须为页大小的整数倍 */
+#ifndef STREAM_WINDOW
+#define STREAM_WINDOW (256 * 1024)
+#endif
+
+/* 全局映射窗口总量超过STREAM_GLOBAL_MAX后, 新窗口缩小为STREAM_WINDOW_MIN; 仍不够时新的大文件请求返回503 */
+#ifndef STREAM_WINDOW_MIN
+#define STREAM_WINDOW_MIN (64 * 1024)
+#endif
+
+#ifndef STREAM_GLOBAL_MAX
+#define STREAM_GLOBAL_MAX (256 * 1024 * 1024)
+#endif
+
+/* 慢速客户端: 发送超过STREAM_GRACE_MS后平均速率低于STREAM_MIN_RATE(字节/秒)则断开 */
+#ifndef STREAM_MIN_RATE
+#define STREAM_MIN_RATE (8 * 1024)
+#endif
+
+#ifndef STREAM_GRACE_MS
+#define STREAM_GRACE_MS 10000
+#endif
+
+/* 响应体不小于该大小时用MSG_ZEROCOPY发送, 0表示关闭(默认关闭, 仅在高带宽网卡上有收益) */
+#ifndef ZEROCOPY_MIN
+#define ZEROCOPY_MIN 0
+#endif
+
+/* HTTPS监听端口, 0表示不开启; 证书和私钥为PEM格式 */
+#ifndef TLS_PORT
+#define TLS_PORT 0
+#endif
+
+#ifndef TLS_CERT_FILE
+#define TLS_CERT_FILE "./cert/server.crt"
+#endif
+
+#ifndef TLS_KEY_FILE
+#define TLS_KEY_FILE "./cert/server.key"
+#endif
+
+/* TLS会话缓存条数和会话/票据有效期(秒) */
+#ifndef TLS_SESSION_CACHE_SIZE
+#define TLS_SESSION_CACHE_SIZE 20480
+#endif
+
+#ifndef TLS_SESSION_TIMEOUT
+#define TLS_SESSION_TIMEOUT 300
+#endif
+
+/* HTTP/2: 1开启(h2c升级/直接发送连接序言, HTTPS上ALPN协商h2), 0只支持HTTP/1.1 */
+#ifndef H2_ENABLE
+#define H2_ENABLE 1
+#endif
+
+/* HTTP/2单连接最大并发流数 */
+#ifndef H2_MAX_STREAMS
+#define H2_MAX_STREAMS 100
+#endif
+
+/* HTTP/2单连接同时分段发送的大文件流数, 其余大文件流等待; 单连接预留的映射窗口不超过该数乘STREAM_WINDOW */
+#ifndef H2_MAX_FILE_STREAMS
+#define H2_MAX_FILE_STREAMS 2
+#endif
+
+/* HTTP/2本端接收窗口(连接和每个流), 请求体上限须小于该值 */
+#ifndef H2_WINDOW
+#define H2_WINDOW (1024 * 1024)
+#endif
+
+#ifndef H2_MAX_BODY
+#define H2_MAX_BODY (64 * 1024)
+#endif
+
+/* HTTP/2解码后的首部列表上限 */
+#ifndef H2_MAX_HEADER_SIZE
+#define H2_MAX_HEADER_SIZE (16 * 1024)
+#endif
+
+/* HTTP/2每批生成的帧字节数, 写缓冲区发送完后再按优先级生成下一批 */
+#ifndef H2_FILL_SIZE
+#define H2_FILL_SIZE (64 * 1024)
+#endif
+
+/*
+ * 同步MySQL连接池: 启动时并行建立的最小连接数(不超过connPoolNum), 获取连接的最长等待(毫秒),
+ * 空闲连接ping检查间隔(毫秒), 建立连接超时(秒)
+ */
+#ifndef SQL_POOL_MIN
+#define SQL_POOL_MIN 4
+#endif
+
+#ifndef SQL_POOL_WAIT_MS
+#define SQL_POOL_WAIT_MS 500
+#endif
+
+#ifndef SQL_POOL_PING_MS
+#define SQL_POOL_PING_MS 30000
+#endif
+
+#ifndef SQL_CONNECT_TIMEOUT
+#define SQL_CONNECT_TIMEOUT 3
+#endif
+
+/* 异步MySQL连接数: HTTP/1.1的登录/注册在epoll线程中非阻塞查询, 0表示关闭(工作线程同步查询SqlConnPool) */
+#ifndef SQL_ASYNC_CONN
+#define SQL_ASYNC_CONN 4
+#endif
+
+/* 异步查询超时(毫秒), 排队等待和执行分别计算, 每秒检查一次 */
+#ifndef SQL_ASYNC_TIMEOUT_MS
+#define SQL_ASYNC_TIMEOUT_MS 3000
+#endif
+
+/* 等待空闲连接的查询上限, 超过时直接失败 */
+#ifndef SQL_ASYNC_QUEUE_MAX
+#define SQL_ASYNC_QUEUE_MAX 10000
+#endif
+
+/* 数据库主机为localhost时同步和异步连接池都连接这个unix socket */
+#ifndef SQL_UNIX_SOCKET
+#define SQL_UNIX_SOCKET "/var/run/mysqld/mysqld.sock"
+#endif
+
+/*
+ * 注册批量插入: 每批最多条数(1表示关闭, 每个注册单独插入), 第一个请求最多等待的毫秒数
+ * 注册突发时合并为一条多行INSERT, 平时只增加不超过REG_BATCH_DELAY_MS的延迟
+ */
+#ifndef REG_BATCH_MAX
+#define REG_BATCH_MAX 64
+#endif
+
+#ifndef REG_BATCH_DELAY_MS
+#define REG_BATCH_DELAY_MS 2
+#endif
+
+/* 内存用户表(启动参数 -f 文件): 1每次注册后fdatasync, 0由内核回写 */
+#ifndef USER_STORE_FSYNC
+#define USER_STORE_FSYNC 1
+#endif
+
+/* 用户记录缓存: 条数(0表示关闭), 分片数, 有效期(秒) */
+#ifndef USER_CACHE_SIZE
+#define USER_CACHE_SIZE 65536
+#endif
+
+#ifndef USER_CACHE_SHARDS
+#define USER_CACHE_SHARDS 16
+#endif
+
+#ifndef USER_CACHE_TTL
+#define USER_CACHE_TTL 300
+#endif
+
+/*
+ * 用户名布隆过滤器位数(0表示关闭)和哈希函数个数; 默认约可容纳170万用户名, 误判率1%
+ * 启动时从user表加载, 多个实例共用一个数据库时应关闭(其他实例注册的用户名不会加入)
+ */
+#ifndef USER_BLOOM_BITS
+#define USER_BLOOM_BITS (1 << 24)
+#endif
+
+#ifndef USER_BLOOM_HASHES
+#define USER_BLOOM_HASHES 7
+#endif
+
+/* 登录会话: 条数上限(0表示关闭), 分片数, 空闲超时(秒), 定时清理间隔(毫秒) */
+#ifndef SESSION_SIZE
+#define SESSION_SIZE 65536
+#endif
+
+#ifndef SESSION_SHARDS
+#define SESSION_SHARDS 16
+#endif
+
+#ifndef SESSION_TIMEOUT
+#define SESSION_TIMEOUT 1800
+#endif
+
+#ifndef SESSION_SWEEP_MS
+#define SESSION_SWEEP_MS 1000
+#endif
+
+/* 编译进程序的最低日志级别(0 debug 1 info 2 warn 3 error), 更低级别的LOG_*调用在编译时去掉 */
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN 0
+#endif
+
+/* 日志: 每个线程的缓冲区大小(字节), 后台线程写文件的间隔(毫秒) */
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE (64 * 1024)
+#endif
+
+#ifndef LOG_FLUSH_MS
+#define LOG_FLUSH_MS 100
+#endif
+
+/* 日志文件超过LOG_ROTATE_SIZE字节时轮转(0为不限), 轮转后的文件(包括访问日志)在后台压缩为.gz */
+#ifndef LOG_ROTATE_SIZE
+#define LOG_ROTATE_SIZE (64L * 1024 * 1024)
+#endif
+
+#ifndef LOG_COMPRESS
+#define LOG_COMPRESS 1
+#endif
+
+/*
+ * 日志落盘策略, 由后台线程在写入后调用fdatasync, 为0时不按该条件同步:
+ * 距上次同步超过LOG_FSYNC_MS毫秒, 未同步的数据超过LOG_FSYNC_BYTES字节, 或写入了error日志(LOG_FSYNC_ON_ERROR)
+ */
+#ifndef LOG_FSYNC_MS
+#define LOG_FSYNC_MS 0
+#endif
+
+#ifndef LOG_FSYNC_BYTES
+#define LOG_FSYNC_BYTES 0
+#endif
+
+#ifndef LOG_FSYNC_ON_ERROR
+#define LOG_FSYNC_ON_ERROR 1
+#endif
+
+/*
+ * 日志文件用内存映射写入: 每个文件预分配LOG_MMAP_SEGMENT字节并映射, 写满后轮转
+ * 写入位置之前每累计LOG_MMAP_RELEASE字节调用msync(MS_ASYNC)和madvise(MADV_DONTNEED)
+ */
+#ifndef LOG_MMAP
+#define LOG_MMAP 0
+#endif
+
+#ifndef LOG_MMAP_SEGMENT
+#define LOG_MMAP_SEGMENT (64L * 1024 * 1024)
+#endif
+
+#ifndef LOG_MMAP_RELEASE
+#define LOG_MMAP_RELEASE (4L * 1024 * 1024)
+#endif
+
+/*
+ * 访问日志: 每个线程每ACCESS_LOG_SAMPLE个请求记录一个(0为关闭, 1为全部记录)
+ * 文件超过ACCESS_LOG_ROTATE_SIZE字节或ACCESS_LOG_ROTATE_SEC秒后轮转, 为0时不按该条件轮转
+ */
+#ifndef ACCESS_LOG_PATH
+#define ACCESS_LOG_PATH "./log/access.log"
+#endif
+
+#ifndef ACCESS_LOG_SAMPLE
+#define ACCESS_LOG_SAMPLE 1
+#endif
+
+#ifndef ACCESS_LOG_ROTATE_SIZE
+#define ACCESS_LOG_ROTATE_SIZE (256L * 1024 * 1024)
+#endif
+
+#ifndef ACCESS_LOG_ROTATE_SEC
+#define ACCESS_LOG_ROTATE_SEC 86400
+#endif
+
+/* 二进制日志: 不在调用线程格式化, 文件后缀为.blog, 用bin/logdecode转换为文本 */
+#ifndef LOG_BINARY
+#define LOG_BINARY 0
+#endif
+
+/*
+ * 运行指标: METRICS_ENABLE为0时不记录; 以Prometheus文本格式在METRICS_PATH提供(为空时不提供)
+ * METRICS_LOCAL_ONLY时只响应本机(127.0.0.0/8)的请求, 其他地址按普通文件处理; 也适用于TRACE_PATH
+ */
+#ifndef METRICS_ENABLE
+#define METRICS_ENABLE 1
+#endif
+
+#ifndef METRICS_PATH
+#define METRICS_PATH "/metrics"
+#endif
+
+#ifndef METRICS_LOCAL_ONLY
+#define METRICS_LOCAL_ONLY 1
+#endif
+
+/*
+ * 按阶段统计系统调用和堆内存分配(每个请求的平均值见/metrics), 用于检查稳态下是否仍有分配
+ * 开启时替换malloc/calloc/realloc, 每次分配多一次线程局部计数
+ */
+#ifndef METRICS_ACCOUNTING
+#define METRICS_ACCOUNTING 0
+#endif
+
+/*
+ * 统计线程池/日志/数据库连接池的锁: 加锁次数, 竞争次数和等待时间(/metrics, 退出时写入日志)
+ * 开启后SIGINT/SIGTERM使服务器正常退出, 以便输出汇总
+ */
+#ifndef METRICS_LOCK_PROFILE
+#define METRICS_LOCK_PROFILE 0
+#endif
+
+/*
+ * 请求追踪: TRACE_ENABLE为0时不编译; 每TRACE_SAMPLE个请求采样一个
+ * 每个线程保留最近TRACE_RING_SIZE段(2的幂); SIGUSR2写入TRACE_FILE, 本机也可请求TRACE_PATH
+ */
+#ifndef TRACE_ENABLE
+#define TRACE_ENABLE 0
+#endif
+
+#ifndef TRACE_SAMPLE
+#define TRACE_SAMPLE 100
+#endif
+
+#ifndef TRACE_RING_SIZE
+#define TRACE_RING_SIZE 8192
+#endif
+
+#ifndef TRACE_PATH
+#define TRACE_PATH "/trace"
+#endif
+
+#ifndef TRACE_FILE
+#define TRACE_FILE "./log/trace.json"
+#endif
+
+#endif //CONFIG_H
@@ -0,0 +1,482 @@
+#include "hpack.h"
+using namespace std;
+
+namespace
+{
+
+/* RFC 7541 附录A 静态表 */
+const HeaderField STATIC_TABLE[] =
+{
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+const size_t STATIC_SIZE = sizeof(STATIC_TABLE) / sizeof(STATIC_TABLE[0]);
+
+/* RFC 7541 附录B Huffman编码, 最后一项为EOS */
+const uint32_t HUFF_CODES[257] =
+{
+	0x1ff8, 0x7fffd8, 0xfffffe2, 0xfffffe3, 0xfffffe4, 0xfffffe5, 0xfffffe6, 0xfffffe7,
+	0xfffffe8, 0xffffea, 0x3ffffffc, 0xfffffe9, 0xfffffea, 0x3ffffffd, 0xfffffeb, 0xfffffec,
+	0xfffffed, 0xfffffee, 0xfffffef, 0xffffff0, 0xffffff1, 0xffffff2, 0x3ffffffe, 0xffffff3,
+	0xffffff4, 0xffffff5, 0xffffff6, 0xffffff7, 0xffffff8, 0xffffff9, 0xffffffa, 0xffffffb,
+	0x14, 0x3f8, 0x3f9, 0xffa, 0x1ff9, 0x15, 0xf8, 0x7fa,
+	0x3fa, 0x3fb, 0xf9, 0x7fb, 0xfa, 0x16, 0x17, 0x18,
+	0x0, 0x1, 0x2, 0x19, 0x1a, 0x1b, 0x1c, 0x1d,
+	0x1e, 0x1f, 0x5c, 0xfb, 0x7ffc, 0x20, 0xffb, 0x3fc,
+	0x1ffa, 0x21, 0x5d, 0x5e, 0x5f, 0x60, 0x61, 0x62,
+	0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a,
+	0x6b, 0x6c, 0x6d, 0x6e, 0x6f, 0x70, 0x71, 0x72,
+	0xfc, 0x73, 0xfd, 0x1ffb, 0x7fff0, 0x1ffc, 0x3ffc, 0x22,
+	0x7ffd, 0x3, 0x23, 0x4, 0x24, 0x5, 0x25, 0x26,
+	0x27, 0x6, 0x74, 0x75, 0x28, 0x29, 0x2a, 0x7,
+	0x2b, 0x76, 0x2c, 0x8, 0x9, 0x2d, 0x77, 0x78,
+	0x79, 0x7a, 0x7b, 0x7ffe, 0x7fc, 0x3ffd, 0x1ffd, 0xffffffc,
+	0xfffe6, 0x3fffd2, 0xfffe7, 0xfffe8, 0x3fffd3, 0x3fffd4, 0x3fffd5, 0x7fffd9,
+	0x3fffd6, 0x7fffda, 0x7fffdb, 0x7fffdc, 0x7fffdd, 0x7fffde, 0xffffeb, 0x7fffdf,
+	0xffffec, 0xffffed, 0x3fffd7, 0x7fffe0, 0xffffee, 0x7fffe1, 0x7fffe2, 0x7fffe3,
+	0x7fffe4, 0x1fffdc, 0x3fffd8, 0x7fffe5, 0x3fffd9, 0x7fffe6, 0x7fffe7, 0xffffef,
+	0x3fffda, 0x1fffdd, 0xfffe9, 0x3fffdb, 0x3fffdc, 0x7fffe8, 0x7fffe9, 0x1fffde,
+	0x7fffea, 0x3fffdd, 0x3fffde, 0xfffff0, 0x1fffdf, 0x3fffdf, 0x7fffeb, 0x7fffec,
+	0x1fffe0, 0x1fffe1, 0x3fffe0, 0x1fffe2, 0x7fffed, 0x3fffe1, 0x7fffee, 0x7fffef,
+	0xfffea, 0x3fffe2, 0x3fffe3, 0x3fffe4, 0x7ffff0, 0x3fffe5, 0x3fffe6, 0x7ffff1,
+	0x3ffffe0, 0x3ffffe1, 0xfffeb, 0x7fff1, 0x3fffe7, 0x7ffff2, 0x3fffe8, 0x1ffffec,
+	0x3ffffe2, 0x3ffffe3, 0x3ffffe4, 0x7ffffde, 0x7ffffdf, 0x3ffffe5, 0xfffff1, 0x1ffffed,
+	0x7fff2, 0x1fffe3, 0x3ffffe6, 0x7ffffe0, 0x7ffffe1, 0x3ffffe7, 0x7ffffe2, 0xfffff2,
+	0x1fffe4, 0x1fffe5, 0x3ffffe8, 0x3ffffe9, 0xffffffd, 0x7ffffe3, 0x7ffffe4, 0x7ffffe5,
+	0xfffec, 0xfffff3, 0xfffed, 0x1fffe6, 0x3fffe9, 0x1fffe7, 0x1fffe8, 0x7ffff3,
+	0x3fffea, 0x3fffeb, 0x1ffffee, 0x1ffffef, 0xfffff4, 0xfffff5, 0x3ffffea, 0x7ffff4,
+	0x3ffffeb, 0x7ffffe6, 0x3ffffec, 0x3ffffed, 0x7ffffe7, 0x7ffffe8, 0x7ffffe9, 0x7ffffea,
+	0x7ffffeb, 0xffffffe, 0x7ffffec, 0x7ffffed, 0x7ffffee, 0x7ffffef, 0x7fffff0, 0x3ffffee,
+	0x3fffffff
+};
+
+const uint8_t HUFF_LENS[257] =
+{
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+	30
+};
+
+struct HuffNode
+{
+	int16_t next[2];  // 子节点下标, -1表示没有
+	int16_t sym;      // 叶子节点的符号, 内部节点为-1
+};
+
+const vector<HuffNode>& HuffTree()
+{
+	/* 首次使用时由编码表生成解码树 */
+	static const vector<HuffNode> tree = []
+	{
+		vector<HuffNode> res(1, HuffNode{ { -1, -1 }, -1 });
+		for (int sym = 0; sym < 257; sym++)
+		{
+			int node = 0;
+			for (int i = HUFF_LENS[sym] - 1; i >= 0; i--)
+			{
+				int bit = (HUFF_CODES[sym] >> i) & 1;
+				if (res[node].next[bit] < 0)
+				{
+					res[node].next[bit] = res.size();
+					res.push_back(HuffNode{ { -1, -1 }, -1 });
+				}
+				node = res[node].next[bit];
+			}
+			res[node].sym = sym;
+		}
+		return res;
+	}();
+	return tree;
+}
+
+bool HuffDecode(const uint8_t* data, size_t len, string& out)
+{
+	const vector<HuffNode>& tree = HuffTree();
+	int node = 0;
+	int depth = 0;  // 当前符号已读入的位数
+	bool isAllOnes = true;
+	for (size_t i = 0; i < len; i++)
+	{
+		for (int b = 7; b >= 0; b--)
+		{
+			int bit = (data[i] >> b) & 1;
+			node = tree[node].next[bit];
+			if (node < 0)
+			{ return false; }
+			depth++;
+			isAllOnes = isAllOnes && bit;
+			if (tree[node].sym >= 0)
+			{
+				if (tree[node].sym == 256)
+				{ return false; }  // 首部块中不能出现EOS
+				out.push_back((char)tree[node].sym);
+				node = 0;
+				depth = 0;
+				isAllOnes = true;
+			}
+		}
+	}
+	// 结尾填充不超过7位, 且为EOS的高位(全1)
+	return depth <= 7 && isAllOnes;
+}
+
+size_t HuffLen(const string& str)
+{
+	size_t bits = 0;
+	for (unsigned char c : str)
+	{ bits += HUFF_LENS[c]; }
+	return (bits + 7) / 8;
+}
+
+void HuffEncode(const string& str, string& out)
+{
+	uint64_t bits = 0;
+	int n = 0;  // bits中尚未输出的位数
+	for (unsigned char c : str)
+	{
+		bits = (bits << HUFF_LENS[c]) | HUFF_CODES[c];
+		n += HUFF_LENS[c];
+		while (n >= 8)
+		{
+			n -= 8;
+			out.push_back((char)(bits >> n));
+		}
+	}
+	if (n > 0)
+	{ out.push_back((char)((bits << (8 - n)) | (0xff >> n))); }
+}
+
+void EncodeInt(string& out, uint8_t first, int prefix, size_t value)
+{
+	// 整数表示: 前缀放不下时, 余数按7位一组小端输出
+	size_t max = (1u << prefix) - 1;
+	if (value < max)
+	{
+		out.push_back((char)(first | value));
+		return;
+	}
+	out.push_back((char)(first | max));
+	value -= max;
+	while (value >= 128)
+	{
+		out.push_back((char)((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out.push_back((char)value);
+}
+
+bool DecodeInt(const uint8_t*& p, const uint8_t* end, int prefix, size_t& value)
+{
+	if (p >= end)
+	{ return false; }
+	size_t max = (1u << prefix) - 1;
+	value = *p++ & max;
+	if (value < max)
+	{ return true; }
+	for (int shift = 0; shift <= 28; shift += 7)
+	{
+		if (p >= end)
+		{ return false; }
+		uint8_t b = *p++;
+		value += (size_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+		{ return true; }
+	}
+	return false;  // 超过5个字节的整数视为格式错误
+}
+
+void EncodeString(string& out, const string& str)
+{
+	size_t len = HuffLen(str);
+	if (len < str.size())
+	{
+		EncodeInt(out, 0x80, 7, len);
+		HuffEncode(str, out);
+		return;
+	}
+	EncodeInt(out, 0, 7, str.size());
+	out += str;
+}
+
+bool DecodeString(const uint8_t*& p, const uint8_t* end, string& out)
+{
+	if (p >= end)
+	{ return false; }
+	bool isHuffman = *p & 0x80;
+	size_t len = 0;
+	if (!DecodeInt(p, end, 7, len) || len > (size_t)(end - p))
+	{ return false; }
+	out.clear();
+	if (isHuffman)
+	{
+		if (!HuffDecode(p, len, out))
+		{ return false; }
+	}
+	else
+	{ out.assign((const char*)p, len); }
+	p += len;
+	return true;
+}
+
+size_t EntrySize(const HeaderField& field)
+{
+	return field.first.size() + field.second.size() + 32;
+}
+
+}
+
+HpackTable::HpackTable(size_t maxSize)
+{
+	size_ = 0;
+	maxSize_ = maxSize;
+}
+
+void HpackTable::SetMaxSize(size_t maxSize)
+{
+	maxSize_ = maxSize;
+	Evict_(maxSize_);
+}
+
+void HpackTable::Add(const string& name, const string& value)
+{
+	size_t size = name.size() + value.size() + 32;
+	if (size > maxSize_)
+	{
+		/* 大于整个表的条目: 清空动态表, 不插入 */
+		Evict_(0);
+		return;
+	}
+	Evict_(maxSize_ - size);
+	entries_.emplace_front(name, value);
+	size_ += size;
+}
+
+void HpackTable::Evict_(size_t maxSize)
+{
+	while (size_ > maxSize)
+	{
+		size_ -= EntrySize(entries_.back());
+		entries_.pop_back();
+	}
+}
+
+const HeaderField* HpackTable::Get(size_t index) const
+{
+	if (index == 0)
+	{ return nullptr; }
+	if (index <= STATIC_SIZE)
+	{ return &STATIC_TABLE[index - 1]; }
+	index -= STATIC_SIZE + 1;
+	if (index < entries_.size())
+	{ return &entries_[index]; }
+	return nullptr;
+}
+
+size_t HpackTable::Find(const string& name, const string& value, size_t* nameIndex) const
+{
+	*nameIndex = 0;
+	for (size_t i = 0; i < STATIC_SIZE; i++)
+	{
+		if (STATIC_TABLE[i].first != name)
+		{ continue; }
+		if (STATIC_TABLE[i].second == value)
+		{ return i + 1; }
+		if (*nameIndex == 0)
+		{ *nameIndex = i + 1; }
+	}
+	for (size_t i = 0; i < entries_.size(); i++)
+	{
+		if (entries_[i].first != name)
+		{ continue; }
+		if (entries_[i].second == value)
+		{ return STATIC_SIZE + 1 + i; }
+		if (*nameIndex == 0)
+		{ *nameIndex = STATIC_SIZE + 1 + i; }
+	}
+	return 0;
+}
+
+HpackDecoder::HpackDecoder() : table_(4096)
+{
+	limit_ = 4096;
+}
+
+bool HpackDecoder::Decode(const uint8_t* data, size_t len, HeaderList& headers, size_t maxListSize)
+{
+	const uint8_t* p = data;
+	const uint8_t* end = data + len;
+	size_t start = headers.size();
+	size_t listSize = 0;
+	while (p < end)
+	{
+		uint8_t b = *p;
+		size_t index = 0;
+		if (b & 0x80)
+		{
+			/* 1xxxxxxx 索引表示 */
+			if (!DecodeInt(p, end, 7, index))
+			{ return false; }
+			const HeaderField* field = table_.Get(index);
+			if (!field)
+			{ return false; }
+			headers.push_back(*field);
+		}
+		else if ((b & 0xe0) == 0x20)
+		{
+			/* 001xxxxx 动态表大小更新, 只能出现在首部块开头 */
+			size_t size = 0;
+			if (!DecodeInt(p, end, 5, size) || size > limit_ || headers.size() != start)
+			{ return false; }
+			table_.SetMaxSize(size);
+			continue;
+		}
+		else
+		{
+			/* 01xxxxxx 增量索引, 0000xxxx 不索引, 0001xxxx 永不索引 */
+			bool isIndexing = (b & 0xc0) == 0x40;
+			if (!DecodeInt(p, end, isIndexing ? 6 : 4, index))
+			{ return false; }
+			HeaderField field;
+			if (index > 0)
+			{
+				const HeaderField* name = table_.Get(index);
+				if (!name)
+				{ return false; }
+				field.first = name->first;
+			}
+			else if (!DecodeString(p, end, field.first))
+			{ return false; }
+			if (!DecodeString(p, end, field.second))
+			{ return false; }
+			if (isIndexing)
+			{ table_.Add(field.first, field.second); }
+			headers.push_back(move(field));
+		}
+		listSize += EntrySize(headers.back());
+		if (listSize > maxListSize)
+		{ return false; }
+	}
+	return true;
+}
+
+HpackEncoder::HpackEncoder() : table_(4096)
+{
+	isSizeUpdate_ = false;
+}
+
+void HpackEncoder::SetMaxTableSize(size_t size)
+{
+	// 本端动态表不超过默认的4096字节
+	if (size > 4096)
+	{ size = 4096; }
+	if (size != table_.MaxSize())
+	{
+		table_.SetMaxSize(size);
+		isSizeUpdate_ = true;
+	}
+}
+
+void HpackEncoder::Encode(const HeaderList& headers, string& out)
+{
+	if (isSizeUpdate_)
+	{
+		EncodeInt(out, 0x20, 5, table_.MaxSize());
+		isSizeUpdate_ = false;
+	}
+	for (const auto& h : headers)
+	{
+		size_t nameIndex = 0;
+		size_t index = table_.Find(h.first, h.second, &nameIndex);
+		if (index > 0)
+		{
+			EncodeInt(out, 0x80, 7, index);
+			continue;
+		}
+		/* 会话cookie和凭据不进入动态表, 并标记为永不索引, 中间代理也不能压缩它们(RFC 7541 7.1.3) */
+		bool isSensitive = h.first == "set-cookie" || h.first == "authorization";
+		/* content-length每个响应都不同, 加入动态表只会挤掉有用的条目 */
+		bool isIndexing = !isSensitive && h.first != "content-length";
+		if (isIndexing)
+		{ EncodeInt(out, 0x40, 6, nameIndex); }
+		else
+		{ EncodeInt(out, isSensitive ? 0x10 : 0x00, 4, nameIndex); }
+		if (nameIndex == 0)
+		{ EncodeString(out, h.first); }
+		EncodeString(out, h.second);
+		if (isIndexing)
+		{ table_.Add(h.first, h.second); }
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <stdint.h>
+
+typedef std::pair<std::string, std::string> HeaderField;
+typedef std::vector<HeaderField> HeaderList;
+
+/*
+ * HPACK(RFC 7541)首部表
+ * 索引从1开始: 1~61为静态表, 之后是动态表(最新插入的条目索引最小)
+ * 每个条目按 name + value + 32 字节计入表大小, 超出上限时从最旧的条目淘汰
+ */
+class HpackTable
+{
+ public:
+	explicit HpackTable(size_t maxSize = 4096);
+
+	void SetMaxSize(size_t maxSize);
+	size_t MaxSize() const
+	{
+		return maxSize_;
+	}
+
+	void Add(const std::string& name, const std::string& value);
+	const HeaderField* Get(size_t index) const;
+
+	/* 完全匹配时返回索引; 只有名字匹配时返回0, 名字的索引存入nameIndex */
+	size_t Find(const std::string& name, const std::string& value, size_t* nameIndex) const;
+
+ private:
+	void Evict_(size_t maxSize);
+
+	std::deque<HeaderField> entries_;
+	size_t size_;
+	size_t maxSize_;
+};
+
+/* 解码HEADERS/CONTINUATION拼接成的首部块 */
+class HpackDecoder
+{
+ public:
+	HpackDecoder();
+
+	/* 首部块格式错误或解码后超过maxListSize时返回false, 对应COMPRESSION_ERROR */
+	bool Decode(const uint8_t* data, size_t len, HeaderList& headers, size_t maxListSize);
+
+ private:
+	HpackTable table_;
+	size_t limit_;  // 本端允许的动态表大小(SETTINGS_HEADER_TABLE_SIZE)
+};
+
+/* 编码响应首部: 完全匹配的用索引, 其余按名字索引+字面值, 字符串较短时使用Huffman编码 */
+class HpackEncoder
+{
+ public:
+	HpackEncoder();
+
+	void Encode(const HeaderList& headers, std::string& out);
+
+	/* 对端SETTINGS_HEADER_TABLE_SIZE变化, 下一个首部块开头发送动态表大小更新 */
+	void SetMaxTableSize(size_t size);
+
+ private:
+	HpackTable table_;
+	bool isSizeUpdate_;
+};
+
+#endif //HPACK_H
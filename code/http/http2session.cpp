@@ -0,0 +1,821 @@
+#include "http2session.h"
+using namespace std;
+
+namespace
+{
+
+const char PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t PREFACE_LEN = sizeof(PREFACE) - 1;
+const size_t FRAME_HEADER_LEN = 9;
+const uint32_t DEFAULT_MAX_FRAME = 16384;  // 本端不通告更大的帧
+const int64_t MAX_WINDOW = 0x7fffffff;
+
+const uint8_t FLAG_END_STREAM = 0x1;
+const uint8_t FLAG_ACK = 0x1;
+const uint8_t FLAG_END_HEADERS = 0x4;
+const uint8_t FLAG_PADDED = 0x8;
+const uint8_t FLAG_PRIORITY = 0x20;
+
+uint32_t Get32(const uint8_t* p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+void Put32(uint8_t* p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
+}
+
+void PutSetting(uint8_t* p, uint16_t key, uint32_t value)
+{
+	p[0] = key >> 8;
+	p[1] = key;
+	Put32(p + 2, value);
+}
+
+bool DecodeBase64Url(const string& in, string& out)
+{
+	// HTTP2-Settings为base64url编码, 不带填充
+	uint32_t acc = 0;
+	int bits = 0;
+	for (char c : in)
+	{
+		int v;
+		if (c >= 'A' && c <= 'Z')
+		{ v = c - 'A'; }
+		else if (c >= 'a' && c <= 'z')
+		{ v = c - 'a' + 26; }
+		else if (c >= '0' && c <= '9')
+		{ v = c - '0' + 52; }
+		else if (c == '-' || c == '+')
+		{ v = 62; }
+		else if (c == '_' || c == '/')
+		{ v = 63; }
+		else if (c == '=')
+		{ break; }
+		else
+		{ return false; }
+		acc = (acc << 6) | v;
+		bits += 6;
+		if (bits >= 8)
+		{
+			bits -= 8;
+			out.push_back((char)(acc >> bits));
+		}
+	}
+	return true;
+}
+
+}
+
+Http2Session::Http2Session(const char* srcDir) : srcDir_(srcDir)
+{
+	isPreface_ = false;
+	isGoAway_ = false;
+	isPeerGoAway_ = false;
+	lastStreamId_ = 0;
+	continuationId_ = 0;
+	continuationFlags_ = 0;
+	connSendWindow_ = 65535;
+	recvUnacked_ = 0;
+	peerInitWindow_ = 65535;
+	peerMaxFrame_ = DEFAULT_MAX_FRAME;
+	vtime_ = 0;
+	fileStreams_ = 0;
+	fileSent_ = 0;
+
+	/* 服务端连接序言: SETTINGS, 并把连接级接收窗口从65535调大到H2_WINDOW */
+	uint8_t settings[18];
+	PutSetting(settings, 0x3, H2_MAX_STREAMS);      // MAX_CONCURRENT_STREAMS
+	PutSetting(settings + 6, 0x4, H2_WINDOW);       // INITIAL_WINDOW_SIZE
+	PutSetting(settings + 12, 0x6, H2_MAX_HEADER_SIZE);  // MAX_HEADER_LIST_SIZE
+	AppendFrame_(ctrl_, SETTINGS, 0, 0, settings, sizeof(settings));
+	if (H2_WINDOW > 65535)
+	{
+		uint8_t inc[4];
+		Put32(inc, H2_WINDOW - 65535);
+		AppendFrame_(ctrl_, WINDOW_UPDATE, 0, 0, inc, sizeof(inc));
+	}
+}
+
+Http2Session::~Http2Session()
+{
+	/* 连接关闭时未发送完的流也要记录 */
+	for (const auto& it : streams_)
+	{
+		EndStream_(*it.second);
+	}
+}
+
+bool Http2Session::IsPreface(const char* data, size_t len)
+{
+	size_t n = min(len, PREFACE_LEN);
+	return n > 0 && memcmp(data, PREFACE, n) == 0;
+}
+
+bool Http2Session::Upgrade(const string& settings, HttpRequest& request)
+{
+	string payload;
+	if (!DecodeBase64Url(settings, payload)
+		|| !OnSettings_((const uint8_t*)payload.data(), payload.size()))
+	{ return false; }
+	/* 升级请求隐式占用流1, 处于半关闭(远端)状态, 不需要ACK这份SETTINGS */
+	lastStreamId_ = 1;
+	StartResponse_(NewStream_(1), request, true);
+	return true;
+}
+
+bool Http2Session::OnRead(Buffer& buff)
+{
+	if (isGoAway_)
+	{
+		buff.RetrieveAll();  // 已发送GOAWAY, 不再处理新的帧
+		return false;
+	}
+	if (!isPreface_)
+	{
+		size_t n = min(buff.ReadableBytes(), PREFACE_LEN);
+		if (memcmp(buff.Peek(), PREFACE, n) != 0)
+		{
+			buff.RetrieveAll();
+			return GoAway_(PROTOCOL_ERROR);
+		}
+		if (n < PREFACE_LEN)
+		{ return true; }
+		buff.Retrieve(PREFACE_LEN);
+		isPreface_ = true;
+	}
+	/* 帧头: 长度(24) 类型(8) 标志(8) 流ID(31) */
+	while (buff.ReadableBytes() >= FRAME_HEADER_LEN)
+	{
+		const uint8_t* p = (const uint8_t*)buff.Peek();
+		size_t len = ((size_t)p[0] << 16) | (p[1] << 8) | p[2];
+		if (len > DEFAULT_MAX_FRAME)
+		{
+			buff.RetrieveAll();
+			return GoAway_(FRAME_SIZE_ERROR);
+		}
+		if (buff.ReadableBytes() < FRAME_HEADER_LEN + len)
+		{ break; }
+		bool isOk = OnFrame_(p[3], p[4], Get32(p + 5) & 0x7fffffff, p + FRAME_HEADER_LEN, len);
+		buff.Retrieve(FRAME_HEADER_LEN + len);
+		if (!isOk)
+		{
+			buff.RetrieveAll();
+			return false;
+		}
+	}
+	return true;
+}
+
+bool Http2Session::OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+	/* 首部块未结束时只能收到同一个流的CONTINUATION */
+	if (continuationId_ && (type != CONTINUATION || id != continuationId_))
+	{ return GoAway_(PROTOCOL_ERROR); }
+	switch (type)
+	{
+	case DATA:
+		return OnData_(flags, id, payload, len);
+	case HEADERS:
+		return OnHeaders_(flags, id, payload, len);
+	case PRIORITY:
+		if (id == 0)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		if (len != 5)
+		{
+			ResetStream_(id, FRAME_SIZE_ERROR);
+			return true;
+		}
+		if (streams_.count(id))
+		{ streams_[id]->weight = payload[4] + 1; }
+		return true;
+	case RST_STREAM:
+		if (id == 0 || id > lastStreamId_)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		if (len != 4)
+		{ return GoAway_(FRAME_SIZE_ERROR); }
+		CloseStream_(id);
+		return true;
+	case SETTINGS:
+		if (id != 0)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		if (flags & FLAG_ACK)
+		{ return len == 0 ? true : GoAway_(FRAME_SIZE_ERROR); }
+		if (!OnSettings_(payload, len))
+		{ return false; }
+		AppendFrame_(ctrl_, SETTINGS, FLAG_ACK, 0, nullptr, 0);
+		return true;
+	case PING:
+		if (id != 0)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		if (len != 8)
+		{ return GoAway_(FRAME_SIZE_ERROR); }
+		if (!(flags & FLAG_ACK))
+		{ AppendFrame_(ctrl_, PING, FLAG_ACK, 0, payload, len); }
+		return true;
+	case GOAWAY:
+		if (id != 0)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		/* 对端不再发起新流, 已有的流发送完毕后关闭连接 */
+		isPeerGoAway_ = true;
+		return true;
+	case WINDOW_UPDATE:
+		return OnWindowUpdate_(id, payload, len);
+	case CONTINUATION:
+		if (!continuationId_)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		headerBlock_.append((const char*)payload, len);
+		if (headerBlock_.size() > H2_MAX_HEADER_SIZE)
+		{ return GoAway_(ENHANCE_YOUR_CALM); }
+		if (flags & FLAG_END_HEADERS)
+		{ return OnHeaderBlock_(id); }
+		return true;
+	case PUSH_PROMISE:
+		return GoAway_(PROTOCOL_ERROR);  // 客户端不能推送
+	default:
+		return true;  // 忽略未知类型的帧
+	}
+}
+
+bool Http2Session::OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+	if (id == 0 || !(id & 1))
+	{ return GoAway_(PROTOCOL_ERROR); }
+	size_t pad = 0;
+	if (flags & FLAG_PADDED)
+	{
+		if (len < 1)
+		{ return GoAway_(FRAME_SIZE_ERROR); }
+		pad = payload[0];
+		payload++;
+		len--;
+	}
+	uint32_t weight = 0;
+	if (flags & FLAG_PRIORITY)
+	{
+		if (len < 5)
+		{ return GoAway_(FRAME_SIZE_ERROR); }
+		weight = payload[4] + 1;
+		payload += 5;
+		len -= 5;
+	}
+	if (pad > len)
+	{ return GoAway_(PROTOCOL_ERROR); }
+	len -= pad;
+
+	if (id > lastStreamId_)
+	{
+		/* 新的流; 超过并发上限或对端已GOAWAY时拒绝, 首部块仍要解码 */
+		lastStreamId_ = id;
+		if (streams_.size() >= H2_MAX_STREAMS || isPeerGoAway_)
+		{ ResetStream_(id, REFUSED_STREAM); }
+		else
+		{
+			Stream* stream = NewStream_(id);
+			if (weight)
+			{ stream->weight = weight; }
+		}
+	}
+	headerBlock_.assign((const char*)payload, len);
+	if (headerBlock_.size() > H2_MAX_HEADER_SIZE)
+	{ return GoAway_(ENHANCE_YOUR_CALM); }
+	continuationFlags_ = flags;
+	if (flags & FLAG_END_HEADERS)
+	{ return OnHeaderBlock_(id); }
+	continuationId_ = id;
+	return true;
+}
+
+bool Http2Session::OnHeaderBlock_(uint32_t id)
+{
+	/* 首部块必须解码, 即使流已被拒绝或关闭, 否则两端的动态表不再一致 */
+	continuationId_ = 0;
+	HeaderList headers;
+	if (!decoder_.Decode((const uint8_t*)headerBlock_.data(), headerBlock_.size(), headers, H2_MAX_HEADER_SIZE))
+	{ return GoAway_(COMPRESSION_ERROR); }
+	headerBlock_.clear();
+
+	auto it = streams_.find(id);
+	if (it == streams_.end())
+	{
+		/* 已关闭的流: 本端重置的忽略在途的帧, 否则按RFC 9113 5.1为连接错误 */
+		if (find(resetIds_.begin(), resetIds_.end(), id) != resetIds_.end())
+		{ return true; }
+		return GoAway_(STREAM_CLOSED);
+	}
+	Stream* stream = it->second.get();
+	if (stream->isEndRecv)
+	{
+		ResetStream_(id, STREAM_CLOSED);
+		return true;
+	}
+	if (stream->headers.empty())
+	{ stream->headers = move(headers); }
+	else if (!(continuationFlags_ & FLAG_END_STREAM))
+	{
+		/* 请求体之后的首部(trailers)必须结束流, 内容忽略 */
+		ResetStream_(id, PROTOCOL_ERROR);
+		return true;
+	}
+	if (continuationFlags_ & FLAG_END_STREAM)
+	{ OnRequest_(stream); }
+	return true;
+}
+
+bool Http2Session::OnData_(uint8_t flags, uint32_t id, const uint8_t* payload, size_t len)
+{
+	if (id == 0 || id > lastStreamId_)
+	{ return GoAway_(PROTOCOL_ERROR); }
+	/* 整个帧(含填充)计入流量控制, 累计超过窗口一半时归还连接窗口 */
+	recvUnacked_ += len;
+	if (recvUnacked_ >= H2_WINDOW / 2)
+	{
+		uint8_t inc[4];
+		Put32(inc, recvUnacked_);
+		AppendFrame_(ctrl_, WINDOW_UPDATE, 0, 0, inc, sizeof(inc));
+		recvUnacked_ = 0;
+	}
+	size_t pad = 0;
+	if (flags & FLAG_PADDED)
+	{
+		if (len < 1)
+		{ return GoAway_(FRAME_SIZE_ERROR); }
+		pad = payload[0];
+		payload++;
+		len--;
+	}
+	if (pad > len)
+	{ return GoAway_(PROTOCOL_ERROR); }
+	len -= pad;
+
+	auto it = streams_.find(id);
+	if (it == streams_.end())
+	{ return true; }  // 已重置或已关闭的流, 忽略
+	Stream* stream = it->second.get();
+	if (stream->isEndRecv)
+	{
+		ResetStream_(id, STREAM_CLOSED);
+		return true;
+	}
+	/* 请求体上限远小于流的接收窗口, 不需要归还流级窗口 */
+	if (stream->reqBody.size() + len > H2_MAX_BODY)
+	{
+		LOG_WARN("HTTP/2 stream %u body too large", id);
+		ResetStream_(id, ENHANCE_YOUR_CALM);
+		return true;
+	}
+	stream->reqBody.append((const char*)payload, len);
+	if (flags & FLAG_END_STREAM)
+	{ OnRequest_(stream); }
+	return true;
+}
+
+bool Http2Session::OnSettings_(const uint8_t* payload, size_t len)
+{
+	if (len % 6 != 0)
+	{ return GoAway_(FRAME_SIZE_ERROR); }
+	for (size_t i = 0; i < len; i += 6)
+	{
+		uint16_t key = (payload[i] << 8) | payload[i + 1];
+		uint32_t value = Get32(payload + i + 2);
+		switch (key)
+		{
+		case 0x1:  // HEADER_TABLE_SIZE
+			encoder_.SetMaxTableSize(value);
+			break;
+		case 0x2:  // ENABLE_PUSH, 本端不推送
+			if (value > 1)
+			{ return GoAway_(PROTOCOL_ERROR); }
+			break;
+		case 0x4:  // INITIAL_WINDOW_SIZE, 按差值调整所有流的发送窗口
+			if (value > MAX_WINDOW)
+			{ return GoAway_(FLOW_CONTROL_ERROR); }
+			for (auto& it : streams_)
+			{
+				it.second->sendWindow += (int64_t)value - peerInitWindow_;
+				if (it.second->sendWindow > MAX_WINDOW)
+				{ return GoAway_(FLOW_CONTROL_ERROR); }
+			}
+			peerInitWindow_ = value;
+			break;
+		case 0x5:  // MAX_FRAME_SIZE
+			if (value < 16384 || value > 16777215)
+			{ return GoAway_(PROTOCOL_ERROR); }
+			peerMaxFrame_ = value;
+			break;
+		default:
+			break;
+		}
+	}
+	return true;
+}
+
+bool Http2Session::OnWindowUpdate_(uint32_t id, const uint8_t* payload, size_t len)
+{
+	if (len != 4)
+	{ return GoAway_(FRAME_SIZE_ERROR); }
+	uint32_t inc = Get32(payload) & 0x7fffffff;
+	if (id == 0)
+	{
+		if (inc == 0)
+		{ return GoAway_(PROTOCOL_ERROR); }
+		connSendWindow_ += inc;
+		if (connSendWindow_ > MAX_WINDOW)
+		{ return GoAway_(FLOW_CONTROL_ERROR); }
+		return true;
+	}
+	auto it = streams_.find(id);
+	if (it == streams_.end())
+	{ return id <= lastStreamId_ ? true : GoAway_(PROTOCOL_ERROR); }
+	if (inc == 0)
+	{
+		ResetStream_(id, PROTOCOL_ERROR);
+		return true;
+	}
+	it->second->sendWindow += inc;
+	if (it->second->sendWindow > MAX_WINDOW)
+	{ ResetStream_(id, FLOW_CONTROL_ERROR); }
+	return true;
+}
+
+Http2Session::Stream* Http2Session::NewStream_(uint32_t id)
+{
+	unique_ptr<Stream> stream(new Stream);
+	stream->id = id;
+	stream->isEndRecv = false;
+	stream->isHeadersSent = false;
+	stream->isFile = false;
+	stream->isDeferred = false;
+	stream->code = 200;
+	stream->bodyLeft = 0;
+	stream->fileOff = 0;
+	stream->sendWindow = peerInitWindow_;
+	stream->urgency = 3;
+	stream->isIncremental = true;
+	stream->weight = 16;
+	stream->vtime = vtime_;  // 新的流从当前虚拟时间开始参与轮转
+	stream->isLogged = false;
+	stream->start = chrono::steady_clock::now();
+	stream->bodySize = 0;
+	Stream* res = stream.get();
+	streams_[id] = move(stream);
+	return res;
+}
+
+void Http2Session::OnRequest_(Stream* stream)
+{
+	HttpRequest request;
+	auto start = Metrics::Clock::now();
+	bool isOk = false;
+	{
+		Metrics::StageScope stage(Metrics::STAGE_PARSE);
+		isOk = request.ParseH2(stream->headers, stream->reqBody);
+	}
+	Metrics::Observe(Metrics::STAGE_PARSE, start);
+	StartResponse_(stream, request, isOk);
+}
+
+void Http2Session::StartResponse_(Stream* stream, HttpRequest& request, bool isOk)
+{
+	/*
+	 * 请求完整后立即生成响应, HEADERS和DATA由Fill按优先级发送
+	 * 响应体为映射的文件, 没有文件时为body中的错误页
+	 */
+	stream->isEndRecv = true;
+	ParsePriority_(stream, request.GetHeader("priority"));
+	stream->headers.clear();
+	stream->reqBody.clear();
+	stream->response.Init(srcDir_, request.path(), true, isOk ? 200 : 400);
+	stream->response.SetCookie(request.SessionCookie());
+	{
+		Metrics::StageScope stage(Metrics::STAGE_NONE);  // 生成导出内容计入other
+		if (isOk && Metrics::IsEndpoint(request.path(), peer_.c_str()))
+		{ stream->response.SetText("text/plain; version=0.0.4", Metrics::Instance()->Render()); }
+		else if (isOk && Trace::IsEndpoint(request.path(), peer_.c_str()))
+		{ stream->response.SetText("application/json", Trace::Instance()->Render()); }
+	}
+	if (!MakeBody_(stream))
+	{
+		stream->isDeferred = true;
+		stream->path = request.path();
+		stream->cookie = request.SessionCookie();
+	}
+	stream->isLogged = AccessLog::Instance()->Sample();
+	if (stream->isLogged)
+	{
+		stream->method = request.method();
+		stream->target = request.target();
+		stream->user = request.SessionUser();
+		stream->referer = request.GetHeader("referer");
+		stream->agent = request.GetHeader("user-agent");
+	}
+	LOG_DEBUG("h2 stream %u: %s %d, %d bytes", stream->id, request.path().c_str(), stream->code, (int)stream->bodyLeft);
+}
+
+bool Http2Session::MakeBody_(Stream* stream)
+{
+	/*
+	 * 生成响应体; 本连接分段发送的大文件流已有H2_MAX_FILE_STREAMS个时释放窗口返回false,
+	 * 由ResumeDeferred_在其中一个完成后重新生成, 单连接不会占满全局的STREAM_GLOBAL_MAX
+	 */
+	{
+		Metrics::StageScope stage(Metrics::STAGE_BUILD);
+		auto start = Metrics::Clock::now();
+		stream->response.MakeBody(stream->body);
+		Metrics::Observe(Metrics::STAGE_BUILD, start);
+	}
+	if (stream->response.IsStream())
+	{
+		if (fileStreams_ >= H2_MAX_FILE_STREAMS)
+		{
+			stream->response.UnmapFile();
+			return false;
+		}
+		if (fileStreams_++ == 0)
+		{
+			fileStart_ = chrono::steady_clock::now();
+			fileSent_ = 0;
+		}
+		stream->isFile = true;
+	}
+	stream->code = stream->response.Code();
+	if (stream->body.ReadableBytes() > 0)
+	{
+		stream->type = stream->response.IsText() ? stream->response.ContentType() : "text/html";
+		stream->bodyLeft = stream->body.ReadableBytes();
+	}
+	else
+	{
+		stream->type = stream->response.ContentType();
+		stream->bodyLeft = stream->response.FileLen() + stream->response.RemainBytes();
+	}
+	stream->bodySize = stream->bodyLeft;
+	return true;
+}
+
+void Http2Session::ResumeDeferred_()
+{
+	/* 大文件流完成后按流ID顺序重新生成等待中的流, 文件可能已变为小文件, 继续下一个 */
+	for (auto& it : streams_)
+	{
+		if (fileStreams_ >= H2_MAX_FILE_STREAMS)
+		{ break; }
+		Stream* stream = it.second.get();
+		if (!stream->isDeferred)
+		{ continue; }
+		stream->response.Init(srcDir_, stream->path, true, 200);
+		stream->response.SetCookie(stream->cookie);
+		stream->isDeferred = !MakeBody_(stream);
+	}
+}
+
+bool Http2Session::IsTooSlow() const
+{
+	if (fileStreams_ == 0)
+	{ return false; }
+	auto elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - fileStart_).count();
+	if (elapsed < STREAM_GRACE_MS)
+	{ return false; }
+	return fileSent_ * 1000 / elapsed < STREAM_MIN_RATE;
+}
+
+void Http2Session::ParsePriority_(Stream* stream, const string& value)
+{
+	/*
+	 * RFC 9218 priority首部, 如 "u=1, i"
+	 * 带该首部的流默认不增量发送; 没有该首部时与其它流按HTTP/2权重轮转
+	 */
+	if (value.empty())
+	{ return; }
+	stream->isIncremental = false;
+	size_t pos = 0;
+	while (pos < value.size())
+	{
+		size_t end = value.find(',', pos);
+		if (end == string::npos)
+		{ end = value.size(); }
+		size_t begin = value.find_first_not_of(' ', pos);
+		if (begin < end)
+		{
+			string item = value.substr(begin, end - begin);
+			item.erase(item.find_last_not_of(' ') + 1);
+			if (item.size() == 3 && item[0] == 'u' && item[1] == '=' && item[2] >= '0' && item[2] <= '7')
+			{ stream->urgency = item[2] - '0'; }
+			else if (item == "i" || item == "i=?1")
+			{ stream->isIncremental = true; }
+		}
+		pos = end + 1;
+	}
+}
+
+Http2Session::Stream* Http2Session::NextStream_()
+{
+	/*
+	 * 可发送DATA的流中urgency小的优先
+	 * 同一urgency下非增量流按流ID顺序逐个发完, 增量流按 已发送字节/权重 的虚拟时间轮转
+	 */
+	Stream* res = nullptr;
+	for (auto& it : streams_)
+	{
+		Stream* stream = it.second.get();
+		if (!stream->isHeadersSent || stream->bodyLeft == 0 || stream->sendWindow <= 0)
+		{ continue; }
+		if (!res || stream->urgency < res->urgency
+			|| (stream->urgency == res->urgency && res->isIncremental
+				&& (!stream->isIncremental || stream->vtime < res->vtime)))
+		{ res = stream; }
+	}
+	return res;
+}
+
+void Http2Session::Fill(Buffer& buff, size_t maxBytes)
+{
+	size_t start = buff.ReadableBytes();
+	if (ctrl_.ReadableBytes() > 0)
+	{
+		buff.Append(ctrl_);
+		ctrl_.RetrieveAll();
+	}
+	/* h2c升级时先只发101和SETTINGS, 收到客户端序言及其SETTINGS(初始窗口等)后再发送流1 */
+	if (isGoAway_ || !isPreface_)
+	{ return; }
+	/* 响应首部不受流量控制, 全部先发出 */
+	for (auto it = streams_.begin(); it != streams_.end();)
+	{
+		Stream* stream = (it++)->second.get();  // AppendHeaders_可能删除该流
+		if (stream->isEndRecv && !stream->isHeadersSent && !stream->isDeferred)
+		{ AppendHeaders_(buff, stream); }
+	}
+	while (buff.ReadableBytes() - start < maxBytes && connSendWindow_ > 0)
+	{
+		Stream* stream = NextStream_();
+		if (!stream)
+		{ break; }
+		size_t n = min({ (int64_t)peerMaxFrame_, connSendWindow_, stream->sendWindow, (int64_t)stream->bodyLeft });
+		const char* data = nullptr;
+		if (stream->body.ReadableBytes() > 0)
+		{ data = stream->body.Peek(); }
+		else
+		{
+			HttpResponse& response = stream->response;
+			if (stream->fileOff == response.FileLen())
+			{
+				/* 大文件当前映射窗口已发送完, 映射下一段 */
+				if (!response.NextWindow())
+				{
+					LOG_ERROR("HTTP/2 stream %u map file error!", stream->id);
+					ResetStream_(stream->id, INTERNAL_ERROR);
+					continue;
+				}
+				stream->fileOff = 0;
+			}
+			n = min(n, response.FileLen() - stream->fileOff);
+			data = response.File() + stream->fileOff;
+		}
+		stream->bodyLeft -= n;
+		stream->sendWindow -= n;
+		connSendWindow_ -= n;
+		stream->vtime += n * 256 / stream->weight;
+		if (stream->isIncremental)
+		{ vtime_ = stream->vtime; }
+		AppendFrame_(buff, DATA, stream->bodyLeft == 0 ? FLAG_END_STREAM : 0, stream->id, data, n);
+		if (stream->body.ReadableBytes() > 0)
+		{ stream->body.Retrieve(n); }
+		else
+		{ stream->fileOff += n; }
+		if (stream->isFile)
+		{ fileSent_ += n; }
+		if (stream->bodyLeft == 0)
+		{ CloseStream_(stream->id); }
+	}
+}
+
+size_t Http2Session::PendingBytes() const
+{
+	/* 控制帧 + 未发送的首部 + 当前窗口允许发送的响应体, 只用于判断是否还有数据要写 */
+	size_t res = ctrl_.ReadableBytes();
+	if (isGoAway_ || !isPreface_)
+	{ return res; }
+	int64_t data = 0;
+	for (const auto& it : streams_)
+	{
+		const Stream* stream = it.second.get();
+		if (!stream->isEndRecv || stream->isDeferred)
+		{ continue; }
+		if (!stream->isHeadersSent)
+		{ res += FRAME_HEADER_LEN; }
+		if (stream->sendWindow > 0)
+		{ data += min((int64_t)stream->bodyLeft, stream->sendWindow); }
+	}
+	return res + (connSendWindow_ > 0 ? min(data, connSendWindow_) : 0);
+}
+
+void Http2Session::AppendFrame_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len)
+{
+	uint8_t header[FRAME_HEADER_LEN];
+	header[0] = len >> 16;
+	header[1] = len >> 8;
+	header[2] = len;
+	header[3] = type;
+	header[4] = flags;
+	Put32(header + 5, id & 0x7fffffff);
+	buff.Append(header, sizeof(header));
+	if (len > 0)
+	{ buff.Append(payload, len); }
+}
+
+void Http2Session::AppendHeaders_(Buffer& buff, Stream* stream)
+{
+	HeaderList headers = {
+		{ ":status", to_string(stream->code) },
+		{ "content-type", stream->type },
+		{ "content-length", to_string(stream->bodyLeft) },
+	};
+	if (!stream->response.Cookie().empty())
+	{ headers.push_back({ "set-cookie", stream->response.Cookie() }); }
+	string block;
+	encoder_.Encode(headers, block);
+	/* 首部块超过对端最大帧长度时拆分出CONTINUATION帧 */
+	uint8_t type = HEADERS;
+	uint8_t flags = stream->bodyLeft == 0 ? FLAG_END_STREAM : 0;
+	size_t off = 0;
+	do
+	{
+		size_t n = min(block.size() - off, (size_t)peerMaxFrame_);
+		if (off + n == block.size())
+		{ flags |= FLAG_END_HEADERS; }
+		AppendFrame_(buff, type, flags, stream->id, block.data() + off, n);
+		off += n;
+		type = CONTINUATION;
+		flags = 0;
+	} while (off < block.size());
+	stream->isHeadersSent = true;
+	if (stream->bodyLeft == 0)
+	{ CloseStream_(stream->id); }
+}
+
+void Http2Session::CloseStream_(uint32_t id)
+{
+	auto it = streams_.find(id);
+	if (it == streams_.end())
+	{ return; }
+	bool isFile = it->second->isFile;
+	EndStream_(*it->second);
+	streams_.erase(it);  // 析构HttpResponse, 释放映射
+	if (isFile)
+	{
+		fileStreams_--;
+		ResumeDeferred_();
+	}
+}
+
+void Http2Session::EndStream_(const Stream& stream)
+{
+	/* 响应发送完毕或流被重置时记录, bytes为实际发送的响应体字节数 */
+	if (!stream.isEndRecv)
+	{ return; }
+	Metrics::AddResponse(stream.code);
+	Metrics::Observe(Metrics::STAGE_TOTAL, stream.start);
+	if (!stream.isLogged)
+	{ return; }
+	AccessEntry entry = {
+		peer_.c_str(), stream.user.c_str(), stream.method.c_str(), stream.target.c_str(), "2",
+		stream.code, stream.bodySize - stream.bodyLeft, stream.referer.c_str(), stream.agent.c_str(),
+		chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - stream.start).count(),
+	};
+	AccessLog::Instance()->Write(entry);
+}
+
+void Http2Session::ResetStream_(uint32_t id, ERROR_CODE code)
+{
+	uint8_t payload[4];
+	Put32(payload, code);
+	AppendFrame_(ctrl_, RST_STREAM, 0, id, payload, sizeof(payload));
+	CloseStream_(id);
+	resetIds_.push_back(id);
+	if (resetIds_.size() > H2_MAX_STREAMS)
+	{ resetIds_.pop_front(); }
+}
+
+bool Http2Session::GoAway_(ERROR_CODE code)
+{
+	/* 连接错误: 丢弃所有流, GOAWAY发送完毕后由HttpConn关闭连接 */
+	LOG_WARN("HTTP/2 connection error %d, last stream %u", (int)code, lastStreamId_);
+	uint8_t payload[8];
+	Put32(payload, lastStreamId_);
+	Put32(payload + 4, code);
+	AppendFrame_(ctrl_, GOAWAY, 0, 0, payload, sizeof(payload));
+	isGoAway_ = true;
+	continuationId_ = 0;
+	for (const auto& it : streams_)
+	{
+		EndStream_(*it.second);
+	}
+	streams_.clear();
+	fileStreams_ = 0;
+	return false;
+}
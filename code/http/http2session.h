@@ -0,0 +1,182 @@
+#ifndef HTTP2_SESSION_H
+#define HTTP2_SESSION_H
+
+#include <map>
+#include <deque>
+#include <algorithm>  // find
+#include <memory>
+#include <string>
+#include <chrono>
+#include <stdint.h>
+#include <string.h>  // memcmp
+
+#include "../buffer/buffer.h"
+#include "../log/log.h"
+#include "../log/accesslog.h"
+#include "../config/config.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "hpack.h"
+#include "httprequest.h"
+#include "httpresponse.h"
+
+/*
+ * 一个HTTP/2连接(RFC 7540/9113)的帧层状态
+ * 由HttpConn在h2c升级、收到连接序言或ALPN协商出h2时创建, 与连接生命周期相同
+ * OnRead解析readBuff_中的帧, 请求完整后立即生成响应(每个流一个HttpResponse)
+ * Fill按优先级和流量控制窗口把控制帧、HEADERS和DATA帧写入writeBuff_
+ * 同一连接同一时刻只有一个工作线程访问(EPOLLONESHOT), 不加锁
+ */
+class Http2Session
+{
+ public:
+	explicit Http2Session(const char* srcDir);
+	~Http2Session();
+
+	/* 访问日志中的客户端地址, 也用于判断是否响应指标请求 */
+	void SetPeer(const std::string& ip)
+	{
+		peer_ = ip;
+	}
+
+	/* data以连接序言开头(可以不完整) */
+	static bool IsPreface(const char* data, size_t len);
+
+	/* h2c升级: settings为HTTP2-Settings首部, 升级请求作为流1响应 */
+	bool Upgrade(const std::string& settings, HttpRequest& request);
+
+	/* 连接错误返回false, 此时已排队GOAWAY, 发送完毕后关闭连接 */
+	bool OnRead(Buffer& buff);
+
+	/* 生成约maxBytes字节的帧追加到buff */
+	void Fill(Buffer& buff, size_t maxBytes);
+	size_t PendingBytes() const;
+
+	/* 有大文件流期间整个连接的平均发送速率低于STREAM_MIN_RATE, 与HTTP/1.1的慢速客户端相同 */
+	bool IsTooSlow() const;
+
+	/* 已发送GOAWAY, 或对端GOAWAY后所有流都已完成 */
+	bool IsClosing() const
+	{
+		return isGoAway_ || (isPeerGoAway_ && streams_.empty());
+	}
+
+ private:
+	enum FRAME_TYPE
+	{
+		DATA = 0x0,
+		HEADERS = 0x1,
+		PRIORITY = 0x2,
+		RST_STREAM = 0x3,
+		SETTINGS = 0x4,
+		PUSH_PROMISE = 0x5,
+		PING = 0x6,
+		GOAWAY = 0x7,
+		WINDOW_UPDATE = 0x8,
+		CONTINUATION = 0x9,
+	};
+
+	enum ERROR_CODE
+	{
+		NO_ERROR = 0x0,
+		PROTOCOL_ERROR = 0x1,
+		INTERNAL_ERROR = 0x2,
+		FLOW_CONTROL_ERROR = 0x3,
+		STREAM_CLOSED = 0x5,
+		FRAME_SIZE_ERROR = 0x6,
+		REFUSED_STREAM = 0x7,
+		COMPRESSION_ERROR = 0x9,
+		ENHANCE_YOUR_CALM = 0xb,
+	};
+
+	struct Stream
+	{
+		uint32_t id;
+		bool isEndRecv;      // 请求已完整收到, 响应已生成
+		bool isHeadersSent;
+		bool isFile;         // 分段发送的大文件, 计入fileStreams_
+		bool isDeferred;     // 大文件流已达上限, 释放了窗口, 等待重新生成响应
+		std::string path;    // 等待时保存重新生成所需的路径和Set-Cookie
+		std::string cookie;
+		HeaderList headers;
+		std::string reqBody;
+
+		/* 发送: 响应体来自映射的文件, 或body中的错误页 */
+		HttpResponse response;
+		Buffer body;
+		int code;
+		std::string type;
+		size_t bodyLeft;     // 尚未发送的响应体字节数
+		size_t fileOff;      // 当前映射窗口内已发送的字节数
+		int64_t sendWindow;
+
+		/* 访问日志: 被采样的流在关闭时记录; 已生成响应的流都记录指标 */
+		bool isLogged;
+		std::chrono::steady_clock::time_point start;
+		size_t bodySize;
+		std::string method, target, user, referer, agent;
+
+		/* 调度: urgency小的优先; 同级非增量流按流ID顺序, 增量流按加权虚拟时间轮转 */
+		int urgency;
+		bool isIncremental;
+		uint32_t weight;
+		uint64_t vtime;
+	};
+
+	bool OnFrame_(uint8_t type, uint8_t flags, uint32_t id, const uint8_t* payload, size_t len);
+	bool OnHeaders_(uint8_t flags, uint32_t id, const uint8_t* payload, size_t len);
+	bool OnHeaderBlock_(uint32_t id);
+	bool OnData_(uint8_t flags, uint32_t id, const uint8_t* payload, size_t len);
+	bool OnSettings_(const uint8_t* payload, size_t len);
+	bool OnWindowUpdate_(uint32_t id, const uint8_t* payload, size_t len);
+
+	Stream* NewStream_(uint32_t id);
+	void OnRequest_(Stream* stream);
+	void StartResponse_(Stream* stream, HttpRequest& request, bool isOk);
+	bool MakeBody_(Stream* stream);
+	void ResumeDeferred_();
+	void ParsePriority_(Stream* stream, const std::string& value);
+	Stream* NextStream_();
+	void CloseStream_(uint32_t id);
+	void EndStream_(const Stream& stream);
+
+	void AppendFrame_(Buffer& buff, uint8_t type, uint8_t flags, uint32_t id, const void* payload, size_t len);
+	void AppendHeaders_(Buffer& buff, Stream* stream);
+	void ResetStream_(uint32_t id, ERROR_CODE code);
+	bool GoAway_(ERROR_CODE code);
+
+	std::string srcDir_;
+	std::string peer_;
+
+	bool isPreface_;     // 已收到客户端连接序言
+	bool isGoAway_;
+	bool isPeerGoAway_;
+	uint32_t lastStreamId_;
+
+	/* 跨HEADERS/CONTINUATION帧拼接的首部块 */
+	uint32_t continuationId_;
+	uint8_t continuationFlags_;
+	std::string headerBlock_;
+
+	/* 流量控制: 本端发送窗口, 本端已接收尚未通过WINDOW_UPDATE归还的字节数 */
+	int64_t connSendWindow_;
+	size_t recvUnacked_;
+	uint32_t peerInitWindow_;
+	uint32_t peerMaxFrame_;
+
+	uint64_t vtime_;  // 最近一次调度的增量流的虚拟时间
+
+	/* 大文件流: 数量不超过H2_MAX_FILE_STREAMS; 有大文件流期间的开始时间和发送的文件字节数 */
+	size_t fileStreams_;
+	std::chrono::steady_clock::time_point fileStart_;
+	size_t fileSent_;
+
+	HpackDecoder decoder_;
+	HpackEncoder encoder_;
+
+	Buffer ctrl_;  // 待发送的SETTINGS/PING/WINDOW_UPDATE/RST_STREAM/GOAWAY
+	std::map<uint32_t, std::unique_ptr<Stream>> streams_;
+	std::deque<uint32_t> resetIds_;  // 最近由本端重置的流, 对端可能仍有在途的帧
+};
+
+#endif //HTTP2_SESSION_H
@@ -10,6 +10,21 @@ HttpConn::HttpConn()
 	fd_ = -1;
 	addr_ = { 0 };
 	isClose_ = true;
+	iovCnt_ = 0;
+	bytesSent_ = 0;
+	headerLen_ = 0;
+	isNew_ = false;
+	isRespPending_ = false;
+	traceId_ = 0;
+	traceMark_ = 0;
+	isZeroCopy_ = false;
+	useZeroCopy_ = false;
+	zcCopied_ = false;
+	zcSeq_ = zcDone_ = 0;
+	ssl_ = nullptr;
+	isHandshake_ = false;
+	isKtlsSend_ = false;
+	gen_ = 0;
 }
 
 HttpConn::~HttpConn()
@@ -17,26 +32,67 @@ HttpConn::~HttpConn()
 	Close();
 }
 
-void HttpConn::init(int fd, const sockaddr_in& addr)
+bool HttpConn::init(int fd, const sockaddr_in& addr, bool isTls)
 {
 	/*
 	 * 初始化客户端的缓存结构体buff,作为客户端的缓存空间
 	 */
 	assert(fd > 0);
 	userCount++;  // 统计user数量
+	gen_++;
 	addr_ = addr;
 	fd_ = fd;
 	writeBuff_.RetrieveAll();  // 刷新缓存, 分配1024 bytes空间
 	readBuff_.RetrieveAll();  // 缓存空间 : 1024 bytes
 	isClose_ = false;
+	acceptTime_ = std::chrono::steady_clock::now();
+	isNew_ = true;
+	isRespPending_ = false;
+	traceId_ = Trace::Sample();
+	ssl_ = nullptr;
+	isHandshake_ = false;
+	isKtlsSend_ = false;
+	h2_.reset();
+	/* 开启SO_ZEROCOPY, 不支持的内核上退回普通writev; TLS连接不使用 */
+	int one = 1;
+	isZeroCopy_ = ZEROCOPY_MIN > 0 && !isTls && setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == 0;
+	useZeroCopy_ = false;
+	zcCopied_ = false;
+	zcSeq_ = zcDone_ = 0;
+	if (isTls)
+	{
+		/* 不能退回明文: TLS端口上的客户端无法解析明文的HTTP响应 */
+		ssl_ = TlsContext::Instance()->NewSsl(fd);
+		if (!ssl_)
+		{
+			LOG_ERROR("Client[%d] SSL_new error: %s", fd_, TlsContext::LastError().c_str());
+			return false;
+		}
+	}
+	return true;
 }
 
 void HttpConn::Close()
 {
 	response_.UnmapFile();  // 删除映射数据
+	response_.ReleaseHeld(zcDone_, true);
+	h2_.reset();
 	if (isClose_) return;
+	EndRequest_();  // 响应未发送完时连接关闭
 	isClose_ = true;
 	userCount--;
+	if (ssl_)
+	{
+		if (isHandshake_)
+		{
+			ERR_clear_error();
+			SSL_shutdown(ssl_);
+			ERR_clear_error();
+		}  // 非阻塞, 只尝试发送close_notify
+		SSL_free(ssl_);
+		ssl_ = nullptr;
+	}
+	Metrics::AddSyscall();
 	close(fd_);
 }
 
@@ -63,26 +119,87 @@ int HttpConn::GetPort() const
 ssize_t HttpConn::read(int* saveErrno)
 {
     // 返回可读数据长度
+	TraceSpan span("read", traceId_);
+	Metrics::StageScope stage(Metrics::STAGE_READ);
+	auto start = std::chrono::steady_clock::now();
+	size_t oldBytes = readBuff_.ReadableBytes();
 	ssize_t len = -1;
-	do
+	if (ssl_)
+	{ len = TlsRead_(saveErrno); }
+	else
 	{
-		len = readBuff_.ReadFd(fd_, saveErrno);
-		// 读fd,拷贝到readBuff
-		if (len <= 0)
+		do
 		{
-			break;
+			len = readBuff_.ReadFd(fd_, saveErrno);
+			// 读fd,拷贝到readBuff
+			if (len <= 0)
+			{
+				break;
+			}
+		} while (isET);
+	}
+	size_t readBytes = readBuff_.ReadableBytes() - oldBytes;
+	if (readBytes > 0)
+	{
+		Metrics::Add(Metrics::BYTES_READ, readBytes);
+		Metrics::Observe(Metrics::STAGE_READ, start);
+		if (isNew_)
+		{
+			Metrics::Observe(Metrics::STAGE_ACCEPT, acceptTime_);
+			isNew_ = false;
 		}
-	} while (isET);
+	}
 	return len;
 }
 
 ssize_t HttpConn::write(int* saveErrno)
 {
 	// 向acceptfd写入数据 write iov to file
+	Metrics::StageScope stage(Metrics::STAGE_WRITE);
 	ssize_t len = -1;
+	if (isZeroCopy_ && zcDone_ != zcSeq_)
+	{ ReapZeroCopy(); }
+	if ((response_.IsStream() && IsTooSlow_()) || (h2_ && h2_->IsTooSlow()))
+	{
+		/* 大文件下载速率过低, 断开以释放映射窗口; HTTP/2按整个连接计算 */
+		LOG_WARN("Client[%d] too slow, %d bytes sent", fd_, (int)bytesSent_);
+		*saveErrno = ETIMEDOUT;
+		return -1;
+	}
 	do
 	{
-		len = writev(fd_, iov_, iovCnt_);
+		if (iov_[1].iov_len == 0 && response_.RemainBytes() > 0)
+		{
+			/// 当前窗口发送完毕, 映射文件的下一段
+			HoldZeroCopy_();
+			if (!response_.NextWindow())
+			{
+				*saveErrno = EIO;
+				return -1;
+			}
+			iov_[1].iov_base = response_.File();
+			iov_[1].iov_len = response_.FileLen();
+			if (NeedLoadFile())
+			{
+				/* 新窗口不在page cache中, 交给IO线程读入后再继续发送 */
+				*saveErrno = EAGAIN;
+				return -1;
+			}
+		}
+		if (h2_ && iov_[0].iov_len == 0)
+		{ FillH2_(); }  // 上一批帧已发送完, 按优先级生成下一批
+		{
+			TraceSpan span("writev", traceId_);
+			if (ssl_ && !isKtlsSend_)
+			{ len = TlsWrite_(); }
+			else if (useZeroCopy_)
+			{ len = WriteZeroCopy_(); }
+			else
+			{
+				Metrics::AddSyscall();
+				len = writev(fd_, iov_, iovCnt_);
+			}
+		}
 		/// 将响应头iov_[0], 响应体iov_[1]一起写出至accept()函数返回的fd_
 
 		if (len <= 0)
@@ -90,6 +207,8 @@ ssize_t HttpConn::write(int* saveErrno)
 			*saveErrno = errno;
 			break;
 		}
+		bytesSent_ += len;
+		Metrics::Add(Metrics::BYTES_WRITTEN, len);
 		if (iov_[0].iov_len + iov_[1].iov_len == 0)  // iov结构体中没有数据
 		{ break; } /* 传输结束 */
 		else if (static_cast<size_t>(len) > iov_[0].iov_len)
@@ -111,9 +230,198 @@ ssize_t HttpConn::write(int* saveErrno)
 			writeBuff_.Retrieve(len);
 		}
 	} while (isET || ToWriteBytes() > 10240);  // 边缘触发 或 待写数据大于10240 bytes
+	if (isRespPending_ && ToWriteBytes() == 0)
+	{ EndRequest_(); }
+	return len;
+}
+
+bool HttpConn::TlsHandshake_(int* saveErrno)
+{
+	/*
+	 * 非阻塞握手, 数据不足时返回false且saveErrno为EAGAIN
+	 * 握手只有几个小报文, 远小于socket发送缓冲区, WANT_WRITE同样等待下一次可读
+	 * OpenSSL的错误队列是线程局部的, 每次调用前清空, 避免其他连接留下的错误影响SSL_get_error
+	 */
+	ERR_clear_error();
+	int ret = SSL_do_handshake(ssl_);
+	if (ret == 1)
+	{
+		isHandshake_ = true;
+		isKtlsSend_ = BIO_get_ktls_send(SSL_get_wbio(ssl_));
+		const unsigned char* alpn = nullptr;
+		unsigned int alpnLen = 0;
+		SSL_get0_alpn_selected(ssl_, &alpn, &alpnLen);
+		if (alpnLen == 2 && memcmp(alpn, "h2", 2) == 0)
+		{ StartH2_(new Http2Session(srcDir)); }
+		LOG_DEBUG("Client[%d] TLS %s %s, resumed:%d, ktls send:%d, h2:%d", fd_,
+			SSL_get_version(ssl_), SSL_get_cipher_name(ssl_),
+			SSL_session_reused(ssl_), (int)isKtlsSend_, (int)(h2_ != nullptr));
+		return true;
+	}
+	int err = SSL_get_error(ssl_, ret);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+	{
+		*saveErrno = EAGAIN;
+		return false;
+	}
+	LOG_WARN("Client[%d] TLS handshake error: %s", fd_, TlsContext::LastError().c_str());
+	*saveErrno = EPROTO;
+	return false;
+}
+
+ssize_t HttpConn::TlsRead_(int* saveErrno)
+{
+	/*
+	 * 解密后的数据直接读入readBuff_
+	 * 边缘触发时读到WANT_READ为止, OpenSSL内部缓冲的记录也一并读出
+	 */
+	if (!isHandshake_ && !TlsHandshake_(saveErrno))
+	{ return -1; }
+	ssize_t total = 0;
+	while (true)
+	{
+		readBuff_.EnsureWriteable(16384);
+		Metrics::AddSyscall();
+		ERR_clear_error();
+		int len = SSL_read(ssl_, readBuff_.BeginWrite(), readBuff_.WritableBytes());
+		if (len > 0)
+		{
+			readBuff_.HasWritten(len);
+			total += len;
+			if (!isET && SSL_pending(ssl_) == 0)
+			{ break; }
+			continue;
+		}
+		int err = SSL_get_error(ssl_, len);
+		if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE)
+		{
+			*saveErrno = EAGAIN;
+			return total > 0 ? total : -1;
+		}
+		if (err == SSL_ERROR_ZERO_RETURN)
+		{ return total > 0 ? total : 0; }  // 对端发送close_notify
+		int sysErrno = errno;
+		TlsError_("read", err);
+		*saveErrno = err == SSL_ERROR_SYSCALL ? sysErrno : EPROTO;
+		return total > 0 ? total : -1;
+	}
+	return total;
+}
+
+ssize_t HttpConn::TlsWrite_()
+{
+	/*
+	 * 没有kTLS时由OpenSSL加密发送, 每次写一个iov
+	 * 返回值与writev一致, 由write()统一移动iov_
+	 */
+	struct iovec* iov = iov_[0].iov_len > 0 ? &iov_[0] : &iov_[1];
+	if (iov->iov_len == 0)
+	{ return 0; }
+	Metrics::AddSyscall();
+	ERR_clear_error();
+	int len = SSL_write(ssl_, iov->iov_base, iov->iov_len > INT32_MAX ? INT32_MAX : iov->iov_len);
+	if (len > 0)
+	{ return len; }
+	int err = SSL_get_error(ssl_, len);
+	if (err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ)
+	{ errno = EAGAIN; }
+	else
+	{
+		int sysErrno = errno;
+		TlsError_("write", err);
+		errno = err == SSL_ERROR_SYSCALL ? sysErrno : EPROTO;
+	}
+	return -1;
+}
+
+void HttpConn::TlsError_(const char* op, int err)
+{
+	/* 取出并清空错误队列; 协议错误记录日志, 系统调用错误由errno反映 */
+	std::string error = TlsContext::LastError();
+	if (err == SSL_ERROR_SSL)
+	{ LOG_WARN("Client[%d] TLS %s error: %s", fd_, op, error.c_str()); }
+}
+
+ssize_t HttpConn::WriteZeroCopy_()
+{
+	/*
+	 * 响应头在writeBuff_中, 发送完即被复用, 仍用普通writev
+	 * 响应体用MSG_ZEROCOPY发送, 内核直接引用文件页, 每次成功发送对应一个完成通知
+	 */
+	Metrics::AddSyscall();
+	if (iov_[0].iov_len > 0)
+	{ return writev(fd_, iov_, 1); }
+	struct msghdr msg = { 0 };
+	msg.msg_iov = &iov_[1];
+	msg.msg_iovlen = 1;
+	ssize_t len = sendmsg(fd_, &msg, MSG_ZEROCOPY);
+	if (len < 0 && errno == ENOBUFS)
+	{
+		/* 待完成的零拷贝超过optmem限制, 本次退回普通发送 */
+		Metrics::AddSyscall();
+		return writev(fd_, &iov_[1], 1);
+	}
+	if (len >= 0)
+	{ zcSeq_++; }
 	return len;
 }
 
+void HttpConn::HoldZeroCopy_()
+{
+	// 仍有未完成的零拷贝发送时, 当前映射/缓冲区移交给待释放队列
+	if (zcDone_ != zcSeq_)
+	{ response_.HoldFile(zcSeq_); }
+}
+
+bool HttpConn::ReapZeroCopy()
+{
+	/*
+	 * 读取socket错误队列中的零拷贝完成通知
+	 * 每个通知带一个完成区间[ee_info, ee_data], TCP按序确认, 累加完成次数即可
+	 * 返回false表示socket上有真正的错误
+	 */
+	char control[128];
+	while (true)
+	{
+		struct msghdr msg = { 0 };
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		Metrics::AddSyscall();
+		if (recvmsg(fd_, &msg, MSG_ERRQUEUE) < 0)
+		{ break; }
+		for (struct cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm))
+		{
+			if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR)
+				|| (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+			{ continue; }
+			struct sock_extended_err* serr = (struct sock_extended_err*)CMSG_DATA(cm);
+			if (serr->ee_errno != 0 || serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+			{ continue; }
+			zcDone_ += serr->ee_data - serr->ee_info + 1;
+			if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+			{
+				/* 内核仍然复制了数据(如回环网卡), 零拷贝没有收益, 该连接不再使用 */
+				zcCopied_ = true;
+			}
+		}
+	}
+	response_.ReleaseHeld(zcDone_);
+	int err = 0;
+	socklen_t len = sizeof(err);
+	getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+	return err == 0;
+}
+
+bool HttpConn::IsTooSlow_() const
+{
+	// 超过STREAM_GRACE_MS后, 平均发送速率低于STREAM_MIN_RATE
+	auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now() - writeStart_).count();
+	if (elapsed < STREAM_GRACE_MS)
+	{ return false; }
+	return bytesSent_ * 1000 / elapsed < STREAM_MIN_RATE;
+}
+
 bool HttpConn::process()
 {
 	/*
@@ -122,28 +430,85 @@ bool HttpConn::process()
 	 * 2. 生成响应(response)
 	 * 3. 响应头设置在iov[0]中
 	 *    响应内容设置在iov[1]中
+	 * HTTP/2连接交给会话解析帧, 生成的帧都在iov[0]中
 	 */
+	if (!h2_ && H2_ENABLE && Http2Session::IsPreface(readBuff_.Peek(), readBuff_.ReadableBytes()))
+	{
+		/* 客户端直接发送HTTP/2连接序言(h2c prior knowledge) */
+		StartH2_(new Http2Session(srcDir));
+	}
+	if (h2_)
+	{
+		h2_->OnRead(readBuff_);
+		return FillH2_();
+	}
 	request_.Init();
+	HoldZeroCopy_();  // response_.Init会释放上一个响应的映射
 
 	if (readBuff_.ReadableBytes() <= 0)  // 可读为0
 	{
 		return false;
 	}
-	else if (request_.parse(readBuff_))
+	reqStart_ = std::chrono::steady_clock::now();
+	bool isOk = false;
+	{
+		TraceSpan span("parse", traceId_);
+		Metrics::StageScope stage(Metrics::STAGE_PARSE);
+		isOk = request_.parse(readBuff_);
+	}
+	Metrics::Observe(Metrics::STAGE_PARSE, reqStart_);
+	if (isOk)
 	{
 		// 解析请求
 		LOG_DEBUG("%s", request_.path().c_str());
+		if (request_.IsVerifying())
+		{
+			// 登录/注册等待异步查询, 由WebServer发起
+			verifyStart_ = std::chrono::steady_clock::now();
+			return false;
+		}
+		if (H2_ENABLE && request_.IsH2cUpgrade() && UpgradeH2_())
+		{ return true; }
 		response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+		response_.SetCookie(request_.SessionCookie());
+		char ip[INET_ADDRSTRLEN];
+		inet_ntop(AF_INET, &addr_.sin_addr, ip, sizeof(ip));
+		Metrics::StageScope stage(Metrics::STAGE_NONE);  // 生成导出内容计入other, 不算在请求的阶段中
+		if (Metrics::IsEndpoint(request_.path(), ip))
+		{ response_.SetText("text/plain; version=0.0.4", Metrics::Instance()->Render()); }
+		else if (Trace::IsEndpoint(request_.path(), ip))
+		{ response_.SetText("application/json", Trace::Instance()->Render()); }
 	}
 	else
 	{
 		response_.Init(srcDir, request_.path(), false, 400);
 	}
+	MakeResponse_();
+	return true;
+}
+
+bool HttpConn::OnVerify(uint32_t gen, bool isOk)
+{
+	/* 查询期间连接可能已超时关闭, fd也可能已被新连接复用 */
+	if (isClose_ || gen != gen_)
+	{ return false; }
+	request_.OnVerify(isOk);
+	Metrics::Observe(Metrics::STAGE_VERIFY, verifyStart_);
+	response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+	response_.SetCookie(request_.SessionCookie());
+	MakeResponse_();
+	return true;
+}
 
+void HttpConn::MakeResponse_()
+{
 	/*
 	 * 添加响应头字段Content-length至 Buffer writeBuff_
 	 * 设置响应内容映射区char *mmfile_
 	 */
+	TraceSpan span("MakeResponse", traceId_);
+	Metrics::StageScope stage(Metrics::STAGE_BUILD);
+	auto start = std::chrono::steady_clock::now();
 	response_.MakeResponse(writeBuff_);
 
 	iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());  // 响应头的起始位置是writeBuff_.Peek()
@@ -161,6 +526,94 @@ bool HttpConn::process()
 		iov_[1].iov_len = response_.FileLen();
 		iovCnt_ = 2;
 	}
-	LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen(), iovCnt_, ToWriteBytes());
-	return true;
+	writeStart_ = std::chrono::steady_clock::now();
+	bytesSent_ = 0;
+	/* 错误页的内容可能与响应头一起在writeBuff_中 */
+	const char* headerEnd = (const char*)memmem(writeBuff_.Peek(), writeBuff_.ReadableBytes(), "\r\n\r\n", 4);
+	headerLen_ = headerEnd ? headerEnd + 4 - writeBuff_.Peek() : writeBuff_.ReadableBytes();
+	isRespPending_ = true;
+	useZeroCopy_ = isZeroCopy_ && !zcCopied_ && iovCnt_ == 2 && response_.FileLen() + response_.RemainBytes() >= ZEROCOPY_MIN;
+	LOG_DEBUG("filesize:%d, %d  to %d", (int)response_.FileLen(), iovCnt_, (int)ToWriteBytes());
+	Metrics::Observe(Metrics::STAGE_BUILD, start);
+}
+
+void HttpConn::EndRequest_()
+{
+	/* 响应发送完毕或连接中途关闭时记录指标和访问日志, bytes为实际发送的响应体字节数 */
+	if (!isRespPending_)
+	{ return; }
+	isRespPending_ = false;
+	Metrics::AddResponse(response_.Code());
+	Metrics::Observe(Metrics::STAGE_WRITE, writeStart_);
+	Metrics::Observe(Metrics::STAGE_TOTAL, reqStart_);
+	traceId_ = Trace::Sample();  // 连接上的下一个请求, 在epoll返回前决定是否采样
+	if (!AccessLog::Instance()->Sample())
+	{ return; }
+	char ip[INET_ADDRSTRLEN];
+	inet_ntop(AF_INET, &addr_.sin_addr, ip, sizeof(ip));
+	std::string method = request_.method(), version = request_.version();
+	std::string referer = request_.GetHeader("Referer"), agent = request_.GetHeader("User-Agent");
+	AccessEntry entry = {
+		ip, request_.SessionUser().c_str(), method.c_str(), request_.target().c_str(), version.c_str(),
+		response_.Code(), bytesSent_ > headerLen_ ? bytesSent_ - headerLen_ : 0, referer.c_str(), agent.c_str(),
+		std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - reqStart_).count(),
+	};
+	AccessLog::Instance()->Write(entry);
+}
+
+void HttpConn::LoadFile()
+{
+	// IO线程读入冷文件后, 响应体iov_[1]指向新的地址
+	response_.LoadFile();
+	if (iovCnt_ == 2)
+	{
+		iov_[1].iov_base = response_.File();
+		iov_[1].iov_len = response_.FileLen();
+	}
+	if (response_.IsBuffered())
+	{ useZeroCopy_ = false; }  // 池化缓冲区会被其他请求复用, 改为普通发送
+}
+
+bool HttpConn::UpgradeH2_()
+{
+	/*
+	 * h2c升级: 回复101后切换为HTTP/2, 升级请求的响应在流1上发送
+	 * HTTP2-Settings无效时忽略升级, 按HTTP/1.1响应
+	 */
+	std::unique_ptr<Http2Session> h2(new Http2Session(srcDir));
+	if (!h2->Upgrade(request_.GetHeader("HTTP2-Settings"), request_))
+	{
+		LOG_WARN("Client[%d] invalid HTTP2-Settings", fd_);
+		return false;
+	}
+	StartH2_(h2.release());
+	writeBuff_.Append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+	return FillH2_();
+}
+
+void HttpConn::StartH2_(Http2Session* h2)
+{
+	/*
+	 * HTTP/2的帧小而频繁(流量控制窗口用尽后的最后一段, PING/SETTINGS应答)
+	 * 关闭Nagle, 避免与对端的延迟确认相互等待
+	 */
+	h2_.reset(h2);
+	h2_->SetPeer(GetIP());
+	int one = 1;
+	setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+bool HttpConn::FillH2_()
+{
+	/*
+	 * 会话按优先级和流量控制生成约H2_FILL_SIZE字节的帧追加到writeBuff_
+	 * iov_[0]始终指向writeBuff_中全部未发送的数据, 发送完后再生成下一批
+	 */
+	h2_->Fill(writeBuff_, H2_FILL_SIZE);
+	iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
+	iov_[0].iov_len = writeBuff_.ReadableBytes();
+	iov_[1].iov_len = 0;
+	iovCnt_ = 1;
+	useZeroCopy_ = false;
+	return iov_[0].iov_len > 0;
 }
@@ -7,12 +7,30 @@
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>
+#include <chrono>
+#include <memory>
+#include <sys/socket.h>
+#include <netinet/tcp.h>  // TCP_NODELAY
+#include <linux/errqueue.h>  // sock_extended_err
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
+#include "../config/config.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
 #include "httprequest.h"
 #include "httpresponse.h"
+#include "tlscontext.h"
+#include "http2session.h"
 
 class HttpConn
 {
@@ -21,8 +39,8 @@ class HttpConn
 
 	~HttpConn();
 
-	/* 初始化新接受连接 */
-	void init(int sockFd, const sockaddr_in& addr);
+	/* 初始化新接受连接; TLS连接创建SSL失败时返回false, 由调用方Close */
+	bool init(int sockFd, const sockaddr_in& addr, bool isTls = false);
 
 	ssize_t read(int* saveErrno);
 
@@ -40,13 +58,59 @@ class HttpConn
 
 	bool process();
 
-	int ToWriteBytes()
+	/* 登录/注册请求等待异步查询数据库, 此时不监听fd */
+	bool IsVerifying() const
 	{
-		return iov_[0].iov_len + iov_[1].iov_len;
+		return !h2_ && request_.IsVerifying();
+	}
+	void VerifyAsync(std::function<void(bool)> cb)
+	{
+		request_.VerifyAsync(cb);
+	}
+	/* 查询完成后生成响应; gen与连接当前的不一致说明连接已关闭, 返回false */
+	bool OnVerify(uint32_t gen, bool isOk);
+	uint32_t GetGen() const
+	{
+		return gen_;
+	}
+
+	/* 响应文件是冷文件, 需先由IO线程调用LoadFile() */
+	bool NeedLoadFile() const
+	{
+		return !h2_ && response_.IsCold();
+	}
+	void LoadFile();
+
+	/* 连接开启了SO_ZEROCOPY, EPOLLERR可能只是错误队列中的发送完成通知 */
+	bool IsZeroCopy() const
+	{
+		return isZeroCopy_;
+	}
+	bool ReapZeroCopy();
+
+	size_t ToWriteBytes()
+	{
+		return iov_[0].iov_len + iov_[1].iov_len + response_.RemainBytes() + (h2_ ? h2_->PendingBytes() : 0);
+	}
+
+	/* 追踪: 当前请求的追踪id(未采样为0), 任务加入线程池时的TSC */
+	uint32_t TraceId() const
+	{
+		return traceId_;
+	}
+	uint64_t TraceMark() const
+	{
+		return traceMark_;
+	}
+	void SetTraceMark(uint64_t tsc)
+	{
+		traceMark_ = tsc;
 	}
 
 	bool IsKeepAlive() const
 	{
+		if (h2_)
+		{ return !h2_->IsClosing(); }
 		return request_.IsKeepAlive();
 	}
 
@@ -55,20 +119,65 @@ class HttpConn
 	static std::atomic<int> userCount;  // 原子类型，静态数据成员，记录用户数量
 
  private:
+	bool IsTooSlow_() const;
+	ssize_t TlsRead_(int* saveErrno);
+	ssize_t TlsWrite_();
+	void TlsError_(const char* op, int err);
+	bool TlsHandshake_(int* saveErrno);
+	ssize_t WriteZeroCopy_();
+	void HoldZeroCopy_();
+	bool UpgradeH2_();
+	void StartH2_(Http2Session* h2);
+	bool FillH2_();
+	void MakeResponse_();
+	void EndRequest_();
 
 	int fd_;
 	struct sockaddr_in addr_;
 
 	bool isClose_;
+	uint32_t gen_;  // 每次init加1, 区分复用同一fd的连接
+
+	/* HTTPS连接; 内核kTLS接管发送后响应直接writev到fd_ */
+	SSL* ssl_;
+	bool isHandshake_;  // 握手已完成
+	bool isKtlsSend_;
 
 	int iovCnt_;
 	struct iovec iov_[2];
 
+	/* 分段发送大文件时统计发送速率 */
+	std::chrono::steady_clock::time_point writeStart_;
+	size_t bytesSent_;
+
+	/* 连接建立的时间, 尚未读到数据 */
+	std::chrono::steady_clock::time_point acceptTime_;
+	bool isNew_;
+
+	/* 访问日志和指标: 收到请求的时间, 开始查询数据库的时间, 响应头长度, 当前响应尚未记录 */
+	std::chrono::steady_clock::time_point reqStart_;
+	std::chrono::steady_clock::time_point verifyStart_;
+	size_t headerLen_;
+	bool isRespPending_;
+
+	uint32_t traceId_;
+	uint64_t traceMark_;
+
+	/* MSG_ZEROCOPY: 已发出的零拷贝发送次数, 已收到完成通知的次数 */
+	bool isZeroCopy_;
+	bool useZeroCopy_;  // 当前响应体使用零拷贝发送
+	bool zcCopied_;  // 内核报告退化为复制
+	uint32_t zcSeq_;
+	uint32_t zcDone_;
+
 	Buffer readBuff_; // 读缓冲区
 	Buffer writeBuff_; // 写缓冲区
 
 	HttpRequest request_;  //
 	HttpResponse response_;
+
+	/* HTTP/2连接, 请求和响应都在会话的各个流中; HTTP/1.1连接为空 */
+	std::unique_ptr<Http2Session> h2_;
 };
 
 #endif //HTTP_CONN_H
\ No newline at end of file
@@ -1,6 +1,9 @@
 #include "httprequest.h"
 using namespace std;
 
+bool HttpRequest::isAsyncVerify = false;
+UserStore* HttpRequest::userStore = nullptr;
+
 const unordered_set<string> HttpRequest::DEFAULT_HTML{
 	"/index", "/register", "/login",
 	"/welcome", "/video", "/picture", "/snake" };
@@ -11,7 +14,11 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG{
 void HttpRequest::Init()
 {
 	method_ = path_ = version_ = body_ = "";
+	target_ = "";
 	state_ = REQUEST_LINE;  // 初始化state：解析请求头
+	isVerifying_ = isLogin_ = false;
+	isSessionChecked_ = false;
+	sessionUser_ = newSession_ = "";
 	header_.clear();
 	post_.clear();
 }
@@ -25,6 +32,93 @@ bool HttpRequest::IsKeepAlive() const
 	return false;
 }
 
+std::string HttpRequest::GetHeader(const std::string& key) const
+{
+	auto it = header_.find(key);
+	if (it != header_.end())
+	{ return it->second; }
+	for (const auto& h : header_)
+	{
+		if (strcasecmp(h.first.c_str(), key.c_str()) == 0)
+		{ return h.second; }
+	}
+	return "";
+}
+
+std::string HttpRequest::GetCookie(const std::string& name) const
+{
+	/* Cookie: a=1; b=2 */
+	string cookies = GetHeader("Cookie");
+	size_t pos = 0;
+	while (pos < cookies.size())
+	{
+		size_t end = cookies.find(';', pos);
+		if (end == string::npos)
+		{ end = cookies.size(); }
+		while (pos < end && cookies[pos] == ' ')
+		{ pos++; }
+		size_t eq = cookies.find('=', pos);
+		if (eq < end && cookies.compare(pos, eq - pos, name) == 0)
+		{ return cookies.substr(eq + 1, end - eq - 1); }
+		pos = end + 1;
+	}
+	return "";
+}
+
+const std::string& HttpRequest::SessionUser()
+{
+	/* 第一次调用时查询会话表 */
+	if (!isSessionChecked_)
+	{
+		isSessionChecked_ = true;
+		string token = GetCookie(SessionStore::COOKIE_NAME);
+		if (!token.empty() && !SessionStore::Instance()->Get(token, sessionUser_))
+		{ sessionUser_ = ""; }
+	}
+	return sessionUser_;
+}
+
+std::string HttpRequest::SessionCookie() const
+{
+	if (newSession_.empty())
+	{ return ""; }
+	return SessionStore::Cookie(newSession_);
+}
+
+bool HttpRequest::IsH2cUpgrade() const
+{
+	return version_ == "1.1" && GetHeader("Upgrade") == "h2c" && !GetHeader("HTTP2-Settings").empty();
+}
+
+bool HttpRequest::ParseH2(const HeaderList& headers, const std::string& body)
+{
+	/*
+	 * 伪首部:method, :path对应请求行, 其余首部按原名保存
+	 * 缺少必需的伪首部时返回false
+	 */
+	Init();
+	for (const auto& h : headers)
+	{
+		if (h.first == ":method")
+		{ method_ = h.second; }
+		else if (h.first == ":path")
+		{ path_ = h.second; }
+		else if (h.first == "cookie" && header_.count("cookie"))
+		{ header_["cookie"] += "; " + h.second; }  // cookie可以拆分为多个首部
+		else if (h.first[0] != ':')
+		{ header_[h.first] = h.second; }
+	}
+	version_ = "2";
+	if (method_.empty() || path_.empty())
+	{ return false; }
+	ParsePath_();
+	body_ = body;
+	ParsePost_(false);
+	state_ = FINISH;
+	LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
+	return true;
+}
+
 bool HttpRequest::parse(Buffer& buff)
 {
 
@@ -73,7 +167,8 @@ bool HttpRequest::parse(Buffer& buff)
 void HttpRequest::ParsePath_()
 {
 	// 解析请求资源路径
-	LOG_DEBUG("request path_: %s", path_);
+	LOG_DEBUG("request path_: %s", path_.c_str());
+	target_ = path_;
 	if (path_ == "/")
 	{
 		path_ = "/index.html";
@@ -117,7 +212,7 @@ void HttpRequest::ParseHeader_(const string& line)
 void HttpRequest::ParseBody_(const string& line)
 {
 	body_ = line;  /// body中会包含用户名, 密码等信息
-	ParsePost_();
+	ParsePost_(IsAsyncReady());
 	state_ = FINISH;  // 解析完成
 	LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
 }
@@ -129,10 +224,10 @@ int HttpRequest::ConverHex(char ch)
 	return ch;
 }
 
-void HttpRequest::ParsePost_()
+void HttpRequest::ParsePost_(bool isAsync)
 {
 	// 解析POST类http报文中的用户名，密码
-	if (method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded")
+	if (method_ == "POST" && GetHeader("Content-Type") == "application/x-www-form-urlencoded")
 	{
 		// 对于post请求报文, 默认Content-Type是application/x-www-form-urlencoded
 		ParseFromUrlencoded_();
@@ -143,14 +238,25 @@ void HttpRequest::ParsePost_()
 			if (tag == 0 || tag == 1)
 			{
 				bool isLogin = (tag == 1);
-				if (UserVerify(post_["username"], post_["password"], isLogin))
+				bool flag = false;
+				if (isLogin && !post_["username"].empty() && SessionUser() == post_["username"])
+				{ flag = true; }  // 会话已登录该用户, 不再验证密码
+				else if (!isAsync)
 				{
-					path_ = "/blog.html";
+					TraceSpan span("UserVerify");
+					Metrics::StageScope stage(Metrics::STAGE_VERIFY);
+					auto start = Metrics::Clock::now();
+					flag = UserVerify(post_["username"], post_["password"], isLogin);
+					Metrics::Observe(Metrics::STAGE_VERIFY, start);
 				}
-				else
+				else if (!VerifyCached_(post_["username"], post_["password"], isLogin, flag))
 				{
-					path_ = "/error.html";
+					/* 缓存不能确定结果, 由HttpConn发起异步查询, 完成后OnVerify设置path_ */
+					isVerifying_ = true;
+					isLogin_ = isLogin;
+					return;
 				}
+				OnVerify(flag);
 			}
 		}
 	}
@@ -207,88 +313,184 @@ void HttpRequest::ParseFromUrlencoded_()
 	}
 }
 
-bool HttpRequest::UserVerify(const string& name, const string& pwd, bool isLogin)
+bool HttpRequest::VerifyCached_(const string& name, const string& pwd, bool isLogin, bool& flag)
 {
+	/* 只用用户缓存和布隆过滤器判断, 能确定结果时返回true, 结果存入flag */
+	flag = false;
 	if (name == "" || pwd == "")
-	{ return false; }
+	{ return true; }
 	LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-	MYSQL* sql;
-	SqlConnRAII(&sql, SqlConnPool::Instance());
-	/* 相当于从SqlConnPool队列中获取MYSQL*对象
-	   参数: MYSQL**, SqlConnPool(musql连接池)对象(单例模式创建) */
-	assert(sql);  //
+	string password;
+	if (UserCache::Instance()->Get(name, password))
+	{
+		flag = isLogin && pwd == password;
+		if (!flag && isLogin)
+		{ LOG_DEBUG("pwd error!"); }
+		else if (!flag)
+		{ LOG_DEBUG("user used!"); }
+		return true;
+	}
+	/*
+	 * 布隆过滤器只在启动时加载, 之后不会看到其他进程写入的用户, 所以不用它拒绝登录
+	 * 注册时跳过查询直接插入, 用户名已被使用时由唯一键使插入失败
+	 */
+	return false;
+}
 
+bool HttpRequest::UserVerify(const string& name, const string& pwd, bool isLogin)
+{
 	bool flag = false;
-	unsigned int j = 0;
-	char order[256] = { 0 };
-	MYSQL_FIELD* fields = nullptr;
-	MYSQL_RES* res = nullptr;
-
-	if (!isLogin)
-	{ flag = true; }
-	/* 查询用户名, 得到用户名列和密码列 */
-	snprintf(order, 256,
-		"SELECT username, password FROM user WHERE username='%s' LIMIT 1",
-		name.c_str());
-	LOG_DEBUG("%s", order);
-
-	if (mysql_query(sql, order))
+	if (VerifyCached_(name, pwd, isLogin, flag))
+	{ return flag; }
+
+	bool isExist = false;
+	string password;
+	/* 查询用户名对应的密码; 注册时布隆过滤器确定用户名未被使用则跳过 */
+	if (isLogin || UserCache::Instance()->MayExist(name))
 	{
-		/* MYSQL*对象sql, 调用mysql查询语句
-		   mysql_query()成功调用返回0 */
-		mysql_free_result(res);
-		return false;
+		if (!userStore->Query(name, password, isExist))
+		{ return false; }
+		if (isExist)
+		{ UserCache::Instance()->Put(name, password); }
+	}
+
+	if (isLogin)
+	{
+		// 登录行为, 检查密码
+		flag = isExist && pwd == password;
+		if (!flag)
+		{ LOG_DEBUG("pwd error!"); }
+	}
+	else if (isExist)
+	{
+		// 注册行为, 用户名已被使用
+		LOG_DEBUG("user used!");
+	}
+	else
+	{
+		/* 注册行为 且 用户名未被使用*/
+		LOG_DEBUG("regirster!");
+		flag = userStore->Insert(name, pwd);
+		if (flag)
+		{ UserCache::Instance()->Put(name, pwd); }
 	}
-	res = mysql_store_result(sql);  // mysql_real_query()返回一个MYSQL_RES
-	j = mysql_num_fields(res);
-	fields = mysql_fetch_fields(res);
+	LOG_DEBUG("UserVerify success!!");
+	return flag;
+}
 
-	while (MYSQL_ROW row = mysql_fetch_row(res))
+void HttpRequest::VerifyAsync(function<void(bool)> cb)
+{
+	assert(isVerifying_);
+	UserVerifyAsync(post_["username"], post_["password"], isLogin_, cb);
+}
+
+void HttpRequest::OnVerify(bool isOk)
+{
+	isVerifying_ = false;
+	path_ = isOk ? "/blog.html" : "/error.html";
+	if (isOk && SessionUser() != post_["username"])
+	{ newSession_ = SessionStore::Instance()->Create(post_["username"]); }
+}
+
+void HttpRequest::UserVerifyAsync(const string& name, const string& pwd, bool isLogin, function<void(bool)> cb)
+{
+	/* 与UserVerify相同的流程, 调用前VerifyCached_已经不能确定结果 */
+	if (!isLogin && !UserCache::Instance()->MayExist(name))
 	{
-		/* while循环被执行说明查找到用户名
-		   mysql_fetch_row是一个同步函数
-		   mysql_fetch_row_nonblock异步
-		   返回MYSQL_RES的下一行，MYSQL_ROW对象 */
-		LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-		string password(row[1]);
-		if (isLogin)
+		InsertUserAsync_(name, pwd, cb);
+		return;
+	}
+	AsyncSqlPool::Instance()->Query(MysqlUserStore::SQL_QUERY_PASSWORD, { name },
+		[name, pwd, isLogin, cb](SqlResult& result)
 		{
-			// 登录行为, 检查密码
-			if (pwd == password)
-			{ flag = true; }
-			else
+			if (!result.isOk)
 			{
-				flag = false;
-				LOG_DEBUG("pwd error!");
+				LOG_ERROR("Query error: %s", result.error.c_str());
+				cb(false);
+				return;
 			}
-		}
-		else
+			bool isExist = !result.rows.empty();
+			if (isExist)
+			{ UserCache::Instance()->Put(name, result.rows[0][0]); }
+			if (isLogin)
+			{
+				bool flag = isExist && result.rows[0][0] == pwd;
+				if (!flag)
+				{ LOG_DEBUG("pwd error!"); }
+				cb(flag);
+				return;
+			}
+			if (isExist)
+			{
+				LOG_DEBUG("user used!");
+				cb(false);
+				return;
+			}
+			InsertUserAsync_(name, pwd, cb);
+		});
+}
+
+void HttpRequest::InsertUserAsync_(const string& name, const string& pwd, function<void(bool)> cb)
+{
+	LOG_DEBUG("regirster!");
+	if (RegisterBatcher::Instance()->IsOpen())
+	{
+		RegisterBatcher::Instance()->Insert(name, pwd, [name, pwd, cb](bool isOk)
 		{
-			// 如果不是islogin是false, 则解释为注册行为, 并返回false
-			flag = false;
-			LOG_DEBUG("user used!");
-		}
+			if (isOk)
+			{ UserCache::Instance()->Put(name, pwd); }
+			cb(isOk);
+		});
+		return;
+	}
+	AsyncSqlPool::Instance()->Query(MysqlUserStore::SQL_INSERT_USER, { name, pwd },
+		[name, pwd, cb](SqlResult& result)
+		{
+			if (result.isOk)
+			{ UserCache::Instance()->Put(name, pwd); }
+			else
+			{ LOG_DEBUG("Insert error: %s", result.error.c_str()); }
+			cb(result.isOk);
+		});
+}
+
+void HttpRequest::LoadUserNames()
+{
+	/*
+	 * 启动时把user表中的用户名加入布隆过滤器, 加载完成后才用于判断用户名未被使用
+	 * 加载失败时布隆过滤器不启用, 每次都查询数据库
+	 */
+	if (USER_BLOOM_BITS == 0)
+	{ return; }
+	if (IsAsyncReady())
+	{
+		AsyncSqlPool::Instance()->Query(MysqlUserStore::SQL_QUERY_NAMES, {}, [](SqlResult& result)
+		{
+			if (!result.isOk)
+			{
+				LOG_WARN("Load user names error: %s", result.error.c_str());
+				return;
+			}
+			for (const auto& row : result.rows)
+			{ UserCache::Instance()->AddName(row[0]); }
+			UserCache::Instance()->SetBloomReady();
+			LOG_INFO("Load %d user names", (int)result.rows.size());
+		});
+		return;
 	}
-	mysql_free_result(res); // 释放结构
 
-	/* 注册行为 且 用户名未被使用*/
-	if (!isLogin && flag)
+	int count = 0;
+	if (!userStore->LoadNames([&count](const string& name)
+		{
+			UserCache::Instance()->AddName(name);
+			count++;
+		}))
 	{
-		LOG_DEBUG("regirster!");
-		bzero(order, 256);
-		// MySQL语句，添加用户
-		snprintf(order, 256, "INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-		LOG_DEBUG("%s", order);
-		if (mysql_query(sql, order))
-		{  // 执行mysql语句, 返回0,调用成功
-			LOG_DEBUG("Insert error!");
-			flag = false;
-		}
-		flag = true;
+		LOG_WARN("Load user names error!");
+		return;
 	}
-	SqlConnPool::Instance()->FreeConn(sql);  // MYSQL对象弹出sql连接队列
-	LOG_DEBUG("UserVerify success!!");
-	return flag;
+	UserCache::Instance()->SetBloomReady();
+	LOG_INFO("Load %d user names", count);
 }
 
 std::string HttpRequest::path() const
@@ -5,13 +5,19 @@
 #include <unordered_set>
 #include <string>
 #include <regex>
+#include <functional>
 #include <errno.h>
-#include <mysql/mysql.h>  //mysql
+#include <strings.h>  // strcasecmp
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
-#include "../pool/sqlconnpool.h"
-#include "../pool/sqlconnRAII.h"
+#include "../pool/asyncsqlpool.h"
+#include "../metrics/metrics.h"
+#include "../metrics/trace.h"
+#include "hpack.h"
+#include "usercache.h"
+#include "sessionstore.h"
+#include "userstore.h"
 
 class HttpRequest
 {
@@ -45,15 +51,62 @@ class HttpRequest
 	void Init();
 	bool parse(Buffer& buff);
 
+	/* HTTP/2: 由HEADERS帧解码出的首部和DATA帧拼接的请求体构造请求 */
+	bool ParseH2(const HeaderList& headers, const std::string& body);
+
 	std::string path() const;
 	std::string& path();
 	std::string method() const;
 	std::string version() const;
+	/* 请求行中的原始路径, path()会被改写为实际的页面 */
+	const std::string& target() const
+	{
+		return target_;
+	}
 	std::string GetPost(const std::string& key) const;
 	std::string GetPost(const char* key) const;
 
 	bool IsKeepAlive() const;
 
+	/* 首部名不区分大小写(HTTP/2首部名均为小写) */
+	std::string GetHeader(const std::string& key) const;
+
+	std::string GetCookie(const std::string& name) const;
+
+	/* 请求Cookie中的会话对应的用户名, 没有有效会话时为空串 */
+	const std::string& SessionUser();
+
+	/* 登录/注册成功后新建的会话, 响应中需要设置的Cookie; 没有时为空串 */
+	std::string SessionCookie() const;
+
+	/* 请求头 Upgrade: h2c, 且带HTTP2-Settings */
+	bool IsH2cUpgrade() const;
+
+	/*
+	 * IsAsyncReady时HTTP/1.1的登录/注册请求解析后不查询数据库, 而是等待VerifyAsync完成
+	 * cb在epoll线程中调用, 之后由工作线程调用OnVerify设置响应页面
+	 */
+	bool IsVerifying() const
+	{
+		return isVerifying_;
+	}
+	void VerifyAsync(std::function<void(bool)> cb);
+	void OnVerify(bool isOk);
+
+	static bool isAsyncVerify;
+
+	/* isAsyncVerify且异步连接池已有可用连接; 连接建立前和全部断开时使用同步连接池 */
+	static bool IsAsyncReady()
+	{
+		return isAsyncVerify && AsyncSqlPool::Instance()->IsReady();
+	}
+
+	/* 同步登录/注册使用的用户表, 由WebServer设置 */
+	static UserStore* userStore;
+
+	/* 启动时把已有用户名加载到布隆过滤器, 在连接池初始化之后调用 */
+	static void LoadUserNames();
+
 	/*
 	todo
 	void HttpConn::ParseFormData() {}
@@ -66,13 +119,23 @@ class HttpRequest
 	void ParseBody_(const std::string& line);
 
 	void ParsePath_();
-	void ParsePost_();
+	void ParsePost_(bool isAsync);
 	void ParseFromUrlencoded_();
 
 	static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
+	static bool VerifyCached_(const std::string& name, const std::string& pwd, bool isLogin, bool& flag);
+	static void UserVerifyAsync(const std::string& name, const std::string& pwd, bool isLogin,
+		std::function<void(bool)> cb);
+	static void InsertUserAsync_(const std::string& name, const std::string& pwd, std::function<void(bool)> cb);
 
 	PARSE_STATE state_;
+	bool isVerifying_;
+	bool isLogin_;
+	bool isSessionChecked_;
+	std::string sessionUser_;
+	std::string newSession_;
 	std::string method_, path_, version_, body_;
+	std::string target_;
 	std::unordered_map<std::string, std::string> header_;
 	std::unordered_map<std::string, std::string> post_;
 
@@ -21,8 +21,8 @@ const unordered_map<string, string> HttpResponse::SUFFIX_TYPE = {
 	{ ".avi", "video/x-msvideo" },
 	{ ".gz", "application/x-gzip" },
 	{ ".tar", "application/x-tar" },
-	{ ".css", "text/css " },
-	{ ".js", "text/javascript " },
+	{ ".css", "text/css" },
+	{ ".js", "text/javascript" },
 };
 
 const unordered_map<int, string> HttpResponse::CODE_STATUS = {
@@ -30,8 +30,12 @@ const unordered_map<int, string> HttpResponse::CODE_STATUS = {
 	{ 400, "Bad Request" },
 	{ 403, "Forbidden" },
 	{ 404, "Not Found" },
+	{ 500, "Internal Server Error" },
+	{ 503, "Service Unavailable" },
 };
 
+atomic<size_t> HttpResponse::streamBytes_(0);
+
 const unordered_map<int, string> HttpResponse::CODE_PATH = {
 	{ 400, "/400.html" },
 	{ 403, "/403.html" },
@@ -45,29 +49,82 @@ HttpResponse::HttpResponse()
 	isKeepAlive_ = false;
 	mmFile_ = nullptr;
 	mmFileStat_ = { 0 };
+	isCold_ = false;
+	fileBuf_ = nullptr;
+	isStream_ = false;
+	fileFd_ = -1;
+	windowOff_ = 0;
+	windowLen_ = 0;
+	reserved_ = 0;
 };
 
 HttpResponse::~HttpResponse()
 {
 	UnmapFile();
+	ReleaseHeld(0, true);
 }
 
 void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code)
 {
 	assert(srcDir != "");
-	if (mmFile_)
-	{ UnmapFile(); }  // mmFile被设置为true,则删除映射
+	UnmapFile();  // 删除上一个请求的映射或缓冲区
 	code_ = code;
 	isKeepAlive_ = isKeepAlive;
+	cookie_ = "";
+	textType_.clear();
+	text_.clear();
 	path_ = path;
 	srcDir_ = srcDir;
 	mmFile_ = nullptr;
 	mmFileStat_ = { 0 };
 }
 
+void HttpResponse::SetText(const string& type, string text)
+{
+	code_ = 200;
+	textType_ = type;
+	text_ = move(text);
+}
+
 void HttpResponse::MakeResponse(Buffer& buff)
 {
-	if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode))
+	if (!textType_.empty())
+	{
+		AddStateLine_(buff);
+		AddHeader_(buff);
+		buff.Append("Content-length: " + to_string(text_.size()) + "\r\n\r\n");
+		buff.Append(text_);
+		return;
+	}
+	CheckFile_();
+	if (!ErrorHtml_())
+	{
+		/* 没有错误页面文件, 直接使用预生成的错误响应 */
+		buff.Append(ErrorBlob(code_, isKeepAlive_));
+		return;
+	}
+	AddStateLine_(buff);  // 响应报文状态行
+	AddHeader_(buff);     // 响应报文首部行
+	AddContent_(buff);    // 响应内容
+}
+
+void HttpResponse::MakeBody(Buffer& body)
+{
+	if (!textType_.empty())
+	{
+		body.Append(text_);
+		return;
+	}
+	CheckFile_();
+	if (CODE_STATUS.count(code_) == 0)
+	{ code_ = 400; }
+	if (!ErrorHtml_() || !MapFile_())
+	{ body.Append(ErrorBody_("File NotFound!")); }
+}
+
+void HttpResponse::CheckFile_()
+{
+	if (!StatFile_() || S_ISDIR(mmFileStat_.st_mode))
 	{
 		/* 判断请求的资源文件是否存在，是否有可访问权限 */
 		code_ = 404;  // 文件不存在
@@ -76,34 +133,104 @@ void HttpResponse::MakeResponse(Buffer& buff)
 	{
 		code_ = 403;  // 请求的文件不具有 other read(00004) 权限
 	}
+	else if ((code_ == -1 || code_ == 200) && mmFileStat_.st_size > STREAM_FILE_MIN
+		&& !ReserveWindow_(mmFileStat_.st_size))
+	{
+		code_ = 503;  // 分段发送的映射总量已达上限
+	}
 	else if (code_ == -1)
 	{  //
 		code_ = 200;  // 正常返回
 	}
-	ErrorHtml_();
-	AddStateLine_(buff);  // 响应报文状态行
-	AddHeader_(buff);     // 响应报文首部行
-	AddContent_(buff);    // 响应内容
 }
 
 char* HttpResponse::File()
 {
+	if (fileBuf_)
+	{ return fileBuf_->data(); }
 	return mmFile_;
 }
 
 size_t HttpResponse::FileLen() const
 {
+	// 分段发送时为当前窗口长度
+	if (isStream_)
+	{ return windowLen_; }
 	return mmFileStat_.st_size;
 }
 
-void HttpResponse::ErrorHtml_()
+size_t HttpResponse::RemainBytes() const
 {
-	// 处理错误返回页面
+	if (!isStream_)
+	{ return 0; }
+	return mmFileStat_.st_size - windowOff_ - windowLen_;
+}
+
+bool HttpResponse::StatFile_()
+{
+	/*
+	 * stat srcDir_ + path_
+	 * 已知不存在的路径由负向缓存直接返回, 不再stat
+	 * 缓存代数在stat之前读取, stat之后目录有变化时不插入
+	 */
+	mmFileStat_ = { 0 };
+	uint64_t gen = NegCache::Instance()->Generation();
+	if (NegCache::Instance()->Contains(path_))
+	{ return false; }
+	Metrics::AddSyscall();
+	if (stat((srcDir_ + path_).data(), &mmFileStat_) < 0)
+	{
+		if (errno == ENOENT || errno == ENOTDIR)
+		{ NegCache::Instance()->Insert(path_, gen); }
+		mmFileStat_ = { 0 };
+		return false;
+	}
+	return true;
+}
+
+bool HttpResponse::ErrorHtml_()
+{
+	// 处理错误返回页面, 返回false表示应使用预生成的错误响应
 	if (CODE_PATH.count(code_) == 1)
 	{
 		path_ = CODE_PATH.find(code_)->second;
-		stat((srcDir_ + path_).data(), &mmFileStat_);
+		return StatFile_();
 	}
+	return code_ < 400;
+}
+
+const string& HttpResponse::ErrorBlob(int code, bool isKeepAlive)
+{
+	/*
+	 * 首次调用时为每个错误码生成keep-alive和close两种响应
+	 * 内容与AddStateLine_/AddHeader_/ErrorContent逐段拼接的结果一致
+	 */
+	static const unordered_map<int, string> blobs = []
+	{
+		unordered_map<int, string> res;
+		for (const auto& it : CODE_STATUS)
+		{
+			if (it.first < 400)
+			{ continue; }
+			for (int keepAlive = 0; keepAlive < 2; keepAlive++)
+			{
+				HttpResponse resp;
+				resp.code_ = it.first;
+				resp.isKeepAlive_ = keepAlive;
+				resp.path_ = CODE_PATH.count(it.first) ? CODE_PATH.find(it.first)->second : ".html";
+				Buffer buff;
+				resp.AddStateLine_(buff);
+				resp.AddHeader_(buff);
+				resp.ErrorContent(buff, "File NotFound!");
+				res[it.first * 2 + keepAlive] = buff.RetrieveAllToStr();
+			}
+		}
+		return res;
+	}();
+	auto it = blobs.find(code * 2 + isKeepAlive);
+	if (it == blobs.end())
+	{ it = blobs.find(400 * 2 + isKeepAlive); }
+	return it->second;
 }
 
 void HttpResponse::AddStateLine_(Buffer& buff)
@@ -139,58 +266,300 @@ void HttpResponse::AddHeader_(Buffer& buff)
 		buff.Append("close\r\n");
 	}
 	buff.Append("Content-type: " + GetFileType_() + "\r\n");
+	if (!cookie_.empty())
+	{ buff.Append("Set-Cookie: " + cookie_ + "\r\n"); }
 }
 
 void HttpResponse::AddContent_(Buffer& buff)
+{
+	/*
+	 * 映射文件, 响应头添加 Content-length: xxx 部分
+	 *    -- 空行 --
+	 */
+	if (!MapFile_())
+	{
+		ErrorContent(buff, "File NotFound!");
+		return;
+	}
+	buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+}
+
+bool HttpResponse::MapFile_()
 {
 	/*
 	 * 将网页文件数据映射到内存
 	 * 首地址保存在数据成员mmFile_中
-	 * 响应头添加 Content-length: xxx 部分
 	 */
+	Metrics::AddSyscall();
 	int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
-	LOG_DEBUG("response source path: %s", srcDir_ + path_);
+	LOG_DEBUG("response source path: %s", (srcDir_ + path_).data());
 	if (srcFd < 0)
 	{
 		// open 失败
-		ErrorContent(buff, "File NotFound!");
-		return;
+		return false;
+	}
+	if (mmFileStat_.st_size > STREAM_FILE_MIN)
+	{
+		/*
+		 * 大文件: 保留fd, 每次只映射一个窗口
+		 * 随着socket可写逐段发送, 单连接占用的地址空间不超过STREAM_WINDOW
+		 */
+		fileFd_ = srcFd;
+		isStream_ = true;
+		if (!MapWindow_(0))
+		{
+			Metrics::AddSyscall();
+			close(fileFd_);
+			fileFd_ = -1;
+			isStream_ = false;
+			return false;
+		}
+		return true;
 	}
 	/* 将文件映射到内存提高文件的访问速度
 		MAP_PRIVATE 建立一个写入时拷贝的私有映射,  */
 	LOG_DEBUG("file path %s", (srcDir_ + path_).data());
-	int* mmRet = (int*)mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);  // 本身返回void*
-	if (*mmRet == -1)
+	Metrics::AddSyscall();
+	void* mmRet = mmap(0, mmFileStat_.st_size, PROT_READ, MAP_PRIVATE, srcFd, 0);
+	Metrics::AddSyscall();
+	close(srcFd);  // 关闭文件
+	if (mmRet == MAP_FAILED)
 	{
 		// mmap调用失败返回(void *)-1
-		ErrorContent(buff, "File NotFound!");
-		return;
+		return false;
 	}
 	mmFile_ = (char*)mmRet;  // 文件映射地址赋值给mmFile_(char *)成员
+	/* 文件页不在内存中时, writev会在工作线程中缺页阻塞, 交给IO线程先读入 */
+	isCold_ = !IsResident_();
+	return true;
+}
 
-	close(srcFd);  // 关闭文件
+void HttpResponse::UnmapFile()
+{
+	// 删除映射数据
+	if (mmFile_)
+	{
+		Metrics::AddSyscall();
+		munmap(mmFile_, FileLen());
+		mmFile_ = nullptr;
+	}
+	if (reserved_ > 0)
+	{
+		streamBytes_ -= reserved_;
+		reserved_ = 0;
+	}
+	if (isStream_)
+	{
+		windowOff_ = 0;
+		windowLen_ = 0;
+		Metrics::AddSyscall();
+		close(fileFd_);
+		fileFd_ = -1;
+		isStream_ = false;
+	}
+	if (fileBuf_)
+	{
+		FileBufPool::Instance()->FreeBuf(fileBuf_);
+		fileBuf_ = nullptr;
+	}
+	isCold_ = false;
+}
 
+bool HttpResponse::MapWindow_(off_t offset)
+{
 	/*
-	 * buff添加内容:
-	 * Content-length: xxxxx
-	 *    -- 空行 --
+	 * 映射从offset开始的一个窗口(offset为页大小的整数倍), 大小为本连接的预留
+	 * 每个窗口都检查是否在page cache中, 不在时由IO线程先读入
 	 */
-	buff.Append("Content-length: " + to_string(mmFileStat_.st_size) + "\r\n\r\n");
+	assert(isStream_ && fileFd_ >= 0 && !mmFile_);
+	if (!ReserveWindow_(mmFileStat_.st_size - offset))
+	{
+		windowLen_ = 0;
+		return false;
+	}
+	size_t len = reserved_;
+	Metrics::AddSyscall();
+	void* mmRet = mmap(0, len, PROT_READ, MAP_PRIVATE, fileFd_, offset);
+	if (mmRet == MAP_FAILED)
+	{
+		windowLen_ = 0;
+		return false;
+	}
+	mmFile_ = (char*)mmRet;
+	windowOff_ = offset;
+	windowLen_ = len;
+	isCold_ = !IsResident_();
+	/* 内核异步预读下一个窗口, 发送到那里时通常不会缺页 */
+	if (RemainBytes() > 0)
+	{ posix_fadvise(fileFd_, offset + len, STREAM_WINDOW, POSIX_FADV_WILLNEED); }
+	return true;
 }
 
-void HttpResponse::UnmapFile()
+bool HttpResponse::ReserveWindow_(size_t left)
+{
+	/*
+	 * 调整本连接预留的窗口: 优先STREAM_WINDOW, 总量不够时STREAM_WINDOW_MIN, 不超过剩余字节数
+	 * 所有连接的预留总和不超过STREAM_GLOBAL_MAX; 已有的预留不会被收回, 已开始的发送总能推进
+	 */
+	size_t want = min<size_t>(STREAM_WINDOW, left);
+	size_t least = min<size_t>(STREAM_WINDOW_MIN, left);
+	if (reserved_ >= want)
+	{
+		streamBytes_ -= reserved_ - want;
+		reserved_ = want;
+		return true;
+	}
+	for (size_t len : { want, least })
+	{
+		if (len <= reserved_)
+		{ return true; }
+		size_t cur = streamBytes_.load(memory_order_relaxed);
+		while (cur + len - reserved_ <= STREAM_GLOBAL_MAX)
+		{
+			if (streamBytes_.compare_exchange_weak(cur, cur + len - reserved_, memory_order_relaxed))
+			{
+				reserved_ = len;
+				return true;
+			}
+		}
+	}
+	return reserved_ > 0;
+}
+
+bool HttpResponse::NextWindow()
+{
+	// 当前窗口发送完毕, 映射下一个窗口
+	assert(isStream_ && RemainBytes() > 0);
+	off_t next = windowOff_ + windowLen_;
+	if (mmFile_)  // 可能已被HoldFile移走
+	{
+		Metrics::AddSyscall();
+		munmap(mmFile_, windowLen_);
+	}
+	mmFile_ = nullptr;
+	windowLen_ = 0;
+	return MapWindow_(next);
+}
+
+void HttpResponse::HoldFile(uint32_t seq)
 {
-	// 删除映射数据
 	if (mmFile_)
 	{
-		munmap(mmFile_, mmFileStat_.st_size);
+		held_.push_back({ seq, mmFile_, FileLen(), nullptr });
 		mmFile_ = nullptr;
 	}
+	if (fileBuf_)
+	{
+		held_.push_back({ seq, nullptr, 0, fileBuf_ });
+		fileBuf_ = nullptr;
+	}
+}
+
+void HttpResponse::ReleaseHeld(uint32_t done, bool force)
+{
+	/*
+	 * force: 连接关闭时释放全部, 此后收不到完成通知
+	 * 零拷贝发送时内核持有文件页的引用, munmap不影响已排队的数据, 提前释放是安全的
+	 * 池化缓冲区会被其他请求复用, 因此从不用零拷贝发送(见HttpConn::LoadFile)
+	 */
+	size_t i = 0;
+	for (; i < held_.size(); i++)
+	{
+		if (!force && done < held_[i].seq)
+		{ break; }
+		if (held_[i].addr)
+		{
+			Metrics::AddSyscall();
+			munmap(held_[i].addr, held_[i].len);
+		}
+		if (held_[i].buf)
+		{ FileBufPool::Instance()->FreeBuf(held_[i].buf); }
+	}
+	held_.erase(held_.begin(), held_.begin() + i);
+}
+
+bool HttpResponse::IsResident_() const
+{
+	/*
+	 * mincore检查映射区的页是否都在page cache中
+	 * 小文件最多一两次缺页, 不检查
+	 */
+	size_t size = FileLen();
+	if (IO_THREAD_NUM <= 0 || size < ASYNC_READ_MIN)
+	{ return true; }
+	static const long pageSize = sysconf(_SC_PAGESIZE);
+	thread_local vector<unsigned char> vec;
+	vec.resize((size + pageSize - 1) / pageSize);
+	Metrics::AddSyscall();
+	if (mincore(mmFile_, size, vec.data()) < 0)
+	{ return true; }
+	for (unsigned char v : vec)
+	{
+		if (!(v & 1))
+		{ return false; }
+	}
+	return true;
+}
+
+bool HttpResponse::LoadFile()
+{
+	/*
+	 * 在IO线程中执行, 读入冷文件:
+	 * 不大于ASYNC_READ_MAX的文件pread到池化缓冲区, 随后释放映射
+	 * 更大的文件或分段发送的窗口, 预读并逐页访问映射区, 使后续writev不再缺页
+	 */
+	assert(mmFile_ && isCold_);
+	isCold_ = false;
+	size_t size = FileLen();
+	if (isStream_ || size > ASYNC_READ_MAX)
+	{
+		static const long pageSize = sysconf(_SC_PAGESIZE);
+		madvise(mmFile_, size, MADV_WILLNEED);
+		volatile char sum = 0;
+		for (size_t i = 0; i < size; i += pageSize)
+		{ sum += mmFile_[i]; }
+		(void)sum;
+		return true;
+	}
+	Metrics::AddSyscall();
+	int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
+	if (srcFd < 0)
+	{ return false; }
+	vector<char>* buf = FileBufPool::Instance()->GetBuf(size);
+	size_t done = 0;
+	while (done < size)
+	{
+		Metrics::AddSyscall();
+		ssize_t len = pread(srcFd, buf->data() + done, size - done, done);
+		if (len <= 0)
+		{
+			if (len < 0 && errno == EINTR)
+			{ continue; }
+			break;
+		}
+		done += len;
+	}
+	Metrics::AddSyscall();
+	close(srcFd);
+	if (done != size)
+	{
+		/* 读取失败(文件被截断等), 仍使用映射区发送 */
+		LOG_WARN("pread %s error!", path_.data());
+		FileBufPool::Instance()->FreeBuf(buf);
+		return false;
+	}
+	Metrics::AddSyscall();
+	munmap(mmFile_, size);
+	mmFile_ = nullptr;
+	fileBuf_ = buf;
+	return true;
 }
 
 string HttpResponse::GetFileType_()
 {
 	// 生成Content-type报文段
+	if (!textType_.empty())
+	{ return textType_; }
 	string::size_type idx = path_.find_last_of('.');
 	/* 判断文件类型
 	  idx值path_最后一个.符号的位置 */
@@ -209,6 +578,13 @@ string HttpResponse::GetFileType_()
 }
 
 void HttpResponse::ErrorContent(Buffer& buff, string message)
+{
+	string body = ErrorBody_(message);
+	buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
+	buff.Append(body);
+}
+
+string HttpResponse::ErrorBody_(const string& message) const
 {
 	string body;
 	string status;
@@ -225,7 +601,5 @@ void HttpResponse::ErrorContent(Buffer& buff, string message)
 	body += to_string(code_) + " : " + status + "\n";
 	body += "<p>" + message + "</p>";
 	body += "<hr><em>WebServer</em></body></html>";
-
-	buff.Append("Content-length: " + to_string(body.size()) + "\r\n\r\n");
-	buff.Append(body);
+	return body;
 }
@@ -2,6 +2,7 @@
 #define HTTP_RESPONSE_H
 
 #include <unordered_map>
+#include <atomic>
 #include <fcntl.h>       // open
 #include <unistd.h>      // close
 #include <sys/stat.h>    // stat
@@ -9,6 +10,9 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../metrics/metrics.h"
+#include "../pool/filebufpool.h"
+#include "negcache.h"
 
 class HttpResponse
 {
@@ -18,25 +22,90 @@ class HttpResponse
 
 	void Init(const std::string& srcDir, std::string& path, bool isKeepAlive = false, int code = -1);
 	void MakeResponse(Buffer& buff);
+
+	/*
+	 * HTTP/2: 不生成HTTP/1.1报文, 状态码/类型/长度由调用方编码为HEADERS帧
+	 * 映射文件失败或使用预生成错误页时, 内容写入body
+	 */
+	void MakeBody(Buffer& body);
+	std::string ContentType()
+	{
+		return GetFileType_();
+	}
 	void UnmapFile();
 	char* File();
 	size_t FileLen() const;
+	bool IsCold() const
+	{
+		return isCold_;
+	}
+	bool LoadFile();
+	/* 响应体在FileBufPool的缓冲区中(LoadFile读入), 而不是文件映射 */
+	bool IsBuffered() const
+	{
+		return fileBuf_ != nullptr;
+	}
+
+	/* 大文件分段映射发送: 当前窗口之后尚未映射的字节数 */
+	size_t RemainBytes() const;
+	bool NextWindow();
+	bool IsStream() const
+	{
+		return isStream_;
+	}
+
+	/*
+	 * MSG_ZEROCOPY只用于文件映射, 缓冲区(IsBuffered)总是普通发送
+	 * HoldFile将当前映射/缓冲区移入待释放队列, 序号seq之前的零拷贝发送全部完成后由ReleaseHeld释放
+	 */
+	void HoldFile(uint32_t seq);
+	void ReleaseHeld(uint32_t done, bool force = false);
 	void ErrorContent(Buffer& buff, std::string message);
 	int Code() const
 	{
 		return code_;
 	}
 
+	/* Set-Cookie首部的值, 为空时不添加; Init时清空 */
+	void SetCookie(const std::string& cookie)
+	{
+		cookie_ = cookie;
+	}
+	const std::string& Cookie() const
+	{
+		return cookie_;
+	}
+
+	/* 以生成的内容代替文件作为200响应(如/metrics); Init时清空 */
+	void SetText(const std::string& type, std::string text);
+	bool IsText() const
+	{
+		return !textType_.empty();
+	}
+
+	/* 预先生成的完整错误响应(状态行+首部+内容), 错误页面文件不存在时使用 */
+	static const std::string& ErrorBlob(int code, bool isKeepAlive);
+
  private:
 	void AddStateLine_(Buffer& buff);
 	void AddHeader_(Buffer& buff);
 	void AddContent_(Buffer& buff);
+	void CheckFile_();
+	bool MapFile_();
+	std::string ErrorBody_(const std::string& message) const;
 
-	void ErrorHtml_();
+	bool ErrorHtml_();
+	bool StatFile_();
+	bool IsResident_() const;
+	bool MapWindow_(off_t offset);
+	bool ReserveWindow_(size_t left);
 	std::string GetFileType_();
 
 	int code_;
 	bool isKeepAlive_;
+	std::string cookie_;
+	std::string textType_;  // 不为空时响应内容为text_
+	std::string text_;
 
 	std::string path_;
 	std::string srcDir_;
@@ -44,6 +113,27 @@ class HttpResponse
 	char* mmFile_;
 	struct stat mmFileStat_;
 
+	bool isCold_;  // 映射的文件页不全在page cache中, 需要IO线程先读入
+	std::vector<char>* fileBuf_;  // IO线程pread得到的文件内容, 来自FileBufPool
+
+	/* 分段发送: 只映射[windowOff_, windowOff_ + windowLen_)一段文件 */
+	bool isStream_;
+	int fileFd_;
+	off_t windowOff_;
+	size_t windowLen_;
+	size_t reserved_;  // 本连接在streamBytes_中预留的窗口大小, 开始分段发送前由CheckFile_预留
+
+	static std::atomic<size_t> streamBytes_;  // 所有连接预留的窗口总字节数, 不超过STREAM_GLOBAL_MAX
+
+	struct HeldFile
+	{
+		uint32_t seq;
+		char* addr;
+		size_t len;
+		std::vector<char>* buf;
+	};
+	std::vector<HeldFile> held_;  // 等待零拷贝完成的映射/缓冲区
+
 	static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
 	static const std::unordered_map<int, std::string> CODE_STATUS;
 	static const std::unordered_map<int, std::string> CODE_PATH;
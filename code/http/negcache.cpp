@@ -0,0 +1,151 @@
+#include "negcache.h"
+using namespace std;
+
+NegCache::NegCache()
+{
+	isEnabled_ = false;
+	inotifyFd_ = -1;
+	capacity_ = 0;
+	next_ = 0;
+	gen_ = 0;
+}
+
+NegCache::~NegCache()
+{
+	Close();
+}
+
+NegCache* NegCache::Instance()
+{
+	static NegCache inst;
+	return &inst;
+}
+
+int NegCache::WatchDir(const char* dir, size_t capacity)
+{
+	assert(dir);
+	if (capacity == 0)
+	{ return -1; }
+	inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotifyFd_ < 0)
+	{
+		/* 无法感知目录变化时不能缓存不存在的路径 */
+		LOG_WARN("inotify init error, negative cache disabled");
+		return -1;
+	}
+	{
+		lock_guard<mutex> locker(mtx_);
+		capacity_ = capacity;
+		next_ = 0;
+		set_.clear();
+		set_.reserve(capacity_);
+		ring_.clear();
+		ring_.reserve(capacity_);
+	}
+	AddWatch_(dir);
+	isEnabled_ = true;
+	return inotifyFd_;
+}
+
+void NegCache::AddWatch_(const string& dir)
+{
+	// 递归监听dir及其子目录
+	const uint32_t mask = IN_CREATE | IN_MOVED_TO | IN_DELETE_SELF | IN_ONLYDIR;
+	int wd = inotify_add_watch(inotifyFd_, dir.c_str(), mask);
+	if (wd < 0)
+	{
+		LOG_WARN("inotify watch %s error!", dir.c_str());
+		return;
+	}
+	watchDirs_[wd] = dir;
+	DIR* dp = opendir(dir.c_str());
+	if (!dp)
+	{ return; }
+	while (struct dirent* ent = readdir(dp))
+	{
+		if (ent->d_type != DT_DIR || strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+		{ continue; }
+		string sub = dir;
+		if (sub.back() != '/')
+		{ sub += '/'; }
+		AddWatch_(sub + ent->d_name);
+	}
+	closedir(dp);
+}
+
+void NegCache::OnDirChange()
+{
+	/*
+	 * 读空inotify事件
+	 * 新建子目录需要补充监听, 其余事件只需清空缓存
+	 * 被删除的目录的监听已由内核移除(IN_IGNORED), wd可能被复用, 从watchDirs_中删除
+	 */
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t len;
+	while ((len = ::read(inotifyFd_, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + len;)
+		{
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+			if (ev->mask & (IN_IGNORED | IN_DELETE_SELF))
+			{ watchDirs_.erase(ev->wd); }
+			else if ((ev->mask & IN_ISDIR) && ev->len > 0 && watchDirs_.count(ev->wd) == 1)
+			{
+				// 新建子目录
+				AddWatch_(watchDirs_[ev->wd] + "/" + ev->name);
+			}
+			p += sizeof(struct inotify_event) + ev->len;
+		}
+	}
+	/* 先补充监听再清空, 避免遗漏新目录中的文件 */
+	Clear();
+}
+
+void NegCache::Close()
+{
+	isEnabled_ = false;
+	if (inotifyFd_ >= 0)
+	{
+		close(inotifyFd_);
+		inotifyFd_ = -1;
+	}
+	watchDirs_.clear();
+	Clear();
+}
+
+bool NegCache::Contains(const string& path)
+{
+	if (!isEnabled_)
+	{ return false; }
+	lock_guard<mutex> locker(mtx_);
+	return set_.count(path) == 1;
+}
+
+void NegCache::Insert(const string& path, uint64_t gen)
+{
+	if (!isEnabled_ || path.size() > NEG_CACHE_MAX_PATH)
+	{ return; }  // 超长路径不缓存, 避免单条占用过多内存
+	lock_guard<mutex> locker(mtx_);
+	if (gen != gen_.load(memory_order_relaxed))
+	{ return; }  // stat之后缓存已失效, 文件可能已创建
+	if (!set_.insert(path).second)
+	{ return; }
+	if (ring_.size() < capacity_)
+	{
+		ring_.push_back(path);
+		return;
+	}
+	/* 满: 淘汰最早插入的路径 */
+	set_.erase(ring_[next_]);
+	ring_[next_] = path;
+	next_ = (next_ + 1) % capacity_;
+}
+
+void NegCache::Clear()
+{
+	lock_guard<mutex> locker(mtx_);
+	set_.clear();
+	ring_.clear();
+	next_ = 0;
+	gen_.fetch_add(1, memory_order_release);
+}
@@ -0,0 +1,65 @@
+#ifndef NEG_CACHE_H
+#define NEG_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_set>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <dirent.h>       // opendir
+#include <unistd.h>       // close
+#include <sys/inotify.h>  // inotify
+
+#include "../log/log.h"
+#include "../config/config.h"
+
+/*
+ * 负向查找缓存: 记录srcDir下确定不存在的路径
+ * 命中时跳过stat/open, 直接返回404
+ * 有界集合, 满后按插入顺序淘汰
+ * 通过inotify监听资源目录, 目录中有文件创建/移入时整体失效
+ * 每次失效代数加一: 调用方在stat之前取得代数, 插入时代数已变化说明期间目录有变化, 不插入
+ */
+class NegCache
+{
+ public:
+	static NegCache* Instance();
+
+	/* 监听资源目录(递归), 返回inotify fd, 失败返回-1且缓存不启用 */
+	int WatchDir(const char* dir, size_t capacity = NEG_CACHE_SIZE);
+	void OnDirChange();  // inotify fd可读时由主线程调用
+	void Close();
+
+	bool Contains(const std::string& path);
+	uint64_t Generation() const
+	{
+		return gen_.load(std::memory_order_acquire);
+	}
+	void Insert(const std::string& path, uint64_t gen);
+	void Clear();
+
+	bool IsEnabled() const
+	{
+		return isEnabled_;
+	}
+
+ private:
+	NegCache();
+	~NegCache();
+	void AddWatch_(const std::string& dir);
+
+	std::atomic<bool> isEnabled_;
+	int inotifyFd_;
+	size_t capacity_;
+	size_t next_;  // ring_中下一个被替换的位置
+	std::atomic<uint64_t> gen_;  // Clear的次数, 在mtx_内修改
+
+	std::unordered_map<int, std::string> watchDirs_;  // key: inotify wd, 只在主线程访问; 目录删除后移除
+
+	std::unordered_set<std::string> set_;
+	std::vector<std::string> ring_;  // 插入顺序, 用于淘汰
+	std::mutex mtx_;
+};
+
+#endif //NEG_CACHE_H
@@ -0,0 +1,226 @@
+#include "registerbatcher.h"
+#include <mysql/errmsg.h>  // CR_UNKNOWN_ERROR
+using namespace std;
+
+const unsigned int ER_DUP_ENTRY = 1062;
+
+RegisterBatcher::RegisterBatcher()
+{
+	isAsync_ = false;
+	isOpen_ = false;
+	inFlight_ = 0;
+}
+
+RegisterBatcher::~RegisterBatcher()
+{
+	Close();
+}
+
+RegisterBatcher* RegisterBatcher::Instance()
+{
+	static RegisterBatcher inst;
+	return &inst;
+}
+
+void RegisterBatcher::Init(bool isAsync)
+{
+	assert(!isOpen_);
+	isAsync_ = isAsync;
+	isOpen_ = true;
+	thread_.reset(new thread([this]
+	{
+		Run_();
+		mysql_thread_end();
+	}));
+}
+
+void RegisterBatcher::Close()
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (!isOpen_)
+		{ return; }
+		isOpen_ = false;
+	}
+	cond_.notify_all();
+	if (thread_ && thread_->joinable())
+	{ thread_->join(); }
+}
+
+string RegisterBatcher::InsertSql_(size_t n)
+{
+	/* n为1时与单条注册的语句相同 */
+	string sql = "INSERT INTO user(username, password) VALUES(?,?)";
+	for (size_t i = 1; i < n; i++)
+	{ sql += ",(?,?)"; }
+	return sql;
+}
+
+void RegisterBatcher::Insert(const string& name, const string& pwd, function<void(bool)> cb)
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		bool isDup = false;
+		for (const auto& p : pending_)
+		{
+			if (p.name == name)
+			{
+				isDup = true;
+				break;
+			}
+		}
+		if (isOpen_ && !isDup)
+		{
+			if (pending_.empty())
+			{ first_ = chrono::steady_clock::now(); }
+			pending_.push_back({ name, pwd, cb });
+			if (pending_.size() == 1 || (int)pending_.size() >= REG_BATCH_MAX)
+			{ cond_.notify_one(); }
+			return;
+		}
+	}
+	/* 同一批中已有相同的用户名, 与数据库的唯一键冲突结果一致 */
+	cb(false);
+}
+
+void RegisterBatcher::Run_()
+{
+	unique_lock<mutex> locker(mtx_);
+	while (isOpen_)
+	{
+		if (pending_.empty())
+		{
+			cond_.wait(locker);
+			continue;
+		}
+		cond_.wait_until(locker, first_ + chrono::milliseconds(REG_BATCH_DELAY_MS),
+			[this] { return !isOpen_ || (int)pending_.size() >= REG_BATCH_MAX; });
+		/* 执行中的批次达到上限时继续积累, 数据库越忙每批越大 */
+		int maxInFlight = isAsync_ ? max(SQL_ASYNC_CONN, 1) : 1;
+		cond_.wait(locker, [this, maxInFlight] { return !isOpen_ || inFlight_ < maxInFlight; });
+		if (!isOpen_)
+		{ break; }
+
+		/* 上一批执行期间积累的请求超过上限时分多批 */
+		Batch batch;
+		if ((int)pending_.size() <= REG_BATCH_MAX)
+		{ batch.swap(pending_); }
+		else
+		{
+			auto end = pending_.begin() + REG_BATCH_MAX;
+			batch.assign(make_move_iterator(pending_.begin()), make_move_iterator(end));
+			pending_.erase(pending_.begin(), end);
+			first_ = chrono::steady_clock::now();
+		}
+		inFlight_++;
+		locker.unlock();
+		/* 异步连接池还没有可用连接时由批量线程同步执行 */
+		if (isAsync_ && AsyncSqlPool::Instance()->IsReady())
+		{ FlushAsync_(make_shared<Batch>(move(batch))); }
+		else
+		{
+			FlushSync_(batch);
+			Done_();
+		}
+		locker.lock();
+	}
+	/* 关闭时未执行的请求失败 */
+	Batch rest;
+	rest.swap(pending_);
+	locker.unlock();
+	for (auto& p : rest)
+	{ p.cb(false); }
+}
+
+void RegisterBatcher::Done_()
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		inFlight_--;
+	}
+	cond_.notify_all();
+}
+
+void RegisterBatcher::FlushSync_(Batch& batch)
+{
+	LOG_DEBUG("register batch: %d", (int)batch.size());
+	MYSQL* sql;
+	SqlConnRAII connRAII(&sql, SqlConnPool::Instance());
+	if (!sql)
+	{
+		LOG_ERROR("No sql connection!");
+		for (auto& p : batch)
+		{ p.cb(false); }
+		return;
+	}
+	unsigned int err = ExecSync_(sql, batch.data(), batch.size());
+	if (err == ER_DUP_ENTRY && batch.size() > 1)
+	{
+		/* 有用户名冲突, 整批没有插入, 逐行重试 */
+		for (auto& p : batch)
+		{ p.cb(ExecSync_(sql, &p, 1) == 0); }
+		return;
+	}
+	for (auto& p : batch)
+	{ p.cb(err == 0); }
+}
+
+unsigned int RegisterBatcher::ExecSync_(MYSQL* sql, const Pending* rows, size_t n)
+{
+	/* 成功返回0, 否则返回错误码 */
+	string query = InsertSql_(n);
+	MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, query);
+	if (!stmt)
+	{ return mysql_errno(sql) ? mysql_errno(sql) : CR_UNKNOWN_ERROR; }
+
+	vector<MYSQL_BIND> params(n * 2);
+	memset(params.data(), 0, params.size() * sizeof(MYSQL_BIND));
+	for (size_t i = 0; i < n; i++)
+	{
+		params[i * 2].buffer_type = MYSQL_TYPE_STRING;
+		params[i * 2].buffer = const_cast<char*>(rows[i].name.data());
+		params[i * 2].buffer_length = rows[i].name.size();
+		params[i * 2 + 1].buffer_type = MYSQL_TYPE_STRING;
+		params[i * 2 + 1].buffer = const_cast<char*>(rows[i].pwd.data());
+		params[i * 2 + 1].buffer_length = rows[i].pwd.size();
+	}
+	if (mysql_stmt_bind_param(stmt, params.data()) || mysql_stmt_execute(stmt))
+	{
+		unsigned int err = mysql_stmt_errno(stmt);
+		LOG_DEBUG("Insert error: %s", mysql_stmt_error(stmt));
+		SqlConnPool::Instance()->DropStmt(sql, query);
+		return err ? err : CR_UNKNOWN_ERROR;
+	}
+	return 0;
+}
+
+void RegisterBatcher::FlushAsync_(shared_ptr<Batch> batch)
+{
+	LOG_DEBUG("register batch: %d", (int)batch->size());
+	vector<string> params;
+	params.reserve(batch->size() * 2);
+	for (const auto& p : *batch)
+	{
+		params.push_back(p.name);
+		params.push_back(p.pwd);
+	}
+	AsyncSqlPool::Instance()->Query(InsertSql_(batch->size()), params, [this, batch](SqlResult& result)
+	{
+		Done_();
+		if (result.errorCode == ER_DUP_ENTRY && batch->size() > 1)
+		{
+			/* 有用户名冲突, 整批没有插入, 逐行重试 */
+			for (auto& p : *batch)
+			{
+				auto cb = p.cb;
+				AsyncSqlPool::Instance()->Query(InsertSql_(1), { p.name, p.pwd },
+					[cb](SqlResult& result) { cb(result.isOk); });
+			}
+			return;
+		}
+		if (!result.isOk)
+		{ LOG_DEBUG("Insert error: %s", result.error.c_str()); }
+		for (auto& p : *batch)
+		{ p.cb(result.isOk); }
+	});
+}
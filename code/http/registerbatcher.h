@@ -0,0 +1,77 @@
+#ifndef REGISTER_BATCHER_H
+#define REGISTER_BATCHER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#include "../log/log.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+#include "../pool/asyncsqlpool.h"
+#include "../config/config.h"
+
+/*
+ * 注册请求的批量插入(组提交), 单例
+ * 第一个请求到达后最多等待REG_BATCH_DELAY_MS, 或凑满REG_BATCH_MAX个, 合并为一条多行INSERT
+ * 同时执行的批次不超过异步连接数(同步模式为1), 前一批未完成时新请求继续积累
+ * 一条语句在autocommit下就是一个事务, 整批只有一次往返和一次提交
+ * 批内有用户名冲突(其他实例或并发注册)时整条语句失败, 改为逐行插入, 各请求得到各自的结果
+ */
+class RegisterBatcher
+{
+ public:
+	static RegisterBatcher* Instance();
+
+	/* isAsync时通过AsyncSqlPool执行, 否则由批量线程使用SqlConnPool */
+	void Init(bool isAsync);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return isOpen_;
+	}
+
+	/*
+	 * 加入等待队列, 插入完成后调用cb(是否成功)
+	 * 同步模式下cb在批量线程中调用, 异步模式下在epoll线程中调用, 都不能阻塞
+	 */
+	void Insert(const std::string& name, const std::string& pwd, std::function<void(bool)> cb);
+
+ private:
+	RegisterBatcher();
+	~RegisterBatcher();
+
+	struct Pending
+	{
+		std::string name;
+		std::string pwd;
+		std::function<void(bool)> cb;
+	};
+	typedef std::vector<Pending> Batch;
+
+	void Run_();
+	void FlushSync_(Batch& batch);
+	void FlushAsync_(std::shared_ptr<Batch> batch);
+	void Done_();
+
+	static unsigned int ExecSync_(MYSQL* sql, const Pending* rows, size_t n);
+	static std::string InsertSql_(size_t n);
+
+	bool isAsync_;
+	bool isOpen_;
+
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	Batch pending_;
+	std::chrono::steady_clock::time_point first_;  // 队列中第一个请求到达的时间
+	int inFlight_;  // 正在执行的批次数
+	std::unique_ptr<std::thread> thread_;
+};
+
+#endif //REGISTER_BATCHER_H
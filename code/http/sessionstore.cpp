@@ -0,0 +1,104 @@
+#include "sessionstore.h"
+#include <sys/random.h>  // getrandom
+using namespace std;
+
+const char* SessionStore::COOKIE_NAME = "sid";
+
+SessionStore::SessionStore()
+{
+	shardCapacity_ = max(SESSION_SIZE / SESSION_SHARDS, 1);
+	if (SESSION_SIZE > 0)
+	{ shards_.reset(new Shard[SESSION_SHARDS]); }
+}
+
+SessionStore* SessionStore::Instance()
+{
+	static SessionStore inst;
+	return &inst;
+}
+
+SessionStore::Shard& SessionStore::GetShard_(const string& token)
+{
+	return shards_[hash<string>()(token) % SESSION_SHARDS];
+}
+
+string SessionStore::Create(const string& name)
+{
+	if (!shards_)
+	{ return ""; }
+	unsigned char bytes[16];
+	if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes))
+	{
+		LOG_ERROR("getrandom error: %d", errno);
+		return "";
+	}
+	static const char HEX[] = "0123456789abcdef";
+	string token;
+	for (unsigned char b : bytes)
+	{
+		token += HEX[b >> 4];
+		token += HEX[b & 0xf];
+	}
+
+	auto expire = chrono::steady_clock::now() + chrono::seconds(SESSION_TIMEOUT);
+	Shard& shard = GetShard_(token);
+	lock_guard<mutex> locker(shard.mtx);
+	shard.lru.push_front({ token, name, expire });
+	shard.index[token] = shard.lru.begin();
+	if (shard.lru.size() > shardCapacity_)
+	{
+		/* 满: 淘汰最久未访问的 */
+		shard.index.erase(shard.lru.back().token);
+		shard.lru.pop_back();
+	}
+	return token;
+}
+
+bool SessionStore::Get(const string& token, string& name)
+{
+	if (!shards_ || token.size() != 32)
+	{ return false; }
+	auto now = chrono::steady_clock::now();
+	Shard& shard = GetShard_(token);
+	lock_guard<mutex> locker(shard.mtx);
+	auto it = shard.index.find(token);
+	if (it == shard.index.end())
+	{ return false; }
+	if (now > it->second->expire)
+	{
+		shard.lru.erase(it->second);
+		shard.index.erase(it);
+		return false;
+	}
+	it->second->expire = now + chrono::seconds(SESSION_TIMEOUT);
+	shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+	name = it->second->name;
+	return true;
+}
+
+void SessionStore::Expire()
+{
+	if (!shards_)
+	{ return; }
+	auto now = chrono::steady_clock::now();
+	size_t count = 0;
+	for (int i = 0; i < SESSION_SHARDS; i++)
+	{
+		Shard& shard = shards_[i];
+		lock_guard<mutex> locker(shard.mtx);
+		while (!shard.lru.empty() && now > shard.lru.back().expire)
+		{
+			shard.index.erase(shard.lru.back().token);
+			shard.lru.pop_back();
+			count++;
+		}
+	}
+	if (count > 0)
+	{ LOG_DEBUG("%d sessions expired", (int)count); }
+}
+
+string SessionStore::Cookie(const string& token)
+{
+	return string(COOKIE_NAME) + "=" + token + "; Path=/; Max-Age=" + to_string(SESSION_TIMEOUT)
+		+ "; HttpOnly; SameSite=Lax";
+}
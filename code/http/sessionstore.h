@@ -0,0 +1,63 @@
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <chrono>
+
+#include "../log/log.h"
+#include "../config/config.h"
+
+/*
+ * 登录会话表, 单例: 会话令牌(128位随机数, 32个十六进制字符) -> 用户名
+ * 登录/注册成功后创建会话并通过Cookie发给客户端, 之后的请求凭Cookie查表即可确认身份, 不再访问数据库
+ * 按令牌哈希分片, 每片独立加锁; 每次访问刷新空闲超时, 片内按最近访问排序
+ * 因此链表尾部就是最早超时的会话, 超出容量时淘汰, 定时清理也只需从尾部检查
+ */
+class SessionStore
+{
+ public:
+	static SessionStore* Instance();
+
+	/* 创建会话返回令牌; 关闭或获取随机数失败时返回空串 */
+	std::string Create(const std::string& name);
+
+	/* 会话存在且未超时时返回true, 并刷新空闲超时 */
+	bool Get(const std::string& token, std::string& name);
+
+	/* 清理超时的会话, 由WebServer的定时器每SESSION_SWEEP_MS调用 */
+	void Expire();
+
+	/* Set-Cookie首部的值 */
+	static std::string Cookie(const std::string& token);
+
+	static const char* COOKIE_NAME;
+
+ private:
+	SessionStore();
+	~SessionStore() = default;
+
+	struct Entry
+	{
+		std::string token;
+		std::string name;
+		std::chrono::steady_clock::time_point expire;
+	};
+
+	struct Shard
+	{
+		std::mutex mtx;
+		std::list<Entry> lru;  // 头部是最近访问的
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	};
+
+	Shard& GetShard_(const std::string& token);
+
+	size_t shardCapacity_;
+	std::unique_ptr<Shard[]> shards_;
+};
+
+#endif //SESSION_STORE_H
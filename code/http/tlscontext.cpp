@@ -0,0 +1,104 @@
+#include "tlscontext.h"
+using namespace std;
+
+TlsContext::TlsContext()
+{
+	ctx_ = nullptr;
+}
+
+TlsContext::~TlsContext()
+{
+	Close();
+}
+
+TlsContext* TlsContext::Instance()
+{
+	static TlsContext inst;
+	return &inst;
+}
+
+bool TlsContext::Init(const char* certFile, const char* keyFile)
+{
+	assert(certFile && keyFile);
+	ctx_ = SSL_CTX_new(TLS_server_method());
+	if (!ctx_)
+	{
+		LOG_ERROR("SSL_CTX_new error: %s", LastError().c_str());
+		return false;
+	}
+	SSL_CTX_set_min_proto_version(ctx_, TLS1_2_VERSION);
+	if (SSL_CTX_use_certificate_chain_file(ctx_, certFile) != 1
+		|| SSL_CTX_use_PrivateKey_file(ctx_, keyFile, SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(ctx_) != 1)
+	{
+		LOG_ERROR("Load cert %s / key %s error: %s", certFile, keyFile, LastError().c_str());
+		Close();
+		return false;
+	}
+	/*
+	 * 非阻塞socket: 允许SSL_write部分写入, 重试时缓冲区地址可以变化(iov_会前移)
+	 * 内核支持时开启kTLS
+	 */
+	SSL_CTX_set_mode(ctx_, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_options(ctx_, SSL_OP_ENABLE_KTLS | SSL_OP_CIPHER_SERVER_PREFERENCE | SSL_OP_NO_RENEGOTIATION);
+
+	/* 会话恢复: TLS1.2会话ID缓存 + 会话票据(TLS1.3只用票据) */
+	static const unsigned char sidCtx[] = "WebServer";
+	SSL_CTX_set_session_id_context(ctx_, sidCtx, sizeof(sidCtx) - 1);
+	SSL_CTX_set_session_cache_mode(ctx_, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(ctx_, TLS_SESSION_CACHE_SIZE);
+	SSL_CTX_set_timeout(ctx_, TLS_SESSION_TIMEOUT);
+	SSL_CTX_set_num_tickets(ctx_, 1);
+
+	SSL_CTX_set_alpn_select_cb(ctx_, AlpnSelect_, nullptr);
+	return true;
+}
+
+int TlsContext::AlpnSelect_(SSL* ssl, const unsigned char** out, unsigned char* outLen,
+	const unsigned char* in, unsigned int inLen, void* arg)
+{
+	// 按本端顺序优先选择h2, 客户端都不支持时不协商
+	static const unsigned char protos[] = "\x02h2\x08http/1.1";
+	static const unsigned char protosH1[] = "\x08http/1.1";
+	if (SSL_select_next_proto((unsigned char**)out, outLen,
+		H2_ENABLE ? protos : protosH1, H2_ENABLE ? sizeof(protos) - 1 : sizeof(protosH1) - 1,
+		in, inLen) != OPENSSL_NPN_NEGOTIATED)
+	{
+		return SSL_TLSEXT_ERR_NOACK;
+	}
+	return SSL_TLSEXT_ERR_OK;
+}
+
+SSL* TlsContext::NewSsl(int fd)
+{
+	assert(ctx_);
+	SSL* ssl = SSL_new(ctx_);
+	if (!ssl)
+	{ return nullptr; }
+	SSL_set_fd(ssl, fd);
+	SSL_set_accept_state(ssl);
+	return ssl;
+}
+
+void TlsContext::Close()
+{
+	if (ctx_)
+	{
+		SSL_CTX_free(ctx_);
+		ctx_ = nullptr;
+	}
+}
+
+string TlsContext::LastError()
+{
+	string res;
+	char buf[256];
+	while (unsigned long err = ERR_get_error())
+	{
+		ERR_error_string_n(err, buf, sizeof(buf));
+		if (!res.empty())
+		{ res += "; "; }
+		res += buf;
+	}
+	return res;
+}
@@ -0,0 +1,45 @@
+#ifndef TLS_CONTEXT_H
+#define TLS_CONTEXT_H
+
+#include <string>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "../log/log.h"
+#include "../config/config.h"
+
+/*
+ * HTTPS监听使用的SSL_CTX, 单例
+ * 开启服务端会话缓存和会话票据(session ticket), 支持会话恢复
+ * 开启SSL_OP_ENABLE_KTLS: 内核支持时握手完成后由内核加解密,
+ * 之后响应仍可直接writev映射的文件, 不经过用户态加密
+ */
+class TlsContext
+{
+ public:
+	static TlsContext* Instance();
+
+	bool Init(const char* certFile, const char* keyFile);
+	void Close();
+
+	SSL* NewSsl(int fd);
+
+	bool IsOpen() const
+	{
+		return ctx_ != nullptr;
+	}
+
+	/* 取出并清空当前线程的OpenSSL错误队列 */
+	static std::string LastError();
+
+ private:
+	TlsContext();
+	~TlsContext();
+
+	static int AlpnSelect_(SSL* ssl, const unsigned char** out, unsigned char* outLen,
+		const unsigned char* in, unsigned int inLen, void* arg);
+
+	SSL_CTX* ctx_;
+};
+
+#endif //TLS_CONTEXT_H
@@ -0,0 +1,123 @@
+#include "usercache.h"
+using namespace std;
+
+UserCache::UserCache()
+{
+	shardCapacity_ = max(USER_CACHE_SIZE / USER_CACHE_SHARDS, 1);
+	if (USER_CACHE_SIZE > 0)
+	{ shards_.reset(new Shard[USER_CACHE_SHARDS]); }
+
+	isBloomReady_ = false;
+	if (USER_BLOOM_BITS > 0)
+	{
+		size_t words = (USER_BLOOM_BITS + 63) / 64;
+		bloom_.reset(new atomic<uint64_t>[words]);
+		for (size_t i = 0; i < words; i++)
+		{ bloom_[i].store(0, memory_order_relaxed); }
+	}
+}
+
+UserCache* UserCache::Instance()
+{
+	static UserCache inst;
+	return &inst;
+}
+
+UserCache::Shard& UserCache::GetShard_(const string& name)
+{
+	return shards_[hash<string>()(name) % USER_CACHE_SHARDS];
+}
+
+bool UserCache::Get(const string& name, string& password)
+{
+	if (!shards_)
+	{ return false; }
+	Shard& shard = GetShard_(name);
+	lock_guard<mutex> locker(shard.mtx);
+	auto it = shard.index.find(name);
+	if (it == shard.index.end())
+	{ return false; }
+	if (chrono::steady_clock::now() > it->second->expire)
+	{
+		shard.lru.erase(it->second);
+		shard.index.erase(it);
+		return false;
+	}
+	shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+	password = it->second->password;
+	return true;
+}
+
+void UserCache::Put(const string& name, const string& password)
+{
+	AddName(name);
+	if (!shards_)
+	{ return; }
+	auto expire = chrono::steady_clock::now() + chrono::seconds(USER_CACHE_TTL);
+	Shard& shard = GetShard_(name);
+	lock_guard<mutex> locker(shard.mtx);
+	auto it = shard.index.find(name);
+	if (it != shard.index.end())
+	{
+		it->second->password = password;
+		it->second->expire = expire;
+		shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+		return;
+	}
+	shard.lru.push_front({ name, password, expire });
+	shard.index[name] = shard.lru.begin();
+	if (shard.lru.size() > shardCapacity_)
+	{
+		/* 满: 淘汰最久未使用的 */
+		shard.index.erase(shard.lru.back().name);
+		shard.lru.pop_back();
+	}
+}
+
+void UserCache::BloomHash_(const string& name, uint64_t& h1, uint64_t& h2)
+{
+	/* 双重哈希: 第i个位置为 h1 + i * h2 */
+	h1 = hash<string>()(name);
+	h2 = 14695981039346656037ULL;  // FNV-1a
+	for (unsigned char c : name)
+	{
+		h2 ^= c;
+		h2 *= 1099511628211ULL;
+	}
+	h2 |= 1;
+}
+
+bool UserCache::MayExist(const string& name) const
+{
+	if (!isBloomReady_.load(memory_order_acquire))
+	{ return true; }
+	uint64_t h1, h2;
+	BloomHash_(name, h1, h2);
+	for (int i = 0; i < USER_BLOOM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % USER_BLOOM_BITS;
+		if (!(bloom_[bit / 64].load(memory_order_relaxed) & (1ULL << (bit % 64))))
+		{ return false; }
+	}
+	return true;
+}
+
+void UserCache::AddName(const string& name)
+{
+	if (!bloom_)
+	{ return; }
+	uint64_t h1, h2;
+	BloomHash_(name, h1, h2);
+	for (int i = 0; i < USER_BLOOM_HASHES; i++)
+	{
+		uint64_t bit = (h1 + i * h2) % USER_BLOOM_BITS;
+		bloom_[bit / 64].fetch_or(1ULL << (bit % 64), memory_order_relaxed);
+	}
+}
+
+void UserCache::SetBloomReady()
+{
+	/* 加载期间注册的用户名也已加入, 之后布隆过滤器才能用于判断用户名未被使用 */
+	if (bloom_)
+	{ isBloomReady_.store(true, memory_order_release); }
+}
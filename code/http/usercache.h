@@ -0,0 +1,70 @@
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdint.h>
+
+#include "../log/log.h"
+#include "../config/config.h"
+
+/*
+ * 用户记录缓存, 登录/注册先查缓存, 不能确定结果时才查询数据库
+ * 按用户名哈希分片, 每片独立加锁, 片内LRU淘汰; 条目USER_CACHE_TTL秒后过期, 以感知数据库中的修改
+ * 布隆过滤器记录已存在的用户名: 启动时从user表加载完成后, 未命中说明用户名一定未被使用
+ */
+class UserCache
+{
+ public:
+	static UserCache* Instance();
+
+	/* 命中且未过期时返回true */
+	bool Get(const std::string& name, std::string& password);
+
+	/* 查询到的用户或注册成功的用户, 同时加入布隆过滤器 */
+	void Put(const std::string& name, const std::string& password);
+
+	/* 布隆过滤器; 加载完全部用户名之前总是返回true */
+	bool MayExist(const std::string& name) const;
+	void AddName(const std::string& name);
+	void SetBloomReady();
+
+	bool IsBloomReady() const
+	{
+		return isBloomReady_;
+	}
+
+ private:
+	UserCache();
+	~UserCache() = default;
+
+	struct Entry
+	{
+		std::string name;
+		std::string password;
+		std::chrono::steady_clock::time_point expire;
+	};
+
+	struct Shard
+	{
+		std::mutex mtx;
+		std::list<Entry> lru;  // 头部是最近使用的
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+	};
+
+	Shard& GetShard_(const std::string& name);
+	static void BloomHash_(const std::string& name, uint64_t& h1, uint64_t& h2);
+
+	size_t shardCapacity_;
+	std::unique_ptr<Shard[]> shards_;
+
+	std::atomic<bool> isBloomReady_;
+	std::unique_ptr<std::atomic<uint64_t>[]> bloom_;
+};
+
+#endif //USER_CACHE_H
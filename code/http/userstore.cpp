@@ -0,0 +1,238 @@
+#include "userstore.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/stat.h>
+using namespace std;
+
+const string MysqlUserStore::SQL_QUERY_PASSWORD = "SELECT password FROM user WHERE username=? LIMIT 1";
+const string MysqlUserStore::SQL_INSERT_USER = "INSERT INTO user(username, password) VALUES(?,?)";
+const string MysqlUserStore::SQL_QUERY_NAMES = "SELECT username FROM user";
+
+bool MysqlUserStore::Query(const string& name, string& password, bool& isExist)
+{
+	MYSQL* sql;
+	SqlConnRAII connRAII(&sql, SqlConnPool::Instance());
+	/* 相当于从SqlConnPool队列中获取MYSQL*对象, connRAII析构时归还
+	   参数: MYSQL**, SqlConnPool(musql连接池)对象(单例模式创建) */
+	if (!sql)
+	{
+		LOG_ERROR("No sql connection!");
+		return false;
+	}
+	MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, SQL_QUERY_PASSWORD);
+	if (!stmt)
+	{ return false; }
+
+	MYSQL_BIND param;
+	memset(&param, 0, sizeof(param));
+	param.buffer_type = MYSQL_TYPE_STRING;
+	param.buffer = const_cast<char*>(name.data());
+	param.buffer_length = name.size();
+
+	char buff[256];
+	unsigned long len = 0;
+	MYSQL_BIND result;
+	memset(&result, 0, sizeof(result));
+	result.buffer_type = MYSQL_TYPE_STRING;
+	result.buffer = buff;
+	result.buffer_length = sizeof(buff);
+	result.length = &len;
+
+	if (mysql_stmt_bind_param(stmt, &param) || mysql_stmt_bind_result(stmt, &result)
+		|| mysql_stmt_execute(stmt) || mysql_stmt_store_result(stmt))
+	{
+		/* 连接断开后服务端的语句已失效, 丢弃缓存以便下次重新prepare */
+		LOG_ERROR("Query error: %s", mysql_stmt_error(stmt));
+		SqlConnPool::Instance()->DropStmt(sql, SQL_QUERY_PASSWORD);
+		return false;
+	}
+	int ret = mysql_stmt_fetch(stmt);
+	/* 超长的密码被截断, 只会导致比较失败 */
+	isExist = (ret == 0 || ret == MYSQL_DATA_TRUNCATED);
+	if (isExist)
+	{ password.assign(buff, min<unsigned long>(len, sizeof(buff))); }
+	mysql_stmt_free_result(stmt);
+	return true;
+}
+
+bool MysqlUserStore::Insert(const string& name, const string& pwd)
+{
+	if (RegisterBatcher::Instance()->IsOpen())
+	{
+		/* 等待批量插入完成, 等待期间不占用数据库连接 */
+		auto done = make_shared<promise<bool>>();
+		future<bool> isOk = done->get_future();
+		RegisterBatcher::Instance()->Insert(name, pwd, [done](bool isOk) { done->set_value(isOk); });
+		return isOk.get();
+	}
+
+	MYSQL* sql;
+	SqlConnRAII connRAII(&sql, SqlConnPool::Instance());
+	if (!sql)
+	{
+		LOG_ERROR("No sql connection!");
+		return false;
+	}
+	MYSQL_STMT* stmt = SqlConnPool::Instance()->GetStmt(sql, SQL_INSERT_USER);
+	if (!stmt)
+	{ return false; }
+
+	MYSQL_BIND params[2];
+	memset(params, 0, sizeof(params));
+	params[0].buffer_type = MYSQL_TYPE_STRING;
+	params[0].buffer = const_cast<char*>(name.data());
+	params[0].buffer_length = name.size();
+	params[1].buffer_type = MYSQL_TYPE_STRING;
+	params[1].buffer = const_cast<char*>(pwd.data());
+	params[1].buffer_length = pwd.size();
+
+	if (mysql_stmt_bind_param(stmt, params) || mysql_stmt_execute(stmt))
+	{
+		LOG_DEBUG("Insert error: %s", mysql_stmt_error(stmt));
+		SqlConnPool::Instance()->DropStmt(sql, SQL_INSERT_USER);
+		return false;
+	}
+	return true;
+}
+
+bool MysqlUserStore::LoadNames(const function<void(const string&)>& fn)
+{
+	MYSQL* sql;
+	SqlConnRAII connRAII(&sql, SqlConnPool::Instance());
+	MYSQL_STMT* stmt = sql ? SqlConnPool::Instance()->GetStmt(sql, SQL_QUERY_NAMES) : nullptr;
+	if (!stmt)
+	{ return false; }
+	char buff[256];
+	unsigned long len = 0;
+	MYSQL_BIND result;
+	memset(&result, 0, sizeof(result));
+	result.buffer_type = MYSQL_TYPE_STRING;
+	result.buffer = buff;
+	result.buffer_length = sizeof(buff);
+	result.length = &len;
+	if (mysql_stmt_bind_result(stmt, &result) || mysql_stmt_execute(stmt) || mysql_stmt_store_result(stmt))
+	{
+		LOG_WARN("Load user names error: %s", mysql_stmt_error(stmt));
+		SqlConnPool::Instance()->DropStmt(sql, SQL_QUERY_NAMES);
+		return false;
+	}
+	bool isOk = true;
+	int ret;
+	while ((ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED)
+	{
+		/* 截断的用户名不完整, 结果不能用于判断用户名未被使用 */
+		isOk = isOk && ret == 0;
+		fn(string(buff, min<unsigned long>(len, sizeof(buff))));
+	}
+	mysql_stmt_free_result(stmt);
+	return isOk && ret == MYSQL_NO_DATA;
+}
+
+MemUserStore::MemUserStore()
+{
+	fd_ = -1;
+	size_ = 0;
+}
+
+MemUserStore::~MemUserStore()
+{
+	if (fd_ >= 0)
+	{ close(fd_); }
+}
+
+bool MemUserStore::Init(const string& path)
+{
+	assert(fd_ < 0);
+	path_ = path;
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+	if (fd_ < 0)
+	{ return false; }
+	struct stat st;
+	if (fstat(fd_, &st) < 0)
+	{ return false; }
+
+	string data(st.st_size, '\0');
+	size_t n = 0;
+	while (n < data.size())
+	{
+		ssize_t len = pread(fd_, &data[n], data.size() - n, n);
+		if (len <= 0)
+		{ break; }
+		n += len;
+	}
+	data.resize(n);
+
+	size_t pos = 0;
+	while (data.size() - pos >= 8)
+	{
+		uint32_t nameLen, pwdLen;
+		memcpy(&nameLen, data.data() + pos, 4);
+		memcpy(&pwdLen, data.data() + pos + 4, 4);
+		if (data.size() - pos - 8 < (size_t)nameLen + pwdLen)
+		{ break; }
+		users_[data.substr(pos + 8, nameLen)] = data.substr(pos + 8 + nameLen, pwdLen);
+		pos += 8 + nameLen + pwdLen;
+	}
+	if (pos < data.size())
+	{
+		/* 末尾的记录不完整, 截掉后再追加 */
+		LOG_WARN("User file %s: drop %d bytes of partial record", path.c_str(), (int)(data.size() - pos));
+		if (ftruncate(fd_, pos) < 0)
+		{ return false; }
+	}
+	size_ = pos;
+	return true;
+}
+
+bool MemUserStore::Query(const string& name, string& password, bool& isExist)
+{
+	lock_guard<mutex> locker(mtx_);
+	auto it = users_.find(name);
+	isExist = (it != users_.end());
+	if (isExist)
+	{ password = it->second; }
+	return true;
+}
+
+bool MemUserStore::Insert(const string& name, const string& pwd)
+{
+	uint32_t nameLen = name.size(), pwdLen = pwd.size();
+	string record(8, '\0');
+	memcpy(&record[0], &nameLen, 4);
+	memcpy(&record[4], &pwdLen, 4);
+	record += name;
+	record += pwd;
+
+	lock_guard<mutex> locker(mtx_);
+	if (users_.count(name))
+	{ return false; }
+	/* 先写文件再加入内存, 写入或落盘失败时注册失败 */
+	bool isOk = write(fd_, record.data(), record.size()) == (ssize_t)record.size();
+	if (!isOk)
+	{ LOG_ERROR("User file %s write error: %d", path_.c_str(), errno); }
+	else if (USER_STORE_FSYNC && fdatasync(fd_) < 0)
+	{
+		LOG_ERROR("User file %s fdatasync error: %d", path_.c_str(), errno);
+		isOk = false;
+	}
+	if (!isOk)
+	{
+		/* 去掉已追加的记录, 否则重启后会加载一个注册失败的用户 */
+		if (ftruncate(fd_, size_) < 0)
+		{ LOG_ERROR("User file %s truncate error: %d", path_.c_str(), errno); }
+		return false;
+	}
+	size_ += record.size();
+	users_[name] = pwd;
+	return true;
+}
+
+bool MemUserStore::LoadNames(const function<void(const string&)>& fn)
+{
+	lock_guard<mutex> locker(mtx_);
+	for (const auto& it : users_)
+	{ fn(it.first); }
+	return true;
+}
@@ -0,0 +1,89 @@
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <sys/types.h>
+#include <mysql/mysql.h>
+
+#include "../log/log.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+#include "../config/config.h"
+#include "registerbatcher.h"
+
+/*
+ * 用户表接口: 登录/注册的同步查询都经过它, 由WebServer在启动时选择实现
+ * 所有方法都可能被多个工作线程同时调用
+ */
+class UserStore
+{
+ public:
+	virtual ~UserStore() = default;
+
+	/* 查询用户的密码, isExist表示用户是否存在; 出错返回false */
+	virtual bool Query(const std::string& name, std::string& password, bool& isExist) = 0;
+
+	/* 插入新用户; 用户名已存在或出错返回false */
+	virtual bool Insert(const std::string& name, const std::string& pwd) = 0;
+
+	/* 遍历全部用户名(加载布隆过滤器); 出错或有用户名不完整时返回false */
+	virtual bool LoadNames(const std::function<void(const std::string&)>& fn) = 0;
+
+	virtual const char* Name() const = 0;
+};
+
+/* MySQL user表, 使用SqlConnPool的连接和预处理语句 */
+class MysqlUserStore : public UserStore
+{
+ public:
+	bool Query(const std::string& name, std::string& password, bool& isExist) override;
+	bool Insert(const std::string& name, const std::string& pwd) override;
+	bool LoadNames(const std::function<void(const std::string&)>& fn) override;
+
+	const char* Name() const override
+	{
+		return "mysql";
+	}
+
+	/* 用户名和密码都作为参数绑定, 不拼接进SQL; AsyncSqlPool也使用这些语句 */
+	static const std::string SQL_QUERY_PASSWORD;
+	static const std::string SQL_INSERT_USER;
+	static const std::string SQL_QUERY_NAMES;
+};
+
+/*
+ * 内存用户表, 不依赖数据库: 全部用户保存在哈希表中, 新用户追加写入文件, 启动时读回
+ * 文件中每条记录为 用户名长度(4字节) 密码长度(4字节) 用户名 密码
+ * 用户不会修改或删除, 文件只追加, 不需要压缩; 末尾不完整的记录(写入时崩溃)在启动时截掉
+ */
+class MemUserStore : public UserStore
+{
+ public:
+	MemUserStore();
+	~MemUserStore();
+
+	/* 打开或创建文件并读入全部用户, 失败返回false */
+	bool Init(const std::string& path);
+
+	bool Query(const std::string& name, std::string& password, bool& isExist) override;
+	bool Insert(const std::string& name, const std::string& pwd) override;
+	bool LoadNames(const std::function<void(const std::string&)>& fn) override;
+
+	const char* Name() const override
+	{
+		return "file";
+	}
+
+ private:
+	int fd_;
+	off_t size_;  // 文件中完整记录的长度
+	std::string path_;
+	std::mutex mtx_;
+	std::unordered_map<std::string, std::string> users_;
+};
+
+#endif //USER_STORE_H
@@ -0,0 +1,285 @@
+#include "accesslog.h"
+#include "log.h"
+#include "logcompress.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+#include <libgen.h>  // dirname
+#include <sys/stat.h>
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+	/* 在定长缓冲区中拼接一行, 超长的字段被截断, 总能放下结尾的换行 */
+	class LineWriter
+	{
+	 public:
+		LineWriter(char* buff, size_t size) : buff_(buff), end_(size - 1), len_(0)
+		{
+		}
+
+		void Append(const char* str)
+		{
+			if (!str || !*str)
+			{ str = "-"; }
+			while (*str && len_ < end_)
+			{ buff_[len_++] = *str++; }
+		}
+
+		void Append(char c)
+		{
+			if (len_ < end_)
+			{ buff_[len_++] = c; }
+		}
+
+		void AppendNum(long long num)
+		{
+			char tmp[24];
+			snprintf(tmp, sizeof(tmp), "%lld", num);
+			Append(tmp);
+		}
+
+		/* 与Apache相同, '"'和'\\'前加'\\', 控制字符和非ASCII字节输出为\xHH */
+		void AppendEscaped(const char* str)
+		{
+			if (!str || !*str)
+			{
+				Append('-');
+				return;
+			}
+			static const char HEX[] = "0123456789abcdef";
+			for (; *str && len_ + 4 < end_; str++)
+			{
+				unsigned char c = *str;
+				if (c == '"' || c == '\\')
+				{
+					buff_[len_++] = '\\';
+					buff_[len_++] = c;
+				}
+				else if (c < 0x20 || c >= 0x7f)
+				{
+					buff_[len_++] = '\\';
+					buff_[len_++] = 'x';
+					buff_[len_++] = HEX[c >> 4];
+					buff_[len_++] = HEX[c & 0xf];
+				}
+				else
+				{ buff_[len_++] = c; }
+			}
+		}
+
+		size_t Finish()
+		{
+			buff_[len_++] = '\n';
+			return len_;
+		}
+
+	 private:
+		char* buff_;
+		size_t end_;
+		size_t len_;
+	};
+}
+
+AccessLog::AccessLog()
+{
+	fd_ = -1;
+	size_ = 0;
+	openTime_ = 0;
+	isOpen_ = false;
+	isClose_ = false;
+	dropped_ = 0;
+}
+
+AccessLog::~AccessLog()
+{
+	Close();
+}
+
+AccessLog* AccessLog::Instance()
+{
+	static AccessLog inst;
+	return &inst;
+}
+
+bool AccessLog::Init(const char* path)
+{
+	lock_guard<mutex> locker(mtx_);
+	assert(!thread_);
+	path_ = path;
+	if (!OpenFile_())
+	{ return false; }
+	isOpen_ = true;
+	thread_.reset(new thread([this] { Run_(); }));
+	return true;
+}
+
+void AccessLog::Close()
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (!thread_ || isClose_)
+		{ return; }
+		isOpen_ = false;
+		isClose_ = true;
+	}
+	cond_.notify_one();
+	thread_->join();  // 退出前写完所有缓冲区
+	lock_guard<mutex> locker(mtx_);
+	close(fd_);
+	fd_ = -1;
+}
+
+bool AccessLog::OpenFile_()
+{
+	int fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (fd < 0)
+	{
+		// 目录不存在时创建
+		string dir = path_;
+		mkdir(dirname(&dir[0]), 0777);
+		fd = open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	}
+	if (fd < 0)
+	{
+		LOG_ERROR("AccessLog open %s error: %d", path_.c_str(), errno);
+		return false;
+	}
+	struct stat st;
+	size_ = fstat(fd, &st) == 0 ? st.st_size : 0;
+	openTime_ = time(nullptr);
+	if (fd_ >= 0)
+	{ close(fd_); }
+	fd_ = fd;
+	return true;
+}
+
+void AccessLog::CheckRotate_()
+{
+	time_t now = time(nullptr);
+	bool isFull = ACCESS_LOG_ROTATE_SIZE > 0 && size_ >= (off_t)ACCESS_LOG_ROTATE_SIZE;
+	bool isOld = ACCESS_LOG_ROTATE_SEC > 0 && now - openTime_ >= ACCESS_LOG_ROTATE_SEC;
+	if (!isFull && !isOld)
+	{ return; }
+	if (size_ == 0)
+	{
+		openTime_ = now;  // 空文件不轮转
+		return;
+	}
+
+	struct tm t;
+	localtime_r(&now, &t);
+	char suffix[32];
+	strftime(suffix, sizeof(suffix), ".%Y%m%d-%H%M%S", &t);
+	/* 同一秒内轮转多次时加序号, 不覆盖已有文件 */
+	string newName = path_ + suffix;
+	for (int i = 1; access(newName.c_str(), F_OK) == 0 || access((newName + ".gz").c_str(), F_OK) == 0; i++)
+	{ newName = path_ + suffix + "-" + to_string(i); }
+	if (rename(path_.c_str(), newName.c_str()) < 0)
+	{
+		LOG_ERROR("AccessLog rename %s error: %d", path_.c_str(), errno);
+		openTime_ = now;
+		return;
+	}
+	OpenFile_();
+	if (LOG_COMPRESS)
+	{ LogCompress::Instance()->Add(newName); }
+}
+
+bool AccessLog::Sample()
+{
+	if (!isOpen_)
+	{ return false; }
+	if (ACCESS_LOG_SAMPLE <= 1)
+	{ return true; }
+	static thread_local unsigned int count = 0;
+	return ++count % ACCESS_LOG_SAMPLE == 0;
+}
+
+void AccessLog::Write(const AccessEntry& entry)
+{
+	/* 时间部分每秒格式化一次 */
+	static thread_local time_t lastSec = -1;
+	static thread_local char timeStr[40];
+	time_t now = time(nullptr);
+	if (now != lastSec)
+	{
+		struct tm t;
+		localtime_r(&now, &t);
+		strftime(timeStr, sizeof(timeStr), "[%d/%b/%Y:%H:%M:%S %z]", &t);
+		lastSec = now;
+	}
+
+	char buff[LINE_LEN];
+	LineWriter line(buff, sizeof(buff));
+	line.Append(entry.ip);
+	line.Append(" - ");
+	line.AppendEscaped(entry.user);
+	line.Append(' ');
+	line.Append(timeStr);
+	line.Append(" \"");
+	line.AppendEscaped(entry.method);
+	line.Append(' ');
+	line.AppendEscaped(entry.target);
+	line.Append(" HTTP/");
+	line.Append(entry.version);
+	line.Append("\" ");
+	line.AppendNum(entry.code);
+	line.Append(' ');
+	if (entry.bytes > 0)
+	{ line.AppendNum(entry.bytes); }
+	else
+	{ line.Append('-'); }
+	line.Append(" \"");
+	line.AppendEscaped(entry.referer);
+	line.Append("\" \"");
+	line.AppendEscaped(entry.agent);
+	line.Append("\" ");
+	line.AppendNum(entry.durationUs);
+	size_t len = line.Finish();
+
+	LogRing* ring = rings_.Local();
+	int retry = 0;
+	while (!ring->Write(buff, len))
+	{
+		/* 缓冲区满: 唤醒后台线程并等待, 磁盘跟不上时丢弃, 不阻塞工作线程 */
+		if (retry == 0)
+		{ cond_.notify_one(); }
+		if (++retry > FULL_RETRY)
+		{
+			dropped_++;
+			return;
+		}
+		this_thread::yield();
+	}
+	if (ring->Size() > ring->Capacity() / 2)
+	{ cond_.notify_one(); }
+}
+
+void AccessLog::WriteRings_()
+{
+	iov_.clear();
+	rings_.Peek(iov_, [this](const struct iovec*, int, size_t len) { size_ += len; });
+	if (!iov_.empty())
+	{ WritevAll(fd_, iov_.data(), iov_.size()); }
+	rings_.Consume();
+
+	unsigned long dropped = dropped_.exchange(0);
+	if (dropped > 0)
+	{ LOG_WARN("AccessLog: %lu records dropped", dropped); }
+}
+
+void AccessLog::Run_()
+{
+	unique_lock<mutex> locker(mtx_);
+	while (!isClose_)
+	{
+		cond_.wait_for(locker, chrono::milliseconds(LOG_FLUSH_MS));
+		WriteRings_();
+		CheckRotate_();
+	}
+	WriteRings_();
+}
\ No newline at end of file
@@ -0,0 +1,82 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include <stdint.h>
+#include <sys/types.h>
+#include "logring.h"
+#include "../config/config.h"
+
+/* 一个请求的访问记录, 字符串为空或nullptr时输出"-" */
+struct AccessEntry
+{
+	const char* ip;
+	const char* user;
+	const char* method;
+	const char* target;  // 请求行中的原始路径
+	const char* version;  // "1.1", "2"
+	int code;
+	size_t bytes;  // 已发送的响应体字节数
+	const char* referer;
+	const char* agent;
+	int64_t durationUs;  // 收到请求到响应发送完毕
+};
+
+/*
+ * 访问日志, Combined Log Format, 末尾附加处理时间(微秒), 如
+ * 127.0.0.1 - alice [19/Oct/2026:10:21:03 +0800] "GET /index.html HTTP/1.1" 200 3120 "-" "curl/8.5.0" 412
+ * 与Log相同, 每个线程写自己的LogRing, 后台线程定时收集, 一次writev追加到O_APPEND打开的文件
+ * 文件超过ACCESS_LOG_ROTATE_SIZE字节或打开超过ACCESS_LOG_ROTATE_SEC秒时, 后台线程将其改名为"文件名.年月日-时分秒"并重新打开, LOG_COMPRESS时再压缩为.gz
+ */
+class AccessLog
+{
+ public:
+	static AccessLog* Instance();
+
+	bool Init(const char* path);
+	void Close();
+
+	bool IsOpen() const
+	{
+		return isOpen_;
+	}
+
+	/* 是否记录当前请求(每个线程每ACCESS_LOG_SAMPLE个记录一个), 返回false时不需要生成记录 */
+	bool Sample();
+	void Write(const AccessEntry& entry);
+
+ private:
+	AccessLog();
+	~AccessLog();
+
+	void Run_();
+	/* 以下持有mtx_调用 */
+	void WriteRings_();
+	void CheckRotate_();
+	bool OpenFile_();
+
+	static const int LINE_LEN = 4096;
+	static const int FULL_RETRY = 1000;  // 缓冲区满时让出CPU的次数, 仍然满则丢弃
+
+	std::string path_;
+	int fd_;
+	off_t size_;
+	time_t openTime_;
+	std::atomic<bool> isOpen_;
+	bool isClose_;
+
+	LogRingSet<AccessLog> rings_;
+	std::vector<struct iovec> iov_;
+	std::atomic<unsigned long> dropped_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	std::unique_ptr<std::thread> thread_;
+};
+
+#endif //ACCESSLOG_H
\ No newline at end of file
@@ -1,249 +1,627 @@
 #include "log.h"
+#include "logcompress.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
 
 using namespace std;
 
-Log::Log()
+namespace
+{
+	/* 按时间或字节数同步时, 关闭文件前也同步 */
+	const bool SYNC_ON_CLOSE = LOG_FSYNC_MS > 0 || LOG_FSYNC_BYTES > 0;
+
+	const long pageSize = sysconf(_SC_PAGESIZE);
+}
+
+atomic<int> Log::level_(Log::LEVEL_OFF);
+
+Log::Log() : rings_(Metrics::LOCK_LOG_RING), mtx_(Metrics::LOCK_LOG), ringMtx_(Metrics::LOCK_LOG_RING)
 {
 	lineCount_ = 0;
+	fileIndex_ = 0;
+	isOpen_ = false;
 	isAsync_ = false;
+	isBinary_ = false;
+	isClose_ = false;
 	writeThread_ = nullptr;
-	deque_ = nullptr;
 	toDay_ = 0;
-	fp_ = nullptr;
+	fd_ = -1;
+	fileSize_ = 0;
+	unsynced_ = 0;
+	map_ = nullptr;
+	mapSize_ = 0;
+	released_ = 0;
+	dropped_ = 0;
+	hasError_ = false;
+	droppedFormat_ = nullptr;
 }
 
 Log::~Log()
 {
 	if (writeThread_ && writeThread_->joinable())
 	{
-		while (!deque_->empty())
 		{
-			deque_->flush();
-		};
-		deque_->Close();
-		writeThread_->join();
+			lock_guard<ProfiledMutex> locker(mtx_);
+			isClose_ = true;
+		}
+		cond_.notify_one();
+		writeThread_->join();  // 退出前写完所有缓冲区
 	}
-	if (fp_)
+	lock_guard<ProfiledMutex> locker(mtx_);
+	isClose_ = true;
+	if (fd_ >= 0)
 	{
-		lock_guard<mutex> locker(mtx_);
-		flush();
-		fclose(fp_);
+		WriteRings_();
+		CloseFile_();
 	}
 }
 
 int Log::GetLevel()
 {
-	lock_guard<mutex> locker(mtx_);
-	return level_;
+	return level_.load(memory_order_relaxed);
 }
 
 void Log::SetLevel(int level)
 {
-	lock_guard<mutex> locker(mtx_);
-	level_ = level;
+	level_.store(level, memory_order_relaxed);
 }
 
 void Log::init(int level = 1,
 	const char* path,
 	const char* suffix,
-	int maxQueueSize)
+	int maxQueueSize,
+	bool isBinary)
 {
 	isOpen_ = true;
-	level_ = level;
-	if (maxQueueSize > 0)
+
+	// 设置文件名信息
+	time_t timer = time(nullptr);
+	struct tm t;
+	localtime_r(&timer, &t);
+	char fileName[LOG_NAME_LEN] = { 0 };
+
 	{
-		isAsync_ = true;  // 异步日志
-		if (!deque_)
+		lock_guard<ProfiledMutex> locker(mtx_);
+		if (fd_ >= 0)
 		{
-			/*
-			 * deque_为nullptr
-			 * 为deque_分配空间
-			 * 创建writeThread_线程
-			 * 刷新缓冲
-			 * 关闭现有文件指针
-			 * 创建和打开文件指针
-			 */
-			unique_ptr<BlockDeque<std::string>> newDeque(new BlockDeque<std::string>);
-            //	  deque_ = move(newDeque);
-			deque_.reset(newDeque.release());
-
-			std::unique_ptr<std::thread> NewThread(new thread(FlushLogThread));
-			//	  writeThread_ = move(NewThread);
-			writeThread_.reset(NewThread.release());
+			// 缓冲区中的日志写入现有文件
+			WriteRings_();
 		}
+		path_ = path;
+		suffix_ = suffix;
+		snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
+			path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
+		// 日志文件名： 路径/年_月_日
+		toDay_ = t.tm_mday;
+		lineCount_ = 0;
+		fileIndex_ = 0;
+		isBinary_ = isBinary;
+		if (isBinary_ && !droppedFormat_)
+		{ droppedFormat_ = RegisterFormat(2, "%lu log lines dropped"); }
+
+		bool isOk = OpenFile_(fileName);
+		printf("log file init path : %s\n", fileName);
+		assert(isOk);  // 文件创建失败，退出程序
+		(void)isOk;
 	}
-	else
+
+	isAsync_ = maxQueueSize > 0;
+	if (isAsync_ && !writeThread_)
 	{
-		isAsync_ = false;
+		// 异步日志, 创建后台写线程
+		writeThread_.reset(new thread(FlushLogThread));
 	}
+	SetLevel(level);  // 文件打开后才允许写日志
+}
 
-	lineCount_ = 0;
+bool Log::OpenFile_(const char* fileName)
+{
+	// 映射需要读写打开; 映射失败时再加上O_APPEND
+	int flags = LOG_MMAP ? O_RDWR | O_CREAT | O_CLOEXEC : O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC;
+	int fd = open(fileName, flags, 0644);
+	if (fd < 0)
+	{
+		// 文件目录不存在，则创建目录
+		mkdir(path_, 0777);  // 权限，所有人可读可写可执行
+		fd = open(fileName, flags, 0644);
+	}
+	if (fd < 0)
+	{ return false; }
+	if (fd_ >= 0)
+	{ CloseFile_(); }
+	fd_ = fd;
+	fileName_ = fileName;
+	struct stat st;
+	fileSize_ = fstat(fd_, &st) == 0 ? st.st_size : 0;
+	unsynced_ = 0;
+	if (LOG_MMAP && !MapFile_())
+	{
+		fprintf(stderr, "log file mmap error: %s %d\n", fileName, errno);
+		fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_APPEND);
+	}
+	if (isBinary_)
+	{ WriteHeader_(); }
+	return true;
+}
 
-	// 设置文件名信息
+bool Log::MapFile_()
+{
+	/* 预分配一个段并映射, 从已有内容的末尾继续写 */
+	off_t size = fileSize_;
+	if (size > (off_t)LOG_MMAP_SEGMENT)
+	{ return false; }
+	// 不支持fallocate的文件系统上退回稀疏文件
+	if (fallocate(fd_, 0, 0, LOG_MMAP_SEGMENT) < 0 && ftruncate(fd_, LOG_MMAP_SEGMENT) < 0)
+	{ return false; }
+	void* map = mmap(nullptr, LOG_MMAP_SEGMENT, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if (map == MAP_FAILED)
+	{
+		if (ftruncate(fd_, size) < 0)
+		{ fprintf(stderr, "log file truncate error: %d\n", errno); }
+		return false;
+	}
+	map_ = (char*)map;
+	mapSize_ = LOG_MMAP_SEGMENT;
+	released_ = 0;
+	fileSize_ = FindEnd_(size);
+	return true;
+}
+
+off_t Log::FindEnd_(off_t size)
+{
+	/* 正常关闭的文件已截掉预分配的部分; 崩溃后长度为整个段, 末尾是0 */
+	if (!isBinary_)
+	{
+		while (size > 0 && map_[size - 1] == '\0')
+		{ size--; }
+		return size;
+	}
+	off_t pos = 0;
+	while (size - pos >= (off_t)sizeof(logbin::RecordHead))
+	{
+		uint32_t len;
+		memcpy(&len, map_ + pos, 4);
+		if (len < sizeof(logbin::RecordHead) || len > size - pos)
+		{ break; }
+		pos += len;
+	}
+	return pos;
+}
+
+void Log::Unmap_()
+{
+	/* 截掉映射中未写的部分, 之后用O_APPEND写 */
+	munmap(map_, mapSize_);
+	map_ = nullptr;
+	mapSize_ = 0;
+	if (ftruncate(fd_, fileSize_) < 0)
+	{ fprintf(stderr, "log file truncate error: %d\n", errno); }
+	fcntl(fd_, F_SETFL, fcntl(fd_, F_GETFL) | O_APPEND);
+}
+
+void Log::ReleaseMapped_()
+{
+	/* 写入位置之前的页开始回写并解除映射, 已写完的日志不常驻进程内存 */
+	off_t end = fileSize_ & ~(off_t)(pageSize - 1);
+	if (!map_ || end - released_ < (off_t)LOG_MMAP_RELEASE)
+	{ return; }
+	msync(map_ + released_, end - released_, MS_ASYNC);
+	madvise(map_ + released_, end - released_, MADV_DONTNEED);
+	released_ = end;
+}
+
+void Log::CloseFile_()
+{
+	if (map_)
+	{ Unmap_(); }
+	if (SYNC_ON_CLOSE && unsynced_ > 0)
+	{ fdatasync(fd_); }
+	close(fd_);
+	fd_ = -1;
+}
+
+void Log::WriteHeader_()
+{
+	/* 每个文件都从HEADER和全部格式串开始, 可以单独解码 */
+	char buff[sizeof(logbin::RecordHead) + sizeof(logbin::FileHeader)];
+	logbin::RecordHead head = { sizeof(buff), logbin::HEADER, 0, 0, 0, logbin::NowNs(CLOCK_MONOTONIC) };
+	logbin::FileHeader header = { logbin::MAGIC, logbin::VERSION, logbin::NowNs(CLOCK_REALTIME) };
+	memcpy(buff, &head, sizeof(head));
+	memcpy(buff + sizeof(head), &header, sizeof(header));
+	struct iovec iov = { buff, sizeof(buff) };
+	WriteFile_(&iov, 1);
+	for (auto logFormat : written_)
+	{ WriteFormat_(*logFormat); }
+}
+
+void Log::WriteNewFormats_()
+{
+	/* 在写出使用它的日志之前调用: 日志写入缓冲区时格式串已经登记 */
+	if (!isBinary_)
+	{ return; }
+	lock_guard<ProfiledMutex> locker(ringMtx_);
+	for (size_t i = written_.size(); i < formats_.size(); i++)
+	{
+		WriteFormat_(*formats_[i]);
+		written_.push_back(formats_[i].get());
+	}
+}
+
+void Log::WriteFormat_(const LogFormat& logFormat)
+{
+	size_t len = strlen(logFormat.format);
+	logbin::RecordHead head = { (uint32_t)(sizeof(head) + len), logbin::FORMAT,
+		(uint16_t)logFormat.level, logFormat.id, 0, 0 };
+	struct iovec iov[2] = { { &head, sizeof(head) }, { const_cast<char*>(logFormat.format), len } };
+	WriteFile_(iov, 2);
+}
+
+const LogFormat* Log::RegisterFormat(int level, const char* format)
+{
+	unique_ptr<LogFormat> logFormat(new LogFormat);
+	logFormat->level = level;
+	logFormat->format = format;
+	logFormat->fixedSize = 0;
+	vector<logbin::FormatSpec> specs;
+	logbin::ParseFormat(format, specs);
+	for (const auto& spec : specs)
+	{
+		logFormat->args.insert(logFormat->args.end(), spec.stars, logbin::ARG_INT);
+		if (spec.type != logbin::ARG_NONE)
+		{ logFormat->args.push_back(spec.type); }
+	}
+	for (auto type : logFormat->args)
+	{ logFormat->fixedSize += (type == logbin::ARG_STRING ? 2 : 8); }
+
+	// 由写文件的线程在使用它的日志之前写入文件
+	lock_guard<ProfiledMutex> locker(ringMtx_);
+	logFormat->id = formats_.size();
+	formats_.push_back(move(logFormat));
+	return formats_.back().get();
+}
+
+void Log::CheckFile_(bool isFull)
+{
+	/* 是否需要创建新文件
+	 * 系统日期改变到下一天, 日志条数超过限制, 文件超过LOG_ROTATE_SIZE, 或映射的段已写满(isFull)
+	 */
 	time_t timer = time(nullptr);
-	struct tm* sysTime = localtime(&timer);
-	struct tm t = *sysTime;
-	path_ = path;
-	suffix_ = suffix;
-	char fileName[LOG_NAME_LEN] = { 0 };
-	snprintf(fileName, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
-		path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
-	// 日志文件名： 路径/年_月_日
-	toDay_ = t.tm_mday;
+	struct tm t;
+	localtime_r(&timer, &t);
+	if (!isFull && toDay_ == t.tm_mday && lineCount_ < MAX_LINES
+		&& (LOG_ROTATE_SIZE <= 0 || fileSize_ < (off_t)LOG_ROTATE_SIZE))
+	{ return; }
 
+	char newFile[LOG_NAME_LEN];
+	if (toDay_ != t.tm_mday)
+	{
+		snprintf(newFile, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d%s",
+			path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, suffix_);
+		toDay_ = t.tm_mday;
+		fileIndex_ = 0;
+	}
+	else
 	{
-		lock_guard<mutex> locker(mtx_);
-		buff_.RetrieveAll();
-		if (fp_)
+		/* 跳过之前运行时创建的文件(包括已压缩的) */
+		struct stat st;
+		do
 		{
-			// 将缓冲写入现有文件指针,
-			flush();  // 通知deque_的pop操作, 将字符串写入fp_
-			fclose(fp_);
-		}
+			fileIndex_++;
+			snprintf(newFile, LOG_NAME_LEN - 1, "%s/%04d_%02d_%02d-%d%s",
+				path_, t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, fileIndex_, suffix_);
+		} while (stat(newFile, &st) == 0 || stat((string(newFile) + ".gz").c_str(), &st) == 0);
+	}
+	lineCount_ = 0;
+	string oldFile = fileName_;
+	if (!OpenFile_(newFile))
+	{
+		fprintf(stderr, "log file open error: %s\n", newFile);
+		return;
+	}
+	// 退出时Log析构, LogCompress已经先析构
+	if (LOG_COMPRESS && !isClose_ && oldFile != fileName_)
+	{ LogCompress::Instance()->Add(oldFile); }
+}
 
-		fp_ = fopen(fileName, "a");
-		// 已append模式打开fileName
-		if (fp_ == nullptr)
-		{
-			// 文件目录不存在，则创建目录
-			mkdir(path_, 0777);  // 权限，所有人可读可写可执行
-			fp_ = fopen(fileName, "a");
-		}
-		printf("log file init path : %s\n", fileName);
-		assert(fp_ != nullptr);  // fp创建失败，退出程序
+void Log::CheckSync_()
+{
+	bool hasError = hasError_.exchange(false, memory_order_relaxed);
+	if (unsynced_ == 0)
+	{ return; }
+	auto now = chrono::steady_clock::now();
+	if ((LOG_FSYNC_ON_ERROR && hasError)
+		|| (LOG_FSYNC_BYTES > 0 && unsynced_ >= (size_t)LOG_FSYNC_BYTES)
+		|| (LOG_FSYNC_MS > 0 && now - lastSync_ >= chrono::milliseconds(LOG_FSYNC_MS)))
+	{
+		if (fdatasync(fd_) < 0)
+		{ fprintf(stderr, "log file fdatasync error: %d\n", errno); }
+		unsynced_ = 0;
+		lastSync_ = now;
+	}
+}
+
+const char* Log::LevelTitle_(int level)
+{
+	switch (level)
+	{
+	case 0:
+		return "[debug]: ";
+	case 2:
+		return "[warn] : ";
+	case 3:
+		return "[error]: ";
+	default:
+		return "[info] : ";
 	}
 }
 
 void Log::write(int level, const char* format, ...)
 {
-	// 写入deque_, 指向阻塞队列
 	struct timeval now = { 0, 0 };
 	gettimeofday(&now, nullptr);
-	time_t tSec = now.tv_sec;
-	struct tm* sysTime = localtime(&tSec);
-	struct tm t = *sysTime;
+
+	/* 同一秒内复用格式化好的日期时间, 不必每行调用localtime */
+	static thread_local time_t lastSec = -1;
+	static thread_local char timeStr[32];
+	static thread_local int timeLen = 0;
+	if (now.tv_sec != lastSec)
+	{
+		struct tm t;
+		localtime_r(&now.tv_sec, &t);
+		timeLen = snprintf(timeStr, sizeof(timeStr), "%d-%02d-%02d %02d:%02d:%02d.",
+			t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+			t.tm_hour, t.tm_min, t.tm_sec);
+		lastSec = now.tv_sec;
+	}
+
+	char buff[LOG_LINE_LEN];
+	memcpy(buff, timeStr, timeLen);
+	int n = timeLen;
+	n += snprintf(buff + n, sizeof(buff) - n, "%06ld ", (long)now.tv_usec);
+	memcpy(buff + n, LevelTitle_(level), 9);
+	n += 9;
+
 	va_list vaList;
+	va_start(vaList, format);
+	int m = vsnprintf(buff + n, sizeof(buff) - n - 1, format, vaList);
+	va_end(vaList);
+	if (m < 0)
+	{ m = 0; }
+	if (n + m < LOG_LINE_LEN - 1)
+	{
+		buff[n + m] = '\n';
+		WriteLine_(buff, n + m + 1, level);
+		return;
+	}
 
-	/* 日志日期 日志行数 */
-	if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_ % MAX_LINES == 0)))
+	/* 超长的行 */
+	string line(buff, n);
+	line.resize(n + m + 1);
+	va_start(vaList, format);
+	vsnprintf(&line[n], m + 1, format, vaList);
+	va_end(vaList);
+	line[n + m] = '\n';
+	WriteLine_(line.data(), line.size(), level);
+}
+
+void Log::writeBinary(const LogFormat* logFormat, ...)
+{
+	/* 不格式化, 只复制参数的原始值; 字符串超过剩余空间时截断 */
+	char buff[LOG_LINE_LEN];
+	size_t pos = sizeof(logbin::RecordHead);
+	size_t room = sizeof(buff) - pos - min(logFormat->fixedSize, sizeof(buff) - pos);
+
+	va_list vaList;
+	va_start(vaList, logFormat);
+	for (auto type : logFormat->args)
 	{
-		/* 是否需要创建新文件
-		 * 系统日期改变到下一天, 或日志条数超过限制
-		*/
-		unique_lock<mutex> locker(mtx_);
-		locker.unlock();
-
-		char newFile[LOG_NAME_LEN];
-		char tail[36] = { 0 };
-		snprintf(tail, 36, "%04d_%02d_%02d",
-			t.tm_year + 1900,  // 自1900年起
-			t.tm_mon + 1,  // tm_mon表示月份, [0,11]
-			t.tm_mday);  //
-
-		if (toDay_ != t.tm_mday)
+		if (pos + 8 > sizeof(buff))
+		{ break; }
+		int64_t value = 0;
+		switch (type)
 		{
-			//
-			snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s%s",
-				path_,  // log
-				tail,   // xxxx_xx_xx
-				suffix_);  // .log
-			toDay_ = t.tm_mday;
-			lineCount_ = 0;
+		case logbin::ARG_INT:
+			value = va_arg(vaList, int);
+			break;
+		case logbin::ARG_LONG:
+			value = va_arg(vaList, long);
+			break;
+		case logbin::ARG_LLONG:
+			value = va_arg(vaList, long long);
+			break;
+		case logbin::ARG_DOUBLE:
+		case logbin::ARG_LDOUBLE:
+		{
+			double d = type == logbin::ARG_DOUBLE ? va_arg(vaList, double) : (double)va_arg(vaList, long double);
+			memcpy(&value, &d, 8);
+			break;
 		}
-		else
+		case logbin::ARG_PTR:
+			value = (intptr_t)va_arg(vaList, void*);
+			break;
+		case logbin::ARG_STRING:
 		{
-			snprintf(newFile, LOG_NAME_LEN - 72, "%s/%s-%d%s",
-				path_,  // log
-				tail,   // xxxx_xx_xx
-				(lineCount_ / MAX_LINES),  // 500001/500000 = 1
-				suffix_);  // .log
+			const char* str = va_arg(vaList, const char*);
+			if (!str)
+			{ str = "(null)"; }
+			uint16_t len = strnlen(str, min<size_t>(room, UINT16_MAX));
+			room -= len;
+			memcpy(buff + pos, &len, 2);
+			memcpy(buff + pos + 2, str, len);
+			pos += 2 + len;
+			continue;
 		}
-
-		locker.lock();  // 访问buff_和fp_的程序，需要加锁
-		flush();  // 刷新buff_.buffer_, 强制写入fp_
-		fclose(fp_);  // 关闭
-		fp_ = fopen(newFile, "a");
-		assert(fp_ != nullptr);
+		default:
+			break;
+		}
+		memcpy(buff + pos, &value, 8);
+		pos += 8;
 	}
+	va_end(vaList);
 
-	{
-		unique_lock<mutex> locker(mtx_);
-		lineCount_++;
-		// print to buff_.BeginWrite(),readPos_
-		// 将时间信息输入buff_
-		int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-			t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-			t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
+	logbin::RecordHead head = { (uint32_t)pos, logbin::ENTRY, (uint16_t)logFormat->level,
+		logFormat->id, 0, logbin::NowNs(CLOCK_MONOTONIC) };
+	memcpy(buff, &head, sizeof(head));
+	WriteLine_(buff, pos, logFormat->level);
+}
 
-		buff_.HasWritten(n);  // 更新buff_的writePos_位置
-		AppendLogLevelTitle_(level);
+void Log::WriteLine_(const char* line, size_t len, int level)
+{
+	if (level >= 3)
+	{ hasError_.store(true, memory_order_relaxed); }
+	if (isAsync_)
+	{
+		LogRing* ring = rings_.Local();
+		if (len > ring->Capacity())
+		{
+			/* 超过缓冲区大小的行截断, 二进制记录截断后无法解码, 丢弃 */
+			if (isBinary_)
+			{
+				dropped_++;
+				return;
+			}
+			string cut(line, ring->Capacity());
+			cut.back() = '\n';
+			WriteLine_(cut.data(), cut.size(), level);
+			return;
+		}
+		int retry = 0;
+		while (!ring->Write(line, len))
+		{
+			/* 缓冲区满: 唤醒后台线程并等待, 磁盘跟不上时丢弃, 不阻塞工作线程 */
+			if (retry == 0)
+			{ cond_.notify_one(); }
+			if (++retry > FULL_RETRY)
+			{
+				dropped_++;
+				return;
+			}
+			this_thread::yield();
+		}
+		if (level >= 3 || ring->Size() > ring->Capacity() / 2)
+		{ cond_.notify_one(); }
+		return;
+	}
 
-		va_start(vaList, format);  //  format表示日志条目的内容格式, 初始化valist
-		// snprintf的va_list版本
-		int m = vsnprintf(buff_.BeginWrite(),  // print位置
-			buff_.WritableBytes(),  // 最大空间 - writePos_
-			format,
-			vaList);
-		// 日志, 主体信息(除时间，等级以外的内容)
-		va_end(vaList);  // 回收vaList
+	// 同步日志, 直接写文件
+	lock_guard<ProfiledMutex> locker(mtx_);
+	WriteNewFormats_();
+	struct iovec iov = { const_cast<char*>(line), len };
+	WriteFile_(&iov, 1);
+	lineCount_++;
+	ReleaseMapped_();
+	CheckSync_();
+	CheckFile_();
+}
 
-		buff_.HasWritten(m);  // 更新buff_的writePos_位置
-		buff_.Append("\n\0", 2);  /// 尾端 + "\n\0"，用来刷新缓冲区
+void Log::WriteFile_(struct iovec* iov, int cnt)
+{
+	/* 每次调用写入的都是完整的行或记录, 段的剩余空间不够时整体写入下一个文件 */
+	size_t len = 0;
+	for (int i = 0; i < cnt; i++)
+	{ len += iov[i].iov_len; }
+	if (map_ && fileSize_ + len > mapSize_ && fileSize_ > 0)
+	{ CheckFile_(true); }
+	if (map_ && fileSize_ + len <= mapSize_)
+	{
+		for (int i = 0; i < cnt; i++)
+		{
+			memcpy(map_ + fileSize_, iov[i].iov_base, iov[i].iov_len);
+			fileSize_ += iov[i].iov_len;
+		}
+		unsynced_ += len;
+		return;
+	}
+	if (map_)
+	{ Unmap_(); }  // 比一个段还大, 写完后轮转
+	WritevAll(fd_, iov, cnt);
+	fileSize_ += len;
+	unsynced_ += len;
+}
 
-		if (isAsync_ && deque_ && !deque_->full())
+void Log::WriteRings_()
+{
+	// 持有mtx_, 同一时间只有一个线程读缓冲区
+	iov_.clear();
+	rings_.Peek(iov_, [this](const struct iovec* iov, int cnt, size_t len) {
+		if (isBinary_)
 		{
-			// 异步日志开启，将日志内容push_back到deque_
-			deque_->push_back(buff_.RetrieveAllToStr());
+			lineCount_ += CountRecords_(iov, len);
+			return;
 		}
-		else
+		for (int j = 0; j < cnt; j++)
 		{
-			fputs(buff_.Peek(), fp_);
+			const char* base = (const char*)iov[j].iov_base;
+			lineCount_ += count(base, base + iov[j].iov_len, '\n');
 		}
-		buff_.RetrieveAll();
+	});
+	// Peek之后再取格式串, 缓冲区中的记录使用的格式串都已登记
+	WriteNewFormats_();
+	if (!iov_.empty())
+	{ WriteFile_(iov_.data(), iov_.size()); }
+	rings_.Consume();
+
+	unsigned long dropped = dropped_.exchange(0);
+	if (dropped > 0 && isBinary_)
+	{
+		logbin::RecordHead head = { sizeof(head) + 8, logbin::ENTRY, (uint16_t)droppedFormat_->level,
+			droppedFormat_->id, 0, logbin::NowNs(CLOCK_MONOTONIC) };
+		struct iovec iov[2] = { { &head, sizeof(head) }, { &dropped, 8 } };
+		WriteFile_(iov, 2);
+		lineCount_++;
 	}
+	else if (dropped > 0)
+	{
+		char buff[128];
+		int n = snprintf(buff, sizeof(buff), "%s%lu log lines dropped\n", LevelTitle_(2), dropped);
+		struct iovec iov = { buff, (size_t)n };
+		WriteFile_(&iov, 1);
+		lineCount_++;
+	}
+	ReleaseMapped_();
+	CheckSync_();
+	CheckFile_();
 }
 
-void Log::AppendLogLevelTitle_(int level)
+size_t Log::CountRecords_(const struct iovec* iov, size_t len)
 {
-	switch (level)
+	/* 记录可能跨越环的末尾, 逐条读出长度 */
+	size_t n = 0;
+	for (size_t off = 0; off + 4 <= len; n++)
 	{
-	case 0:
-		buff_.Append("[debug]: ", 9);
-		break;
-	case 1:
-		buff_.Append("[info] : ", 9);
-		break;
-	case 2:
-		buff_.Append("[warn] : ", 9);
-		break;
-	case 3:
-		buff_.Append("[error]: ", 9);
-		break;
-	default:
-		buff_.Append("[info] : ", 9);
-		break;
+		uint32_t recordLen;
+		char* p = (char*)&recordLen;
+		for (size_t k = 0; k < 4; k++)
+		{
+			size_t i = off + k;
+			p[k] = i < iov[0].iov_len ? ((char*)iov[0].iov_base)[i] : ((char*)iov[1].iov_base)[i - iov[0].iov_len];
+		}
+		if (recordLen == 0)
+		{ break; }
+		off += recordLen;
 	}
+	return n;
 }
 
 void Log::flush()
 {
-	if (isAsync_)
-	{
-		deque_->flush();  // 通知deque_中条件等待的pop
-	}
-	fflush(fp_);  //  从缓冲强制写入fp_
+	lock_guard<ProfiledMutex> locker(mtx_);
+	if (fd_ >= 0)
+	{ WriteRings_(); }
 }
 
 void Log::AsyncWrite_()
 {
 	// 执行异步写日志动作
-	string str = "";
-	while (deque_->pop(str))
+	unique_lock<ProfiledMutex> locker(mtx_);
+	while (!isClose_)
 	{
-		lock_guard<mutex> locker(mtx_);
-//		printf("%s", str.c_str());
-		fputs(str.c_str(), fp_);
+		mtx_.WaitFor(cond_, locker, chrono::milliseconds(LOG_FLUSH_MS));
+		WriteRings_();
 	}
+	WriteRings_();
 }
 
 Log* Log::Instance()
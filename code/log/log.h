@@ -4,25 +4,58 @@
 #include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <sys/time.h>
 #include <string.h>
 #include <stdarg.h>           // vastart va_end
 #include <assert.h>
 #include <sys/stat.h>         //mkdir
-#include "blockqueue.h"
-#include "../buffer/buffer.h"
+#include "logring.h"
+#include "logformat.h"
+#include "../config/config.h"
+#include "../metrics/profmutex.h"
+
+/*
+ * 异步模式下每个线程把格式化好的行写入自己的LogRing, 不加锁, 不做系统调用
+ * 后台线程每LOG_FLUSH_MS(或被缓冲区过半/error日志唤醒)收集所有线程的缓冲区, 一次writev写入文件
+ * 同一批内按线程分组写出, 不同线程的行之间可能不严格按时间排序
+ * 文件轮转(按日期, 行数, LOG_ROTATE_SIZE), fdatasync和写入格式串都在后台线程中进行, 调用线程不访问文件
+ * 同步模式(maxQueueCapacity为0)下由调用线程写文件和轮转
+ * LOG_MMAP时文件预分配LOG_MMAP_SEGMENT字节并映射, 后台线程memcpy追加, 写满后轮转; 文件关闭前末尾是预分配的0
+ * 二进制模式下调用线程不做格式化, 只记录格式串编号, 时间和参数, 见logformat.h
+ */
+
+/* 二进制日志中一个调用点的格式串, 登记后不释放 */
+struct LogFormat
+{
+	uint32_t id;
+	int level;
+	const char* format;
+	std::vector<logbin::ArgType> args;  // 依次读取的参数类型, 包括'*'
+	size_t fixedSize;  // 参数占用的字节数, 不包括字符串内容
+};
 
 class Log
 {
  public:
+	/* maxQueueCapacity大于0为异步模式, 每个线程的缓冲区大小为LOG_RING_SIZE */
 	void init(int level, const char* path = "./log",
 		const char* suffix = ".log",
-		int maxQueueCapacity = 1024);
+		int maxQueueCapacity = 1024,
+		bool isBinary = false);
 
 	static Log* Instance();
 	static void FlushLogThread();  // 调用AsyncWrite()
 
 	void write(int level, const char* format, ...);
+	/* 二进制模式: 格式串只能是字符串常量, 每个调用点登记一次 */
+	const LogFormat* RegisterFormat(int level, const char* format);
+	void writeBinary(const LogFormat* logFormat, ...);
+	/* 在调用线程中写出所有缓冲区, 写日志不需要调用 */
 	void flush();
 
 	int GetLevel();
@@ -31,17 +64,45 @@ class Log
 	{
 		return isOpen_;
 	}
+	/* LOG_BASE在调用Instance()之前检查, 未init时所有级别都关闭 */
+	static bool IsEnabled(int level)
+	{
+		return level >= level_.load(std::memory_order_relaxed);
+	}
+	bool IsBinary()
+	{
+		return isBinary_;
+	}
 
  private:
 	Log();
-	void AppendLogLevelTitle_(int level);
+	static const char* LevelTitle_(int level);
 	virtual ~Log();
 	void AsyncWrite_();
+	void WriteLine_(const char* line, size_t len, int level);
+	/* 以下持有mtx_调用 */
+	void WriteRings_();
+	void WriteFile_(struct iovec* iov, int cnt);
+	void CheckFile_(bool isFull = false);
+	void CheckSync_();
+	bool OpenFile_(const char* fileName);
+	void CloseFile_();
+	bool MapFile_();
+	off_t FindEnd_(off_t size);
+	void Unmap_();
+	void ReleaseMapped_();
+	void WriteHeader_();
+	void WriteNewFormats_();
+	void WriteFormat_(const LogFormat& logFormat);
+	static size_t CountRecords_(const struct iovec* iov, size_t len);
 
  private:
 	static const int LOG_PATH_LEN = 256;
 	static const int LOG_NAME_LEN = 256;
+	static const int LOG_LINE_LEN = 1024;  // 超过的行在堆上格式化
 	static const int MAX_LINES = 50000;
+	static const int FULL_RETRY = 1000;  // 缓冲区满时让出CPU的次数, 仍然满则丢弃
+	static const int LEVEL_OFF = 4;
 
 	const char* path_;
 	const char* suffix_;
@@ -49,29 +110,53 @@ class Log
 	int MAX_LINES_;
 
 	int lineCount_;
+	int fileIndex_;  // 当天因行数或大小超过限制而创建的文件数
 	int toDay_;
+	std::string fileName_;
+	off_t fileSize_;
+	size_t unsynced_;  // 上次fdatasync之后写入的字节数
+	char* map_;  // LOG_MMAP时映射的整个段, fileSize_为写入位置
+	size_t mapSize_;
+	off_t released_;  // 之前的页已madvise(MADV_DONTNEED)
+	std::chrono::steady_clock::time_point lastSync_;
 
 	bool isOpen_;
 
-	Buffer buff_;
-	int level_;
+	static std::atomic<int> level_;  // 静态成员常量初始化, 读取时没有局部静态变量的初始化检查
 	bool isAsync_;
-
-	FILE* fp_;
-	std::unique_ptr<BlockDeque<std::string>> deque_;
+	bool isBinary_;
+	bool isClose_;
+
+	int fd_;
+	LogRingSet<Log> rings_;
+	std::vector<std::unique_ptr<LogFormat>> formats_;  // 下标为编号
+	std::vector<const LogFormat*> written_;  // 已写入当前文件的格式串
+	std::vector<struct iovec> iov_;
+	const LogFormat* droppedFormat_;
+	std::atomic<unsigned long> dropped_;
+	std::atomic<bool> hasError_;  // 有未同步的error日志
+	std::condition_variable cond_;
 	std::unique_ptr<std::thread> writeThread_;
-	std::mutex mtx_;
+	ProfiledMutex mtx_;  // 文件, 由后台线程持有; 写文件期间调用线程只会等待ringMtx_
+	ProfiledMutex ringMtx_;  // formats_
 };
 
+/*
+ * 只写入调用线程的缓冲区, 由后台线程写文件, 调用方不flush
+ * 低于LOG_LEVEL_MIN的级别在编译时去掉; 运行时级别只读一个原子变量, 关闭时不计算参数
+ */
 #define LOG_BASE(level, format, ...) \
     do {\
-        Log* log = Log::Instance();\
-        if (log->IsOpen() && log->GetLevel() <= level) {\
-            log->write(level, format, ##__VA_ARGS__);   \
-            log->flush();\
+        if ((level) >= LOG_LEVEL_MIN && Log::IsEnabled(level)) {\
+            Log* log = Log::Instance();\
+            if (log->IsBinary()) {\
+                static const LogFormat* logFormat = log->RegisterFormat(level, format);\
+                log->writeBinary(logFormat, ##__VA_ARGS__);\
+            } else {\
+                log->write(level, format, ##__VA_ARGS__);   \
+            }\
         }                            \
     } while(0);
-// log->flush()将deque_->buff_中的内容写入文件
 
 #define LOG_DEBUG(format, ...) do {LOG_BASE(0, format, ##__VA_ARGS__)} while(0)
 #define LOG_INFO(format, ...) do {LOG_BASE(1, format, ##__VA_ARGS__)} while(0)
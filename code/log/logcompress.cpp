@@ -0,0 +1,119 @@
+#include "logcompress.h"
+#include "log.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <zlib.h>
+
+using namespace std;
+
+LogCompress::LogCompress()
+{
+	isClose_ = false;
+}
+
+LogCompress::~LogCompress()
+{
+	Close();
+}
+
+LogCompress* LogCompress::Instance()
+{
+	static LogCompress inst;
+	return &inst;
+}
+
+void LogCompress::Add(const string& path)
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (isClose_)
+		{ return; }  // 退出后轮转的文件保持不压缩
+		queue_.push_back(path);
+		if (!thread_)
+		{ thread_.reset(new thread([this] { Run_(); })); }
+	}
+	cond_.notify_one();
+}
+
+void LogCompress::Close()
+{
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (isClose_)
+		{ return; }
+		isClose_ = true;
+	}
+	cond_.notify_one();
+	if (thread_ && thread_->joinable())
+	{ thread_->join(); }
+}
+
+void LogCompress::Run_()
+{
+	unique_lock<mutex> locker(mtx_);
+	while (true)
+	{
+		cond_.wait(locker, [this] { return isClose_ || !queue_.empty(); });
+		if (queue_.empty())
+		{ break; }
+		string path = move(queue_.front());
+		queue_.pop_front();
+		locker.unlock();
+		if (Compress_(path))
+		{ LOG_DEBUG("log compressed: %s.gz", path.c_str()); }
+		locker.lock();
+	}
+}
+
+bool LogCompress::Compress_(const string& path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+	{
+		LOG_ERROR("log compress open %s error: %d", path.c_str(), errno);
+		return false;
+	}
+	string gzPath = path + ".gz";
+	int gzFd = open(gzPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	off_t oldSize = gzFd < 0 ? 0 : lseek(gzFd, 0, SEEK_END);
+	gzFile gz = gzFd < 0 ? nullptr : gzdopen(dup(gzFd), "ab");
+	if (!gz)
+	{
+		LOG_ERROR("log compress open %s error: %d", gzPath.c_str(), errno);
+		close(fd);
+		if (gzFd >= 0)
+		{ close(gzFd); }
+		return false;
+	}
+
+	char buff[64 * 1024];
+	ssize_t n;
+	bool isOk = true;
+	while (isOk && (n = read(fd, buff, sizeof(buff))) != 0)
+	{
+		if (n < 0)
+		{
+			isOk = errno == EINTR;
+			continue;
+		}
+		isOk = gzwrite(gz, buff, n) == n;
+	}
+	isOk = gzclose(gz) == Z_OK && isOk;
+	/* .gz落盘后才删除原文件, 崩溃时至少保留一份 */
+	isOk = isOk && fdatasync(gzFd) == 0;
+	if (!isOk)
+	{
+		// 去掉写了一半的gzip成员, 保留原文件
+		LOG_ERROR("log compress %s error: %d", path.c_str(), errno);
+		if (oldSize == 0)
+		{ unlink(gzPath.c_str()); }
+		else if (ftruncate(gzFd, oldSize) < 0)
+		{ LOG_ERROR("log compress truncate %s error: %d", gzPath.c_str(), errno); }
+	}
+	close(gzFd);
+	close(fd);
+	if (isOk)
+	{ unlink(path.c_str()); }
+	return isOk;
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef LOGCOMPRESS_H
+#define LOGCOMPRESS_H
+
+#include <mutex>
+#include <string>
+#include <thread>
+#include <deque>
+#include <memory>
+#include <condition_variable>
+
+/*
+ * 轮转后的日志文件由后台线程用zlib压缩为"文件名.gz", 写入并同步到磁盘后删除原文件
+ * 写日志的线程只把文件名加入队列; 退出时压缩完队列中的文件
+ * 已有同名.gz时追加为新的gzip成员, zcat和bin/logdecode都能读出全部内容
+ */
+class LogCompress
+{
+ public:
+	static LogCompress* Instance();
+
+	/* 第一次调用时创建后台线程 */
+	void Add(const std::string& path);
+	void Close();
+
+ private:
+	LogCompress();
+	~LogCompress();
+
+	void Run_();
+	static bool Compress_(const std::string& path);
+
+	bool isClose_;
+	std::deque<std::string> queue_;
+	std::mutex mtx_;
+	std::condition_variable cond_;
+	std::unique_ptr<std::thread> thread_;
+};
+
+#endif //LOGCOMPRESS_H
\ No newline at end of file
@@ -0,0 +1,140 @@
+#ifndef LOGFORMAT_H
+#define LOGFORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+/*
+ * 二进制日志格式, Log和离线解码工具logdecode共用
+ * 文件由连续的记录组成, 每条记录以RecordHead开头, len为包括头部的总长度
+ *   HEADER: 每次打开文件时写入, 内容为FileHeader, ns为此时的单调时钟, 解码时用来换算实际时间
+ *   FORMAT: 登记一个调用点的格式串, 内容为格式串(不含'\0'); 每个HEADER之后重新登记所有格式串
+ *   ENTRY:  一条日志, 内容为参数的原始值: 字符串为2字节长度+内容, 其他参数都是8字节
+ * 同一个文件可能有多次启动追加的内容, 格式串编号只在两个HEADER之间有效
+ */
+namespace logbin
+{
+	const uint32_t MAGIC = 0x474c4257;  // "WBLG"
+	const uint32_t VERSION = 1;
+
+	enum RecordType
+	{
+		HEADER = 1,
+		FORMAT = 2,
+		ENTRY = 3,
+	};
+
+	struct RecordHead
+	{
+		uint32_t len;
+		uint16_t type;
+		uint16_t level;
+		uint32_t id;  // 格式串编号
+		uint32_t reserved;
+		int64_t ns;  // CLOCK_MONOTONIC
+	};
+
+	struct FileHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		int64_t realNs;  // 与RecordHead::ns同时取得的CLOCK_REALTIME
+	};
+
+	/* 参数读取时的类型(va_arg的类型), 不区分有无符号 */
+	enum ArgType
+	{
+		ARG_NONE,  // 不认识的转换, 不读取参数, 解码时原样输出
+		ARG_INT,
+		ARG_LONG,
+		ARG_LLONG,
+		ARG_DOUBLE,
+		ARG_LDOUBLE,  // 按double保存
+		ARG_STRING,
+		ARG_PTR,
+	};
+
+	/* 格式串中的一个转换说明, 不包括"%%" */
+	struct FormatSpec
+	{
+		size_t pos;
+		size_t len;
+		int stars;  // '*'宽度/精度的个数, 各占一个int参数, 在本参数之前
+		ArgType type;
+	};
+
+	/* 解析printf格式串 */
+	inline void ParseFormat(const char* format, std::vector<FormatSpec>& specs)
+	{
+		for (size_t i = 0; format[i]; i++)
+		{
+			if (format[i] != '%')
+			{ continue; }
+			FormatSpec spec;
+			spec.pos = i++;
+			spec.stars = 0;
+			if (format[i] == '%')
+			{ continue; }
+			while (format[i] && strchr("-+ #0'", format[i]))
+			{ i++; }
+			if (format[i] == '*')
+			{
+				spec.stars++;
+				i++;
+			}
+			while (format[i] >= '0' && format[i] <= '9')
+			{ i++; }
+			if (format[i] == '.')
+			{
+				i++;
+				if (format[i] == '*')
+				{
+					spec.stars++;
+					i++;
+				}
+				while (format[i] >= '0' && format[i] <= '9')
+				{ i++; }
+			}
+			/* 长度: 0无 1为l 2为ll 3为L; size_t, ptrdiff_t, intmax_t都是long */
+			int length = 0;
+			while (format[i] && strchr("hlLqjzZt", format[i]))
+			{
+				char c = format[i++];
+				if (c == 'l')
+				{ length++; }
+				else if (c == 'q')
+				{ length = 2; }
+				else if (c == 'L')
+				{ length = 3; }
+				else if (c != 'h')
+				{ length = 1; }
+			}
+			char c = format[i];
+			if (!c)
+			{ break; }
+			spec.len = i - spec.pos + 1;
+			if (strchr("diouxXc", c))
+			{ spec.type = length == 0 ? ARG_INT : (length == 1 ? ARG_LONG : ARG_LLONG); }
+			else if (strchr("eEfFgGaA", c))
+			{ spec.type = length == 3 ? ARG_LDOUBLE : ARG_DOUBLE; }
+			else if (c == 's')
+			{ spec.type = ARG_STRING; }
+			else if (c == 'p' || c == 'n')
+			{ spec.type = ARG_PTR; }
+			else
+			{ spec.type = ARG_NONE; }
+			specs.push_back(spec);
+		}
+	}
+
+	inline int64_t NowNs(clockid_t clock)
+	{
+		struct timespec ts;
+		clock_gettime(clock, &ts);
+		return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+}
+
+#endif //LOGFORMAT_H
@@ -0,0 +1,212 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>  // IOV_MAX
+#include <sys/uio.h>  // iovec, writev
+#include "../config/config.h"
+#include "../metrics/profmutex.h"
+
+/*
+ * 单生产者单消费者的字节环形缓冲区, 每个写日志的线程一个
+ * 生产者(所属线程)只修改head_, 消费者(后台写线程)只修改tail_, 两边都不加锁
+ * 一行日志全部写入后才更新head_, 消费者看到的总是完整的行
+ */
+class LogRing
+{
+ public:
+	explicit LogRing(size_t capacity) : capacity_(RoundUp_(capacity)), data_(new char[capacity_])
+	{
+		head_ = 0;
+		tail_ = 0;
+		isDetached_ = false;
+	}
+
+	/* 生产者: 剩余空间不足时不写入, 返回false */
+	bool Write(const char* str, size_t len)
+	{
+		size_t head = head_.load(std::memory_order_relaxed);
+		if (capacity_ - (head - tail_.load(std::memory_order_acquire)) < len)
+		{ return false; }
+		size_t pos = head & (capacity_ - 1);
+		size_t n = std::min(len, capacity_ - pos);
+		memcpy(data_.get() + pos, str, n);
+		memcpy(data_.get(), str + n, len - n);
+		head_.store(head + len, std::memory_order_release);
+		return true;
+	}
+
+	/* 消费者: 可读的数据在环的末尾处分为最多两段, 填入iov并返回段数, len为总长度 */
+	int Peek(struct iovec* iov, size_t& len) const
+	{
+		size_t tail = tail_.load(std::memory_order_relaxed);
+		len = head_.load(std::memory_order_acquire) - tail;
+		if (len == 0)
+		{ return 0; }
+		size_t pos = tail & (capacity_ - 1);
+		size_t n = std::min(len, capacity_ - pos);
+		iov[0].iov_base = data_.get() + pos;
+		iov[0].iov_len = n;
+		if (n == len)
+		{ return 1; }
+		iov[1].iov_base = data_.get();
+		iov[1].iov_len = len - n;
+		return 2;
+	}
+
+	/* 消费者: 数据写出后释放空间 */
+	void Consume(size_t len)
+	{
+		tail_.store(tail_.load(std::memory_order_relaxed) + len, std::memory_order_release);
+	}
+
+	size_t Size() const
+	{
+		return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+	}
+
+	size_t Capacity() const
+	{
+		return capacity_;
+	}
+
+	/* 所属线程退出, 消费者写空后释放 */
+	void Detach()
+	{
+		isDetached_.store(true, std::memory_order_release);
+	}
+
+	bool IsDetached() const
+	{
+		return isDetached_.load(std::memory_order_acquire);
+	}
+
+ private:
+	static size_t RoundUp_(size_t n)
+	{
+		size_t cap = 64;
+		while (cap < n)
+		{ cap <<= 1; }
+		return cap;
+	}
+
+	const size_t capacity_;  // 2的幂, 位置取模用与运算
+	std::unique_ptr<char[]> data_;
+	/* head_和tail_分别由两个线程写, 放在不同的缓存行 */
+	std::atomic<size_t> head_;
+	char pad_[64];
+	std::atomic<size_t> tail_;
+	std::atomic<bool> isDetached_;
+};
+
+/*
+ * 所有写过日志的线程的LogRing(每个LOG_RING_SIZE字节), Log和AccessLog各一个, 以Owner区分线程局部的缓冲区
+ * 线程第一次写入时注册, 线程退出时Detach, 消费者写空后释放
+ * Peek和Consume只由消费者调用(调用方保证同一时间只有一个), 收集期间注册新缓冲区不会等待写文件
+ */
+template<class Owner>
+class LogRingSet
+{
+ public:
+	explicit LogRingSet(Metrics::LockSite site = Metrics::LOCK_NONE) : mtx_(site) {}
+
+	/* 调用线程的缓冲区, 第一次调用时创建并注册, 只有这里需要加锁 */
+	LogRing* Local()
+	{
+		if (!local_.ring)
+		{
+			std::unique_ptr<LogRing> ring(new LogRing(LOG_RING_SIZE));
+			local_.ring = ring.get();
+			std::lock_guard<ProfiledMutex> locker(mtx_);
+			rings_.push_back(std::move(ring));
+		}
+		return local_.ring;
+	}
+
+	/* 消费者: 把所有缓冲区的可读数据追加到iov, 每个缓冲区调用一次f(段, 段数, 长度) */
+	template<class F>
+	void Peek(std::vector<struct iovec>& iov, F f)
+	{
+		{
+			std::lock_guard<ProfiledMutex> locker(mtx_);
+			active_.clear();
+			for (const auto& ring : rings_)
+			{ active_.push_back(ring.get()); }
+		}
+		lens_.resize(active_.size());
+		for (size_t i = 0; i < active_.size(); i++)
+		{
+			struct iovec seg[2];
+			int cnt = active_[i]->Peek(seg, lens_[i]);
+			iov.insert(iov.end(), seg, seg + cnt);
+			f(seg, cnt, lens_[i]);
+		}
+	}
+
+	/* 消费者: Peek取出的数据写出后释放空间, 并释放已退出线程的已写空的缓冲区 */
+	void Consume()
+	{
+		for (size_t i = 0; i < active_.size(); i++)
+		{ active_[i]->Consume(lens_[i]); }
+		active_.clear();
+		std::lock_guard<ProfiledMutex> locker(mtx_);
+		rings_.erase(std::remove_if(rings_.begin(), rings_.end(),
+			[](const std::unique_ptr<LogRing>& ring) { return ring->IsDetached() && ring->Size() == 0; }),
+			rings_.end());
+	}
+
+ private:
+	/* 线程退出时把缓冲区交给消费者 */
+	struct LocalRing
+	{
+		LogRing* ring = nullptr;
+		~LocalRing()
+		{
+			if (ring)
+			{ ring->Detach(); }
+		}
+	};
+	static thread_local LocalRing local_;
+
+	std::vector<std::unique_ptr<LogRing>> rings_;
+	std::vector<LogRing*> active_;  // 本次收集的缓冲区
+	std::vector<size_t> lens_;
+	ProfiledMutex mtx_;  // rings_
+};
+
+template<class Owner>
+thread_local typename LogRingSet<Owner>::LocalRing LogRingSet<Owner>::local_;
+
+/* 写出全部iov, writev一次最多IOV_MAX段, 部分写入时从写到的位置继续; 会修改iov */
+inline void WritevAll(int fd, struct iovec* iov, int cnt)
+{
+	while (cnt > 0)
+	{
+		ssize_t len = writev(fd, iov, std::min(cnt, IOV_MAX));
+		if (len < 0)
+		{
+			if (errno == EINTR)
+			{ continue; }
+			// 磁盘满等错误, 丢弃这一批
+			break;
+		}
+		while (cnt > 0 && (size_t)len >= iov->iov_len)
+		{
+			len -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (cnt > 0)
+		{
+			iov->iov_base = (char*)iov->iov_base + len;
+			iov->iov_len -= len;
+		}
+	}
+}
+
+#endif //LOGRING_H
@@ -1,15 +1,36 @@
 #include <unistd.h>
+#include <stdlib.h>
 #include "server/webserver.h"
 
-int main()
+int main(int argc, char* argv[])
 {
 	/* 守护进程 后台运行 */
 	//daemon(1, 0);
 
+	/*
+	 * -f 用户文件: 使用内存用户表(新用户追加写入该文件), 不连接MySQL
+	 * -p 端口, -m 触发模式(0~3), -t 线程池数量: 便于用bin/bench对比不同配置
+	 */
+	const char* userFile = nullptr;
+	int port = 8888, trigMode = 3, threadNum = 6;
+	int opt;
+	while ((opt = getopt(argc, argv, "f:p:m:t:")) != -1)
+	{
+		if (opt == 'f')
+		{ userFile = optarg; }
+		else if (opt == 'p')
+		{ port = atoi(optarg); }
+		else if (opt == 'm')
+		{ trigMode = atoi(optarg); }
+		else if (opt == 't')
+		{ threadNum = atoi(optarg); }
+	}
+
 	WebServer server(
-		8888, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
+		port, trigMode, 60000, false,      /* 端口 ET模式 timeoutMs 优雅退出  */
 		3306, "root", "root", "webserverDB", /* Mysql配置 */
-		12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+		12, threadNum, true, 1, 1024,      /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+		userFile);                         /* 用户文件 */
 	server.Start();
 } 
   
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "metrics.h"
+
+#if METRICS_ENABLE && METRICS_ACCOUNTING
+#include <stddef.h>
+
+/*
+ * 替换malloc/calloc/realloc, 记录分配次数和字节数后交给glibc的实现
+ * operator new通过malloc分配, 同样被记录; free及memalign等不记录, 直接使用glibc
+ * 依赖glibc导出的__libc_*函数, 其他C库上关闭METRICS_ACCOUNTING
+ */
+extern "C"
+{
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+
+void* malloc(size_t size)
+{
+	Metrics::AddAlloc(size);
+	return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size)
+{
+	Metrics::AddAlloc(num * size);
+	return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+	Metrics::AddAlloc(size);
+	return __libc_realloc(ptr, size);
+}
+}
+#endif
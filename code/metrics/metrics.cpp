@@ -0,0 +1,443 @@
+#include "metrics.h"
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+
+#include "../log/log.h"
+
+using namespace std;
+
+namespace
+{
+	const char* STAGE_NAME[Metrics::STAGE_NUM] = {
+		"accept", "read", "queue", "io_queue", "parse", "verify", "build", "write", "total",
+	};
+
+	/* 输出的累计桶上界(秒), 由细分的桶按下界归入 */
+	const double BUCKET_LE[] = {
+		0.00001, 0.000025, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005,
+		0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10,
+	};
+
+	/* 锁的等待通常在微秒以下 */
+	const double LOCK_LE[] = {
+		0.0000001, 0.00000025, 0.0000005, 0.000001, 0.0000025, 0.000005, 0.00001, 0.000025,
+		0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.01, 0.1, 1,
+	};
+
+	const char* LOCK_NAME[Metrics::LOCK_NUM] = { "worker_pool", "io_pool", "log", "log_ring", "sql_pool" };
+
+	const double QUANTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+
+	/* 系统调用和分配只记在执行的阶段中; 排队和总计不会被设为当前阶段, 不输出 */
+	bool IsUsageStage(int stage)
+	{
+		return stage != Metrics::STAGE_QUEUE && stage != Metrics::STAGE_IO_QUEUE && stage != Metrics::STAGE_TOTAL;
+	}
+
+	void AppendValue(string& out, const string& name, double value)
+	{
+		char buff[64];
+		snprintf(buff, sizeof(buff), " %.9g\n", value);
+		out += name;
+		out += buff;
+	}
+
+	void AppendValue(string& out, const string& name, uint64_t value)
+	{
+		char buff[32];
+		snprintf(buff, sizeof(buff), " %llu\n", (unsigned long long)value);
+		out += name;
+		out += buff;
+	}
+
+	void AppendHead(string& out, const char* name, const char* type, const char* help)
+	{
+		out += "# HELP ";
+		out += name;
+		out += ' ';
+		out += help;
+		out += "\n# TYPE ";
+		out += name;
+		out += ' ';
+		out += type;
+		out += '\n';
+	}
+}
+
+thread_local Metrics::LocalHolder Metrics::local_;
+thread_local bool Metrics::isExited_ = false;
+thread_local Metrics::Stage Metrics::stage_ = Metrics::STAGE_NONE;
+thread_local bool Metrics::isCounting_ = false;
+atomic<bool> Metrics::isAccounting_(false);
+volatile sig_atomic_t Metrics::isStopPending_ = 0;
+
+Metrics::Metrics()
+{
+	startTime_ = Clock::now();
+	locals_.emplace_back(new Local());  // 值初始化, 全部清零
+	retired_ = locals_[0].get();
+}
+
+Metrics* Metrics::Instance()
+{
+	/* 不析构: 退出时其他线程和静态对象的析构函数(如Log)仍可能记录 */
+	static Metrics* inst = new Metrics();
+	return inst;
+}
+
+Metrics::Local* Metrics::Local_()
+{
+	if (!local_.local)
+	{
+		Metrics* inst = Instance();
+		/* 线程退出期间: 并发写入合计可能丢失少量计数 */
+		if (isExited_)
+		{ return inst->retired_; }
+		// 线程第一次记录时注册, 之后只访问自己的数据; 其中的分配(包括注册线程退出回调)不记录
+		bool isCounting = isCounting_;
+		isCounting_ = true;
+		unique_ptr<Local> local(new Local());  // 值初始化, 全部清零
+		local_.local = local.get();
+		{
+			lock_guard<mutex> locker(inst->mtx_);
+			inst->locals_.push_back(move(local));
+		}
+		isCounting_ = isCounting;
+	}
+	return local_.local;
+}
+
+Metrics::LocalHolder::~LocalHolder()
+{
+	isExited_ = true;
+	if (local)
+	{ Instance()->Retire_(local); }
+	local = nullptr;
+}
+
+void Metrics::Retire_(Local* local)
+{
+	lock_guard<mutex> locker(mtx_);
+	for (int i = 0; i < COUNTER_NUM; i++)
+	{ Bump_(retired_->counters[i], local->counters[i].load(memory_order_relaxed)); }
+	for (int s = 0; s < STAGE_NUM; s++)
+	{ Fold_(retired_->stages[s], local->stages[s]); }
+	for (int s = 0; s <= STAGE_NUM; s++)
+	{
+		for (int i = 0; i < USAGE_NUM; i++)
+		{ Bump_(retired_->usage[s][i], local->usage[s][i].load(memory_order_relaxed)); }
+	}
+	for (size_t l = 0; l < sizeof(local->locks) / sizeof(local->locks[0]); l++)
+	{
+		Bump_(retired_->locks[l].acquired, local->locks[l].acquired.load(memory_order_relaxed));
+		Fold_(retired_->locks[l].wait, local->locks[l].wait);
+	}
+	locals_.erase(find_if(locals_.begin(), locals_.end(),
+		[local](const unique_ptr<Local>& p) { return p.get() == local; }));
+}
+
+void Metrics::Fold_(Histogram& to, const Histogram& from)
+{
+	for (int i = 0; i < BUCKET_NUM; i++)
+	{ Bump_(to.buckets[i], from.buckets[i].load(memory_order_relaxed)); }
+	Bump_(to.sumNs, from.sumNs.load(memory_order_relaxed));
+}
+
+int Metrics::BucketIndex_(uint64_t ns)
+{
+	if (ns < (uint64_t)SUB_COUNT)
+	{ return ns; }
+	int exp = 63 - __builtin_clzll(ns);
+	if (exp > MAX_EXP)
+	{ return BUCKET_NUM - 1; }
+	int sub = (ns >> (exp - SUB_BITS)) & (SUB_COUNT - 1);
+	return (exp - SUB_BITS + 1) * SUB_COUNT + sub;
+}
+
+uint64_t Metrics::BucketLow_(int index)
+{
+	if (index < SUB_COUNT)
+	{ return index; }
+	int exp = index / SUB_COUNT + SUB_BITS - 1;
+	uint64_t sub = index % SUB_COUNT;
+	return (SUB_COUNT + sub) << (exp - SUB_BITS);
+}
+
+uint64_t Metrics::BucketHigh_(int index)
+{
+	if (index < SUB_COUNT)
+	{ return index; }
+	int exp = index / SUB_COUNT + SUB_BITS - 1;
+	return BucketLow_(index) + (1ULL << (exp - SUB_BITS)) - 1;
+}
+
+void Metrics::Observe(Stage stage, int64_t ns)
+{
+	if (!METRICS_ENABLE || stage < 0 || stage >= STAGE_NUM)
+	{ return; }
+	if (ns < 0)
+	{ ns = 0; }
+	Histogram& hist = Local_()->stages[stage];
+	Bump_(hist.buckets[BucketIndex_(ns)], 1);
+	Bump_(hist.sumNs, ns);
+}
+
+void Metrics::AddLockWait(LockSite site, Clock::time_point start)
+{
+	if (!METRICS_ENABLE || !METRICS_LOCK_PROFILE || site < 0)
+	{ return; }
+	uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(Clock::now() - start).count();
+	LockStat& stat = Local_()->locks[site];
+	Bump_(stat.acquired, 1);
+	Bump_(stat.wait.buckets[BucketIndex_(ns)], 1);
+	Bump_(stat.wait.sumNs, ns);
+}
+
+void Metrics::Total::Add(const Histogram& hist)
+{
+	for (int i = 0; i < BUCKET_NUM; i++)
+	{
+		uint64_t n = hist.buckets[i].load(memory_order_relaxed);
+		buckets[i] += n;
+		count += n;  // 由桶求和, 与各个桶一致
+	}
+	sumNs += hist.sumNs.load(memory_order_relaxed);
+}
+
+uint64_t Metrics::Total::Quantile(double q) const
+{
+	uint64_t rank = max<uint64_t>(1, ceil(q * count));
+	uint64_t seen = 0;
+	int i = 0;
+	for (; i < BUCKET_NUM - 1; i++)
+	{
+		seen += buckets[i];
+		if (seen >= rank)
+		{ break; }
+	}
+	return BucketHigh_(i);
+}
+
+void Metrics::SumLocks_(uint64_t* acquired, vector<Total>& waits)
+{
+	waits.assign(LOCK_NUM, Total());
+	lock_guard<mutex> locker(mtx_);
+	for (const auto& local : locals_)
+	{
+		for (int l = 0; l < LOCK_NUM; l++)
+		{
+			acquired[l] += local->locks[l].acquired.load(memory_order_relaxed);
+			waits[l].Add(local->locks[l].wait);
+		}
+	}
+}
+
+void Metrics::LogLocks()
+{
+	if (!METRICS_ENABLE || !METRICS_LOCK_PROFILE)
+	{ return; }
+	uint64_t acquired[LOCK_NUM] = { 0 };
+	vector<Total> waits;
+	SumLocks_(acquired, waits);
+	for (int l = 0; l < LOCK_NUM; l++)
+	{
+		const Total& wait = waits[l];
+		if (acquired[l] == 0)
+		{ continue; }
+		LOG_INFO("Lock %s: acquired %llu, contended %llu (%.3f%%), wait total %.3fms, avg %.3fus, p99 %.3fus",
+			LOCK_NAME[l], (unsigned long long)acquired[l], (unsigned long long)wait.count,
+			wait.count * 100.0 / acquired[l], wait.sumNs / 1e6,
+			wait.count ? wait.sumNs / 1e3 / wait.count : 0.0, wait.count ? wait.Quantile(0.99) / 1e3 : 0.0);
+	}
+}
+
+void Metrics::OnSignal_(int)
+{
+	isStopPending_ = 1;
+}
+
+void Metrics::InitSignal()
+{
+	if (!METRICS_ENABLE || !METRICS_LOCK_PROFILE)
+	{ return; }
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnSignal_;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, nullptr);  // 不设SA_RESTART, epoll_wait返回EINTR
+	sigaction(SIGTERM, &sa, nullptr);
+}
+
+void Metrics::AppendHistogram_(string& out, const char* name, const string& label,
+	const Total& total, const double* les, size_t leNum)
+{
+	/* label为"{key=\"value\""形式, 不带结尾的} */
+	string bucket = string(name) + "_bucket" + label;
+	uint64_t count = 0;
+	int i = 0;
+	for (size_t k = 0; k < leNum; k++)
+	{
+		for (; i < BUCKET_NUM && BucketLow_(i) <= les[k] * 1e9; i++)
+		{ count += total.buckets[i]; }
+		char leStr[32];
+		snprintf(leStr, sizeof(leStr), "%g", les[k]);
+		AppendValue(out, bucket + ",le=\"" + leStr + "\"}", count);
+	}
+	AppendValue(out, bucket + ",le=\"+Inf\"}", total.count);
+	AppendValue(out, string(name) + "_sum" + label + "}", total.sumNs / 1e9);
+	AppendValue(out, string(name) + "_count" + label + "}", total.count);
+}
+
+void Metrics::AddUsage_(Usage usage, uint64_t n, uint64_t bytes)
+{
+	/* 在malloc中调用: Local_()第一次调用时的分配不能再进入这里 */
+	if (!isAccounting_.load(memory_order_relaxed) || isCounting_)
+	{ return; }
+	isCounting_ = true;
+	auto& row = Local_()->usage[stage_ < 0 ? STAGE_NUM : stage_];
+	Bump_(row[usage], n);
+	if (bytes > 0)
+	{ Bump_(row[ALLOC_BYTES], bytes); }
+	isCounting_ = false;
+}
+
+void Metrics::AddGauge(const string& name, const string& help, function<double()> fn)
+{
+	lock_guard<mutex> locker(mtx_);
+	gauges_.push_back({ name, help, fn });
+}
+
+bool Metrics::IsEndpoint(const string& path, const char* ip)
+{
+	if (!METRICS_ENABLE || path != METRICS_PATH)
+	{ return false; }
+	return !METRICS_LOCAL_ONLY || strncmp(ip, "127.", 4) == 0;
+}
+
+string Metrics::Render()
+{
+	/* 汇总时其他线程仍在写, 各个值之间不是同一时刻的快照 */
+	uint64_t counters[COUNTER_NUM] = { 0 };
+	vector<Total> stages(STAGE_NUM);
+	uint64_t usage[STAGE_NUM + 1][USAGE_NUM] = { { 0 } };
+	vector<Gauge> gauges;
+	{
+		lock_guard<mutex> locker(mtx_);
+		for (const auto& local : locals_)
+		{
+			for (int i = 0; i < COUNTER_NUM; i++)
+			{ counters[i] += local->counters[i].load(memory_order_relaxed); }
+			for (int s = 0; s < STAGE_NUM; s++)
+			{ stages[s].Add(local->stages[s]); }
+			for (int s = 0; s <= STAGE_NUM; s++)
+			{
+				for (int i = 0; i < USAGE_NUM; i++)
+				{ usage[s][i] += local->usage[s][i].load(memory_order_relaxed); }
+			}
+		}
+		gauges = gauges_;
+	}
+
+	string out;
+	out.reserve(16 * 1024);
+	AppendHead(out, "webserver_connections_accepted_total", "counter", "Accepted connections, not including rejected ones.");
+	AppendValue(out, "webserver_connections_accepted_total", counters[ACCEPTED]);
+	AppendHead(out, "webserver_connections_rejected_total", "counter", "Connections refused because the server was full.");
+	AppendValue(out, "webserver_connections_rejected_total", counters[REJECTED]);
+	AppendHead(out, "webserver_requests_total", "counter", "Finished requests by status class.");
+	for (int i = RESP_1XX; i <= RESP_5XX; i++)
+	{ AppendValue(out, "webserver_requests_total{code=\"" + to_string(i - RESP_1XX + 1) + "xx\"}", counters[i]); }
+	AppendHead(out, "webserver_read_bytes_total", "counter", "Bytes read from clients.");
+	AppendValue(out, "webserver_read_bytes_total", counters[BYTES_READ]);
+	AppendHead(out, "webserver_written_bytes_total", "counter", "Bytes written to clients.");
+	AppendValue(out, "webserver_written_bytes_total", counters[BYTES_WRITTEN]);
+
+	AppendHead(out, "webserver_uptime_seconds", "gauge", "Seconds since the server started.");
+	AppendValue(out, "webserver_uptime_seconds",
+		chrono::duration_cast<chrono::duration<double>>(Clock::now() - startTime_).count());
+	string lastFamily;
+	for (const auto& gauge : gauges)
+	{
+		string family = gauge.name.substr(0, gauge.name.find('{'));
+		if (family != lastFamily)
+		{
+			AppendHead(out, family.c_str(), "gauge", gauge.help.c_str());
+			lastFamily = family;
+		}
+		AppendValue(out, gauge.name, gauge.fn());
+	}
+
+	AppendHead(out, "webserver_stage_duration_seconds", "histogram", "Time spent in each request processing stage.");
+	for (int s = 0; s < STAGE_NUM; s++)
+	{
+		AppendHistogram_(out, "webserver_stage_duration_seconds", string("{stage=\"") + STAGE_NAME[s] + "\"",
+			stages[s], BUCKET_LE, sizeof(BUCKET_LE) / sizeof(BUCKET_LE[0]));
+	}
+
+	/* 由细分的桶计算分位数, 取桶的上界; 从启动开始累计 */
+	AppendHead(out, "webserver_stage_duration_quantile_seconds", "gauge", "Latency quantiles of each stage since start.");
+	for (int s = 0; s < STAGE_NUM; s++)
+	{
+		if (stages[s].count == 0)
+		{ continue; }
+		for (double q : QUANTILES)
+		{
+			char label[64];
+			snprintf(label, sizeof(label), "{stage=\"%s\",quantile=\"%g\"}", STAGE_NAME[s], q);
+			AppendValue(out, string("webserver_stage_duration_quantile_seconds") + label, stages[s].Quantile(q) / 1e9);
+		}
+	}
+
+	if (METRICS_ACCOUNTING)
+	{
+		/* 系统调用和分配: 累计值, 以及平均到每个完成的请求(stage_duration_seconds_count{stage="total"}) */
+		static const char* USAGE_NAME[USAGE_NUM] = { "syscalls", "allocations", "allocated_bytes" };
+		static const char* USAGE_HELP[USAGE_NUM] = {
+			"System calls issued by the server's I/O wrappers, by stage.",
+			"Heap allocations, by stage.",
+			"Heap bytes allocated, by stage.",
+		};
+		for (int i = 0; i < USAGE_NUM; i++)
+		{
+			string total = string("webserver_stage_") + USAGE_NAME[i] + "_total";
+			string perReq = string("webserver_stage_") + USAGE_NAME[i] + "_per_request";
+			AppendHead(out, total.c_str(), "counter", USAGE_HELP[i]);
+			for (int s = 0; s <= STAGE_NUM; s++)
+			{
+				if (!IsUsageStage(s))
+				{ continue; }
+				AppendValue(out, total + "{stage=\"" + (s < STAGE_NUM ? STAGE_NAME[s] : "other") + "\"}", usage[s][i]);
+			}
+			AppendHead(out, perReq.c_str(), "gauge", "Average per finished request since start.");
+			for (int s = 0; s <= STAGE_NUM; s++)
+			{
+				if (!IsUsageStage(s))
+				{ continue; }
+				AppendValue(out, perReq + "{stage=\"" + (s < STAGE_NUM ? STAGE_NAME[s] : "other") + "\"}",
+					stages[STAGE_TOTAL].count ? (double)usage[s][i] / stages[STAGE_TOTAL].count : 0.0);
+			}
+		}
+	}
+
+	if (METRICS_LOCK_PROFILE)
+	{
+		uint64_t acquired[LOCK_NUM] = { 0 };
+		vector<Total> waits;
+		SumLocks_(acquired, waits);
+		AppendHead(out, "webserver_lock_acquisitions_total", "counter", "Lock acquisitions by lock, including relocks after a condition variable wait.");
+		for (int l = 0; l < LOCK_NUM; l++)
+		{ AppendValue(out, string("webserver_lock_acquisitions_total{lock=\"") + LOCK_NAME[l] + "\"}", acquired[l]); }
+		AppendHead(out, "webserver_lock_contended_total", "counter", "Acquisitions that had to wait for another thread; relocks after a condition variable wait are never counted.");
+		for (int l = 0; l < LOCK_NUM; l++)
+		{ AppendValue(out, string("webserver_lock_contended_total{lock=\"") + LOCK_NAME[l] + "\"}", waits[l].count); }
+		AppendHead(out, "webserver_lock_wait_seconds", "histogram", "Time spent waiting for a contended lock; excludes relocks after a condition variable wait.");
+		for (int l = 0; l < LOCK_NUM; l++)
+		{
+			AppendHistogram_(out, "webserver_lock_wait_seconds", string("{lock=\"") + LOCK_NAME[l] + "\"",
+				waits[l], LOCK_LE, sizeof(LOCK_LE) / sizeof(LOCK_LE[0]));
+		}
+	}
+	return out;
+}
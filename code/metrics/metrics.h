@@ -0,0 +1,247 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <stdint.h>
+#include <signal.h>
+
+#include "../config/config.h"
+
+/*
+ * 运行指标, 单例
+ * 每个线程一份计数器和直方图, 只由所属线程修改: relaxed读写, 不加锁, 也没有原子加
+ * 采集(/metrics)时汇总所有线程的数据, 以Prometheus文本格式输出; 线程退出后数据保留
+ * 直方图按HDR方式分桶, 记录纳秒: 每个2的幂区间分为16个子桶, 相对误差不超过1/16
+ * METRICS_ACCOUNTING时还按阶段统计系统调用和堆内存分配, 阶段由StageScope设置
+ * METRICS_LOCK_PROFILE时统计各个共享锁的加锁次数和等待时间, 由ProfiledMutex记录
+ */
+class Metrics
+{
+ public:
+	enum Counter
+	{
+		ACCEPTED,  // 不含因连接数已满被拒绝的
+		REJECTED,  // 连接数已满
+		RESP_1XX,
+		RESP_2XX,
+		RESP_3XX,
+		RESP_4XX,
+		RESP_5XX,
+		BYTES_READ,
+		BYTES_WRITTEN,
+		COUNTER_NUM
+	};
+
+	/* 请求处理的各个阶段 */
+	enum Stage
+	{
+		STAGE_NONE = -1,
+		STAGE_ACCEPT,  // 接受连接到读到第一个请求
+		STAGE_READ,  // 一次read()
+		STAGE_QUEUE,  // 任务在工作线程池中等待
+		STAGE_IO_QUEUE,  // 任务在IO线程池中等待
+		STAGE_PARSE,  // 解析请求, 同步查询数据库时包括verify
+		STAGE_VERIFY,  // 登录/注册查询数据库
+		STAGE_BUILD,  // 生成响应
+		STAGE_WRITE,  // 响应开始发送到发送完毕
+		STAGE_TOTAL,  // 开始解析请求到响应发送完毕
+		STAGE_NUM
+	};
+
+	/* 记录竞争情况的锁, 同一用途的多个实例合计 */
+	enum LockSite
+	{
+		LOCK_NONE = -1,
+		LOCK_WORKER_POOL,  // 工作线程池的任务队列
+		LOCK_IO_POOL,  // IO线程池的任务队列
+		LOCK_LOG,  // Log::mtx_, 写文件
+		LOCK_LOG_RING,  // Log::ringMtx_, 线程缓冲区列表
+		LOCK_SQL_POOL,  // 数据库连接池
+		LOCK_NUM
+	};
+
+	typedef std::chrono::steady_clock Clock;
+
+	/* 作用域内当前线程的系统调用和内存分配计入stage, 结束时恢复外层的阶段 */
+	class StageScope
+	{
+	 public:
+		explicit StageScope(Stage stage)
+		{
+			prev_ = stage_;
+			if (METRICS_ACCOUNTING)
+			{ stage_ = stage; }
+		}
+		~StageScope()
+		{
+			stage_ = prev_;
+		}
+
+	 private:
+		Stage prev_;
+	};
+
+	static Metrics* Instance();
+
+	static void Add(Counter counter, uint64_t n = 1)
+	{
+		if (METRICS_ENABLE)
+		{ Bump_(Local_()->counters[counter], n); }
+	}
+	static void Observe(Stage stage, int64_t ns);
+	static void Observe(Stage stage, Clock::time_point start)
+	{
+		Observe(stage, std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+	}
+	static void AddResponse(int code)
+	{
+		if (code >= 100 && code < 600)
+		{ Add((Counter)(RESP_1XX + code / 100 - 1)); }
+	}
+
+	/* 服务器自己的IO封装在每次系统调用前调用; 分配由替换的malloc记录 */
+	static void AddSyscall()
+	{
+		if (METRICS_ACCOUNTING)
+		{ AddUsage_(SYSCALLS, 1); }
+	}
+	static void AddAlloc(size_t bytes)
+	{
+		if (METRICS_ACCOUNTING)
+		{ AddUsage_(ALLOCS, 1, bytes); }
+	}
+	/* 服务器初始化完成后开始统计, 之前(包括静态初始化期间)的分配不记录 */
+	static void StartAccounting()
+	{
+		isAccounting_.store(METRICS_ENABLE && METRICS_ACCOUNTING, std::memory_order_relaxed);
+	}
+
+	/* 一次加锁; 等待过时start为开始等待的时间 */
+	static void AddLock(LockSite site)
+	{
+		if (METRICS_ENABLE && METRICS_LOCK_PROFILE && site >= 0)
+		{ Bump_(Local_()->locks[site].acquired, 1); }
+	}
+	static void AddLockWait(LockSite site, Clock::time_point start);
+
+	/* 各个锁的汇总写入日志, 退出时调用 */
+	void LogLocks();
+
+	/*
+	 * METRICS_LOCK_PROFILE时处理SIGINT/SIGTERM: 只设置标志, 由epoll线程退出主循环
+	 * 服务器正常析构, 退出前输出锁的统计; 否则保持默认处理, 直接结束进程
+	 */
+	static void InitSignal();
+	static bool IsStopPending()
+	{
+		return isStopPending_;
+	}
+
+	/* 采集时调用fn取值; name可以带标签, 如 webserver_queue_length{pool="worker"} */
+	void AddGauge(const std::string& name, const std::string& help, std::function<double()> fn);
+
+	/* 是否为本服务的指标请求: 路径为METRICS_PATH, 且地址允许访问 */
+	static bool IsEndpoint(const std::string& path, const char* ip);
+
+	std::string Render();
+
+ private:
+	/* 1~15精确, 之后每个2的幂区间16个子桶; 超过2^40纳秒(约18分钟)的值记入最后一个桶 */
+	static const int SUB_BITS = 4;
+	static const int SUB_COUNT = 1 << SUB_BITS;
+	static const int MAX_EXP = 40;
+	static const int BUCKET_NUM = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+	enum Usage
+	{
+		SYSCALLS,
+		ALLOCS,
+		ALLOC_BYTES,
+		USAGE_NUM
+	};
+
+	struct Histogram
+	{
+		std::atomic<uint64_t> buckets[BUCKET_NUM];
+		std::atomic<uint64_t> sumNs;
+	};
+
+	struct LockStat
+	{
+		std::atomic<uint64_t> acquired;
+		Histogram wait;  // 只记录等待过的加锁, 桶的总数即竞争次数
+	};
+
+	struct Local
+	{
+		std::atomic<uint64_t> counters[COUNTER_NUM];
+		Histogram stages[STAGE_NUM];
+		std::atomic<uint64_t> usage[STAGE_NUM + 1][USAGE_NUM];  // 最后一行为不属于任何阶段
+		LockStat locks[METRICS_LOCK_PROFILE ? LOCK_NUM : 1];
+	};
+
+	/* 所有线程合计的直方图 */
+	struct Total
+	{
+		std::vector<uint64_t> buckets;
+		uint64_t count;
+		uint64_t sumNs;
+
+		Total() : buckets(BUCKET_NUM), count(0), sumNs(0) {}
+		void Add(const Histogram& hist);
+		uint64_t Quantile(double q) const;  // 纳秒, 取所在桶的上界
+	};
+
+	struct Gauge
+	{
+		std::string name;
+		std::string help;
+		std::function<double()> fn;
+	};
+
+	Metrics();
+	~Metrics() = default;
+
+	static void Bump_(std::atomic<uint64_t>& value, uint64_t n)
+	{
+		value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+	}
+	static Local* Local_();
+	void Retire_(Local* local);
+	static void Fold_(Histogram& to, const Histogram& from);
+	static void OnSignal_(int sig);
+	void SumLocks_(uint64_t* acquired, std::vector<Total>& waits);
+	static void AppendHistogram_(std::string& out, const char* name, const std::string& label,
+		const Total& total, const double* les, size_t leNum);
+	static void AddUsage_(Usage usage, uint64_t n, uint64_t bytes = 0);
+	static int BucketIndex_(uint64_t ns);
+	static uint64_t BucketLow_(int index);
+	static uint64_t BucketHigh_(int index);
+
+	/* 线程退出时把计数并入retired_并释放, 像LogRingSet一样不为退出的线程保留数据 */
+	struct LocalHolder
+	{
+		Local* local = nullptr;
+		~LocalHolder();
+	};
+	static thread_local LocalHolder local_;
+	static thread_local bool isExited_;  // 之后其他thread_local析构时的记录写入retired_
+	static thread_local Stage stage_;
+	static thread_local bool isCounting_;  // 正在记录, 其中的分配不再记录
+	static std::atomic<bool> isAccounting_;
+	static volatile sig_atomic_t isStopPending_;
+
+	Clock::time_point startTime_;
+	std::vector<std::unique_ptr<Local>> locals_;  // 正在记录的线程, 第一个为retired_
+	Local* retired_;  // 已退出线程的合计, 不释放
+	std::vector<Gauge> gauges_;
+	std::mutex mtx_;
+};
+
+#endif //METRICS_H
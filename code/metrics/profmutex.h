@@ -0,0 +1,94 @@
+#ifndef PROFMUTEX_H
+#define PROFMUTEX_H
+
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include <assert.h>
+
+#include "metrics.h"
+
+/*
+ * 统计竞争情况的互斥量, 可用于lock_guard/unique_lock; 同一site的实例合计
+ * 先try_lock, 成功只计一次加锁; 失败时计时等待, 记入等待直方图
+ * METRICS_LOCK_PROFILE为0时直接转发给std::mutex
+ * 条件变量通过Wait/WaitFor/WaitUntil等待: 唤醒后重新加锁计一次加锁, 但不知道是否等待过, 不计竞争和等待时间
+ */
+class ProfiledMutex
+{
+ public:
+	explicit ProfiledMutex(Metrics::LockSite site = Metrics::LOCK_NONE) : site_(site) {}
+	ProfiledMutex(const ProfiledMutex&) = delete;
+	ProfiledMutex& operator=(const ProfiledMutex&) = delete;
+
+	void lock()
+	{
+		if (!(METRICS_ENABLE && METRICS_LOCK_PROFILE))
+		{
+			mtx_.lock();
+			return;
+		}
+		if (mtx_.try_lock())
+		{
+			Metrics::AddLock(site_);
+			return;
+		}
+		auto start = Metrics::Clock::now();
+		mtx_.lock();
+		Metrics::AddLockWait(site_, start);
+	}
+	bool try_lock()
+	{
+		if (!mtx_.try_lock())
+		{ return false; }
+		if (METRICS_ENABLE && METRICS_LOCK_PROFILE)
+		{ Metrics::AddLock(site_); }
+		return true;
+	}
+	void unlock()
+	{
+		mtx_.unlock();
+	}
+
+	void Wait(std::condition_variable& cond, std::unique_lock<ProfiledMutex>& locker)
+	{
+		std::unique_lock<std::mutex> inner = Adopt_(locker);
+		cond.wait(inner);
+		inner.release();
+		Metrics::AddLock(site_);
+	}
+	template<class Rep, class Period>
+	std::cv_status WaitFor(std::condition_variable& cond, std::unique_lock<ProfiledMutex>& locker,
+		const std::chrono::duration<Rep, Period>& timeout)
+	{
+		std::unique_lock<std::mutex> inner = Adopt_(locker);
+		std::cv_status status = cond.wait_for(inner, timeout);
+		inner.release();
+		Metrics::AddLock(site_);
+		return status;
+	}
+	template<class Clock, class Duration>
+	std::cv_status WaitUntil(std::condition_variable& cond, std::unique_lock<ProfiledMutex>& locker,
+		const std::chrono::time_point<Clock, Duration>& deadline)
+	{
+		std::unique_lock<std::mutex> inner = Adopt_(locker);
+		std::cv_status status = cond.wait_until(inner, deadline);
+		inner.release();
+		Metrics::AddLock(site_);
+		return status;
+	}
+
+ private:
+	/* locker持有的是mtx_; 等待期间由inner释放和重新获得, 结束后交还locker */
+	std::unique_lock<std::mutex> Adopt_(std::unique_lock<ProfiledMutex>& locker)
+	{
+		assert(locker.owns_lock() && locker.mutex() == this);
+		(void)locker;
+		return std::unique_lock<std::mutex>(mtx_, std::adopt_lock);
+	}
+
+	std::mutex mtx_;
+	Metrics::LockSite site_;
+};
+
+#endif //PROFMUTEX_H
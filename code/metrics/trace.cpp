@@ -0,0 +1,155 @@
+#include "trace.h"
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+
+#include "../log/log.h"
+
+using namespace std;
+
+thread_local Trace::Ring* Trace::ring_ = nullptr;
+thread_local uint32_t Trace::current_ = 0;
+volatile sig_atomic_t Trace::isDumpPending_ = 0;
+
+Trace::Trace() : nextId_(1)
+{
+	startTsc_ = Now();
+	startTime_ = chrono::steady_clock::now();
+}
+
+Trace* Trace::Instance()
+{
+	static Trace inst;
+	return &inst;
+}
+
+uint32_t Trace::Sample()
+{
+	if (!TRACE_ENABLE)
+	{ return 0; }
+	static thread_local uint32_t count = 0;
+	if (++count < (uint32_t)TRACE_SAMPLE)
+	{ return 0; }
+	count = 0;
+	uint32_t id = Instance()->nextId_.fetch_add(1, memory_order_relaxed);
+	return id ? id : Instance()->nextId_.fetch_add(1, memory_order_relaxed);  // 回绕时跳过0
+}
+
+Trace::Ring* Trace::Ring_()
+{
+	if (!ring_)
+	{
+		unique_ptr<Ring> ring(new Ring());
+		ring->tid = syscall(SYS_gettid);
+		ring_ = ring.get();
+		Trace* inst = Instance();
+		lock_guard<mutex> locker(inst->mtx_);
+		inst->rings_.push_back(move(ring));
+	}
+	return ring_;
+}
+
+void Trace::Span(const char* name, uint32_t id, uint64_t begin, uint64_t end)
+{
+	if (!TRACE_ENABLE || id == 0)
+	{ return; }
+	Ring* ring = Ring_();
+	uint64_t head = ring->head.load(memory_order_relaxed);
+	ring->events[head % TRACE_RING_SIZE] = { begin, end, name, id };
+	ring->head.store(head + 1, memory_order_release);
+}
+
+bool Trace::IsEndpoint(const string& path, const char* ip)
+{
+	if (!TRACE_ENABLE || path != TRACE_PATH)
+	{ return false; }
+	return !METRICS_LOCAL_ONLY || strncmp(ip, "127.", 4) == 0;
+}
+
+void Trace::OnSignal_(int)
+{
+	isDumpPending_ = 1;
+}
+
+void Trace::InitSignal()
+{
+	if (!TRACE_ENABLE)
+	{ return; }
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = OnSignal_;
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGUSR2, &sa, nullptr);  // 不设SA_RESTART, epoll_wait返回EINTR后即可写出
+}
+
+void Trace::CheckDump()
+{
+	if (!isDumpPending_)
+	{ return; }
+	isDumpPending_ = 0;
+	if (Dump(TRACE_FILE))
+	{ LOG_INFO("trace written: %s", TRACE_FILE); }
+	else
+	{ LOG_ERROR("trace write %s error: %d", TRACE_FILE, errno); }
+}
+
+string Trace::Render()
+{
+	/* 用启动以来的TSC增量和时钟校准, 时间戳为启动后的微秒数 */
+	double elapsedNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - startTime_).count();
+	uint64_t elapsedTsc = Now() - startTsc_;
+	double usPerTick = elapsedTsc > 0 ? elapsedNs / elapsedTsc / 1000 : 0;
+	int pid = getpid();
+
+	string out;
+	out.reserve(1024 * 1024);
+	out += "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+	bool isFirst = true;
+	char buff[256];
+	vector<Event> events(TRACE_RING_SIZE);
+	lock_guard<mutex> locker(mtx_);
+	for (const auto& ring : rings_)
+	{
+		/*
+		 * 所属线程仍在写: 先复制[begin, head), 复制后再读一次head,
+		 * 期间被覆盖或正在被覆盖的记录(序号不大于新head - TRACE_RING_SIZE)丢弃
+		 */
+		uint64_t head = ring->head.load(memory_order_acquire);
+		uint64_t first = head - min<uint64_t>(head, TRACE_RING_SIZE);
+		for (uint64_t i = first; i < head; i++)
+		{ events[i - first] = ring->events[i % TRACE_RING_SIZE]; }
+		atomic_thread_fence(memory_order_acquire);
+		uint64_t after = ring->head.load(memory_order_acquire);
+		uint64_t begin = first;
+		if (after >= TRACE_RING_SIZE)
+		{ begin = max(begin, after - TRACE_RING_SIZE + 1); }
+		for (uint64_t i = begin; i < head; i++)
+		{
+			const Event& event = events[i - first];
+			if (!event.name || event.begin < startTsc_)
+			{ continue; }
+			snprintf(buff, sizeof(buff),
+				"%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+				"\"pid\":%d,\"tid\":%d,\"args\":{\"req\":%u}}",
+				isFirst ? "" : ",", event.name, (event.begin - startTsc_) * usPerTick,
+				event.end > event.begin ? (event.end - event.begin) * usPerTick : 0,
+				pid, ring->tid, event.id);
+			out += buff;
+			isFirst = false;
+		}
+	}
+	out += "\n]}\n";
+	return out;
+}
+
+bool Trace::Dump(const char* path)
+{
+	string out = Render();
+	FILE* fp = fopen(path, "w");
+	if (!fp)
+	{ return false; }
+	bool isOk = fwrite(out.data(), 1, out.size(), fp) == out.size();
+	return fclose(fp) == 0 && isOk;
+}
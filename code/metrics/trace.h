@@ -0,0 +1,133 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <mutex>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <signal.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>  // __rdtsc
+#endif
+
+#include "../config/config.h"
+
+/*
+ * 请求追踪, 单例; TRACE_ENABLE为0时全部编译为空
+ * 每TRACE_SAMPLE个请求采样一个, 分配非0的追踪id; 未采样的请求只比较一次id
+ * 每个线程一个环形缓冲区, 只由所属线程写入, 记录TSC时间戳, 满后覆盖最旧的记录
+ * 收到SIGUSR2时写入TRACE_FILE, 或由TRACE_PATH返回; 格式为Chrome trace JSON, 可用Perfetto打开
+ */
+class Trace
+{
+ public:
+	static Trace* Instance();
+
+	/* TSC计数, 不支持的平台上为steady_clock纳秒 */
+	static uint64_t Now()
+	{
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	/* 新请求是否采样: 返回追踪id, 不采样时为0 */
+	static uint32_t Sample();
+
+	/* 记录id的一段[begin, end) */
+	static void Span(const char* name, uint32_t id, uint64_t begin, uint64_t end);
+
+	/* 当前线程正在处理的请求, 由TraceSpan设置; 没有时为0 */
+	static uint32_t Current()
+	{
+		return current_;
+	}
+
+	/* 是否为追踪导出请求, 地址限制与METRICS_LOCAL_ONLY相同 */
+	static bool IsEndpoint(const std::string& path, const char* ip);
+
+	/* 安装SIGUSR2处理函数; 信号只设置标志, 由CheckDump在epoll线程中写文件 */
+	static void InitSignal();
+	void CheckDump();
+
+	std::string Render();
+	bool Dump(const char* path);
+
+ private:
+	struct Event
+	{
+		uint64_t begin;
+		uint64_t end;
+		const char* name;  // 字符串常量
+		uint32_t id;
+	};
+
+	struct Ring
+	{
+		int tid;
+		std::atomic<uint64_t> head;  // 已写入的总数, 写第head个记录时覆盖第head - TRACE_RING_SIZE个
+		Event events[TRACE_RING_SIZE];
+	};
+
+	Trace();
+	~Trace() = default;
+
+	static Ring* Ring_();
+	static void OnSignal_(int sig);
+
+	static thread_local Ring* ring_;
+	static thread_local uint32_t current_;
+	static volatile sig_atomic_t isDumpPending_;
+
+	std::atomic<uint32_t> nextId_;
+	uint64_t startTsc_;
+	std::chrono::steady_clock::time_point startTime_;
+	std::vector<std::unique_ptr<Ring>> rings_;  // 所有记录过的线程, 不释放
+	std::mutex mtx_;
+
+	friend class TraceSpan;
+};
+
+/*
+ * 作用域内记录一段; id为0时不记录
+ * 同时把id设为当前线程的Current(), 嵌套的TraceSpan默认使用它
+ */
+class TraceSpan
+{
+ public:
+	explicit TraceSpan(const char* name, uint32_t id = Trace::Current())
+	{
+		name_ = name;
+		id_ = TRACE_ENABLE ? id : 0;
+		prevId_ = 0;
+		begin_ = 0;
+		if (id_)
+		{
+			prevId_ = Trace::current_;
+			Trace::current_ = id_;
+			begin_ = Trace::Now();
+		}
+	}
+	~TraceSpan()
+	{
+		if (id_)
+		{
+			Trace::Span(name_, id_, begin_, Trace::Now());
+			Trace::current_ = prevId_;
+		}
+	}
+
+ private:
+	const char* name_;
+	uint32_t id_;
+	uint32_t prevId_;
+	uint64_t begin_;
+};
+
+#endif //TRACE_H
@@ -0,0 +1,1110 @@
+#include "asyncsqlpool.h"
+
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include <netdb.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/sha.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+using namespace std;
+
+namespace
+{
+
+/* 客户端能力标志 */
+enum CAPABILITY
+{
+	CLIENT_LONG_PASSWORD = 0x1,
+	CLIENT_CONNECT_WITH_DB = 0x8,
+	CLIENT_PROTOCOL_41 = 0x200,
+	CLIENT_TRANSACTIONS = 0x2000,
+	CLIENT_SECURE_CONNECTION = 0x8000,
+	CLIENT_PLUGIN_AUTH = 0x80000,
+};
+
+enum COMMAND
+{
+	COM_QUIT = 0x01,
+	COM_STMT_PREPARE = 0x16,
+	COM_STMT_EXECUTE = 0x17,
+};
+
+/* 二进制结果行中不是长度编码字符串的列类型 */
+enum FIELD_TYPE
+{
+	TYPE_TINY = 1,
+	TYPE_SHORT = 2,
+	TYPE_LONG = 3,
+	TYPE_FLOAT = 4,
+	TYPE_DOUBLE = 5,
+	TYPE_TIMESTAMP = 7,
+	TYPE_LONGLONG = 8,
+	TYPE_INT24 = 9,
+	TYPE_DATE = 10,
+	TYPE_TIME = 11,
+	TYPE_DATETIME = 12,
+	TYPE_YEAR = 13,
+	TYPE_STRING = 0xfe,
+};
+
+const uint16_t UNSIGNED_FLAG = 0x20;
+const uint16_t ER_UNKNOWN_STMT_HANDLER = 1243;
+const uint8_t CHARSET_UTF8MB4 = 45;
+
+const char* NATIVE_PASSWORD = "mysql_native_password";
+const char* CACHING_SHA2_PASSWORD = "caching_sha2_password";
+
+/* 顺序读取包内容, 越界后isOk为false, 之后读到的都是0或空串 */
+struct Reader
+{
+	explicit Reader(const string& payload) :
+		data((const uint8_t*)payload.data()), len(payload.size()), pos(0), isOk(true) {}
+
+	bool Has(uint64_t n)
+	{
+		if (n > len - pos)
+		{
+			isOk = false;
+			pos = len;
+			return false;
+		}
+		return true;
+	}
+
+	uint64_t Int(size_t n)
+	{
+		uint64_t v = 0;
+		if (!Has(n))
+		{ return 0; }
+		for (size_t i = 0; i < n; i++)
+		{ v |= (uint64_t)data[pos + i] << (8 * i); }
+		pos += n;
+		return v;
+	}
+
+	uint64_t Lenenc()
+	{
+		uint8_t c = Int(1);
+		if (c < 0xfb) return c;
+		if (c == 0xfc) return Int(2);
+		if (c == 0xfd) return Int(3);
+		if (c == 0xfe) return Int(8);
+		isOk = false;
+		return 0;
+	}
+
+	string Str(uint64_t n)
+	{
+		if (!Has(n))
+		{ return ""; }
+		string s((const char*)data + pos, n);
+		pos += n;
+		return s;
+	}
+
+	string LenencStr()
+	{
+		return Str(Lenenc());
+	}
+
+	/* 以'\0'结尾的字符串; 没有'\0'时取剩余部分 */
+	string NulStr()
+	{
+		const uint8_t* end = (const uint8_t*)memchr(data + pos, 0, len - pos);
+		if (!end)
+		{ return Rest(); }
+		string s = Str(end - (data + pos));
+		pos++;
+		return s;
+	}
+
+	string Rest()
+	{
+		return Str(len - pos);
+	}
+
+	const uint8_t* data;
+	size_t len;
+	size_t pos;
+	bool isOk;
+};
+
+void PutInt(string& out, uint64_t v, size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+	{ out.push_back(char(v >> (8 * i))); }
+}
+
+void PutLenenc(string& out, uint64_t v)
+{
+	if (v < 0xfb)
+	{ out.push_back(char(v)); }
+	else if (v <= 0xffff)
+	{
+		out.push_back(char(0xfc));
+		PutInt(out, v, 2);
+	}
+	else if (v <= 0xffffff)
+	{
+		out.push_back(char(0xfd));
+		PutInt(out, v, 3);
+	}
+	else
+	{
+		out.push_back(char(0xfe));
+		PutInt(out, v, 8);
+	}
+}
+
+/* ERR包: 0xff, 错误码, ['#' + SQLSTATE], 错误信息 */
+string ErrorMsg(const string& payload, uint16_t* code)
+{
+	Reader r(payload);
+	r.Int(1);
+	uint16_t err = r.Int(2);
+	if (code)
+	{ *code = err; }
+	if (r.pos < r.len && r.data[r.pos] == '#')
+	{ r.Str(6); }
+	return to_string(err) + " " + r.Rest();
+}
+
+/* mysql_native_password: SHA1(pwd) XOR SHA1(salt + SHA1(SHA1(pwd))) */
+string ScrambleNative(const string& pwd, const string& salt)
+{
+	if (pwd.empty())
+	{ return ""; }
+	uint8_t h1[SHA_DIGEST_LENGTH], h2[SHA_DIGEST_LENGTH], h3[SHA_DIGEST_LENGTH];
+	SHA1((const uint8_t*)pwd.data(), pwd.size(), h1);
+	SHA1(h1, sizeof(h1), h2);
+	string buf = salt + string((const char*)h2, sizeof(h2));
+	SHA1((const uint8_t*)buf.data(), buf.size(), h3);
+	string out(SHA_DIGEST_LENGTH, '\0');
+	for (size_t i = 0; i < out.size(); i++)
+	{ out[i] = h1[i] ^ h3[i]; }
+	return out;
+}
+
+/* caching_sha2_password: SHA256(pwd) XOR SHA256(SHA256(SHA256(pwd)) + salt) */
+string ScrambleSha2(const string& pwd, const string& salt)
+{
+	if (pwd.empty())
+	{ return ""; }
+	uint8_t h1[SHA256_DIGEST_LENGTH], h2[SHA256_DIGEST_LENGTH], h3[SHA256_DIGEST_LENGTH];
+	SHA256((const uint8_t*)pwd.data(), pwd.size(), h1);
+	SHA256(h1, sizeof(h1), h2);
+	string buf = string((const char*)h2, sizeof(h2)) + salt;
+	SHA256((const uint8_t*)buf.data(), buf.size(), h3);
+	string out(SHA256_DIGEST_LENGTH, '\0');
+	for (size_t i = 0; i < out.size(); i++)
+	{ out[i] = h1[i] ^ h3[i]; }
+	return out;
+}
+
+/* caching_sha2_password完整认证: (pwd + '\0') XOR salt, 用服务端公钥RSA-OAEP加密 */
+string RsaEncrypt(const string& pem, const string& pwd, const string& salt)
+{
+	string plain = pwd + '\0';
+	for (size_t i = 0; i < plain.size() && !salt.empty(); i++)
+	{ plain[i] ^= salt[i % salt.size()]; }
+
+	string out;
+	BIO* bio = BIO_new_mem_buf(pem.data(), pem.size());
+	EVP_PKEY* key = bio ? PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr) : nullptr;
+	EVP_PKEY_CTX* ctx = key ? EVP_PKEY_CTX_new(key, nullptr) : nullptr;
+	size_t outLen = 0;
+	if (ctx && EVP_PKEY_encrypt_init(ctx) > 0
+		&& EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) > 0
+		&& EVP_PKEY_encrypt(ctx, nullptr, &outLen, (const uint8_t*)plain.data(), plain.size()) > 0)
+	{
+		out.resize(outLen);
+		if (EVP_PKEY_encrypt(ctx, (uint8_t*)&out[0], &outLen, (const uint8_t*)plain.data(), plain.size()) > 0)
+		{ out.resize(outLen); }
+		else
+		{ out.clear(); }
+	}
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(key);
+	BIO_free(bio);
+	return out;
+}
+
+/* 二进制结果行中的一列转换为字符串; 时间类型省略小数秒 */
+string DecodeValue(Reader& r, uint8_t type, bool isUnsigned)
+{
+	char buf[64] = { 0 };
+	switch (type)
+	{
+	case TYPE_TINY:
+	{
+		uint64_t v = r.Int(1);
+		return isUnsigned ? to_string(v) : to_string((int8_t)v);
+	}
+	case TYPE_SHORT:
+	case TYPE_YEAR:
+	{
+		uint64_t v = r.Int(2);
+		return isUnsigned ? to_string(v) : to_string((int16_t)v);
+	}
+	case TYPE_LONG:
+	case TYPE_INT24:
+	{
+		uint64_t v = r.Int(4);
+		return isUnsigned ? to_string(v) : to_string((int32_t)v);
+	}
+	case TYPE_LONGLONG:
+	{
+		uint64_t v = r.Int(8);
+		return isUnsigned ? to_string(v) : to_string((int64_t)v);
+	}
+	case TYPE_FLOAT:
+	{
+		uint32_t v = r.Int(4);
+		float f;
+		memcpy(&f, &v, sizeof(f));
+		snprintf(buf, sizeof(buf), "%g", f);
+		return buf;
+	}
+	case TYPE_DOUBLE:
+	{
+		uint64_t v = r.Int(8);
+		double d;
+		memcpy(&d, &v, sizeof(d));
+		snprintf(buf, sizeof(buf), "%.17g", d);
+		return buf;
+	}
+	case TYPE_DATE:
+	case TYPE_DATETIME:
+	case TYPE_TIMESTAMP:
+	{
+		size_t n = r.Int(1);
+		int year = 0, month = 0, day = 0, hour = 0, minute = 0, second = 0;
+		if (n >= 4)
+		{
+			year = r.Int(2);
+			month = r.Int(1);
+			day = r.Int(1);
+		}
+		if (n >= 7)
+		{
+			hour = r.Int(1);
+			minute = r.Int(1);
+			second = r.Int(1);
+		}
+		if (n >= 11)
+		{ r.Int(4); }
+		if (type == TYPE_DATE)
+		{ snprintf(buf, sizeof(buf), "%04d-%02d-%02d", year, month, day); }
+		else
+		{
+			snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d",
+				year, month, day, hour, minute, second);
+		}
+		return buf;
+	}
+	case TYPE_TIME:
+	{
+		size_t n = r.Int(1);
+		int isNeg = 0, days = 0, hour = 0, minute = 0, second = 0;
+		if (n >= 8)
+		{
+			isNeg = r.Int(1);
+			days = r.Int(4);
+			hour = r.Int(1);
+			minute = r.Int(1);
+			second = r.Int(1);
+		}
+		if (n >= 12)
+		{ r.Int(4); }
+		snprintf(buf, sizeof(buf), "%s%02d:%02d:%02d", isNeg ? "-" : "", days * 24 + hour, minute, second);
+		return buf;
+	}
+	default:
+		/* 字符串, BLOB, DECIMAL等都是长度编码字符串 */
+		return r.LenencStr();
+	}
+}
+
+}  // namespace
+
+AsyncSqlConn::AsyncSqlConn() :
+	fd_(-1), state_(CLOSED), isUnix_(false), seq_(0),
+	result_(), skipPackets_(0), numColumns_(0), isRows_(false)
+{
+}
+
+AsyncSqlConn::~AsyncSqlConn()
+{
+	if (fd_ >= 0)
+	{ close(fd_); }
+}
+
+bool AsyncSqlConn::Connect(const sockaddr* addr, socklen_t addrLen,
+	const string& user, const string& pwd, const string& dbName)
+{
+	assert(state_ == CLOSED);
+	user_ = user;
+	pwd_ = pwd;
+	dbName_ = dbName;
+	error_.clear();
+	readBuff_.RetrieveAll();
+	writeBuff_.RetrieveAll();
+	stmts_.clear();
+	since_ = chrono::steady_clock::now();
+
+	isUnix_ = (addr->sa_family == AF_UNIX);
+	fd_ = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd_ < 0)
+	{
+		LOG_ERROR("MySql socket error: %s", strerror(errno));
+		return false;
+	}
+	if (!isUnix_)
+	{
+		int one = 1;
+		setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	if (connect(fd_, addr, addrLen) == 0)
+	{
+		state_ = HANDSHAKE;
+		return true;
+	}
+	if (errno == EINPROGRESS)
+	{
+		state_ = CONNECTING;
+		return true;
+	}
+	LOG_WARN("MySql connect error: %s", strerror(errno));
+	close(fd_);
+	fd_ = -1;
+	return false;
+}
+
+uint32_t AsyncSqlConn::Events() const
+{
+	if (state_ == CONNECTING || writeBuff_.ReadableBytes() > 0)
+	{ return EPOLLIN | EPOLLOUT; }
+	return EPOLLIN;
+}
+
+bool AsyncSqlConn::Execute(const string& sql, const vector<string>& params, SqlCallback cb)
+{
+	assert(state_ == READY);
+	sql_ = sql;
+	params_ = params;
+	cb_ = std::move(cb);
+	result_ = SqlResult();
+	since_ = chrono::steady_clock::now();
+
+	auto it = stmts_.find(sql);
+	if (it != stmts_.end())
+	{ return SendExecute_(it->second); }
+
+	/* 第一次在该连接上执行, 先prepare */
+	state_ = PREPARE;
+	skipPackets_ = 0;
+	seq_ = 0;
+	Send_(string(1, char(COM_STMT_PREPARE)) + sql);
+	return Flush_();
+}
+
+bool AsyncSqlConn::OnEvent(uint32_t events)
+{
+	if (state_ == CONNECTING)
+	{
+		int err = 0;
+		socklen_t len = sizeof(err);
+		getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len);
+		if (err != 0)
+		{ return Fail_(string("connect: ") + strerror(err)); }
+		state_ = HANDSHAKE;
+	}
+	if (events & (EPOLLIN | EPOLLERR | EPOLLHUP | EPOLLRDHUP))
+	{
+		int readErrno = 0;
+		ssize_t len = readBuff_.ReadFd(fd_, &readErrno);
+		if (len == 0)
+		{ return Fail_("connection closed by server"); }
+		if (len < 0 && readErrno != EAGAIN)
+		{ return Fail_(strerror(readErrno)); }
+
+		string payload;
+		while (NextPacket_(payload))
+		{
+			if (!OnPacket_(payload))
+			{ return false; }
+		}
+	}
+	return Flush_();
+}
+
+void AsyncSqlConn::Close(const string& error)
+{
+	if (fd_ >= 0)
+	{
+		if (state_ == READY)
+		{
+			/* 空闲连接尽量通知服务端正常退出 */
+			const char quit[5] = { 1, 0, 0, 0, COM_QUIT };
+			send(fd_, quit, sizeof(quit), MSG_NOSIGNAL | MSG_DONTWAIT);
+		}
+		close(fd_);
+		fd_ = -1;
+	}
+	state_ = CLOSED;
+	stmts_.clear();
+	readBuff_.RetrieveAll();
+	writeBuff_.RetrieveAll();
+	if (cb_)
+	{
+		result_ = SqlResult();
+		result_.error = error;
+		SqlCallback cb;
+		cb.swap(cb_);
+		cb(result_);
+	}
+}
+
+bool AsyncSqlConn::NextPacket_(string& payload)
+{
+	/* 包头: 3字节长度 + 1字节序号 */
+	if (readBuff_.ReadableBytes() < 4)
+	{ return false; }
+	const uint8_t* p = (const uint8_t*)readBuff_.Peek();
+	size_t len = p[0] | (p[1] << 8) | (p[2] << 16);
+	if (readBuff_.ReadableBytes() < 4 + len)
+	{ return false; }
+	seq_ = p[3] + 1;
+	payload.assign(readBuff_.Peek() + 4, len);
+	readBuff_.Retrieve(4 + len);
+	return true;
+}
+
+bool AsyncSqlConn::OnPacket_(const string& payload)
+{
+	if (payload.empty() || payload.size() >= 0xffffff)
+	{ return Fail_("unsupported packet size"); }
+	switch (state_)
+	{
+	case HANDSHAKE:
+		return OnHandshake_(payload);
+	case AUTH:
+		return OnAuth_(payload);
+	case PREPARE:
+		return OnPrepare_(payload);
+	case EXECUTE:
+		return isRows_ ? OnRow_(payload) : OnExecute_(payload);
+	default:
+		return Fail_("unexpected packet");
+	}
+}
+
+bool AsyncSqlConn::OnHandshake_(const string& payload)
+{
+	if ((uint8_t)payload[0] == 0xff)
+	{ return Fail_(ErrorMsg(payload, nullptr)); }
+
+	/* Initial Handshake Packet(协议版本10) */
+	Reader r(payload);
+	if (r.Int(1) != 10)
+	{ return Fail_("unsupported protocol version"); }
+	r.NulStr();  // 服务端版本
+	r.Int(4);    // 连接ID
+	string salt = r.Str(8);
+	r.Int(1);
+	uint32_t caps = r.Int(2);
+	r.Int(1);    // 字符集
+	r.Int(2);    // 状态
+	caps |= r.Int(2) << 16;
+	size_t saltLen = r.Int(1);
+	r.Str(10);
+	if (caps & CLIENT_SECURE_CONNECTION)
+	{ salt += r.Str(max<size_t>(13, saltLen > 8 ? saltLen - 8 : 0)); }
+	plugin_ = (caps & CLIENT_PLUGIN_AUTH) ? r.NulStr() : NATIVE_PASSWORD;
+	if (!r.isOk || !(caps & CLIENT_PROTOCOL_41))
+	{ return Fail_("unsupported server handshake"); }
+	salt_ = salt.substr(0, 20);
+	if (plugin_ != NATIVE_PASSWORD && plugin_ != CACHING_SHA2_PASSWORD)
+	{ plugin_ = NATIVE_PASSWORD; }  // 服务端会再发送AuthSwitchRequest
+
+	/* Handshake Response 41 */
+	uint32_t flags = CLIENT_LONG_PASSWORD | CLIENT_PROTOCOL_41 | CLIENT_TRANSACTIONS | CLIENT_SECURE_CONNECTION;
+	flags |= caps & CLIENT_PLUGIN_AUTH;
+	if (!dbName_.empty())
+	{ flags |= caps & CLIENT_CONNECT_WITH_DB; }
+
+	string out;
+	PutInt(out, flags, 4);
+	PutInt(out, 1 << 24, 4);  // 最大包长度
+	out.push_back(char(CHARSET_UTF8MB4));
+	out.append(23, '\0');
+	out += user_;
+	out.push_back('\0');
+	string auth = AuthResponse_(plugin_);
+	out.push_back(char(auth.size()));
+	out += auth;
+	if (flags & CLIENT_CONNECT_WITH_DB)
+	{
+		out += dbName_;
+		out.push_back('\0');
+	}
+	if (flags & CLIENT_PLUGIN_AUTH)
+	{
+		out += plugin_;
+		out.push_back('\0');
+	}
+	Send_(out);
+	state_ = AUTH;
+	return true;
+}
+
+bool AsyncSqlConn::OnAuth_(const string& payload)
+{
+	uint8_t type = payload[0];
+	if (type == 0x00)
+	{
+		state_ = READY;
+		since_ = chrono::steady_clock::now();
+		LOG_INFO("MySql async connection[%d] ready", fd_);
+		return true;
+	}
+	if (type == 0xff)
+	{ return Fail_(ErrorMsg(payload, nullptr)); }
+	if (type == 0xfe)
+	{
+		/* AuthSwitchRequest: 换用服务端指定的认证插件和新的salt */
+		Reader r(payload);
+		r.Int(1);
+		plugin_ = r.NulStr();
+		string salt = r.Rest();
+		if (!salt.empty() && salt.back() == '\0')
+		{ salt.pop_back(); }
+		salt_ = salt.substr(0, 20);
+		if (plugin_ != NATIVE_PASSWORD && plugin_ != CACHING_SHA2_PASSWORD)
+		{ return Fail_("unsupported auth plugin " + plugin_); }
+		Send_(AuthResponse_(plugin_));
+		return true;
+	}
+	if (type == 0x01 && plugin_ == CACHING_SHA2_PASSWORD)
+	{
+		if (payload.size() == 2 && payload[1] == 3)
+		{ return true; }  // 快速认证成功, 接着是OK包
+		if (payload.size() == 2 && payload[1] == 4)
+		{
+			/* 需要完整认证: unix socket上明文发送, TCP上先请求服务端公钥 */
+			if (isUnix_)
+			{ Send_(pwd_ + '\0'); }
+			else
+			{ Send_(string(1, '\x02')); }
+			return true;
+		}
+		string key = RsaEncrypt(payload.substr(1), pwd_, salt_);
+		if (key.empty())
+		{ return Fail_("rsa encrypt error"); }
+		Send_(key);
+		return true;
+	}
+	return Fail_("unexpected auth packet");
+}
+
+bool AsyncSqlConn::OnPrepare_(const string& payload)
+{
+	if (skipPackets_ > 0)
+	{
+		/* 参数和列的定义包(各自以EOF结尾), 执行时用不到 */
+		if (--skipPackets_ == 0)
+		{ return SendExecute_(stmts_[sql_]); }
+		return true;
+	}
+	if ((uint8_t)payload[0] == 0xff)
+	{
+		result_.error = ErrorMsg(payload, &result_.errorCode);
+		Finish_();
+		return true;
+	}
+
+	/* COM_STMT_PREPARE_OK: 0x00, 语句ID, 列数, 参数个数 */
+	Reader r(payload);
+	r.Int(1);
+	Stmt stmt;
+	stmt.id = r.Int(4);
+	uint16_t numColumns = r.Int(2);
+	stmt.numParams = r.Int(2);
+	if (!r.isOk)
+	{ return Fail_("bad prepare response"); }
+	stmts_[sql_] = stmt;
+	skipPackets_ = (stmt.numParams > 0 ? stmt.numParams + 1 : 0) + (numColumns > 0 ? numColumns + 1 : 0);
+	if (skipPackets_ == 0)
+	{ return SendExecute_(stmt); }
+	return true;
+}
+
+bool AsyncSqlConn::SendExecute_(const Stmt& stmt)
+{
+	if (stmt.numParams != params_.size())
+	{
+		result_.error = "wrong number of params";
+		Finish_();
+		return true;
+	}
+
+	/* COM_STMT_EXECUTE: 所有参数都按字符串发送, 由服务端转换 */
+	string out(1, char(COM_STMT_EXECUTE));
+	PutInt(out, stmt.id, 4);
+	out.push_back('\0');  // CURSOR_TYPE_NO_CURSOR
+	PutInt(out, 1, 4);    // 执行次数
+	if (!params_.empty())
+	{
+		out.append((params_.size() + 7) / 8, '\0');  // NULL位图
+		out.push_back(1);  // 附带参数类型
+		for (size_t i = 0; i < params_.size(); i++)
+		{
+			out.push_back(char(TYPE_STRING));
+			out.push_back('\0');
+		}
+		for (const auto& param : params_)
+		{
+			PutLenenc(out, param.size());
+			out += param;
+		}
+	}
+	state_ = EXECUTE;
+	isRows_ = false;
+	numColumns_ = 0;
+	types_.clear();
+	flags_.clear();
+	seq_ = 0;
+	Send_(out);
+	return Flush_();
+}
+
+bool AsyncSqlConn::OnExecute_(const string& payload)
+{
+	uint8_t type = payload[0];
+	if (numColumns_ == 0)
+	{
+		if (type == 0x00)
+		{
+			/* OK包: 没有结果集 */
+			Reader r(payload);
+			r.Int(1);
+			result_.affectedRows = r.Lenenc();
+			result_.isOk = true;
+			Finish_();
+			return true;
+		}
+		if (type == 0xff)
+		{
+			uint16_t code = 0;
+			result_.error = ErrorMsg(payload, &code);
+			result_.errorCode = code;
+			if (code == ER_UNKNOWN_STMT_HANDLER)
+			{ stmts_.erase(sql_); }  // 服务端的语句已失效, 下次重新prepare
+			Finish_();
+			return true;
+		}
+		Reader r(payload);
+		numColumns_ = r.Lenenc();
+		if (!r.isOk || numColumns_ == 0)
+		{ return Fail_("bad result set"); }
+		return true;
+	}
+	if (types_.size() < numColumns_)
+	{
+		/* 列定义: catalog, schema, table, org_table, name, org_name, 定长字段 */
+		Reader r(payload);
+		for (int i = 0; i < 6; i++)
+		{ r.LenencStr(); }
+		r.Lenenc();
+		r.Int(2);  // 字符集
+		r.Int(4);  // 列长度
+		types_.push_back(r.Int(1));
+		flags_.push_back(r.Int(2));
+		if (!r.isOk)
+		{ return Fail_("bad column definition"); }
+		return true;
+	}
+	/* 列定义之后的EOF包, 接下来是数据行 */
+	isRows_ = true;
+	return true;
+}
+
+bool AsyncSqlConn::OnRow_(const string& payload)
+{
+	uint8_t type = payload[0];
+	if (type == 0xfe && payload.size() < 9)
+	{
+		result_.isOk = true;
+		Finish_();
+		return true;
+	}
+	if (type == 0xff)
+	{
+		result_.error = ErrorMsg(payload, &result_.errorCode);
+		result_.rows.clear();
+		Finish_();
+		return true;
+	}
+
+	/* 二进制结果行: 0x00, NULL位图(偏移2位), 非NULL列的值 */
+	Reader r(payload);
+	r.Int(1);
+	string nullMap = r.Str((numColumns_ + 9) / 8);
+	if (!r.isOk)
+	{ return Fail_("bad row"); }
+	vector<string> row(numColumns_);
+	for (size_t i = 0; i < numColumns_; i++)
+	{
+		if (nullMap[(i + 2) / 8] & (1 << ((i + 2) % 8)))
+		{ continue; }
+		row[i] = DecodeValue(r, types_[i], flags_[i] & UNSIGNED_FLAG);
+	}
+	if (!r.isOk)
+	{ return Fail_("bad row"); }
+	result_.rows.push_back(std::move(row));
+	return true;
+}
+
+void AsyncSqlConn::Send_(const string& payload)
+{
+	size_t len = payload.size();
+	uint8_t header[4] = { uint8_t(len), uint8_t(len >> 8), uint8_t(len >> 16), seq_++ };
+	writeBuff_.Append(header, sizeof(header));
+	writeBuff_.Append(payload);
+}
+
+bool AsyncSqlConn::Flush_()
+{
+	while (writeBuff_.ReadableBytes() > 0 && state_ != CONNECTING)
+	{
+		ssize_t len = send(fd_, writeBuff_.Peek(), writeBuff_.ReadableBytes(), MSG_NOSIGNAL);
+		if (len < 0)
+		{
+			if (errno == EAGAIN)
+			{ break; }
+			if (errno == EINTR)
+			{ continue; }
+			return Fail_(strerror(errno));
+		}
+		writeBuff_.Retrieve(len);
+	}
+	return true;
+}
+
+string AsyncSqlConn::AuthResponse_(const string& plugin) const
+{
+	if (plugin == CACHING_SHA2_PASSWORD)
+	{ return ScrambleSha2(pwd_, salt_); }
+	return ScrambleNative(pwd_, salt_);
+}
+
+bool AsyncSqlConn::Fail_(const string& error)
+{
+	error_ = error;
+	return false;
+}
+
+void AsyncSqlConn::Finish_()
+{
+	/* 先回到空闲状态, 回调中可以继续提交查询 */
+	state_ = READY;
+	since_ = chrono::steady_clock::now();
+	params_.clear();
+	SqlResult result;
+	std::swap(result, result_);
+	SqlCallback cb;
+	cb.swap(cb_);
+	if (cb)
+	{ cb(result); }
+}
+
+AsyncSqlPool::AsyncSqlPool() :
+	epoller_(nullptr), isOpen_(false), wakeFd_(-1), tickFd_(-1), addrLen_(0), readyConns_(0)
+{
+	memset(&addr_, 0, sizeof(addr_));
+}
+
+AsyncSqlPool::~AsyncSqlPool()
+{
+	ClosePool();
+}
+
+AsyncSqlPool* AsyncSqlPool::Instance()
+{
+	static AsyncSqlPool pool;
+	return &pool;
+}
+
+bool AsyncSqlPool::Init(Epoller* epoller, const char* host, int port,
+	const char* user, const char* pwd,
+	const char* dbName, int connSize)
+{
+	assert(epoller && connSize > 0);
+	if (strcmp(host, "localhost") == 0)
+	{
+		sockaddr_un* addr = (sockaddr_un*)&addr_;
+		addr->sun_family = AF_UNIX;
+		strncpy(addr->sun_path, SQL_UNIX_SOCKET, sizeof(addr->sun_path) - 1);
+		addrLen_ = sizeof(sockaddr_un);
+	}
+	else
+	{
+		/* 启动时解析一次地址, 重连时不再阻塞在DNS上 */
+		addrinfo hints;
+		memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo* res = nullptr;
+		int ret = getaddrinfo(host, to_string(port).c_str(), &hints, &res);
+		if (ret != 0 || !res)
+		{
+			LOG_ERROR("MySql host %s error: %s", host, gai_strerror(ret));
+			return false;
+		}
+		memcpy(&addr_, res->ai_addr, res->ai_addrlen);
+		addrLen_ = res->ai_addrlen;
+		freeaddrinfo(res);
+	}
+	user_ = user;
+	pwd_ = pwd;
+	dbName_ = dbName;
+
+	wakeFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	tickFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (wakeFd_ < 0 || tickFd_ < 0)
+	{
+		LOG_ERROR("AsyncSqlPool init error: %s", strerror(errno));
+		ClosePool();
+		return false;
+	}
+	/* 每秒检查一次超时和断开的连接 */
+	itimerspec tick;
+	memset(&tick, 0, sizeof(tick));
+	tick.it_value.tv_sec = tick.it_interval.tv_sec = 1;
+	timerfd_settime(tickFd_, 0, &tick, nullptr);
+
+	epoller_ = epoller;
+	epoller_->AddFd(wakeFd_, EPOLLIN);
+	epoller_->AddFd(tickFd_, EPOLLIN);
+	isOpen_ = true;
+
+	events_.assign(connSize, 0);
+	for (int i = 0; i < connSize; i++)
+	{
+		conns_.emplace_back(new AsyncSqlConn());
+		Connect_(i);
+	}
+	return true;
+}
+
+void AsyncSqlPool::ClosePool()
+{
+	deque<Task> tasks;
+	{
+		lock_guard<mutex> locker(mtx_);
+		isOpen_ = false;
+		tasks.swap(tasks_);
+	}
+	for (auto& task : tasks)
+	{ Fail_(task, "pool closed"); }
+	/* 关闭fd会自动从epoll中移除 */
+	for (auto& conn : conns_)
+	{ conn->Close("pool closed"); }
+	conns_.clear();
+	events_.clear();
+	fds_.clear();
+	readyConns_ = 0;
+	if (wakeFd_ >= 0)
+	{
+		close(wakeFd_);
+		wakeFd_ = -1;
+	}
+	if (tickFd_ >= 0)
+	{
+		close(tickFd_);
+		tickFd_ = -1;
+	}
+}
+
+bool AsyncSqlPool::IsSqlFd(int fd) const
+{
+	return isOpen_ && (fd == wakeFd_ || fd == tickFd_ || fds_.count(fd) > 0);
+}
+
+void AsyncSqlPool::OnEvent(int fd, uint32_t events)
+{
+	uint64_t count;
+	if (fd == wakeFd_)
+	{ read(wakeFd_, &count, sizeof(count)); }
+	else if (fd == tickFd_)
+	{
+		read(tickFd_, &count, sizeof(count));
+		OnTick_();
+	}
+	else
+	{
+		auto it = fds_.find(fd);
+		if (it == fds_.end())
+		{ return; }
+		size_t i = it->second;
+		if (conns_[i]->OnEvent(events))
+		{ Update_(i); }
+		else
+		{ Drop_(i, conns_[i]->Error()); }
+	}
+	Dispatch_();
+	CountReady_();
+}
+
+void AsyncSqlPool::Query(const string& sql, const vector<string>& params, SqlCallback cb)
+{
+	Task task;
+	task.sql = sql;
+	task.params = params;
+	task.cb = std::move(cb);
+	task.since = chrono::steady_clock::now();
+
+	bool isQueued = false;
+	bool isWake = false;
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (isOpen_ && tasks_.size() < SQL_ASYNC_QUEUE_MAX)
+		{
+			isWake = tasks_.empty();
+			tasks_.push_back(std::move(task));
+			isQueued = true;
+		}
+	}
+	if (!isQueued)
+	{
+		/* 队列已满, 在调用线程中直接失败 */
+		Fail_(task, "too many pending queries");
+		return;
+	}
+	if (isWake)
+	{
+		uint64_t one = 1;
+		write(wakeFd_, &one, sizeof(one));
+	}
+}
+
+void AsyncSqlPool::Connect_(size_t i)
+{
+	AsyncSqlConn* conn = conns_[i].get();
+	if (!conn->Connect((const sockaddr*)&addr_, addrLen_, user_, pwd_, dbName_))
+	{ return; }  // 下一次定时检查时重试
+	fds_[conn->GetFd()] = i;
+	events_[i] = conn->Events();
+	epoller_->AddFd(conn->GetFd(), events_[i]);
+}
+
+void AsyncSqlPool::Drop_(size_t i, const string& error)
+{
+	AsyncSqlConn* conn = conns_[i].get();
+	if (conn->IsClosed())
+	{ return; }
+	LOG_WARN("MySql async connection[%d] closed: %s", conn->GetFd(), error.c_str());
+	epoller_->DelFd(conn->GetFd());
+	fds_.erase(conn->GetFd());
+	conn->Close(error);
+}
+
+void AsyncSqlPool::Update_(size_t i)
+{
+	AsyncSqlConn* conn = conns_[i].get();
+	if (conn->IsClosed())
+	{ return; }
+	uint32_t events = conn->Events();
+	if (events != events_[i])
+	{
+		epoller_->ModFd(conn->GetFd(), events);
+		events_[i] = events;
+	}
+}
+
+void AsyncSqlPool::Dispatch_()
+{
+	/* 把等待中的查询分配给空闲连接 */
+	for (size_t i = 0; i < conns_.size(); i++)
+	{
+		AsyncSqlConn* conn = conns_[i].get();
+		while (conn->IsReady())
+		{
+			Task task;
+			{
+				lock_guard<mutex> locker(mtx_);
+				if (tasks_.empty())
+				{ return; }
+				task = std::move(tasks_.front());
+				tasks_.pop_front();
+			}
+			if (!conn->Execute(task.sql, task.params, std::move(task.cb)))
+			{
+				Drop_(i, conn->Error());
+				break;
+			}
+			Update_(i);
+		}
+	}
+}
+
+void AsyncSqlPool::OnTick_()
+{
+	auto now = chrono::steady_clock::now();
+	auto timeout = chrono::milliseconds(SQL_ASYNC_TIMEOUT_MS);
+	for (size_t i = 0; i < conns_.size(); i++)
+	{
+		AsyncSqlConn* conn = conns_[i].get();
+		if (conn->IsClosed())
+		{ Connect_(i); }
+		else if (!conn->IsReady() && now - conn->Since() > timeout)
+		{ Drop_(i, "timeout"); }
+	}
+
+	/* 排队超时的查询: 数据库不可用时不会无限期挂起请求 */
+	deque<Task> expired;
+	{
+		lock_guard<mutex> locker(mtx_);
+		while (!tasks_.empty() && now - tasks_.front().since > timeout)
+		{
+			expired.push_back(std::move(tasks_.front()));
+			tasks_.pop_front();
+		}
+	}
+	for (auto& task : expired)
+	{ Fail_(task, "timeout"); }
+}
+
+void AsyncSqlPool::CountReady_()
+{
+	int count = 0;
+	for (auto& conn : conns_)
+	{
+		if (conn->IsAuthed())
+		{ count++; }
+	}
+	if (count != readyConns_)
+	{
+		if (count == 0)
+		{ LOG_WARN("MySql async connections all closed, use SqlConnPool"); }
+		else if (readyConns_ == 0)
+		{ LOG_INFO("MySql async connections ready: %d", count); }
+		readyConns_ = count;
+	}
+}
+
+void AsyncSqlPool::Fail_(Task& task, const string& error)
+{
+	SqlResult result = SqlResult();
+	result.error = error;
+	if (task.cb)
+	{ task.cb(result); }
+}
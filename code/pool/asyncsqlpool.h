@@ -0,0 +1,237 @@
+#ifndef ASYNC_SQL_POOL_H
+#define ASYNC_SQL_POOL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <atomic>
+#include <stdint.h>
+#include <sys/socket.h>
+
+#include "../log/log.h"
+#include "../buffer/buffer.h"
+#include "../server/epoller.h"
+#include "../config/config.h"
+
+/* 一次查询的结果; 结果集中的每列都转换为字符串, NULL为空串 */
+struct SqlResult
+{
+	bool isOk;
+	std::string error;
+	uint16_t errorCode;  // 服务端返回的错误码, 连接出错/超时等为0
+	uint64_t affectedRows;
+	std::vector<std::vector<std::string>> rows;
+};
+
+typedef std::function<void(SqlResult& result)> SqlCallback;
+
+/*
+ * 非阻塞的MySQL客户端连接, 直接实现MySQL客户端/服务端协议
+ * 认证支持mysql_native_password和caching_sha2_password(TCP连接完整认证时用服务端RSA公钥加密密码)
+ * 查询使用预处理语句(COM_STMT_PREPARE/COM_STMT_EXECUTE), 语句按SQL文本缓存在连接上
+ * 同一时刻只执行一个查询; 只由epoll线程访问, 不加锁
+ */
+class AsyncSqlConn
+{
+ public:
+	AsyncSqlConn();
+	~AsyncSqlConn();
+
+	/* 发起非阻塞连接, 失败返回false */
+	bool Connect(const sockaddr* addr, socklen_t addrLen,
+		const std::string& user, const std::string& pwd, const std::string& dbName);
+
+	/* 开始执行一个查询, 完成或出错时调用cb; 返回false表示连接已出错 */
+	bool Execute(const std::string& sql, const std::vector<std::string>& params, SqlCallback cb);
+
+	/* 处理socket事件; 返回false表示连接已出错, 应由调用者关闭 */
+	bool OnEvent(uint32_t events);
+
+	/* 关闭连接, 正在执行的查询以error失败 */
+	void Close(const std::string& error);
+
+	int GetFd() const
+	{
+		return fd_;
+	}
+
+	bool IsReady() const
+	{
+		return state_ == READY;
+	}
+
+	/* 已完成认证: 空闲或正在执行查询 */
+	bool IsAuthed() const
+	{
+		return state_ >= READY;
+	}
+
+	bool IsClosed() const
+	{
+		return state_ == CLOSED;
+	}
+
+	const std::string& Error() const
+	{
+		return error_;
+	}
+
+	/* 需要监听的事件 */
+	uint32_t Events() const;
+
+	/* 当前连接/查询开始的时间, 用于超时检查 */
+	std::chrono::steady_clock::time_point Since() const
+	{
+		return since_;
+	}
+
+ private:
+	enum STATE
+	{
+		CLOSED,
+		CONNECTING,
+		HANDSHAKE,
+		AUTH,
+		READY,
+		PREPARE,
+		EXECUTE,
+	};
+
+	/* 预处理语句: 服务端语句ID, 参数个数 */
+	struct Stmt
+	{
+		uint32_t id;
+		uint16_t numParams;
+	};
+
+	bool NextPacket_(std::string& payload);
+	bool OnPacket_(const std::string& payload);
+	bool OnHandshake_(const std::string& payload);
+	bool OnAuth_(const std::string& payload);
+	bool OnPrepare_(const std::string& payload);
+	bool OnExecute_(const std::string& payload);
+	bool OnRow_(const std::string& payload);
+
+	void Send_(const std::string& payload);
+	bool Flush_();
+	bool SendExecute_(const Stmt& stmt);
+	std::string AuthResponse_(const std::string& plugin) const;
+	bool Fail_(const std::string& error);
+	void Finish_();
+
+	int fd_;
+	STATE state_;
+	std::string error_;
+	bool isUnix_;  // unix socket被视为安全连接, 可以明文发送密码
+	uint8_t seq_;  // 下一个发送包的序号
+	std::chrono::steady_clock::time_point since_;
+
+	std::string user_;
+	std::string pwd_;
+	std::string dbName_;
+	std::string plugin_;
+	std::string salt_;
+
+	Buffer readBuff_;
+	Buffer writeBuff_;
+
+	std::unordered_map<std::string, Stmt> stmts_;
+
+	/* 当前查询 */
+	std::string sql_;
+	std::vector<std::string> params_;
+	SqlCallback cb_;
+	SqlResult result_;
+	size_t skipPackets_;  // PREPARE响应中尚未跳过的参数/列定义包
+	size_t numColumns_;
+	std::vector<uint8_t> types_;
+	std::vector<uint16_t> flags_;
+	bool isRows_;
+};
+
+/*
+ * 异步MySQL连接池, 单例
+ * 连接socket注册到WebServer的Epoller, 查询期间请求挂起而不是占用工作线程
+ * 任意线程调用Query把查询放入等待队列, 通过eventfd唤醒epoll线程分配给空闲连接
+ * 连接断开或查询超时时失败当前查询, timerfd定时检查超时并重连
+ */
+class AsyncSqlPool
+{
+ public:
+	static AsyncSqlPool* Instance();
+
+	/*
+	 * host为localhost时与SqlConnPool一样使用unix socket SQL_UNIX_SOCKET
+	 * 连接是非阻塞建立的, 返回true不代表已有可用连接, 见IsReady
+	 */
+	bool Init(Epoller* epoller, const char* host, int port,
+		const char* user, const char* pwd,
+		const char* dbName, int connSize);
+	void ClosePool();
+
+	bool IsOpen() const
+	{
+		return isOpen_;
+	}
+
+	/* 至少有一个连接已完成认证; 否则调用方应使用同步连接池, 而不是排队等待超时 */
+	bool IsReady() const
+	{
+		return readyConns_ > 0;
+	}
+
+	/* 属于连接池的fd, 由epoll线程调用OnEvent处理 */
+	bool IsSqlFd(int fd) const;
+	void OnEvent(int fd, uint32_t events);
+
+	/* params按顺序绑定到sql中的?; 回调在epoll线程中执行, 不能阻塞 */
+	void Query(const std::string& sql, const std::vector<std::string>& params, SqlCallback cb);
+
+ private:
+	AsyncSqlPool();
+	~AsyncSqlPool();
+
+	struct Task
+	{
+		std::string sql;
+		std::vector<std::string> params;
+		SqlCallback cb;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	void Connect_(size_t i);
+	void Drop_(size_t i, const std::string& error);
+	void Update_(size_t i);
+	void Dispatch_();
+	void OnTick_();
+	void CountReady_();
+
+	static void Fail_(Task& task, const std::string& error);
+
+	Epoller* epoller_;
+	bool isOpen_;
+	int wakeFd_;  // eventfd: 等待队列从空变为非空
+	int tickFd_;  // timerfd: 超时检查和重连
+
+	sockaddr_storage addr_;
+	socklen_t addrLen_;
+	std::string user_;
+	std::string pwd_;
+	std::string dbName_;
+
+	/* 只由epoll线程访问 */
+	std::vector<std::unique_ptr<AsyncSqlConn>> conns_;
+	std::vector<uint32_t> events_;  // 各连接当前注册的事件
+	std::unordered_map<int, size_t> fds_;
+	std::atomic<int> readyConns_;  // 已完成认证的连接数, 工作线程读取
+
+	std::mutex mtx_;
+	std::deque<Task> tasks_;
+};
+
+#endif //ASYNC_SQL_POOL_H
@@ -0,0 +1,53 @@
+#include "filebufpool.h"
+using namespace std;
+
+FileBufPool* FileBufPool::Instance()
+{
+	static FileBufPool pool;
+	return &pool;
+}
+
+vector<char>* FileBufPool::GetBuf(size_t len)
+{
+	assert(len <= ASYNC_READ_MAX);
+	vector<char>* buf = nullptr;
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (!freeBufs_.empty())
+		{
+			buf = freeBufs_.back();
+			freeBufs_.pop_back();
+		}
+	}
+	if (!buf)
+	{ buf = new vector<char>; }
+	buf->resize(len);  // 复用的缓冲区容量只增不减, 最大ASYNC_READ_MAX
+	return buf;
+}
+
+void FileBufPool::FreeBuf(vector<char>* buf)
+{
+	assert(buf);
+	{
+		lock_guard<mutex> locker(mtx_);
+		if (freeBufs_.size() < FILE_BUF_POOL_SIZE)
+		{
+			freeBufs_.push_back(buf);
+			return;
+		}
+	}
+	delete buf;  // 空闲缓冲区已足够
+}
+
+int FileBufPool::GetFreeBufCount()
+{
+	lock_guard<mutex> locker(mtx_);
+	return freeBufs_.size();
+}
+
+FileBufPool::~FileBufPool()
+{
+	for (auto buf : freeBufs_)
+	{ delete buf; }
+	freeBufs_.clear();
+}
@@ -0,0 +1,30 @@
+#ifndef FILEBUFPOOL_H
+#define FILEBUFPOOL_H
+
+#include <vector>
+#include <mutex>
+#include <assert.h>
+#include "../config/config.h"
+
+/*
+ * 文件内容缓冲池
+ * IO线程pread冷文件时从池中取缓冲区, 响应发送完毕后归还, 避免每次请求分配大块内存
+ */
+class FileBufPool
+{
+ public:
+	static FileBufPool* Instance();
+
+	std::vector<char>* GetBuf(size_t len);
+	void FreeBuf(std::vector<char>* buf);
+	int GetFreeBufCount();
+
+ private:
+	FileBufPool() = default;
+	~FileBufPool();
+
+	std::vector<std::vector<char>*> freeBufs_;
+	std::mutex mtx_;
+};
+
+#endif //FILEBUFPOOL_H
@@ -1,11 +1,14 @@
-
 #include "sqlconnpool.h"
+#include <algorithm>
+#include <mysql/errmsg.h>  // CR_SERVER_GONE_ERROR
 using namespace std;
 
-SqlConnPool::SqlConnPool()
+SqlConnPool::SqlConnPool() : mtx_(Metrics::LOCK_SQL_POOL)
 {
-	useCount_ = 0;
-	freeCount_ = 0;
+	MAX_CONN_ = MIN_CONN_ = 0;
+	connCount_ = 0;
+	isOpen_ = false;
+	port_ = 0;
 }
 
 SqlConnPool* SqlConnPool::Instance()
@@ -21,77 +24,294 @@ void SqlConnPool::Init(const char* host, int port,  // 服务器ip, 服务器的
 	int connSize = 10)
 {
 	assert(connSize > 0);  // sql链接池, 实现链接重用
-	for (int i = 0; i < connSize; i++)
+	/* 多线程使用前先初始化库, mysql_init本身不是线程安全的 */
+	mysql_library_init(0, nullptr, nullptr);
+	host_ = host;
+	port_ = port;
+	user_ = user;
+	pwd_ = pwd;
+	dbName_ = dbName;
+	MAX_CONN_ = connSize;  // 限制最大连接数
+	MIN_CONN_ = min(max(SQL_POOL_MIN, 1), connSize);
+
+	/* 并行建立最小连接数个连接, 启动时间只取决于最慢的一个 */
+	auto now = chrono::steady_clock::now();
+	vector<MYSQL*> conns = ConnectN_(MIN_CONN_);
+	{
+		lock_guard<ProfiledMutex> locker(mtx_);
+		for (MYSQL* sql : conns)
+		{ connQue_.push_back({ sql, now }); }
+		connCount_ = conns.size();
+		isOpen_ = true;
+	}
+	if ((int)conns.size() < MIN_CONN_)
+	{ LOG_ERROR("MySql Connect error! %d/%d connected", (int)conns.size(), MIN_CONN_); }
+	checkThread_.reset(new thread([this]
+	{
+		Check_();
+		mysql_thread_end();
+	}));
+}
+
+MYSQL* SqlConnPool::Connect_()
+{
+	MYSQL* sql = mysql_init(nullptr);
+	if (!sql)
+	{
+		LOG_ERROR("MySql init error!");
+		return nullptr;
+	}
+	unsigned int timeout = SQL_CONNECT_TIMEOUT;
+	mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &timeout);
+	/* localhost与AsyncSqlPool使用同一个unix socket, 而不是libmysqlclient编译时的默认路径 */
+	const char* unixSocket = host_ == "localhost" ? SQL_UNIX_SOCKET : nullptr;
+	if (!mysql_real_connect(sql, host_.c_str(), user_.c_str(), pwd_.c_str(),
+		dbName_.c_str(), port_, unixSocket, 0))
+	{
+		LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+		mysql_close(sql);
+		return nullptr;
+	}
+	return sql;
+}
+
+vector<MYSQL*> SqlConnPool::ConnectN_(int n)
+{
+	/* 每个连接一个线程, 返回成功建立的连接 */
+	vector<MYSQL*> conns(n, nullptr);
+	vector<thread> threads;
+	for (int i = 0; i < n; i++)
 	{
-		MYSQL* sql = nullptr;
-		sql = mysql_init(sql);
-		if (!sql)
+		threads.emplace_back([this, &conns, i]
 		{
-			LOG_ERROR("MySql init error!");
-			assert(sql);
-		}
-		sql = mysql_real_connect(sql, host,
-			user, pwd,
-			dbName, port, nullptr, 0);
-		if (!sql)
+			conns[i] = Connect_();
+			mysql_thread_end();
+		});
+	}
+	for (auto& t : threads)
+	{ t.join(); }
+	conns.erase(remove(conns.begin(), conns.end(), nullptr), conns.end());
+	return conns;
+}
+
+void SqlConnPool::Close_(MYSQL* sql)
+{
+	/* 关闭连接及其预处理语句, 调用时连接不在队列中 */
+	unordered_map<string, MYSQL_STMT*> stmts;
+	{
+		lock_guard<ProfiledMutex> locker(mtx_);
+		auto it = stmts_.find(sql);
+		if (it != stmts_.end())
 		{
-			LOG_ERROR("MySql Connect error!");
+			stmts.swap(it->second);
+			stmts_.erase(it);
 		}
-		connQue_.push(sql);  // 创建connSize个MYSQL*对象,加入队列
 	}
-	MAX_CONN_ = connSize;  // 限制最大连接数
-	sem_init(&semId_, 0, MAX_CONN_);  // 创建匿名信号量
-	// MAX_CONN_作为信号量的初始值，用来限制最大连接数
+	for (auto& it : stmts)
+	{ mysql_stmt_close(it.second); }
+	mysql_close(sql);
 }
 
-MYSQL* SqlConnPool::GetConn()
+MYSQL_STMT* SqlConnPool::GetStmt(MYSQL* sql, const string& query)
 {
-	MYSQL* sql = nullptr;
-	if (connQue_.empty())
+	assert(sql);
+	unordered_map<string, MYSQL_STMT*>* cache = nullptr;
+	{
+		// 只在查找连接对应的缓存时加锁, 缓存本身属于持有连接的线程
+		lock_guard<ProfiledMutex> locker(mtx_);
+		cache = &stmts_[sql];
+	}
+	auto it = cache->find(query);
+	if (it != cache->end())
+	{ return it->second; }
+	MYSQL_STMT* stmt = mysql_stmt_init(sql);
+	if (!stmt)
 	{
-		LOG_WARN("SqlConnPool busy!");
+		LOG_ERROR("MySql stmt init error!");
 		return nullptr;
 	}
-	sem_wait(&semId_);
-	/*
-	 * 信号量上锁, 信号量值-1
-	 * 连接数+1
-	 * 信号量值为0时阻塞
-	 */
+	if (mysql_stmt_prepare(stmt, query.data(), query.size()))
 	{
-		lock_guard<mutex> locker(mtx_);
-		sql = connQue_.front();
-		connQue_.pop();
+		LOG_ERROR("MySql prepare [%s] error: %s", query.c_str(), mysql_stmt_error(stmt));
+		mysql_stmt_close(stmt);
+		return nullptr;
 	}
-	return sql;
+	(*cache)[query] = stmt;
+	return stmt;
+}
+
+void SqlConnPool::DropStmt(MYSQL* sql, const string& query)
+{
+	assert(sql);
+	unordered_map<string, MYSQL_STMT*>* cache = nullptr;
+	{
+		lock_guard<ProfiledMutex> locker(mtx_);
+		cache = &stmts_[sql];
+	}
+	auto it = cache->find(query);
+	if (it != cache->end())
+	{
+		mysql_stmt_close(it->second);
+		cache->erase(it);
+	}
+}
+
+MYSQL* SqlConnPool::GetConn(int timeoutMS)
+{
+	auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMS);
+	unique_lock<ProfiledMutex> locker(mtx_);
+	while (isOpen_)
+	{
+		if (!connQue_.empty())
+		{
+			/* 取最近放回的连接, 空闲久的留在头部由检查线程处理 */
+			MYSQL* sql = connQue_.back().sql;
+			connQue_.pop_back();
+			return sql;
+		}
+		if (connCount_ < MAX_CONN_)
+		{
+			/* 没有空闲连接且未达上限, 新建一个 */
+			connCount_++;
+			locker.unlock();
+			MYSQL* sql = Connect_();
+			if (sql)
+			{ return sql; }
+			locker.lock();
+			connCount_--;
+			return nullptr;
+		}
+		/* 超时时再检查一次: 期间可能有连接放回, 或断开的连接被丢弃后可以新建 */
+		if (mtx_.WaitUntil(cond_, locker, deadline) == cv_status::timeout
+			&& connQue_.empty() && connCount_ >= MAX_CONN_)
+		{
+			LOG_WARN("SqlConnPool busy!");
+			return nullptr;
+		}
+	}
+	return nullptr;
 }
 
 void SqlConnPool::FreeConn(MYSQL* sql)
 {
 	assert(sql);
-	lock_guard<mutex> locker(mtx_);
-	connQue_.push(sql);
-	sem_post(&semId_);  // 信号量值加1
+	unsigned int err = mysql_errno(sql);
+	{
+		lock_guard<ProfiledMutex> locker(mtx_);
+		if (isOpen_ && err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST)
+		{
+			connQue_.push_back({ sql, chrono::steady_clock::now() });
+			cond_.notify_one();
+			return;
+		}
+		/* 连接已断开或连接池已关闭: 不再放回, 由检查线程补足; 等待的GetConn可以新建连接 */
+		connCount_--;
+		cond_.notify_one();
+	}
+	if (err)
+	{ LOG_WARN("MySql connection lost: %s", mysql_error(sql)); }
+	Close_(sql);
+}
+
+void SqlConnPool::Check_()
+{
+	unique_lock<ProfiledMutex> locker(mtx_);
+	while (isOpen_)
+	{
+		mtx_.WaitFor(checkCond_, locker, chrono::seconds(1));
+		if (!isOpen_)
+		{ break; }
+		/* 取出空闲超过SQL_POOL_PING_MS的连接: 多于最小连接数的关闭, 其余ping */
+		auto now = chrono::steady_clock::now();
+		vector<MYSQL*> idle, extra;
+		while (!connQue_.empty() && now - connQue_.front().since >= chrono::milliseconds(SQL_POOL_PING_MS))
+		{
+			if (connCount_ > MIN_CONN_)
+			{
+				extra.push_back(connQue_.front().sql);
+				connCount_--;
+			}
+			else
+			{ idle.push_back(connQue_.front().sql); }
+			connQue_.pop_front();
+		}
+		int lack = MIN_CONN_ - connCount_;
+		if (idle.empty() && extra.empty() && lack <= 0)
+		{ continue; }
+		connCount_ += max(lack, 0);
+		locker.unlock();
+
+		for (MYSQL* sql : extra)
+		{ Close_(sql); }
+		/* ping失败的连接关闭后重新建立 */
+		vector<MYSQL*> conns;
+		int reconnect = max(lack, 0);
+		for (MYSQL* sql : idle)
+		{
+			if (mysql_ping(sql) == 0)
+			{ conns.push_back(sql); }
+			else
+			{
+				LOG_WARN("MySql ping error: %s", mysql_error(sql));
+				Close_(sql);
+				reconnect++;
+			}
+		}
+		vector<MYSQL*> news = ConnectN_(reconnect);
+		if ((int)news.size() < reconnect)
+		{ LOG_WARN("MySql reconnect %d/%d", (int)news.size(), reconnect); }
+		conns.insert(conns.end(), news.begin(), news.end());
+
+		locker.lock();
+		connCount_ -= reconnect - (int)news.size();
+		now = chrono::steady_clock::now();
+		for (MYSQL* sql : conns)
+		{ connQue_.push_back({ sql, now }); }
+		cond_.notify_all();
+	}
 }
 
 void SqlConnPool::ClosePool()
 {
-	lock_guard<mutex> locker(mtx_);
+	{
+		lock_guard<ProfiledMutex> locker(mtx_);
+		if (!isOpen_)
+		{ return; }
+		isOpen_ = false;
+	}
+	cond_.notify_all();
+	checkCond_.notify_all();
+	if (checkThread_ && checkThread_->joinable())
+	{ checkThread_->join(); }
+
+	lock_guard<ProfiledMutex> locker(mtx_);
+	for (auto& conn : stmts_)
+	{
+		for (auto& it : conn.second)
+		{ mysql_stmt_close(it.second); }
+	}
+	stmts_.clear();
 	while (!connQue_.empty())
 	{
-		auto item = connQue_.front();
-		connQue_.pop();
-		mysql_close(item);
+		mysql_close(connQue_.front().sql);
+		connQue_.pop_front();
+		connCount_--;
 	}
 	mysql_library_end();
 }
 
 int SqlConnPool::GetFreeConnCount()
 {
-	lock_guard<mutex> locker(mtx_);
+	lock_guard<ProfiledMutex> locker(mtx_);
 	return connQue_.size();
 }
 
+int SqlConnPool::GetConnCount()
+{
+	lock_guard<ProfiledMutex> locker(mtx_);
+	return connCount_;
+}
+
 SqlConnPool::~SqlConnPool()
 {
 	ClosePool();
@@ -3,20 +3,42 @@
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
+#include <unordered_map>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
 #include <thread>
+#include <memory>
+#include <chrono>
 #include "../log/log.h"
+#include "../config/config.h"
+#include "../metrics/profmutex.h"
 
+/*
+ * MySQL连接池, 单例
+ * 启动时并行建立SQL_POOL_MIN个连接, 不够用时在GetConn中按需新建, 最多connSize个
+ * 检查线程每秒运行一次: ping空闲超过SQL_POOL_PING_MS的连接, 失败则重连;
+ * 多于最小连接数时关闭长时间空闲的连接; 数据库重启后把连接补足到最小连接数
+ */
 class SqlConnPool
 {  //
  public:
 	static SqlConnPool* Instance();
 
-	MYSQL* GetConn();
+	/* 等待空闲连接最多timeoutMS毫秒, 超时或连接失败返回nullptr */
+	MYSQL* GetConn(int timeoutMS = SQL_POOL_WAIT_MS);
 	void FreeConn(MYSQL* conn);
 	int GetFreeConnCount();
+	int GetConnCount();
+
+	/*
+	 * 预处理语句缓存: 每个连接各自缓存prepare过的MYSQL_STMT, 以SQL文本为键
+	 * 只有当前持有该连接的线程会访问它的缓存
+	 * 执行出错(如连接重连后语句失效)时调用DropStmt, 下次重新prepare
+	 */
+	MYSQL_STMT* GetStmt(MYSQL* sql, const std::string& query);
+	void DropStmt(MYSQL* sql, const std::string& query);
 
 	void Init(const char* host, int port,
 		const char* user, const char* pwd,
@@ -27,13 +49,34 @@ class SqlConnPool
 	SqlConnPool();
 	~SqlConnPool(); // 析构函数
 
+	struct IdleConn
+	{
+		MYSQL* sql;
+		std::chrono::steady_clock::time_point since;  // 放回连接池的时间
+	};
+
+	MYSQL* Connect_();
+	std::vector<MYSQL*> ConnectN_(int n);
+	void Close_(MYSQL* sql);
+	void Check_();
+
 	int MAX_CONN_;
-	int useCount_;
-	int freeCount_;
+	int MIN_CONN_;
+	int connCount_;  // 已建立和正在建立的连接数
+	bool isOpen_;
+
+	std::string host_;
+	int port_;
+	std::string user_;
+	std::string pwd_;
+	std::string dbName_;
 
-	std::queue<MYSQL*> connQue_;
-	std::mutex mtx_;
-	sem_t semId_;
+	std::deque<IdleConn> connQue_;  // 尾部是最近放回的, 头部空闲最久
+	std::unordered_map<MYSQL*, std::unordered_map<std::string, MYSQL_STMT*>> stmts_;
+	ProfiledMutex mtx_;
+	std::condition_variable cond_;       // 等待空闲连接的GetConn
+	std::condition_variable checkCond_;  // 检查线程, 只在关闭连接池时唤醒
+	std::unique_ptr<std::thread> checkThread_;
 };
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
@@ -6,20 +6,27 @@
 #include <condition_variable>
 #include <queue>
 #include <thread>
+#include <vector>
 #include <functional>
+#include "../metrics/metrics.h"
+#include "../metrics/profmutex.h"
 
 class ThreadPool
 {
  public:
-	explicit ThreadPool(size_t threadCount = 8) : pool_(std::make_shared<Pool>())
+	/* queueStage: 任务排队时间记入的指标, STAGE_NONE为不记录; lockSite: 任务队列的锁记入的指标 */
+	explicit ThreadPool(size_t threadCount = 8, Metrics::Stage queueStage = Metrics::STAGE_NONE,
+		Metrics::LockSite lockSite = Metrics::LOCK_NONE)
+		: pool_(std::make_shared<Pool>(lockSite))
 	{
 		assert(threadCount > 0);
+		pool_->queueStage = queueStage;
 		for (size_t i = 0; i < threadCount; i++)
 		{
-			std::thread([pool = pool_]
+			threads_.emplace_back([pool = pool_]
 			{  // lambda的可调用形式
 			  // 创建线程
-			  std::unique_lock<std::mutex> locker(pool->mtx);
+			  std::unique_lock<ProfiledMutex> locker(pool->mtx);
 			  // 没有mtx加锁， 同lock_guard
 			  while (true)
 			  {
@@ -32,13 +39,15 @@ class ThreadPool
 					  auto task = std::move(pool->tasks.front());
 					  pool->tasks.pop();  // 从线程池中取出任务, 弹出可调用类型对象
 					  locker.unlock();  // 完成任务池对象的访问后解锁
-					  task();  // 执行或者调用task(),
+					  if (pool->queueStage != Metrics::STAGE_NONE)
+					  { Metrics::Observe(pool->queueStage, task.addTime); }
+					  task.fn();  // 执行或者调用task(),
 					  locker.lock();  //
 				  }
 				  else if (pool->isClosed) break;
-				  else pool->cond.wait(locker);
+				  else pool->mtx.Wait(pool->cond, locker);
 			  }
-			}).detach();
+			});
 		}
 	}
 
@@ -48,13 +57,23 @@ class ThreadPool
 
 	~ThreadPool()
 	{  // 析构，
-		if (static_cast<bool>(pool_))
+		Close();
+	}
+
+	/* 关闭线程池: 工作线程执行完队列中的任务后退出, 等待全部退出; 不能在工作线程中调用 */
+	void Close()
+	{
+		if (!static_cast<bool>(pool_))
+		{ return; }
+		{
+			std::lock_guard<ProfiledMutex> locker(pool_->mtx);
+			pool_->isClosed = true;  // 关闭线程池
+		}
+		pool_->cond.notify_all();
+		for (auto& thread : threads_)
 		{
-			{
-				std::lock_guard<std::mutex> locker(pool_->mtx);
-				pool_->isClosed = true;  // 关闭线程池
-			}
-			pool_->cond.notify_all();
+			if (thread.joinable())
+			{ thread.join(); }
 		}
 	}
 
@@ -63,21 +82,37 @@ class ThreadPool
 	{
 		// F&& 传递右值引用参数
 		{
-			std::lock_guard<std::mutex> locker(pool_->mtx);
-			pool_->tasks.emplace(std::forward<F>(task));  // std::forward<F>保证传入右值引用
+			std::lock_guard<ProfiledMutex> locker(pool_->mtx);
+			pool_->tasks.push({ std::forward<F>(task),
+				pool_->queueStage != Metrics::STAGE_NONE ? Metrics::Clock::now() : Metrics::Clock::time_point() });
 		}
 		pool_->cond.notify_one();
 	}
 
+	/* 等待执行的任务数 */
+	size_t QueueSize()
+	{
+		std::lock_guard<ProfiledMutex> locker(pool_->mtx);
+		return pool_->tasks.size();
+	}
+
  private:
+	struct Task
+	{
+		std::function<void()> fn;
+		Metrics::Clock::time_point addTime;  // 加入队列的时间
+	};
 	struct Pool
 	{
-		std::mutex mtx;  // 互斥量
+		explicit Pool(Metrics::LockSite lockSite) : mtx(lockSite), isClosed(false) {}
+		ProfiledMutex mtx;  // 互斥量
 		std::condition_variable cond; // 条件量
 		bool isClosed;  //
-		std::queue<std::function<void()>> tasks;  // 任务队列
+		Metrics::Stage queueStage;
+		std::queue<Task> tasks;  // 任务队列
 	};
 	std::shared_ptr<Pool> pool_;
+	std::vector<std::thread> threads_;
 };
 
 #endif //THREADPOOL_H
\ No newline at end of file
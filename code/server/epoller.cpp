@@ -18,6 +18,7 @@ bool Epoller::AddFd(int fd, uint32_t events)
 //  epoll_event ev;
 	ev.data.fd = fd;
 	ev.events = events;
+	Metrics::AddSyscall();
 	return 0 == epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
@@ -27,6 +28,8 @@ bool Epoller::ModFd(int fd, uint32_t events)
 	epoll_event ev = { 0 };
 	ev.data.fd = fd;
 	ev.events = events;
+	TraceSpan span("ModFd");  // 重新监听连接时计入当前线程处理的请求
+	Metrics::AddSyscall();
 	return 0 == epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
 }
 
@@ -34,12 +37,14 @@ bool Epoller::DelFd(int fd)
 {
 	if (fd < 0) return false;
 	epoll_event ev = { 0 };
+	Metrics::AddSyscall();
 	return 0 == epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, &ev);
 }
 
-int Epoller::Wait(int timeoutMs)
+int Epoller::Wait(int timeoutMs, const sigset_t* sigmask)
 {
-	return epoll_wait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs);
+	Metrics::AddSyscall();  // 不在任何阶段中, 计入other
+	return epoll_pwait(epollFd_, &events_[0], static_cast<int>(events_.size()), timeoutMs, sigmask);
 }
 
 int Epoller::GetEventFd(size_t i) const
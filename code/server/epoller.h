@@ -7,6 +7,10 @@
 #include <assert.h> // close()
 #include <vector>
 #include <errno.h>
+#include <signal.h>
+
+#include "../metrics/trace.h"
+#include "../metrics/metrics.h"
 
 class Epoller
 {
@@ -21,7 +25,8 @@ class Epoller
 
 	bool DelFd(int fd);
 
-	int Wait(int timeoutMs = -1);
+	/* sigmask非空时为epoll_pwait, 等待期间使用该信号屏蔽字 */
+	int Wait(int timeoutMs = -1, const sigset_t* sigmask = nullptr);
 
 	int GetEventFd(size_t i) const;
 
@@ -7,11 +7,40 @@ WebServer::WebServer(
 	int port, int trigMode, int timeoutMS, bool OptLinger,
 	int sqlPort, const char* sqlUser, const char* sqlPwd,
 	const char* dbName, int connPoolNum, int threadNum,
-	bool openLog, int logLevel, int logQueSize) :
+	bool openLog, int logLevel, int logQueSize, const char* userFile) :
 	port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-	timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)),
-	epoller_(new Epoller())
+	timer_(new HeapTimer()), epoller_(new Epoller())
 {
+	/*
+	 * SIGINT/SIGTERM/SIGUSR2只由epoll线程在epoll_pwait中接收, 处理函数设置的标志在返回后立即检查:
+	 * 创建任何线程之前在本线程屏蔽, 日志, 线程池, 连接池等线程继承屏蔽字
+	 */
+	sigset_t sigs;
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGTERM);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, &waitMask_);
+	sigdelset(&waitMask_, SIGINT);
+	sigdelset(&waitMask_, SIGTERM);
+	sigdelset(&waitMask_, SIGUSR2);
+
+	/* 先初始化日志, 连接池/用户表初始化时的错误也能记录 */
+	if (openLog)
+	{
+		std::cout << "log available" << std::endl;
+		Log::Instance()->init(logLevel, "./log", LOG_BINARY ? ".blog" : ".log", logQueSize, LOG_BINARY);
+		if (ACCESS_LOG_SAMPLE > 0)
+		{ AccessLog::Instance()->Init(ACCESS_LOG_PATH); }
+	}
+
+	wakeTsc_ = 0;
+	Trace::InitSignal();
+	Metrics::InitSignal();
+
+	threadpool_.reset(new ThreadPool(threadNum, Metrics::STAGE_QUEUE, Metrics::LOCK_WORKER_POOL));
+	if (IO_THREAD_NUM > 0)
+	{ ioPool_.reset(new ThreadPool(IO_THREAD_NUM, Metrics::STAGE_IO_QUEUE, Metrics::LOCK_IO_POOL)); }
 
 	srcDir_ = getcwd(nullptr, 256);  // 当前工作目录
 	assert(srcDir_);
@@ -19,8 +48,63 @@ WebServer::WebServer(
 	HttpConn::userCount = 0;     // 原子类型变量, 记录http连接用户数量
 	HttpConn::srcDir = srcDir_;  // 设置httpconn中静态变量srcDir_
 
-	// 初始化Sql连接池
-	SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  //
+	/* 用户表: 指定了用户文件时使用内存用户表, 不连接MySQL */
+	if (userFile && *userFile)
+	{
+		MemUserStore* store = new MemUserStore();
+		userStore_.reset(store);
+		if (!store->Init(userFile))
+		{
+			std::cout << "user file error: " << userFile << ", " << strerror(errno) << std::endl;
+			isClose_ = true;
+		}
+	}
+	else
+	{
+		// 初始化Sql连接池
+		SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);  //
+		/*
+		 * 异步连接池: HTTP/1.1的登录/注册不占用工作线程; HTTP/2仍使用上面的同步连接池
+		 * 连接在epoll线程中建立, 没有完成认证的连接时也回退到同步连接池
+		 */
+		if (SQL_ASYNC_CONN > 0)
+		{
+			HttpRequest::isAsyncVerify = AsyncSqlPool::Instance()->Init(epoller_.get(),
+				"localhost", sqlPort, sqlUser, sqlPwd, dbName, SQL_ASYNC_CONN);
+		}
+		if (REG_BATCH_MAX > 1)
+		{ RegisterBatcher::Instance()->Init(HttpRequest::isAsyncVerify); }
+		userStore_.reset(new MysqlUserStore());
+	}
+	HttpRequest::userStore = userStore_.get();
+	HttpRequest::LoadUserNames();
+
+	if (METRICS_ENABLE)
+	{
+		/* 采集时读取的当前值; 计数器和直方图由各线程自己记录 */
+		Metrics* metrics = Metrics::Instance();
+		metrics->AddGauge("webserver_connections", "Open client connections.",
+			[] { return (double)HttpConn::userCount; });
+		ThreadPool* pool = threadpool_.get();
+		metrics->AddGauge("webserver_threadpool_queue_length{pool=\"worker\"}", "Tasks waiting in a thread pool.",
+			[pool] { return (double)pool->QueueSize(); });
+		if (ioPool_)
+		{
+			ThreadPool* ioPool = ioPool_.get();
+			metrics->AddGauge("webserver_threadpool_queue_length{pool=\"io\"}", "Tasks waiting in a thread pool.",
+				[ioPool] { return (double)ioPool->QueueSize(); });
+		}
+		if (!(userFile && *userFile))
+		{
+			metrics->AddGauge("webserver_sql_free_connections", "Idle connections in the SQL pool.",
+				[] { return (double)SqlConnPool::Instance()->GetFreeConnCount(); });
+		}
+		Metrics::StartAccounting();
+	}
+
+	/* 登录会话定时清理 */
+	if (SESSION_SIZE > 0)
+	{ SweepSessions_(); }
 
 	/// epoll触发模式 电平 or 边界
 	InitEventMode_(trigMode);
@@ -30,37 +114,84 @@ WebServer::WebServer(
 	 * 设置非阻塞, 延时close属性
 	 * 加入epoll监听
 	 */
-	if (!InitSocket_())
+	if (!InitSocket_(port_, listenFd_))
 	{ isClose_ = true; }  // 初始化失败, isClose_ = true
 
+	/* HTTPS: 第二个监听端口 */
+	tlsListenFd_ = -1;
+	if (TLS_PORT > 0 && !isClose_)
+	{
+		if (!TlsContext::Instance()->Init(TLS_CERT_FILE, TLS_KEY_FILE)
+			|| !InitSocket_(TLS_PORT, tlsListenFd_))
+		{
+			std::cout << "tls init error: " << TLS_CERT_FILE << ", " << TLS_KEY_FILE << std::endl;
+			tlsListenFd_ = -1;
+			isClose_ = true;
+		}
+	}
+
+	/* 负向查找缓存: 监听资源目录变化 */
+	dirWatchFd_ = NegCache::Instance()->WatchDir(srcDir_);
+	if (dirWatchFd_ >= 0)
+	{ epoller_->AddFd(dirWatchFd_, EPOLLIN); }
+
 	std::cout << "start server" << std::endl;
 
 	if (openLog)
 	{  // 日志是否可用
-		std::cout << "log available" << std::endl;
-		Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
 		if (isClose_)
 		{ LOG_ERROR("========== Server init error!=========="); }
 		else
 		{
 			LOG_INFO("========== Server init ==========");
 			LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger ? "true" : "false");
+			if (tlsListenFd_ >= 0)
+			{ LOG_INFO("TLS Port:%d, cert: %s", TLS_PORT, TLS_CERT_FILE); }
 			LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
 				(listenEvent_ & EPOLLET ? "ET" : "LT"),
 				(connEvent_ & EPOLLET ? "ET" : "LT"));
 			LOG_INFO("LogSys level: %d", logLevel);
 			LOG_INFO("srcDir: %s", HttpConn::srcDir);
-			LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+			LOG_INFO("NegCache: %s", NegCache::Instance()->IsEnabled() ? "on" : "off");
+			LOG_INFO("UserStore: %s%s%s", userStore_->Name(), userFile ? ", " : "", userFile ? userFile : "");
+			LOG_INFO("SqlConnPool num: %d-%d, ThreadPool num: %d, IO thread num: %d",
+				SqlConnPool::Instance()->GetConnCount(), connPoolNum, threadNum, IO_THREAD_NUM);
+			LOG_INFO("AsyncSqlPool num: %d", HttpRequest::isAsyncVerify ? SQL_ASYNC_CONN : 0);
+			LOG_INFO("Session size: %d, timeout: %ds", SESSION_SIZE, SESSION_TIMEOUT);
+			if (AccessLog::Instance()->IsOpen())
+			{ LOG_INFO("AccessLog: %s, sample 1/%d", ACCESS_LOG_PATH, ACCESS_LOG_SAMPLE); }
+			if (METRICS_ENABLE && *METRICS_PATH)
+			{
+				LOG_INFO("Metrics: %s%s%s%s", METRICS_PATH, METRICS_LOCAL_ONLY ? ", local only" : "",
+					METRICS_ACCOUNTING ? ", syscall/alloc accounting" : "", METRICS_LOCK_PROFILE ? ", lock profile" : "");
+			}
+			if (TRACE_ENABLE)
+			{ LOG_INFO("Trace: sample 1/%d, %s or SIGUSR2 to %s", TRACE_SAMPLE, TRACE_PATH, TRACE_FILE); }
 		}
 	}
 }
 
 WebServer::~WebServer()
 {
+	/*
+	 * 先停止接受连接, 结束数据库回调(回调向线程池添加任务), 再等待工作线程和IO线程执行完队列中的任务并退出,
+	 * 之后才释放任务使用的srcDir_, TLS上下文和连接池; users_在析构函数返回后才销毁
+	 */
 	close(listenFd_);
+	if (tlsListenFd_ >= 0)
+	{ close(tlsListenFd_); }
 	isClose_ = true;
+	RegisterBatcher::Instance()->Close();
+	AsyncSqlPool::Instance()->ClosePool();
+	threadpool_->Close();
+	if (ioPool_)
+	{ ioPool_->Close(); }  // 工作线程会向IO线程池添加任务, 后关闭
+	TlsContext::Instance()->Close();
+	NegCache::Instance()->Close();
 	free(srcDir_);
 	SqlConnPool::Instance()->ClosePool();
+	AccessLog::Instance()->Close();
+	Metrics::Instance()->LogLocks();
 }
 
 void WebServer::InitEventMode_(int trigMode)
@@ -100,20 +231,46 @@ void WebServer::Start()
 	{ LOG_INFO("========== Server start =========="); }
 	while (!isClose_)
 	{
-		if (timeoutMS_ > 0)
+		if (timeoutMS_ > 0 || SESSION_SIZE > 0)
 		{
 			timeMS = timer_->GetNextTick();
 		}
-		int eventCnt = epoller_->Wait(timeMS);  // 就绪socket个数
+		int eventCnt = epoller_->Wait(timeMS, &waitMask_);  // 就绪socket个数
+		if (TRACE_ENABLE)
+		{
+			wakeTsc_ = Trace::Now();
+			Trace::Instance()->CheckDump();  // 收到SIGUSR2时epoll_wait被中断
+		}
+		if (Metrics::IsStopPending())
+		{
+			LOG_INFO("========== Server stop ==========");
+			break;
+		}
 		for (int i = 0; i < eventCnt; i++)
 		{
 			/* 处理事件 */
 			int fd = epoller_->GetEventFd(i);
 			uint32_t events = epoller_->GetEvents(i);
-			if (fd == listenFd_)
+			if (fd == listenFd_ || fd == tlsListenFd_)
 			{
 				/// 如果就绪的事件是listenfd可读，创建acceptfd,并加入epoll监听
-				DealListen_();
+				DealListen_(fd);
+			}
+			else if (fd == dirWatchFd_)
+			{
+				/// 资源目录有变化, 清空负向缓存
+				NegCache::Instance()->OnDirChange();
+			}
+			else if (AsyncSqlPool::Instance()->IsSqlFd(fd))
+			{
+				/// 异步数据库连接的socket/唤醒/定时事件, 在epoll线程中直接处理
+				AsyncSqlPool::Instance()->OnEvent(fd, events);
+			}
+			else if ((events & EPOLLERR) && !(events & (EPOLLRDHUP | EPOLLHUP))
+				&& users_.count(fd) > 0 && users_[fd].IsZeroCopy())
+			{
+				/// 开启SO_ZEROCOPY的连接, 错误队列中有发送完成通知
+				DealZeroCopy_(&users_[fd]);
 			}
 			else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))
 			{  //
@@ -155,7 +312,7 @@ void WebServer::SendError_(int fd, const char* info)
 void WebServer::CloseConn_(HttpConn* client)
 {
 	assert(client);
-	LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d",
+	LOG_DEBUG("Client[%d](%s:%d) quit, UserCount:%d",
 		client->GetFd(),
 		client->GetIP(),
 		client->GetPort(),
@@ -164,7 +321,7 @@ void WebServer::CloseConn_(HttpConn* client)
 	client->Close();
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr)
+void WebServer::AddClient_(int fd, sockaddr_in addr, bool isTls)
 {
 	/*
 	 * 由地址和监听的文件描述符初始化一个HttpConn对象, 加入unordered_map
@@ -173,7 +330,11 @@ void WebServer::AddClient_(int fd, sockaddr_in addr)
 	assert(fd > 0);
 	/// user_[fd]是webserver各项任务的client参数, 一个描述符和一个地址
 	// 创建了一个匿名HttpConn对象, client的地址为addr
-	users_[fd].init(fd, addr);  // HttpConn::init
+	if (!users_[fd].init(fd, addr, isTls))  // HttpConn::init
+	{
+		users_[fd].Close();  // 尚未加入epoll和定时器
+		return;
+	}
 
 	if (timeoutMS_ > 0)
 	{
@@ -181,18 +342,20 @@ void WebServer::AddClient_(int fd, sockaddr_in addr)
 	}
 	epoller_->AddFd(fd, EPOLLIN | connEvent_);  // fd加入epoll监听，监听事件可读
 	SetFdNonblock(fd);  // 设置fd非阻塞
-	LOG_INFO("Client[%d](%s:%d) in!", users_[fd].GetFd(), users_[fd].GetIP(), users_[fd].GetPort());
+	LOG_DEBUG("Client[%d](%s:%d) in!", users_[fd].GetFd(), users_[fd].GetIP(), users_[fd].GetPort());
 }
 
-void WebServer::DealListen_()
+void WebServer::DealListen_(int listenFd)
 {
 	struct sockaddr_in addr;
 	// 存储被接收的另一端地址
 	socklen_t len = sizeof(addr);
+	Metrics::StageScope stage(Metrics::STAGE_ACCEPT);
 	// do...while 先执行一次后判断
 	do
 	{
-		int fd = accept(listenFd_, (struct sockaddr*)&addr, &len);
+		Metrics::AddSyscall();
+		int fd = accept(listenFd, (struct sockaddr*)&addr, &len);
 		/*
 		 * 返回一个新文件描述符fd
 		 * 每个进程都会打开三个标准文件描述符0，1，2
@@ -203,14 +366,16 @@ void WebServer::DealListen_()
 		 */
 		if (fd <= 0)
 		{ return; }
-		else if (HttpConn::userCount >= MAX_FD)
+		if (HttpConn::userCount >= MAX_FD)
 		{
-			SendError_(fd, "Server busy!");
+			Metrics::Add(Metrics::REJECTED);
+			SendError_(fd, HttpResponse::ErrorBlob(503, false).c_str());
 			LOG_WARN("Clients is full!");
 			return;
 		}
+		Metrics::Add(Metrics::ACCEPTED);
 		// 用accept函数返回的新fd
-		AddClient_(fd, addr);
+		AddClient_(fd, addr, listenFd == tlsListenFd_);
 	} while (listenEvent_ & EPOLLET);
 }
 
@@ -219,6 +384,7 @@ void WebServer::DealRead_(HttpConn* client)
 	/// 线程池中添加read任务
 	assert(client);
 	ExtentTime_(client);
+	TraceEnqueue_(client, "DealRead_");
 	threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));
 }
 
@@ -227,9 +393,42 @@ void WebServer::DealWrite_(HttpConn* client)
 	/// 线程池中添加write任务
 	assert(client);
 	ExtentTime_(client);
+	TraceEnqueue_(client, "DealWrite_");
 	threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));
 }
 
+void WebServer::DealZeroCopy_(HttpConn* client)
+{
+	/// 线程池中添加读取零拷贝完成通知的任务
+	assert(client);
+	threadpool_->AddTask(std::bind(&WebServer::OnZeroCopy_, this, client));
+}
+
+void WebServer::SweepSessions_()
+{
+	/* 清理超时会话后重新加入定时器 */
+	SessionStore::Instance()->Expire();
+	timer_->add(SESSION_TIMER_ID, SESSION_SWEEP_MS, std::bind(&WebServer::SweepSessions_, this));
+}
+
+void WebServer::TraceEnqueue_(HttpConn* client, const char* name)
+{
+	/* 在AddTask之前设置, 工作线程开始执行时一定能看到 */
+	if (!client->TraceId())
+	{ return; }
+	uint64_t now = Trace::Now();
+	client->SetTraceMark(now);
+	Trace::Span(name, client->TraceId(), wakeTsc_, now);
+}
+
+uint32_t WebServer::TraceDequeue_(HttpConn* client)
+{
+	uint32_t id = client->TraceId();
+	if (id)
+	{ Trace::Span("queue", id, client->TraceMark(), Trace::Now()); }
+	return id;
+}
+
 void WebServer::ExtentTime_(HttpConn* client)
 {
 	assert(client);
@@ -240,6 +439,7 @@ void WebServer::ExtentTime_(HttpConn* client)
 void WebServer::OnRead_(HttpConn* client)
 {
 	assert(client);
+	TraceSpan span("OnRead_", TraceDequeue_(client));
 	int ret = -1;
 	int readErrno = 0;
 	ret = client->read(&readErrno);
@@ -256,22 +456,73 @@ void WebServer::OnProcess(HttpConn* client)
 {
 	if (client->process())  // 有可读返回true
 	{
+		if (client->NeedLoadFile() && ioPool_)
+		{
+			/* 响应文件不在内存中, 由IO线程读入后再监听可写 */
+			ioPool_->AddTask(std::bind(&WebServer::OnLoadFile_, this, client));
+			return;
+		}
 		/*
 		 * 已没有可读内容
 		 * 添加监听事件: client socketfd 可写
 		 */
 		epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
 	}
+	else if (client->IsVerifying())
+	{
+		/*
+		 * 登录/注册: 异步查询数据库, 查询期间不监听client fd, 也不占用工作线程
+		 * 必须是最后一步, 回调可能在其他线程中立即执行
+		 */
+		uint32_t gen = client->GetGen();
+		client->VerifyAsync([this, client, gen](bool isOk)
+		{
+			threadpool_->AddTask(std::bind(&WebServer::OnVerify_, this, client, gen, isOk));
+		});
+	}
 	else
 	{
 		epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
 	}
 }
 
+void WebServer::OnVerify_(HttpConn* client, uint32_t gen, bool isOk)
+{
+	assert(client);
+	TraceSpan span("OnVerify_", client->TraceId());
+	if (!client->OnVerify(gen, isOk))
+	{ return; }  // 等待查询期间连接已超时关闭
+	epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+}
+
+void WebServer::OnLoadFile_(HttpConn* client)
+{
+	// IO线程的任务, 此时fd处于EPOLLONESHOT未注册状态, 不会有其他线程访问client
+	assert(client);
+	TraceSpan span("OnLoadFile_", client->TraceId());
+	Metrics::StageScope stage(Metrics::STAGE_BUILD);  // 读入文件是生成响应的一部分
+	client->LoadFile();
+	epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
+}
+
+void WebServer::OnZeroCopy_(HttpConn* client)
+{
+	assert(client);
+	if (!client->ReapZeroCopy())
+	{
+		/* socket真正出错 */
+		CloseConn_(client);
+		return;
+	}
+	/* EPOLLONESHOT已解除监听, 按连接状态重新监听可写或可读 */
+	epoller_->ModFd(client->GetFd(), connEvent_ | (client->ToWriteBytes() > 0 ? EPOLLOUT : EPOLLIN));
+}
+
 void WebServer::OnWrite_(HttpConn* client)
 {
 	// 加入线程的任务
 	assert(client);
+	TraceSpan span("OnWrite_", TraceDequeue_(client));
 	int ret = -1;
 	int writeErrno = 0;
 	ret = client->write(&writeErrno);
@@ -285,31 +536,37 @@ void WebServer::OnWrite_(HttpConn* client)
 			return;
 		}
 	}
-	else if (ret < 0)
+	else if (client->NeedLoadFile() && ioPool_)
 	{
-		if (writeErrno == EAGAIN)
-		{
-			/* 继续传输 */
-			epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);  // 监听文件描述符可写和设置触发模式
-			return;
-		}
+		/* 分段发送的下一个窗口不在内存中, 由IO线程读入后再监听可写 */
+		ioPool_->AddTask(std::bind(&WebServer::OnLoadFile_, this, client));
+		return;
+	}
+	else if (ret >= 0 || writeErrno == EAGAIN)
+	{
+		/*
+		 * 继续传输: 发送缓冲区已满(EAGAIN)
+		 * 或水平触发时剩余不多于10240字节就让出线程, 此时ret >= 0
+		 */
+		epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);  // 监听文件描述符可写和设置触发模式
+		return;
 	}
 	CloseConn_(client);
 }
 
 /* Create listenFd */
-bool WebServer::InitSocket_()
+bool WebServer::InitSocket_(int port, int& listenFd)
 {
 	int ret;
 	struct sockaddr_in addr;
-	if (port_ > 65535 || port_ < 1024)
+	if (port > 65535 || port < 1024)
 	{  // 端口范围1024 ~ 65535
-		LOG_ERROR("Port:%d error!", port_);
+		LOG_ERROR("Port:%d error!", port);
 		return false;
 	}
 	addr.sin_family = AF_INET;  // 协议
 	addr.sin_addr.s_addr = htonl(INADDR_ANY);  // 地址
-	addr.sin_port = htons(port_);  // 地址结构体addr端口, 主机字节序 转 网络字节序
+	addr.sin_port = htons(port);  // 地址结构体addr端口, 主机字节序 转 网络字节序
 	struct linger optLinger = { 0 };
 	if (openLinger_)
 	{
@@ -318,20 +575,20 @@ bool WebServer::InitSocket_()
 		optLinger.l_linger = 1;  // 设置close等待事件
 	}
 
-	listenFd_ = socket(AF_INET, SOCK_STREAM, 0);  // 创建socket
-	if (listenFd_ < 0)
+	listenFd = socket(AF_INET, SOCK_STREAM, 0);  // 创建socket
+	if (listenFd < 0)
 	{
-		LOG_ERROR("Create socket error!", port_);
+		LOG_ERROR("Create socket error!", port);
 		return false;
 	}
 
 	/// 设置close延时
-	ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+	ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
 
 	if (ret < 0)
 	{
-		close(listenFd_);
-		LOG_ERROR("Init linger error!", port_);
+		close(listenFd);
+		LOG_ERROR("Init linger error!", port);
 		return false;
 	}
 
@@ -339,44 +596,44 @@ bool WebServer::InitSocket_()
 
 	/* 只有最后一个套接字会正常接收数据。 */
 	/// 设置端口复用
-	ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+	ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
 	if (ret == -1)
 	{
 		LOG_ERROR("set socket setsockopt error !");
-		close(listenFd_);
+		close(listenFd);
 		return false;
 	}
 
-	ret = bind(listenFd_, (struct sockaddr*)&addr, sizeof(addr));   // bind
+	ret = bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));   // bind
 	if (ret < 0)
 	{
-		LOG_ERROR("Bind Port:%d error!", port_);
-		close(listenFd_);
+		LOG_ERROR("Bind Port:%d error!", port);
+		close(listenFd);
 		return false;
 	}
 
 	/// 监听socket
-	ret = listen(listenFd_, 6);
+	ret = listen(listenFd, 6);
 
 	if (ret < 0)
 	{
-		LOG_ERROR("Listen port:%d error!", port_);
-		close(listenFd_);
+		LOG_ERROR("Listen port:%d error!", port);
+		close(listenFd);
 		return false;
 	}
 
 	/// 加入epoll监听列表
-	ret = epoller_->AddFd(listenFd_, listenEvent_ | EPOLLIN);
+	ret = epoller_->AddFd(listenFd, listenEvent_ | EPOLLIN);
 
 	if (ret == 0)
 	{
 		LOG_ERROR("Add listen error!");
-		close(listenFd_);
+		close(listenFd);
 		return false;
 	}
 	// 设置监听socket非阻塞
-	SetFdNonblock(listenFd_);
-	LOG_INFO("Server port:%d", port_);
+	SetFdNonblock(listenFd);
+	LOG_INFO("Server port:%d", port);
 	return true;
 }
 
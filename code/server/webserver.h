@@ -2,21 +2,26 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <climits>       // INT_MAX
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
 #include "epoller.h"
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/asyncsqlpool.h"
 #include "../http/httpconn.h"
+#include "../config/config.h"
 
 class WebServer
 {
@@ -25,29 +30,40 @@ class WebServer
 		int port, int trigMode, int timeoutMS, bool OptLinger,
 		int sqlPort, const char* sqlUser, const char* sqlPwd,
 		const char* dbName, int connPoolNum, int threadNum,
-		bool openLog, int logLevel, int logQueSize);
+		bool openLog, int logLevel, int logQueSize,
+		const char* userFile = nullptr);
 
 	~WebServer();
 	void Start();
 
  private:
-	bool InitSocket_();
+	bool InitSocket_(int port, int& listenFd);
 	void InitEventMode_(int trigMode);
-	void AddClient_(int fd, sockaddr_in addr);
+	void AddClient_(int fd, sockaddr_in addr, bool isTls = false);
 
-	void DealListen_();
+	void DealListen_(int listenFd);
 	void DealWrite_(HttpConn* client);
 	void DealRead_(HttpConn* client);
+	void DealZeroCopy_(HttpConn* client);
 
 	void SendError_(int fd, const char* info);
 	void ExtentTime_(HttpConn* client);
+	void SweepSessions_();
 	void CloseConn_(HttpConn* client);
 
 	void OnRead_(HttpConn* client);
 	void OnWrite_(HttpConn* client);
 	void OnProcess(HttpConn* client);
+	void OnLoadFile_(HttpConn* client);
+	void OnZeroCopy_(HttpConn* client);
+	void OnVerify_(HttpConn* client, uint32_t gen, bool isOk);
+
+	/* 追踪: epoll返回到任务加入线程池, 任务在线程池中等待 */
+	void TraceEnqueue_(HttpConn* client, const char* name);
+	uint32_t TraceDequeue_(HttpConn* client);
 
 	static const int MAX_FD = 65536;
+	static const int SESSION_TIMER_ID = INT_MAX;  // 定时器中连接以fd为id, 会话清理使用不会与fd冲突的id
 
 	static int SetFdNonblock(int fd);
 
@@ -56,14 +72,20 @@ class WebServer
 	int timeoutMS_;  /* 毫秒MS */
 	bool isClose_;
 	int listenFd_;
+	int tlsListenFd_;  // HTTPS监听, 未开启为-1
+	int dirWatchFd_;  // 资源目录inotify fd, 用于负向缓存失效
 	char* srcDir_;  //
 
 	uint32_t listenEvent_;
 	uint32_t connEvent_;
+	uint64_t wakeTsc_;  // 本轮epoll_wait返回的时间, 开启追踪时记录
+	sigset_t waitMask_;  // epoll_pwait期间的信号屏蔽字, 不屏蔽SIGINT/SIGTERM/SIGUSR2
 
 	std::unique_ptr<HeapTimer> timer_;
 	std::unique_ptr<ThreadPool> threadpool_;
+	std::unique_ptr<ThreadPool> ioPool_;  // 文件IO线程, 读取冷文件
 	std::unique_ptr<Epoller> epoller_;
+	std::unique_ptr<UserStore> userStore_;  // 登录/注册使用的用户表
 	std::unordered_map<int, HttpConn> users_;  // key: 文件描述符 value: HttpConn对象
 };
 
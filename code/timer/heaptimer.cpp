@@ -3,14 +3,13 @@
 void HeapTimer::siftup_(size_t i)
 {
 	assert(i >= 0 && i < heap_.size());
-	size_t j = (i - 1) / 2;
-	while (j >= 0)
+	while (i > 0)
 	{
+		size_t j = (i - 1) / 2;  // 父结点; i为0时已到堆顶
 		if (heap_[j] < heap_[i])
 		{ break; }
 		SwapNode_(i, j);
 		i = j;
-		j = (i - 1) / 2;
 	}
 }
 
@@ -121,8 +120,9 @@ void HeapTimer::tick()
 		{
 			break;
 		}
-		node.cb();
+		/* 先出堆再回调, 回调中可以重新添加同一id的定时器 */
 		pop();
+		node.cb();
 	}
 }
 
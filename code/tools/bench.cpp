@@ -0,0 +1,644 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <netdb.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <chrono>
+#include <thread>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <algorithm>
+
+using namespace std;
+
+/*
+ * HTTP/1.1压测工具: 每个线程一个epoll, 管理一部分连接
+ * 保持连接(可管线化)或每个请求新建连接; 请求从-u和-s目录下的文件中随机选择, 可按比例混入POST登录
+ * -R限速时按每个连接固定间隔的计划时间计算延迟, 不受协调遗漏(coordinated omission)影响;
+ * 不限速时另外按平均发送间隔补齐被阻塞期间遗漏的样本, 与未修正的结果一起输出
+ * 用法见 bench -H
+ */
+
+struct Options
+{
+	const char* host = "127.0.0.1";
+	const char* port = "8888";
+	int threads = 2;
+	int conns = 64;
+	int seconds = 10;
+	bool isKeepAlive = true;
+	int depth = 1;  // 每个连接同时发出的请求数
+	double rate = 0;  // 总请求数/秒, 0为不限速
+	int loginPercent = 0;
+	string loginBody = "username=bench&password=bench";
+	vector<string> paths;
+	int timeoutMs = 5000;
+};
+
+static int64_t NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* 对数线性分桶: 每个2的幂区间128个子桶, 相对误差小于1% */
+class Histogram
+{
+ public:
+	Histogram() : buckets_(BUCKET_NUM, 0), count_(0), sum_(0), max_(0)
+	{
+	}
+
+	void Add(uint64_t ns, uint64_t n = 1)
+	{
+		buckets_[Index_(ns)] += n;
+		count_ += n;
+		sum_ += (double)ns * n;
+		max_ = max(max_, ns);
+	}
+
+	void Merge(const Histogram& other)
+	{
+		for (int i = 0; i < BUCKET_NUM; i++)
+		{ buckets_[i] += other.buckets_[i]; }
+		count_ += other.count_;
+		sum_ += other.sum_;
+		max_ = max(max_, other.max_);
+	}
+
+	/* 按HdrHistogram的方法修正: 超过期望间隔的样本, 补上发送被阻塞期间本应得到的样本 */
+	Histogram Corrected(uint64_t interval) const
+	{
+		Histogram res;
+		for (int i = 0; i < BUCKET_NUM; i++)
+		{
+			if (buckets_[i] == 0)
+			{ continue; }
+			uint64_t value = min(Value_(i), max_);
+			res.Add(value, buckets_[i]);
+			if (interval == 0 || value <= interval)
+			{ continue; }
+			for (uint64_t missing = value - interval; missing >= interval; missing -= interval)
+			{ res.Add(missing, buckets_[i]); }
+		}
+		return res;
+	}
+
+	uint64_t Count() const
+	{
+		return count_;
+	}
+	double Mean() const
+	{
+		return count_ ? sum_ / count_ : 0;
+	}
+	uint64_t Max() const
+	{
+		return max_;
+	}
+	uint64_t Percentile(double q) const
+	{
+		uint64_t rank = max<uint64_t>(1, ceil(q * count_)), seen = 0;
+		for (int i = 0; i < BUCKET_NUM; i++)
+		{
+			seen += buckets_[i];
+			if (seen >= rank)
+			{ return min(Value_(i), max_); }
+		}
+		return max_;
+	}
+
+ private:
+	static const int SUB_BITS = 7;
+	static const int SUB_COUNT = 1 << SUB_BITS;
+	static const int MAX_EXP = 40;
+	static const int BUCKET_NUM = (MAX_EXP - SUB_BITS + 2) * SUB_COUNT;
+
+	static int Index_(uint64_t ns)
+	{
+		if (ns < (uint64_t)SUB_COUNT)
+		{ return ns; }
+		int exp = 63 - __builtin_clzll(ns);
+		if (exp > MAX_EXP)
+		{ return BUCKET_NUM - 1; }
+		return (exp - SUB_BITS + 1) * SUB_COUNT + ((ns >> (exp - SUB_BITS)) & (SUB_COUNT - 1));
+	}
+
+	/* 桶的上界 */
+	static uint64_t Value_(int index)
+	{
+		if (index < SUB_COUNT)
+		{ return index; }
+		int exp = index / SUB_COUNT + SUB_BITS - 1;
+		uint64_t low = (uint64_t)(SUB_COUNT + index % SUB_COUNT) << (exp - SUB_BITS);
+		return low + (1ULL << (exp - SUB_BITS)) - 1;
+	}
+
+	vector<uint64_t> buckets_;
+	uint64_t count_;
+	double sum_;
+	uint64_t max_;
+};
+
+struct Stats
+{
+	uint64_t requests = 0;
+	uint64_t bytes = 0;
+	uint64_t status[6] = { 0 };  // 按状态码百位, 0为无法解析
+	uint64_t connects = 0;
+	uint64_t errConnect = 0;
+	uint64_t errRead = 0;  // 读错误, 或响应未收完时连接被关闭
+	uint64_t errWrite = 0;
+	uint64_t timeouts = 0;
+	Histogram latency;  // 从实际发送请求开始
+	Histogram scheduled;  // 限速时从计划发送的时间开始
+
+	void Merge(const Stats& other)
+	{
+		requests += other.requests;
+		bytes += other.bytes;
+		for (int i = 0; i < 6; i++)
+		{ status[i] += other.status[i]; }
+		connects += other.connects;
+		errConnect += other.errConnect;
+		errRead += other.errRead;
+		errWrite += other.errWrite;
+		timeouts += other.timeouts;
+		latency.Merge(other.latency);
+		scheduled.Merge(other.scheduled);
+	}
+};
+
+class Worker
+{
+ public:
+	Worker(const Options& opt, const addrinfo* addr, int first, int count) :
+		opt_(opt), addr_(addr), conns_(count), rng_(0x9e3779b97f4a7c15ULL * (first + 1))
+	{
+		epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+		/* 限速时每个连接间隔相同, 各连接的起点错开 */
+		interval_ = opt.rate > 0 ? (int64_t)(1e9 * opt.conns / opt.rate) : 0;
+		for (int i = 0; i < count; i++)
+		{ conns_[i].offset = interval_ * (first + i) / opt.conns; }
+		for (const string& path : opt.paths)
+		{ requests_.push_back(MakeRequest_("GET", path, "")); }
+		login_ = MakeRequest_("POST", "/login.html", opt.loginBody);
+	}
+
+	~Worker()
+	{
+		for (Conn& conn : conns_)
+		{
+			if (conn.fd >= 0)
+			{ close(conn.fd); }
+		}
+		close(epollFd_);
+	}
+
+	void Run(int64_t start, int64_t deadline)
+	{
+		for (Conn& conn : conns_)
+		{ conn.nextDue = start + conn.offset; }
+		epoll_event events[256];
+		int64_t now = NowNs(), lastCheck = now;
+		while (now < deadline)
+		{
+			int64_t wait = min<int64_t>(deadline - now, 100000000);
+			for (Conn& conn : conns_)
+			{
+				if (conn.fd < 0 && (interval_ == 0 || conn.nextDue <= now))
+				{ Connect_(conn, now); }
+				else if (conn.fd >= 0)
+				{ Fill_(conn, now); }
+				if (interval_ > 0)
+				{ wait = min(wait, max<int64_t>(conn.nextDue - now, 0)); }
+			}
+			int n = epoll_wait(epollFd_, events, 256, (int)((wait + 999999) / 1000000));
+			now = NowNs();
+			for (int i = 0; i < n; i++)
+			{ OnEvent_(conns_[events[i].data.u32], events[i].events, now); }
+			if (now - lastCheck > 100000000)
+			{
+				CheckTimeout_(now);
+				lastCheck = now;
+			}
+		}
+	}
+
+	Stats stats;
+
+ private:
+	struct Pending
+	{
+		int64_t intended;  // 计划发送的时间
+		int64_t sent;
+	};
+
+	struct Conn
+	{
+		int fd = -1;
+		bool isConnected = false;
+		bool isClosing = false;  // 服务器要求关闭连接
+		bool isWantWrite = false;
+		int sentOnConn = 0;
+		int64_t offset = 0;
+		int64_t nextDue = 0;
+		int64_t connectStart = 0;
+		string out;
+		size_t outPos = 0;
+		string in;
+		size_t inPos = 0;
+		deque<Pending> pending;
+	};
+
+	string MakeRequest_(const char* method, const string& path, const string& body)
+	{
+		string req = string(method) + " " + path + " HTTP/1.1\r\nHost: " + opt_.host + "\r\n";
+		req += opt_.isKeepAlive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+		if (!body.empty())
+		{
+			req += "Content-Type: application/x-www-form-urlencoded\r\n";
+			req += "Content-Length: " + to_string(body.size()) + "\r\n";
+		}
+		return req + "\r\n" + body;
+	}
+
+	const string& Pick_()
+	{
+		/* xorshift, 每个线程独立 */
+		rng_ ^= rng_ << 13;
+		rng_ ^= rng_ >> 7;
+		rng_ ^= rng_ << 17;
+		if (opt_.loginPercent > 0 && (int)(rng_ % 100) < opt_.loginPercent)
+		{ return login_; }
+		return requests_[(rng_ >> 8) % requests_.size()];
+	}
+
+	void Connect_(Conn& conn, int64_t now)
+	{
+		conn.fd = socket(addr_->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (conn.fd < 0)
+		{
+			stats.errConnect++;
+			return;
+		}
+		int one = 1;
+		setsockopt(conn.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		conn.isConnected = false;
+		conn.isClosing = false;
+		conn.sentOnConn = 0;
+		conn.connectStart = now;
+		conn.out.clear();
+		conn.outPos = 0;
+		conn.in.clear();
+		conn.inPos = 0;
+		stats.connects++;
+		if (connect(conn.fd, addr_->ai_addr, addr_->ai_addrlen) < 0 && errno != EINPROGRESS)
+		{
+			stats.errConnect++;
+			Close_(conn);
+			return;
+		}
+		epoll_event ev = { 0 };
+		ev.events = EPOLLOUT;
+		ev.data.u32 = &conn - &conns_[0];
+		epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn.fd, &ev);
+		conn.isWantWrite = true;
+	}
+
+	void Close_(Conn& conn)
+	{
+		if (conn.fd >= 0)
+		{ close(conn.fd); }  // close同时从epoll中移除
+		conn.fd = -1;
+		conn.isConnected = false;
+		conn.pending.clear();
+	}
+
+	void Fill_(Conn& conn, int64_t now)
+	{
+		/* 补足管线深度; 短连接每个连接只发一个请求, 延迟从建立连接开始计算 */
+		if (!conn.isConnected || conn.isClosing)
+		{ return; }
+		while ((int)conn.pending.size() < opt_.depth && (opt_.isKeepAlive || conn.sentOnConn == 0))
+		{
+			int64_t intended = opt_.isKeepAlive ? now : conn.connectStart;
+			if (interval_ > 0)
+			{
+				if (opt_.isKeepAlive && conn.nextDue > now)
+				{ break; }
+				intended = conn.nextDue;
+				conn.nextDue += interval_;
+			}
+			conn.out += Pick_();
+			conn.pending.push_back({ intended, opt_.isKeepAlive ? now : conn.connectStart });
+			conn.sentOnConn++;
+		}
+		Flush_(conn);
+	}
+
+	void Flush_(Conn& conn)
+	{
+		while (conn.outPos < conn.out.size())
+		{
+			ssize_t len = send(conn.fd, conn.out.data() + conn.outPos, conn.out.size() - conn.outPos, MSG_NOSIGNAL);
+			if (len < 0)
+			{
+				if (errno == EAGAIN)
+				{ break; }
+				stats.errWrite++;
+				Close_(conn);
+				return;
+			}
+			conn.outPos += len;
+		}
+		if (conn.outPos == conn.out.size())
+		{
+			conn.out.clear();
+			conn.outPos = 0;
+		}
+		bool isWantWrite = !conn.out.empty();
+		if (isWantWrite != conn.isWantWrite)
+		{
+			epoll_event ev = { 0 };
+			ev.events = EPOLLIN | (isWantWrite ? EPOLLOUT : 0);
+			ev.data.u32 = &conn - &conns_[0];
+			epoll_ctl(epollFd_, EPOLL_CTL_MOD, conn.fd, &ev);
+			conn.isWantWrite = isWantWrite;
+		}
+	}
+
+	void OnEvent_(Conn& conn, uint32_t events, int64_t now)
+	{
+		if (conn.fd < 0)
+		{ return; }
+		if (!conn.isConnected)
+		{
+			int err = 0;
+			socklen_t len = sizeof(err);
+			getsockopt(conn.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+			if (err != 0 || (events & (EPOLLERR | EPOLLHUP)))
+			{
+				stats.errConnect++;
+				Close_(conn);
+				return;
+			}
+			conn.isConnected = true;
+			conn.isWantWrite = true;  // Flush_中改为只监听可读
+			Fill_(conn, now);
+			return;
+		}
+		if (events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+		{ OnRead_(conn, now); }
+		if (conn.fd >= 0 && (events & EPOLLOUT))
+		{ Flush_(conn); }
+	}
+
+	void OnRead_(Conn& conn, int64_t now)
+	{
+		char buff[64 * 1024];
+		while (true)
+		{
+			ssize_t len = recv(conn.fd, buff, sizeof(buff), 0);
+			if (len > 0)
+			{
+				conn.in.append(buff, len);
+				continue;
+			}
+			if (len < 0 && errno == EAGAIN)
+			{ break; }
+			/* 对端关闭或出错: 先处理已收到的响应 */
+			Parse_(conn, now);
+			if (!conn.pending.empty())
+			{ stats.errRead++; }
+			Close_(conn);
+			return;
+		}
+		Parse_(conn, now);
+		if (conn.isClosing && conn.pending.empty())
+		{ Close_(conn); }
+		else
+		{ Fill_(conn, now); }
+	}
+
+	void Parse_(Conn& conn, int64_t now)
+	{
+		while (!conn.pending.empty())
+		{
+			size_t end = conn.in.find("\r\n\r\n", conn.inPos);
+			if (end == string::npos)
+			{ break; }
+			string header = conn.in.substr(conn.inPos, end + 2 - conn.inPos);
+			const char* lenField = strcasestr(header.c_str(), "\r\ncontent-length:");
+			size_t bodyLen = lenField ? strtoul(lenField + 17, nullptr, 10) : 0;
+			size_t total = end + 4 - conn.inPos + bodyLen;
+			if (conn.in.size() - conn.inPos < total)
+			{ break; }
+
+			int code = header.compare(0, 7, "HTTP/1.") == 0 ? atoi(header.c_str() + 9) : 0;
+			stats.status[code >= 100 && code < 600 ? code / 100 : 0]++;
+			if (strcasestr(header.c_str(), "\r\nconnection: close"))
+			{ conn.isClosing = true; }
+			Pending req = conn.pending.front();
+			conn.pending.pop_front();
+			stats.requests++;
+			stats.bytes += total;
+			stats.latency.Add(now - req.sent);
+			if (interval_ > 0)
+			{ stats.scheduled.Add(now - req.intended); }
+			conn.inPos += total;
+		}
+		if (conn.inPos == conn.in.size())
+		{
+			conn.in.clear();
+			conn.inPos = 0;
+		}
+		else if (conn.inPos > 64 * 1024)
+		{
+			conn.in.erase(0, conn.inPos);
+			conn.inPos = 0;
+		}
+	}
+
+	void CheckTimeout_(int64_t now)
+	{
+		for (Conn& conn : conns_)
+		{
+			int64_t since = conn.pending.empty() ? conn.connectStart : conn.pending.front().sent;
+			if (conn.fd >= 0 && (!conn.pending.empty() || !conn.isConnected)
+				&& now - since > (int64_t)opt_.timeoutMs * 1000000)
+			{
+				stats.timeouts++;
+				Close_(conn);
+			}
+		}
+	}
+
+	const Options& opt_;
+	const addrinfo* addr_;
+	int epollFd_;
+	int64_t interval_;  // 限速时每个连接的请求间隔
+	vector<Conn> conns_;
+	vector<string> requests_;
+	string login_;
+	uint64_t rng_;
+};
+
+static void ListFiles(const string& dir, const string& prefix, vector<string>& paths)
+{
+	DIR* d = opendir(dir.c_str());
+	if (!d)
+	{ return; }
+	struct dirent* entry;
+	while ((entry = readdir(d)) != nullptr)
+	{
+		if (entry->d_name[0] == '.')
+		{ continue; }
+		string path = dir + "/" + entry->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) < 0)
+		{ continue; }
+		if (S_ISDIR(st.st_mode))
+		{ ListFiles(path, prefix + "/" + entry->d_name, paths); }
+		else if (S_ISREG(st.st_mode) && (st.st_mode & S_IROTH))
+		{ paths.push_back(prefix + "/" + entry->d_name); }
+	}
+	closedir(d);
+}
+
+static void PrintRow(const char* name, const Histogram& hist)
+{
+	printf("  %-10s", name);
+	for (double q : { 0.5, 0.9, 0.99, 0.999 })
+	{ printf(" %10.3f", hist.Percentile(q) / 1e6); }
+	printf(" %10.3f %10.3f\n", hist.Max() / 1e6, hist.Mean() / 1e6);
+}
+
+static void Usage()
+{
+	fprintf(stderr,
+		"usage: bench [options]\n"
+		"  -h host      server address (127.0.0.1)\n"
+		"  -p port      server port (8888)\n"
+		"  -t threads   client threads (2)\n"
+		"  -c conns     connections (64)\n"
+		"  -d seconds   duration (10)\n"
+		"  -k 0|1       keep-alive, 0 opens a connection per request (1)\n"
+		"  -P depth     pipelined requests per connection (1)\n"
+		"  -R rate      total requests/s, latency from the intended schedule (unlimited)\n"
+		"  -u path      request path, may repeat\n"
+		"  -s dir       also request every readable file under dir, e.g. ../ServerPage\n"
+		"  -L percent   share of POST /login.html requests (0)\n"
+		"  -U body      login form body (username=bench&password=bench)\n"
+		"  -T ms        request timeout (5000)\n");
+}
+
+int main(int argc, char* argv[])
+{
+	Options opt;
+	int ch;
+	while ((ch = getopt(argc, argv, "h:p:t:c:d:k:P:R:u:s:L:U:T:H")) != -1)
+	{
+		switch (ch)
+		{
+		case 'h': opt.host = optarg; break;
+		case 'p': opt.port = optarg; break;
+		case 't': opt.threads = atoi(optarg); break;
+		case 'c': opt.conns = atoi(optarg); break;
+		case 'd': opt.seconds = atoi(optarg); break;
+		case 'k': opt.isKeepAlive = atoi(optarg) != 0; break;
+		case 'P': opt.depth = atoi(optarg); break;
+		case 'R': opt.rate = atof(optarg); break;
+		case 'u': opt.paths.push_back(optarg); break;
+		case 's': ListFiles(optarg, "", opt.paths); break;
+		case 'L': opt.loginPercent = atoi(optarg); break;
+		case 'U': opt.loginBody = optarg; break;
+		case 'T': opt.timeoutMs = atoi(optarg); break;
+		default:
+			Usage();
+			return 1;
+		}
+	}
+	if (opt.paths.empty())
+	{ opt.paths.push_back("/"); }
+	if (!opt.isKeepAlive)
+	{ opt.depth = 1; }  // 短连接不管线化
+	opt.threads = max(1, min(opt.threads, opt.conns));
+	if (opt.conns <= 0 || opt.depth <= 0 || opt.seconds <= 0)
+	{
+		Usage();
+		return 1;
+	}
+
+	addrinfo hints = { 0 }, * addr = nullptr;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int err = getaddrinfo(opt.host, opt.port, &hints, &addr);
+	if (err != 0)
+	{
+		fprintf(stderr, "bench: %s: %s\n", opt.host, gai_strerror(err));
+		return 1;
+	}
+
+	printf("%d s @ %s:%s, %d threads, %d connections, %s, depth %d, %zu paths, login %d%%",
+		opt.seconds, opt.host, opt.port, opt.threads, opt.conns, opt.isKeepAlive ? "keep-alive" : "close",
+		opt.depth, opt.paths.size(), opt.loginPercent);
+	if (opt.rate > 0)
+	{ printf(", %.0f req/s", opt.rate); }
+	printf("\n");
+
+	vector<unique_ptr<Worker>> workers;
+	for (int i = 0, first = 0; i < opt.threads; i++)
+	{
+		int count = opt.conns / opt.threads + (i < opt.conns % opt.threads ? 1 : 0);
+		workers.emplace_back(new Worker(opt, addr, first, count));
+		first += count;
+	}
+	int64_t start = NowNs(), deadline = start + (int64_t)opt.seconds * 1000000000;
+	vector<thread> threads;
+	for (auto& worker : workers)
+	{ threads.emplace_back([&worker, start, deadline] { worker->Run(start, deadline); }); }
+	for (thread& t : threads)
+	{ t.join(); }
+	double elapsed = (NowNs() - start) / 1e9;
+
+	Stats total;
+	for (auto& worker : workers)
+	{ total.Merge(worker->stats); }
+	freeaddrinfo(addr);
+
+	printf("  requests   %llu, %.1f req/s, %.2f MB/s, %llu connects\n",
+		(unsigned long long)total.requests, total.requests / elapsed, total.bytes / elapsed / 1e6,
+		(unsigned long long)total.connects);
+	printf("  status     1xx %llu, 2xx %llu, 3xx %llu, 4xx %llu, 5xx %llu, other %llu\n",
+		(unsigned long long)total.status[1], (unsigned long long)total.status[2],
+		(unsigned long long)total.status[3], (unsigned long long)total.status[4],
+		(unsigned long long)total.status[5], (unsigned long long)total.status[0]);
+	printf("  errors     connect %llu, read %llu, write %llu, timeout %llu\n",
+		(unsigned long long)total.errConnect, (unsigned long long)total.errRead,
+		(unsigned long long)total.errWrite, (unsigned long long)total.timeouts);
+	if (total.requests == 0)
+	{ return 1; }
+	printf("  latency ms        p50        p90        p99      p99.9        max       mean\n");
+	PrintRow("service", total.latency);
+	if (opt.rate > 0)
+	{ PrintRow("scheduled", total.scheduled); }
+	else
+	{
+		/* 不限速时每个管线槽位平均每隔 elapsed / (每槽位请求数) 发送一个请求 */
+		uint64_t interval = elapsed * 1e9 * opt.conns * opt.depth / total.requests;
+		PrintRow("corrected", total.latency.Corrected(interval));
+	}
+	return 0;
+}
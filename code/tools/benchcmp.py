@@ -0,0 +1,68 @@
+#!/usr/bin/env python3
+"""Compare two microbench JSON results (bin/microbench -j).
+
+usage: benchcmp.py old.json new.json [-t percent] [-f filter]
+
+A benchmark counts as a regression only when its median slowed down by more
+than the threshold AND the fastest new repetition is slower than the slowest
+old one, so run-to-run noise does not fail the comparison. Exits with 1 when
+there is a regression. Also reads Google Benchmark JSON (real_time only).
+"""
+
+import argparse
+import json
+import sys
+
+UNIT_NS = {"ns": 1, "us": 1e3, "ms": 1e6, "s": 1e9}
+
+
+def load(path):
+    with open(path) as f:
+        data = json.load(f)
+    res = {}
+    for bench in data.get("benchmarks", []):
+        if bench.get("run_type") == "aggregate":
+            continue
+        scale = UNIT_NS.get(bench.get("time_unit", "ns"), 1)
+        time = bench["real_time"] * scale
+        res[bench["name"]] = (
+            time,
+            bench.get("min_time", bench["real_time"]) * scale,
+            bench.get("max_time", bench["real_time"]) * scale,
+        )
+    return res
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare two microbench JSON results.")
+    parser.add_argument("old")
+    parser.add_argument("new")
+    parser.add_argument("-t", "--threshold", type=float, default=5.0,
+                        help="slowdown in percent that counts as a regression (5)")
+    parser.add_argument("-f", "--filter", default="", help="only compare names containing this")
+    args = parser.parse_args()
+
+    old, new = load(args.old), load(args.new)
+    names = [n for n in old if n in new and args.filter in n]
+    regressions = 0
+    print("%-28s %12s %12s %9s" % ("benchmark", "old ns/op", "new ns/op", "change"))
+    for name in names:
+        (o, omin, omax), (n, nmin, nmax) = old[name], new[name]
+        change = (n - o) / o * 100 if o > 0 else 0
+        mark = ""
+        if change > args.threshold and nmin > omax:
+            mark = "  REGRESSION"
+            regressions += 1
+        elif change < -args.threshold and nmax < omin:
+            mark = "  faster"
+        elif abs(change) > args.threshold:
+            mark = "  (noise)"
+        print("%-28s %12.1f %12.1f %+8.1f%%%s" % (name, o, n, change, mark))
+    for name in sorted(set(old) ^ set(new)):
+        if args.filter in name:
+            print("%-28s only in %s" % (name, args.old if name in old else args.new))
+    return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
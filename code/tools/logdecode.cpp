@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <zlib.h>
+
+#include "../log/logformat.h"
+
+using namespace std;
+
+/*
+ * 二进制日志(LOG_BINARY)解码, 输出与文本日志相同格式的行
+ * 用法: logdecode [file...], 没有文件时读标准输入; 轮转后压缩的.gz文件直接读取
+ */
+
+struct Format
+{
+	int level;
+	string format;
+	vector<logbin::FormatSpec> specs;
+};
+
+/* 按顺序读取记录内容 */
+class Reader
+{
+ public:
+	Reader(const char* data, size_t len) : data_(data), len_(len), pos_(0)
+	{
+	}
+
+	bool Get(void* dest, size_t len)
+	{
+		if (len_ - pos_ < len)
+		{ return false; }
+		memcpy(dest, data_ + pos_, len);
+		pos_ += len;
+		return true;
+	}
+
+	const char* Take(size_t len)
+	{
+		if (len_ - pos_ < len)
+		{ return nullptr; }
+		pos_ += len;
+		return data_ + pos_ - len;
+	}
+
+ private:
+	const char* data_;
+	size_t len_;
+	size_t pos_;
+};
+
+static const char* LevelTitle(int level)
+{
+	switch (level)
+	{
+	case 0:
+		return "[debug]: ";
+	case 2:
+		return "[warn] : ";
+	case 3:
+		return "[error]: ";
+	default:
+		return "[info] : ";
+	}
+}
+
+template<class T>
+static int Print(char* buff, size_t size, const string& spec, int stars, const int* star, T value)
+{
+	switch (stars)
+	{
+	case 0:
+		return snprintf(buff, size, spec.c_str(), value);
+	case 1:
+		return snprintf(buff, size, spec.c_str(), star[0], value);
+	default:
+		return snprintf(buff, size, spec.c_str(), star[0], star[1], value);
+	}
+}
+
+template<class T>
+static void Append(string& out, const string& spec, int stars, const int* star, T value)
+{
+	char buff[256];
+	int n = Print(buff, sizeof(buff), spec, stars, star, value);
+	if (n < 0)
+	{ return; }
+	if ((size_t)n < sizeof(buff))
+	{
+		out.append(buff, n);
+		return;
+	}
+	vector<char> big(n + 1);
+	Print(big.data(), big.size(), spec, stars, star, value);
+	out.append(big.data(), n);
+}
+
+/* 格式串中转换说明之间的文字, "%%"输出为'%' */
+static void AppendText(string& out, const string& format, size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++)
+	{
+		out += format[i];
+		if (format[i] == '%' && i + 1 < end && format[i + 1] == '%')
+		{ i++; }
+	}
+}
+
+static bool Render(string& out, const Format& fmt, Reader& reader)
+{
+	size_t last = 0;
+	for (const auto& spec : fmt.specs)
+	{
+		AppendText(out, fmt.format, last, spec.pos);
+		last = spec.pos + spec.len;
+		string text = fmt.format.substr(spec.pos, spec.len);
+
+		int star[2] = { 0, 0 };
+		for (int i = 0; i < spec.stars && i < 2; i++)
+		{
+			int64_t value;
+			if (!reader.Get(&value, 8))
+			{ return false; }
+			star[i] = (int)value;
+		}
+		if (spec.type == logbin::ARG_NONE)
+		{
+			out += text;
+			continue;
+		}
+		if (spec.type == logbin::ARG_STRING)
+		{
+			uint16_t len;
+			const char* str;
+			if (!reader.Get(&len, 2) || !(str = reader.Take(len)))
+			{ return false; }
+			Append(out, text, spec.stars, star, string(str, len).c_str());
+			continue;
+		}
+
+		int64_t value;
+		double d;
+		if (!reader.Get(&value, 8))
+		{ return false; }
+		memcpy(&d, &value, 8);
+		switch (spec.type)
+		{
+		case logbin::ARG_INT:
+			Append(out, text, spec.stars, star, (int)value);
+			break;
+		case logbin::ARG_LONG:
+			Append(out, text, spec.stars, star, (long)value);
+			break;
+		case logbin::ARG_LLONG:
+			Append(out, text, spec.stars, star, (long long)value);
+			break;
+		case logbin::ARG_DOUBLE:
+			Append(out, text, spec.stars, star, d);
+			break;
+		case logbin::ARG_LDOUBLE:
+			Append(out, text, spec.stars, star, (long double)d);
+			break;
+		case logbin::ARG_PTR:
+			// %n没有输出
+			if (text.back() == 'p')
+			{ Append(out, text, spec.stars, star, (void*)(intptr_t)value); }
+			break;
+		default:
+			break;
+		}
+	}
+	AppendText(out, fmt.format, last, fmt.format.size());
+	return true;
+}
+
+static void AppendTime(string& out, int64_t ns)
+{
+	time_t sec = ns / 1000000000;
+	struct tm t;
+	localtime_r(&sec, &t);
+	char buff[64];
+	int n = snprintf(buff, sizeof(buff), "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
+		t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+		t.tm_hour, t.tm_min, t.tm_sec, (long)(ns % 1000000000 / 1000));
+	out.append(buff, n);
+}
+
+static bool Decode(gzFile fp, const char* name)
+{
+	/* gzread读未压缩的文件时原样返回 */
+	string data;
+	char buff[64 * 1024];
+	int n;
+	while ((n = gzread(fp, buff, sizeof(buff))) > 0)
+	{ data.append(buff, n); }
+	if (n < 0)
+	{ fprintf(stderr, "%s: read error\n", name); }
+
+	unordered_map<uint32_t, Format> formats;
+	int64_t realNs = 0, monoNs = 0;
+	bool hasHeader = false;
+	string line;
+	size_t pos = 0;
+	while (data.size() - pos >= sizeof(logbin::RecordHead))
+	{
+		logbin::RecordHead head;
+		memcpy(&head, data.data() + pos, sizeof(head));
+		if (head.len < sizeof(head) || head.len > data.size() - pos)
+		{ break; }
+		const char* body = data.data() + pos + sizeof(head);
+		Reader reader(body, head.len - sizeof(head));
+
+		if (head.type == logbin::HEADER)
+		{
+			logbin::FileHeader header;
+			if (!reader.Get(&header, sizeof(header)) || header.magic != logbin::MAGIC)
+			{ break; }
+			/* 新的一次启动, 格式串重新编号 */
+			formats.clear();
+			realNs = header.realNs;
+			monoNs = head.ns;
+			hasHeader = true;
+		}
+		else if (!hasHeader)
+		{ break; }
+		else if (head.type == logbin::FORMAT)
+		{
+			Format& fmt = formats[head.id];
+			fmt.level = head.level;
+			fmt.format.assign(body, head.len - sizeof(head));
+			fmt.specs.clear();
+			logbin::ParseFormat(fmt.format.c_str(), fmt.specs);
+		}
+		else if (head.type == logbin::ENTRY)
+		{
+			line.clear();
+			AppendTime(line, realNs + head.ns - monoNs);
+			line += LevelTitle(head.level);
+			auto it = formats.find(head.id);
+			if (it == formats.end())
+			{ line += "<unknown format " + to_string(head.id) + ">"; }
+			else if (!Render(line, it->second, reader))
+			{ line += "<truncated>"; }
+			line += '\n';
+			fwrite(line.data(), 1, line.size(), stdout);
+		}
+		pos += head.len;
+	}
+	if (!hasHeader)
+	{
+		fprintf(stderr, "%s: not a binary log file\n", name);
+		return false;
+	}
+	if (pos < data.size())
+	{
+		fprintf(stderr, "%s: %d bytes of broken record at offset %d\n", name, (int)(data.size() - pos), (int)pos);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		gzFile fp = gzdopen(0, "rb");
+		bool isOk = fp && Decode(fp, "stdin");
+		if (fp)
+		{ gzclose(fp); }
+		return isOk ? 0 : 1;
+	}
+	int ret = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		gzFile fp = gzopen(argv[i], "rb");
+		if (!fp)
+		{
+			perror(argv[i]);
+			ret = 1;
+			continue;
+		}
+		if (!Decode(fp, argv[i]))
+		{ ret = 1; }
+		gzclose(fp);
+	}
+	return ret;
+}
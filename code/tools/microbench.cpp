@@ -0,0 +1,460 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <algorithm>
+
+#include "../buffer/buffer.h"
+#include "../http/httprequest.h"
+#include "../timer/heaptimer.h"
+#include "../pool/threadpool.h"
+#include "../log/log.h"
+
+using namespace std;
+
+/*
+ * 核心组件的微基准测试
+ * 每项自动增加迭代次数直到单次运行超过-t秒, 重复-r次取中位数; -j输出JSON, 用tools/benchcmp.py比较两次结果
+ * 用法: microbench [-f 名称子串] [-t 秒] [-r 次数] [-j 文件]
+ */
+
+static int64_t NowNs()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* 一次运行: 计时默认包括整个函数, 准备工作可以用Pause/Resume排除 */
+class State
+{
+ public:
+	explicit State(int64_t iterations) : iterations(iterations), elapsed_(0)
+	{
+		start_ = NowNs();
+	}
+
+	void Pause()
+	{
+		elapsed_ += NowNs() - start_;
+	}
+	void Resume()
+	{
+		start_ = NowNs();
+	}
+	int64_t Elapsed() const
+	{
+		return elapsed_;
+	}
+
+	const int64_t iterations;
+	int64_t bytes = 0;  // 处理的字节数, 不为0时输出吞吐量
+	map<string, double> counters;  // 附加输出, 取最后一次运行的值
+
+ private:
+	int64_t start_;
+	int64_t elapsed_;
+};
+
+struct Benchmark
+{
+	string name;
+	function<void(State&)> fn;
+};
+
+struct Result
+{
+	string name;
+	int64_t iterations;
+	double nsPerOp;  // 各次重复的中位数
+	double minNs;
+	double maxNs;
+	double bytesPerSec;
+	map<string, double> counters;
+};
+
+static Result Run(const Benchmark& bench, double minSeconds, int repetitions)
+{
+	/* 先找到足够长的迭代次数, 之后每次重复使用相同的次数 */
+	int64_t iterations = 1;
+	while (true)
+	{
+		State state(iterations);
+		bench.fn(state);
+		state.Pause();
+		double seconds = state.Elapsed() / 1e9;
+		if (seconds >= minSeconds || iterations >= (1LL << 40))
+		{ break; }
+		double scale = seconds > 0 ? minSeconds * 1.4 / seconds : 100;
+		iterations = max<int64_t>(iterations + 1, iterations * min(100.0, max(2.0, scale)));
+	}
+
+	Result res = { bench.name, iterations, 0, 0, 0, 0, {} };
+	vector<double> samples;
+	int64_t bytes = 0;
+	for (int i = 0; i < repetitions; i++)
+	{
+		State state(iterations);
+		bench.fn(state);
+		state.Pause();
+		samples.push_back((double)state.Elapsed() / iterations);
+		bytes = state.bytes;
+		res.counters = state.counters;
+	}
+	sort(samples.begin(), samples.end());
+	res.nsPerOp = samples[samples.size() / 2];
+	res.minNs = samples.front();
+	res.maxNs = samples.back();
+	res.bytesPerSec = bytes > 0 ? bytes / (res.nsPerOp * iterations / 1e9) : 0;
+	return res;
+}
+
+/* ---------- Buffer ---------- */
+
+static void BufferAppend(State& state, size_t size)
+{
+	Buffer buff;
+	string data(size, 'x');
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		buff.Append(data);
+		if (buff.ReadableBytes() > 1024 * 1024)
+		{ buff.RetrieveAll(); }
+	}
+	state.bytes = state.iterations * size;
+}
+
+static void BufferCompact(State& state)
+{
+	/* 读走大部分后再写入, 空间足够但需要把未读数据移到开头 */
+	Buffer buff(4096);
+	string data(3000, 'x');
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		buff.Append(data);
+		buff.Retrieve(buff.ReadableBytes() - 100);
+	}
+}
+
+static void BufferGrow(State& state)
+{
+	/* 新缓冲区写入64KB, 多次扩容 */
+	string data(4096, 'x');
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		Buffer buff;
+		for (int j = 0; j < 16; j++)
+		{ buff.Append(data); }
+	}
+	state.bytes = state.iterations * 16 * data.size();
+}
+
+static void BufferReadFd(State& state, size_t size)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0)
+	{ return; }
+	int sndBuf = 1024 * 1024;
+	setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndBuf, sizeof(sndBuf));
+	string data(size, 'x');
+	Buffer buff;
+	int err = 0;
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		state.Pause();
+		if (write(fds[0], data.data(), size) != (ssize_t)size)
+		{
+			state.Resume();  // 计时的区间成对, 否则Elapsed少算最后一段
+			break;
+		}
+		state.Resume();
+		buff.ReadFd(fds[1], &err);
+		buff.RetrieveAll();
+	}
+	state.bytes = state.iterations * size;
+	close(fds[0]);
+	close(fds[1]);
+}
+
+/* ---------- HttpRequest ---------- */
+
+static const char* GET_REQUEST =
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8888\r\n"
+	"Connection: keep-alive\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"Upgrade-Insecure-Requests: 1\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+	"\r\n";
+
+static const char* POST_REQUEST =
+	"POST /picture.html HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8888\r\n"
+	"Connection: keep-alive\r\n"
+	"Content-Length: 39\r\n"
+	"Content-Type: application/x-www-form-urlencoded\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+	"\r\n"
+	"username=bench%40example&password=a+b%21";
+
+static void RequestParse(State& state, const char* text)
+{
+	/* 包括把请求复制到缓冲区 */
+	size_t len = strlen(text);
+	Buffer buff;
+	HttpRequest request;
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		buff.Append(text, len);
+		request.Init();
+		request.parse(buff);
+		buff.RetrieveAll();
+	}
+	state.bytes = state.iterations * len;
+}
+
+/* ---------- HeapTimer ---------- */
+
+static void TimerAdd(State& state, int count)
+{
+	HeapTimer timer;
+	TimeoutCallBack cb = [] {};
+	uint64_t rng = 88172645463325252ULL;
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		if (i % count == 0 && i > 0)
+		{
+			state.Pause();
+			timer.clear();
+			state.Resume();
+		}
+		rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+		timer.add(i % count, 60000 + rng % 60000, cb);
+	}
+}
+
+static void TimerAdjust(State& state, int count)
+{
+	/* 与连接活动时延长超时一样, 新的超时总是比原来晚 */
+	state.Pause();
+	HeapTimer timer;
+	TimeoutCallBack cb = [] {};
+	for (int i = 0; i < count; i++)
+	{ timer.add(i, 60000 + i, cb); }
+	uint64_t rng = 88172645463325252ULL;
+	state.Resume();
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		rng ^= rng << 13, rng ^= rng >> 7, rng ^= rng << 17;
+		timer.adjust(rng % count, 60000 + count + (int)(i / 16));
+	}
+}
+
+static void TimerTick(State& state, int count)
+{
+	/* 每次tick处理count个已超时的定时器, 一个定时器计为一次迭代 */
+	HeapTimer timer;
+	int64_t fired = 0;
+	TimeoutCallBack cb = [&fired] { fired++; };
+	for (int64_t done = 0; done < state.iterations; done += count)
+	{
+		state.Pause();
+		int n = (int)min<int64_t>(count, state.iterations - done);
+		for (int i = 0; i < n; i++)
+		{ timer.add(i, -1 - i % 100, cb); }
+		state.Resume();
+		timer.tick();
+	}
+	if (fired != state.iterations)
+	{ state.counters["missed"] = state.iterations - fired; }
+}
+
+/* ---------- ThreadPool ---------- */
+
+static void PoolAddTask(State& state, int producers)
+{
+	/* 4个工作线程, producers个线程同时添加空任务, 直到全部执行完 */
+	state.Pause();
+	atomic<int64_t> done(0);
+	{
+		ThreadPool pool(4);
+		state.Resume();
+		vector<thread> threads;
+		for (int p = 0; p < producers; p++)
+		{
+			int64_t n = state.iterations / producers + (p < state.iterations % producers ? 1 : 0);
+			threads.emplace_back([&pool, &done, n]
+			{
+				for (int64_t i = 0; i < n; i++)
+				{ pool.AddTask([&done] { done.fetch_add(1, memory_order_relaxed); }); }
+			});
+		}
+		for (thread& t : threads)
+		{ t.join(); }
+		while (done.load() < state.iterations)
+		{ this_thread::yield(); }
+		state.Pause();
+	}
+	state.Resume();
+}
+
+/* ---------- Log ---------- */
+
+static void LogWrite(State& state)
+{
+	/* 异步模式; 每64次调用单独计时一次, 得到调用延迟的分布(包括一次取时间的开销) */
+	vector<int64_t> samples;
+	samples.reserve(state.iterations / 64 + 1);
+	for (int64_t i = 0; i < state.iterations; i++)
+	{
+		if (i % 64 == 0)
+		{
+			int64_t start = NowNs();
+			LOG_INFO("microbench request %d from %s: %s", (int)i, "127.0.0.1", "GET /index.html");
+			samples.push_back(NowNs() - start);
+			continue;
+		}
+		LOG_INFO("microbench request %d from %s: %s", (int)i, "127.0.0.1", "GET /index.html");
+	}
+	sort(samples.begin(), samples.end());
+	state.counters["p50_ns"] = samples[samples.size() / 2];
+	state.counters["p99_ns"] = samples[samples.size() * 99 / 100];
+	state.counters["max_ns"] = samples.back();
+}
+
+static void PrintJson(FILE* fp, const vector<Result>& results)
+{
+	char date[64];
+	time_t now = time(nullptr);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+	char host[256] = "";
+	gethostname(host, sizeof(host) - 1);
+	fprintf(fp, "{\n  \"context\": {\"date\": \"%s\", \"host_name\": \"%s\", \"num_cpus\": %u, \"compiler\": \"%s\"},\n",
+		date, host, thread::hardware_concurrency(), __VERSION__);
+	fprintf(fp, "  \"benchmarks\": [");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const Result& res = results[i];
+		fprintf(fp, "%s\n    {\"name\": \"%s\", \"iterations\": %lld, \"real_time\": %.3f, \"time_unit\": \"ns\", "
+			"\"min_time\": %.3f, \"max_time\": %.3f",
+			i ? "," : "", res.name.c_str(), (long long)res.iterations, res.nsPerOp, res.minNs, res.maxNs);
+		if (res.bytesPerSec > 0)
+		{ fprintf(fp, ", \"bytes_per_second\": %.0f", res.bytesPerSec); }
+		for (const auto& it : res.counters)
+		{ fprintf(fp, ", \"%s\": %.3f", it.first.c_str(), it.second); }
+		fprintf(fp, "}");
+	}
+	fprintf(fp, "\n  ]\n}\n");
+}
+
+/* 日志写入的临时目录, 退出时删除 */
+static char logDir[] = "/tmp/microbench.XXXXXX";
+
+static void RemoveLogDir()
+{
+	DIR* dir = opendir(logDir);
+	if (!dir)
+	{ return; }
+	while (struct dirent* ent = readdir(dir))
+	{
+		if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0)
+		{ unlinkat(dirfd(dir), ent->d_name, 0); }
+	}
+	closedir(dir);
+	rmdir(logDir);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* filter = "";
+	const char* jsonPath = nullptr;
+	double minSeconds = 0.5;
+	int repetitions = 3;
+	int ch;
+	while ((ch = getopt(argc, argv, "f:t:r:j:")) != -1)
+	{
+		switch (ch)
+		{
+		case 'f': filter = optarg; break;
+		case 't': minSeconds = atof(optarg); break;
+		case 'r': repetitions = max(1, atoi(optarg)); break;
+		case 'j': jsonPath = optarg; break;
+		default:
+			fprintf(stderr, "usage: microbench [-f filter] [-t seconds] [-r repetitions] [-j out.json]\n");
+			return 1;
+		}
+	}
+
+	vector<Benchmark> benchmarks = {
+		{ "Buffer/Append/16", [](State& s) { BufferAppend(s, 16); } },
+		{ "Buffer/Append/256", [](State& s) { BufferAppend(s, 256); } },
+		{ "Buffer/Append/4096", [](State& s) { BufferAppend(s, 4096); } },
+		{ "Buffer/MakeSpace/compact", BufferCompact },
+		{ "Buffer/MakeSpace/grow", BufferGrow },
+		{ "Buffer/ReadFd/1024", [](State& s) { BufferReadFd(s, 1024); } },
+		{ "Buffer/ReadFd/65536", [](State& s) { BufferReadFd(s, 65536); } },
+		{ "HttpRequest/parse/get", [](State& s) { RequestParse(s, GET_REQUEST); } },
+		{ "HttpRequest/parse/post", [](State& s) { RequestParse(s, POST_REQUEST); } },
+		{ "HeapTimer/add/10000", [](State& s) { TimerAdd(s, 10000); } },
+		{ "HeapTimer/adjust/10000", [](State& s) { TimerAdjust(s, 10000); } },
+		{ "HeapTimer/tick/1000", [](State& s) { TimerTick(s, 1000); } },
+		{ "ThreadPool/AddTask/1", [](State& s) { PoolAddTask(s, 1); } },
+		{ "ThreadPool/AddTask/4", [](State& s) { PoolAddTask(s, 4); } },
+		{ "Log/write/async", LogWrite },
+	};
+
+	/* 日志写入临时目录, 级别为info; 在Log创建之前注册, 退出时Log析构写完文件后才删除 */
+	if (strstr("Log/write/async", filter) || !*filter)
+	{
+		if (mkdtemp(logDir))
+		{
+			atexit(RemoveLogDir);
+			Log::Instance()->init(1, logDir, ".log", 1024);
+		}
+	}
+
+	vector<Result> results;
+	printf("%-28s %14s %12s %12s %12s  %s\n", "benchmark", "iterations", "ns/op", "min", "max", "extra");
+	for (const Benchmark& bench : benchmarks)
+	{
+		if (bench.name.find(filter) == string::npos)
+		{ continue; }
+		Result res = Run(bench, minSeconds, repetitions);
+		printf("%-28s %14lld %12.1f %12.1f %12.1f ", res.name.c_str(), (long long)res.iterations,
+			res.nsPerOp, res.minNs, res.maxNs);
+		if (res.bytesPerSec > 0)
+		{ printf(" %.1fMB/s", res.bytesPerSec / 1e6); }
+		for (const auto& it : res.counters)
+		{ printf(" %s=%.0f", it.first.c_str(), it.second); }
+		printf("\n");
+		fflush(stdout);
+		results.push_back(res);
+	}
+
+	if (jsonPath)
+	{
+		FILE* fp = fopen(jsonPath, "w");
+		if (!fp)
+		{
+			perror(jsonPath);
+			return 1;
+		}
+		PrintJson(fp, results);
+		fclose(fp);
+	}
+	return 0;
+}